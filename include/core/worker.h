@@ -0,0 +1,51 @@
+#ifndef WORKER_H
+#define WORKER_H
+
+#include <stdbool.h>
+
+/*
+ * worker - Single background thread running the latest submitted job
+ *
+ * Submitting a job cancels the one in flight and replaces any job still
+ * pending, so only the newest request is ever worked on. Long jobs poll
+ * worker_cancelled() and return early once it is set. Jobs are freed by
+ * the worker with free_job after they run (or when they are dropped).
+ * Functions abort on allocation or thread creation failure.
+ */
+
+struct worker; /* Opaque */
+
+typedef void (*worker_fn)(struct worker *w, void *job);
+typedef void (*worker_free_fn)(void *job);
+
+/*
+ * Start worker thread.
+ * notify (may be NULL) is called from the worker by worker_notify() to
+ * wake the UI thread; it must be thread-safe.
+ */
+struct worker *worker_create(worker_fn run,
+			     worker_free_fn free_job,
+			     void (*notify)(void *),
+			     void *notify_arg);
+
+/* Cancel running job, drop pending one and join the thread. */
+void worker_destroy(struct worker *w);
+
+/* Queue job, cancelling the running job and dropping the pending one. */
+void worker_submit(struct worker *w, void *job);
+
+/* Cancel running job and drop pending one. */
+void worker_cancel(struct worker *w);
+
+/* === Called from inside a job === */
+
+/* True once the running job has been superseded or cancelled. */
+bool worker_cancelled(struct worker *w);
+
+/* Flag read by worker_cancelled(), for code that must not see worker. */
+const int *worker_cancel_flag(struct worker *w);
+
+/* Wake the UI thread (calls notify). */
+void worker_notify(struct worker *w);
+
+#endif
@@ -2,24 +2,37 @@
  *
  * Text buffer with line indexing.
  * Layer 3 - depends on core/ only.
+ *
+ * Contents live in an immutable snapshot that is replaced on every
+ * edit. Background jobs take their own reference with buffer_snapshot()
+ * and tag results with its version; buffer_is_current() tells the UI
+ * thread whether such a result is still worth applying.
  */
 
 #ifndef BUFFER_H
 #define BUFFER_H
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #include <core/arena.h>
 #include <core/str.h>
+#include <editor/snapshot.h>
 
 #define BUFFER_PATH_MAX 512
 
+/* Line and byte column, as in a tree-sitter point */
+struct buffer_pos {
+	int line;
+	int col;
+};
+
 struct buffer {
-	struct arena arena;
-	struct str text;      /* Full file content */
-	struct str *lines;    /* Array of line views into text */
+	struct arena arena;	/* Holds the flattened text */
+	struct snapshot *snap;	/* Current contents */
+	struct str text;	/* Flattened snap, rebuilt on demand */
+	uint64_t text_version;	/* Version text was flattened from */
 	int line_count;
-	int line_cap;
 	int cursor_line;
 	char path[BUFFER_PATH_MAX];
 };
@@ -28,10 +41,34 @@ void buffer_init(struct buffer *buf);
 void buffer_destroy(struct buffer *buf);
 bool buffer_load(struct buffer *buf, const char *path);
 
+/* Show snap (owned by the buffer from now on) as the contents of path */
+void buffer_adopt(struct buffer *buf, const char *path, struct snapshot *snap);
+
 struct str buffer_get_text(struct buffer *buf);
 struct str buffer_get_line(struct buffer *buf, int line_num);
 struct str buffer_get_current_line(struct buffer *buf);
 
+/* Replace one line (text must not contain newlines) */
+bool buffer_replace_line(struct buffer *buf, int line_num, struct str text);
+
+/* Retained reference to current contents; release with snapshot_release */
+struct snapshot *buffer_snapshot(struct buffer *buf);
+uint64_t buffer_version(struct buffer *buf);
+bool buffer_is_current(struct buffer *buf, uint64_t version);
+
+/*
+ * Convert between byte offsets into buffer_get_text() and positions.
+ * offset_to_pos is O(log n); pos_to_offset walks one tree path.
+ */
+struct buffer_pos buffer_offset_to_pos(struct buffer *buf, long offset);
+long buffer_pos_to_offset(struct buffer *buf, struct buffer_pos pos);
+
+/* Map n ascending offsets in a single forward pass */
+void buffer_offsets_to_pos(struct buffer *buf,
+			   const long *offsets,
+			   struct buffer_pos *out,
+			   int n);
+
 void buffer_move_down(struct buffer *buf, int n);
 void buffer_move_up(struct buffer *buf, int n);
 
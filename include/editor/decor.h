@@ -0,0 +1,71 @@
+/* include/editor/decor.h
+ *
+ * Decorations: byte ranges of the buffer that move with edits.
+ * Layer 3 - depends on core/ only.
+ *
+ * Ranges live in a treap ordered by start offset and augmented with
+ * the largest end offset of each subtree. An edit shifts everything
+ * after it by adding a lazy delta to one subtree, so both edits and
+ * inserts are O(log n); a range query visits only subtrees that can
+ * overlap it, O(log n + k) for k results.
+ */
+
+#ifndef DECOR_H
+#define DECOR_H
+
+#include <stdint.h>
+
+#include <core/arena.h>
+
+enum decor_kind {
+	DECOR_SEARCH_HIT,
+	DECOR_BOOKMARK,
+	DECOR_KIND_COUNT,
+};
+
+/* [start, end) in bytes of buffer_get_text(); start == end is an anchor */
+struct decor {
+	long start;
+	long end;
+	enum decor_kind kind;
+	int data; /* Owner-defined */
+};
+
+struct decor_node; /* Opaque */
+
+struct decor_tree {
+	struct decor_node *nodes; /* Pool, indexed by int */
+	int count;
+	int cap;
+	int free_list; /* -1 when empty */
+	int root;      /* -1 when empty */
+	int size;      /* Live ranges */
+	uint32_t seed; /* Priority generator */
+};
+
+void decor_init(struct decor_tree *t);
+void decor_destroy(struct decor_tree *t);
+
+void decor_add(struct decor_tree *t, struct decor d);
+
+/* Remove every range of kind */
+void decor_clear(struct decor_tree *t, enum decor_kind kind);
+
+/*
+ * Account for old_len bytes at pos being replaced by new_len bytes.
+ * Ranges after the edit shift; ranges reaching into it are clamped
+ * to the new text.
+ */
+void decor_edit(struct decor_tree *t, long pos, long old_len, long new_len);
+
+/*
+ * Ranges overlapping [lo, hi), sorted by start, copied into an array
+ * allocated from a. Anchors match when lo <= start < hi.
+ */
+int decor_query(struct decor_tree *t,
+		long lo,
+		long hi,
+		struct arena *a,
+		struct decor **out);
+
+#endif /* DECOR_H */
@@ -0,0 +1,91 @@
+/* include/editor/encoding.h
+ *
+ * Text encoding detection and decoding to UTF-8 with LF line endings.
+ * Layer 3 - depends on core/ only.
+ *
+ * The editor works on UTF-8 with '\n' between lines. Files are sniffed
+ * from their first bytes (BOM, else the spread of zero bytes for BOM-less
+ * UTF-16, else UTF-8 validity with Latin-1 as the fallback) and decoded
+ * chunk by chunk, so the loader never needs the raw file and the
+ * decoded text in memory at once. CRLF is folded to LF on the way; the
+ * format records what the file used so it can be written back as such.
+ *
+ * A UTF-8 guess is checked on through every chunk. When a later byte
+ * disproves it the decoder gives up and the caller starts over as
+ * Latin-1, which no byte sequence disproves.
+ *
+ * Hot loops test eight bytes per step (all-ASCII words in UTF-8,
+ * Latin-1 and UTF-16) and find CRs with memchr.
+ */
+
+#ifndef ENCODING_H
+#define ENCODING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define TEXT_SNIFF_LEN 4096 /* Bytes text_sniff looks at */
+
+enum text_encoding {
+	TEXT_UTF8,
+	TEXT_UTF16LE,
+	TEXT_UTF16BE,
+	TEXT_LATIN1,
+};
+
+enum text_eol {
+	TEXT_EOL_LF,
+	TEXT_EOL_CRLF,
+};
+
+struct text_format {
+	enum text_encoding encoding;
+	bool bom;
+	enum text_eol eol; /* Of the first line ending */
+};
+
+/* UTF-8, no BOM, LF: the bytes are used as they are */
+bool text_format_is_plain(struct text_format f);
+
+const char *text_encoding_name(enum text_encoding e);
+
+/* Guess the format from the start of a file (eol is left LF) */
+struct text_format text_sniff(const char *data, size_t len);
+
+/* Most UTF-8 bytes len input bytes can decode to */
+size_t text_decoded_max(enum text_encoding e, size_t len);
+
+/* Decoding state carried between chunks */
+struct text_decoder {
+	struct text_format format;
+	size_t bom_left;	 /* BOM bytes still to skip */
+	unsigned char carry;	 /* Odd byte of a split UTF-16 unit */
+	bool has_carry;
+	unsigned high;		 /* Pending high surrogate, or 0 */
+	bool cr_last;		 /* Output so far ends with '\r' */
+	bool eol_known;
+	unsigned utf8_need;	 /* Continuation bytes still due */
+};
+
+void text_decoder_init(struct text_decoder *d, struct text_format f);
+
+/*
+ * Decode len input bytes to out and return the new end of the output.
+ * out must directly follow the previous call's output: a CRLF split
+ * across chunks is folded by moving the new output back one byte.
+ * For UTF-8 input, in may equal out (decoding in place).
+ *
+ * Returns NULL when the input turns out not to be the UTF-8 that
+ * sniffing took it for (a BOM is taken at its word). d->format then
+ * says Latin-1: decode again from the first byte with it.
+ */
+char *
+text_decode(struct text_decoder *d, const char *in, size_t len, char *out);
+
+/*
+ * End of input: emit U+FFFD for a torn unit. Returns the new end, or
+ * NULL as text_decode does when sniffed UTF-8 ends mid-sequence.
+ */
+char *text_decode_finish(struct text_decoder *d, char *out);
+
+#endif /* ENCODING_H */
@@ -0,0 +1,64 @@
+/* include/editor/fold.h
+ *
+ * Folded line ranges and the mapping between screen rows and lines.
+ * Layer 3 - depends on core/ only.
+ *
+ * A closed fold hides the lines after its first one up to its last.
+ * Folds may nest: a line is hidden while any closed fold covers it.
+ * Rows number the lines left visible from 0. A segment tree over the
+ * lines keeps, for every node, how many closed folds cover all of it
+ * and how many of its lines are hidden, so closing or opening a fold
+ * and translating rows to lines either way take O(log n) whatever the
+ * number of folds. The tree is only allocated once something folds.
+ */
+
+#ifndef FOLD_H
+#define FOLD_H
+
+#include <stdbool.h>
+
+struct fold_range {
+	int start; /* Line left showing */
+	int end;   /* Last line hidden */
+};
+
+struct fold_map {
+	int line_count;
+	int size;		  /* Leaves, a power of two */
+	int *cover;		  /* Per node, NULL until the first fold */
+	int *hidden;		  /* Per node */
+	struct fold_range *folds; /* Closed, by start */
+	int count;
+	int cap;
+};
+
+void fold_init(struct fold_map *f, int line_count);
+void fold_destroy(struct fold_map *f);
+
+/*
+ * Close r, clamped to the lines. Returns false if it hides nothing or
+ * a fold starting on r.start is already closed.
+ */
+bool fold_close(struct fold_map *f, struct fold_range r);
+
+/* Open the fold starting on line; false if there is none */
+bool fold_open(struct fold_map *f, int line);
+
+/* Index into f->folds of the closed fold starting on line, or -1 */
+int fold_find(const struct fold_map *f, int line);
+
+/* Open every fold hiding line, so it shows */
+void fold_reveal(struct fold_map *f, int line);
+
+bool fold_hidden(const struct fold_map *f, int line);
+
+/* Visible lines */
+int fold_rows(const struct fold_map *f);
+
+/* Row of line; a hidden line maps to the row of the fold hiding it */
+int fold_line_to_row(const struct fold_map *f, int line);
+
+/* Line shown on row, row clamped to [0, fold_rows()) */
+int fold_row_to_line(const struct fold_map *f, int row);
+
+#endif /* FOLD_H */
@@ -0,0 +1,60 @@
+/* include/editor/highlight.h
+ *
+ * Highlight spans cached per buffer row.
+ * Layer 3 - depends on core/ and editor/syntax.
+ *
+ * Rows are keyed by number in an open-addressing table whose spans live
+ * in the cache's own arena, so scrolling back over rows seen before
+ * costs a lookup per row and no query work. Rows are dropped only when
+ * an edit touches them or a reparse reports them changed. Lines are
+ * replaced, never inserted, so row numbers stay put across edits.
+ *
+ * Dropped spans stay in the arena until the cache outgrows
+ * HIGHLIGHT_CACHE_BYTES or HIGHLIGHT_CACHE_ROWS, when it starts over.
+ */
+
+#ifndef HIGHLIGHT_H
+#define HIGHLIGHT_H
+
+#include <stdint.h>
+
+#include <editor/syntax.h>
+
+#define HIGHLIGHT_CACHE_ROWS  8192
+#define HIGHLIGHT_CACHE_BYTES (1u << 20)
+
+struct highlight_cache; /* Opaque */
+
+struct highlight_cache *highlight_cache_create(void);
+void highlight_cache_destroy(struct highlight_cache *hc);
+
+/*
+ * Fill out[row - first_row] for rows [first_row, last_row], running the
+ * highlight query of ctx only over runs of rows not cached. The spans
+ * stay valid until the next call on hc. Nothing is cached while ctx
+ * has no tree.
+ */
+void highlight_cache_get(struct highlight_cache *hc,
+			 struct syntax_ctx *ctx,
+			 uint32_t first_row,
+			 uint32_t last_row,
+			 struct syntax_line_spans *out);
+
+/*
+ * Row was edited. Its spans are dropped now and again once a tree is
+ * adopted, since spans queried in between come from the old tree.
+ */
+void highlight_cache_edit(struct highlight_cache *hc, uint32_t row);
+
+/* A tree was adopted: drop the rows of ranges and of pending edits */
+void highlight_cache_update(struct highlight_cache *hc,
+			    const struct syntax_range *ranges,
+			    int count);
+
+/* Drop every row */
+void highlight_cache_clear(struct highlight_cache *hc);
+
+/* Rows queried, for tests and stats */
+uint64_t highlight_cache_misses(const struct highlight_cache *hc);
+
+#endif /* HIGHLIGHT_H */
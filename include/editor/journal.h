@@ -0,0 +1,68 @@
+/* include/editor/journal.h
+ *
+ * Write-ahead edit journal for crash recovery.
+ * Layer 3 - depends on core/ only.
+ *
+ * Every edit is appended to a journal file next to the document
+ * (dir/.name.journal) instead of rewriting the document. Appends only
+ * copy the record into memory; a flusher thread writes and fsyncs in
+ * groups, so a record is durable at most latency_ms after its append
+ * and a burst of keystrokes costs one fsync.
+ *
+ * The journal header records the size and mtime of the document it
+ * applies to. A journal is replayed only if it matches the document
+ * and was written after it; otherwise it is stale and started afresh.
+ *
+ * Record: u32 line, u32 len, len bytes, u32 FNV-1a of the three.
+ * Replay stops at the first torn or corrupt record.
+ */
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <core/str.h>
+
+#define JOURNAL_PATH_MAX 600
+
+struct journal; /* Opaque */
+
+/* Journal path for doc_path. Returns false if it does not fit. */
+bool journal_path(const char *doc_path, char *out, size_t size);
+
+/*
+ * Call fn for every record of a journal that is valid for doc_path.
+ * Returns the number of records replayed (0 if there is no valid
+ * journal).
+ */
+int journal_replay(const char *doc_path,
+		   void (*fn)(int line, struct str text, void *arg),
+		   void *arg);
+
+/*
+ * Open the journal for doc_path, keeping the records of a valid one
+ * and starting a new one otherwise. Starts the flusher thread.
+ * On failure returns NULL and stores errno in *error.
+ */
+struct journal *
+journal_open(const char *doc_path, int latency_ms, int *error);
+
+/* Flush, fsync and stop the flusher. NULL is a no-op. */
+void journal_close(struct journal *j);
+
+/* Queue a "replace line" record. Never blocks on disk. */
+void journal_append(struct journal *j, int line, struct str text);
+
+/*
+ * Block until every record appended so far is on disk. Returns 0 or
+ * the errno of the first failed write or fsync.
+ */
+int journal_sync(struct journal *j);
+
+/* fsyncs issued so far (for measuring group commit) */
+uint64_t journal_fsync_count(struct journal *j);
+
+#endif /* JOURNAL_H */
@@ -0,0 +1,64 @@
+/* include/editor/line_index.h
+ *
+ * Line start offsets, stored plainly or Elias-Fano compressed.
+ * Layer 3 - depends on core/ only.
+ *
+ * An index is one block of 64-bit words with no pointers, so it can be
+ * written to a file and used again straight from a mapping.
+ *
+ * LINE_INDEX_ARRAY keeps every offset in a word. LINE_INDEX_EF splits
+ * each offset into l low bits, packed back to back, and a high part
+ * stored in unary as a bitvector of count + (universe >> l) bits, where
+ * l = log2(universe / count). For text with 40-byte lines that is about
+ * 7 bits per line instead of 64. Lookup is select on the high bits: a
+ * sampled position of every LINE_INDEX_SAMPLE-th set bit, then popcount
+ * over the few words up to the one wanted.
+ */
+
+#ifndef LINE_INDEX_H
+#define LINE_INDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define LINE_INDEX_SAMPLE 128
+
+enum line_index_kind {
+	LINE_INDEX_ARRAY,
+	LINE_INDEX_EF,
+};
+
+struct line_index; /* Opaque */
+
+/* Bytes an index of count offsets, all below universe, occupies */
+size_t line_index_size(enum line_index_kind kind,
+		       uint64_t count,
+		       uint64_t universe);
+
+/*
+ * Start an index in mem (line_index_size() bytes, 8-byte aligned).
+ * Fill it with exactly count line_index_push() calls, strictly
+ * ascending.
+ */
+struct line_index *line_index_init(void *mem,
+				   enum line_index_kind kind,
+				   uint64_t count,
+				   uint64_t universe);
+void line_index_push(struct line_index *idx, uint64_t value);
+
+/*
+ * Check that len bytes at mem hold a complete index, as before using
+ * one read back from a file: the layout, then every offset, decoded
+ * once in O(count). Returns NULL if not.
+ */
+const struct line_index *line_index_check(const void *mem, size_t len);
+
+enum line_index_kind line_index_kind(const struct line_index *idx);
+uint64_t line_index_count(const struct line_index *idx);
+size_t line_index_bytes(const struct line_index *idx);
+
+/* The i-th offset */
+uint64_t line_index_get(const struct line_index *idx, uint64_t i);
+
+#endif /* LINE_INDEX_H */
@@ -0,0 +1,56 @@
+/* include/editor/outline.h
+ *
+ * Heading outline of the document.
+ * Layer 3 - depends on core/ and editor/syntax.
+ *
+ * Every heading in document order, in an array sorted by row. It is
+ * built from the first tree; after that only rows a reparse reports
+ * changed, or that were edited, are queried again and spliced in, so
+ * upkeep costs the changed rows rather than the document. Lookups are
+ * binary searches. Rows are stable keys because lines are replaced,
+ * never inserted; byte offsets drift with every edit above them, so
+ * outline_offset() takes them from the snapshot instead.
+ */
+
+#ifndef OUTLINE_H
+#define OUTLINE_H
+
+#include <core/arena.h>
+#include <editor/syntax.h>
+
+struct outline {
+	struct syntax_heading *entries;
+	int count;
+	int cap;
+	uint32_t edit_first; /* Rows edited since the last update */
+	uint32_t edit_last; /* edit_first > edit_last when there are none */
+};
+
+void outline_init(struct outline *o);
+void outline_destroy(struct outline *o);
+
+/* Row was edited; it is queried again by the next update */
+void outline_edit(struct outline *o, uint32_t row);
+
+/*
+ * ctx adopted a tree (syntax_poll returned ranges, count >= 0):
+ * requery the headings of ranges and edited rows. scratch is used for
+ * the query results and left as it was.
+ */
+void outline_update(struct outline *o,
+		    struct syntax_ctx *ctx,
+		    const struct syntax_range *ranges,
+		    int count,
+		    struct arena *scratch);
+
+/* Index of the last heading at or above row, or -1 */
+int outline_enclosing(const struct outline *o, uint32_t row);
+
+/* Index of the first heading below row / the last above it, or -1 */
+int outline_next(const struct outline *o, uint32_t row);
+int outline_prev(const struct outline *o, uint32_t row);
+
+/* Byte offset of heading i in snap's text */
+long outline_offset(const struct outline *o, int i, struct snapshot *snap);
+
+#endif /* OUTLINE_H */
@@ -0,0 +1,53 @@
+/* include/editor/regex.h
+ *
+ * Line-oriented regular expressions.
+ * Layer 3 - depends on core/ only.
+ *
+ * Patterns are parsed to a Thompson NFA, which is then run as a DFA
+ * built lazily: each DFA state is created the first time a byte leads
+ * to it and cached in a bounded state table (flushed when full). A
+ * literal every match must contain is extracted at compile time and
+ * used to reject lines with str_find before the automaton runs.
+ *
+ * Matches are leftmost-longest. Supported syntax:
+ *   c  .  [abc]  [^a-z]  \d \w \s \D \W \S  \t \n \r  \<punct>
+ *   (...)  a|b  *  +  ?  ^  $
+ *
+ * A compiled regex caches DFA states while matching, so it must only
+ * be used by one thread at a time.
+ */
+
+#ifndef REGEX_H
+#define REGEX_H
+
+#include <stdbool.h>
+
+#include <core/str.h>
+
+struct regex; /* Opaque */
+
+struct regex_match {
+	int start; /* Byte offset of first matched byte */
+	int end;   /* Byte offset one past the match */
+};
+
+/*
+ * Compile pattern. On failure returns NULL and points *error at a
+ * static description.
+ */
+struct regex *regex_compile(struct str pattern, const char **error);
+void regex_destroy(struct regex *re);
+
+/*
+ * Find leftmost-longest match in text starting at byte from.
+ * ^ only matches at offset 0 and $ only at text.len.
+ */
+bool regex_find(struct regex *re,
+		struct str text,
+		int from,
+		struct regex_match *out);
+
+/* Literal every match contains (may be empty) */
+struct str regex_required_literal(const struct regex *re);
+
+#endif /* REGEX_H */
@@ -0,0 +1,157 @@
+/* include/editor/search.h
+ *
+ * Incremental search over a buffer.
+ * Layer 3 - depends on core/ and editor/buffer, editor/regex,
+ * editor/syntax, editor/trigram.
+ *
+ * The trigram index is optional. The first substring query long enough
+ * to use one starts a build on a worker thread from a buffer snapshot,
+ * handed back through search_poll(). Until it arrives (or for queries
+ * shorter than a trigram) every line is a candidate, so search always
+ * works and just gets faster once the index is ready. An index costs
+ * several times the text (see editor/trigram.h): a build that outgrows
+ * SEARCH_INDEX_BUDGET is dropped and every query scans lines.
+ *
+ * In regex mode a second worker scans a snapshot and streams matches
+ * back as it finds them: the viewport first, then the lines below it,
+ * then the lines above. Every new query or edit cancels the scan and
+ * starts a new one; hits from older scans are discarded.
+ *
+ * Structure mode takes the query as a tree-sitter query (see
+ * syntax_query_new) and runs it over copies of the syntax trees on the
+ * same worker, in parallel over chunks of the text, streaming hits in
+ * document order the same way. It rescans when new trees arrive.
+ */
+
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <stdbool.h>
+
+#include <core/arena.h>
+#include <core/str.h>
+#include <core/worker.h>
+#include <editor/buffer.h>
+#include <editor/syntax.h>
+#include <editor/trigram.h>
+
+#define SEARCH_QUERY_MAX 256
+#define SEARCH_HITS_MAX	 (1 << 20) /* Cap on hits from one regex scan */
+#define SEARCH_INDEX_BUDGET ((size_t)256 << 20) /* Bytes of trigram index */
+
+struct search_hit {
+	int line;
+	int start; /* Byte offsets within the line */
+	int end;
+};
+
+/*
+ * Hits for one contiguous range of lines, in line order.
+ * The scan fills above, view and below independently; read in that
+ * order they list every hit sorted by line.
+ */
+struct search_run {
+	struct search_hit *hits;
+	int count;
+	int cap;
+};
+
+enum {
+	SEARCH_RUN_ABOVE,
+	SEARCH_RUN_VIEW,
+	SEARCH_RUN_BELOW,
+	SEARCH_RUN_COUNT,
+};
+
+struct search_stream; /* Opaque, shared with the regex worker */
+
+struct search {
+	struct arena arena;	     /* Candidates of the current query */
+	struct worker *worker;	     /* Builds the trigram index */
+	struct trigram_index *index; /* Ready index, UI thread only */
+	struct trigram_index *built; /* Handed over by the worker */
+	bool indexing;		     /* A build is under way */
+	int too_large; /* Set by the worker: the index outgrew its budget */
+	char query[SEARCH_QUERY_MAX + 1];
+	int query_len;
+	int *candidates; /* Sorted lines that may match */
+	int candidate_count;
+	bool scan_all; /* No usable index: every line is a candidate */
+
+	/* Regex and structure modes */
+	bool regex;
+	bool structural;	 /* The query is a tree-sitter query */
+	struct syntax_ctx *syntax; /* Trees structural queries run on */
+	const char *regex_error; /* Compile error of query, or NULL */
+	struct worker *regex_worker;
+	struct search_stream *stream;
+	struct search_run runs[SEARCH_RUN_COUNT];
+	unsigned scan_id; /* Changes whenever runs are emptied */
+	int scan_first; /* Viewport of the running scan */
+	int scan_last;
+	int scan_lines; /* Lines scanned so far */
+	bool scan_done;
+	int view_first; /* Viewport for the next scan */
+	int view_last;
+};
+
+/* notify is called from the worker when a built index is ready */
+void search_init(struct search *s, void (*notify)(void *), void *notify_arg);
+void search_destroy(struct search *s);
+
+/*
+ * Start building the index for buf in the background, unless one is
+ * under way or buf proved too large. search_set_query calls it as needed.
+ */
+void search_index(struct search *s, struct buffer *buf);
+
+/*
+ * Adopt an index finished by the worker, catching up with edits made
+ * while it was built, and collect streamed regex hits. Returns true if
+ * anything changed.
+ */
+bool search_poll(struct search *s, struct buffer *buf);
+
+/* Reindex the lines changed by the latest edits */
+void search_sync(struct search *s, struct buffer *buf);
+
+bool search_is_indexed(const struct search *s);
+
+/* Whether the index outgrew SEARCH_INDEX_BUDGET, leaving line scans */
+bool search_index_too_large(const struct search *s);
+
+/* Lines to scan first in regex mode */
+void search_set_viewport(struct search *s, int first, int last);
+
+/* Switch between substring and regex queries, keeping the query */
+void search_set_regex(struct search *s, struct buffer *buf, bool regex);
+
+/*
+ * Switch structural queries on or off, keeping the query; they run on
+ * the trees of syntax, which must outlive s.
+ */
+void search_set_structural(struct search *s,
+			   struct buffer *buf,
+			   struct syntax_ctx *syntax,
+			   bool structural);
+
+/* Rerun a structural query on trees syntax adopted since it started */
+void search_syntax_changed(struct search *s, struct buffer *buf);
+
+/* Whether hits come from a scan: regex or structure mode */
+bool search_is_scan(const struct search *s);
+
+/* Set query and recompute candidate lines (or restart the regex scan) */
+void search_set_query(struct search *s, struct buffer *buf, struct str query);
+struct str search_get_query(const struct search *s);
+
+/*
+ * First line matching the query, starting at from and moving by dir
+ * (+1 or -1). Returns -1 if there is none in that direction.
+ */
+int search_next(struct search *s, struct buffer *buf, int from, int dir);
+
+/* Total regex hits found so far */
+int search_hit_count(const struct search *s);
+
+#endif /* SEARCH_H */
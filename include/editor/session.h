@@ -0,0 +1,84 @@
+/* include/editor/session.h
+ *
+ * Session cache: what a restart needs to show a document again without
+ * rescanning it.
+ * Layer 3 - depends on core/ and editor/decor, editor/encoding,
+ * editor/line_index, editor/snapshot.
+ *
+ * The cache (dir/.name.session) holds the line index of the document
+ * as it is on disk, the decorations worth keeping and the cursor.
+ * Sections are addressed by their offset from the start of the file
+ * and hold only fixed-width integers, so the cache is used in place
+ * through a read-only mapping: opening it costs the same for a 1 KB
+ * and a 1 GB document, and validating it means comparing the size and
+ * mtime it was keyed with.
+ *
+ * Edits are not cached: they live in the journal (editor/journal.h)
+ * and are replayed over the mapped document.
+ */
+
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <editor/decor.h>
+#include <editor/snapshot.h>
+
+#define SESSION_PATH_MAX 600
+
+/* Identifies one version of a document on disk */
+struct session_key {
+	uint64_t size;
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+};
+
+/* The view follows the cursor, so the cursor is all there is */
+struct session_state {
+	int cursor_line;
+};
+
+struct session; /* Opaque */
+
+/* Cache path for doc_path. Returns false if it does not fit. */
+bool session_path(const char *doc_path, char *out, size_t size);
+
+/* Key of doc_path as it is now. Take it before loading the document. */
+bool session_key(const char *doc_path, struct session_key *key);
+
+/* Map the cache of doc_path; NULL if missing or for another key */
+struct session *
+session_open(const char *doc_path, const struct session_key *key);
+
+/* Drop the handle; the mapping stays while session_load snapshots do */
+void session_close(struct session *s);
+
+/*
+ * Snapshot of doc_path built on the cached line index (see
+ * snapshot_map). On failure returns NULL and stores errno in *error.
+ */
+struct snapshot *
+session_load(struct session *s, const char *doc_path, int *error);
+
+struct session_state session_state(const struct session *s);
+
+/* Add the cached decorations to t */
+void session_restore_decor(const struct session *s, struct decor_tree *t);
+
+/*
+ * Write the cache of doc_path: the base line index of snap, which must
+ * have been loaded from the document version key names, plus state and
+ * every decoration in t except search hits. If the cache already holds
+ * that version only the state and decorations are rewritten. Documents
+ * that needed decoding are not cached. Returns 0 or an errno.
+ */
+int session_save(const char *doc_path,
+		 const struct session_key *key,
+		 struct snapshot *snap,
+		 const struct session_state *state,
+		 struct decor_tree *t);
+
+#endif /* SESSION_H */
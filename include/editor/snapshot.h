@@ -0,0 +1,121 @@
+/* include/editor/snapshot.h
+ *
+ * Immutable, reference-counted buffer snapshots.
+ * Layer 3 - depends on core/ and editor/encoding, editor/line_index.
+ *
+ * A snapshot is the whole document at one version. The loaded file is
+ * shared by every snapshot derived from it; edited lines live in a
+ * sparse persistent tree (fan-out SNAPSHOT_FANOUT) that is copied only
+ * along the path to the edited line. Taking a snapshot is a refcount
+ * increment, so the UI thread can hand one to a worker without locks.
+ */
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <core/str.h>
+#include <editor/encoding.h>
+#include <editor/line_index.h>
+
+#define SNAPSHOT_BITS	6
+#define SNAPSHOT_FANOUT (1 << SNAPSHOT_BITS)
+
+struct snapshot; /* Opaque */
+
+/*
+ * Load file into a new snapshot (refcount 1), decoding it to UTF-8
+ * with LF line endings (see editor/encoding.h).
+ * On failure returns NULL and stores errno in *error.
+ */
+struct snapshot *snapshot_load(const char *path, int *error);
+
+/*
+ * Like snapshot_load, but maps the file instead of reading it and
+ * takes its line index from the caller instead of scanning for
+ * newlines, so the cost does not grow with the file. lines is laid
+ * out as snapshot_base_index() and must stay valid until done(arg) is
+ * called, after the last snapshot sharing the load is released. Fails
+ * with EINVAL if the index does not end at the file's size or the file
+ * needs decoding. The file must not be truncated while mapped.
+ */
+struct snapshot *snapshot_map(const char *path,
+			      const struct line_index *lines,
+			      void (*done)(void *arg),
+			      void *arg,
+			      int *error);
+
+/* Retain/release are thread-safe; the last release frees everything. */
+struct snapshot *snapshot_retain(struct snapshot *s);
+void snapshot_release(struct snapshot *s);
+
+/*
+ * Return new snapshot with line replaced by text (copied, no newlines).
+ * s is left untouched and still owned by the caller.
+ */
+struct snapshot *
+snapshot_replace_line(struct snapshot *s, int line, struct str text);
+
+/* Globally unique, increasing version; newer snapshots compare greater */
+uint64_t snapshot_version(const struct snapshot *s);
+int snapshot_line_count(const struct snapshot *s);
+bool snapshot_is_edited(const struct snapshot *s);
+
+/* Line view, valid while the snapshot is retained */
+struct str snapshot_get_line(const struct snapshot *s, int line);
+
+/* File contents as loaded (decoded), ignoring edits */
+struct str snapshot_base_text(const struct snapshot *s);
+
+/* Encoding and line endings the file had on disk */
+struct text_format snapshot_format(const struct snapshot *s);
+
+/*
+ * Line start offsets of the text as loaded: snapshot_line_count() + 1
+ * entries, the last being the base length + 1. Files of a million
+ * lines or more get an Elias-Fano index (editor/line_index.h).
+ */
+const struct line_index *snapshot_base_index(const struct snapshot *s);
+
+/* Total length in bytes, lines joined by '\n' */
+long snapshot_text_len(const struct snapshot *s);
+
+/*
+ * Byte offset of the start of line in the flattened text: the base
+ * offset plus the drift recorded along one tree path, so O(depth).
+ * line_count maps to snapshot_text_len() + 1.
+ */
+long snapshot_line_offset(const struct snapshot *s, int line);
+
+/* Line containing byte offset (binary search, O(log n) lookups) */
+int snapshot_offset_line(const struct snapshot *s, long offset);
+
+/*
+ * Map n ascending offsets to lines in one forward pass, galloping over
+ * the lines between consecutive offsets.
+ */
+void snapshot_offsets_lines(const struct snapshot *s,
+			    const long *offsets,
+			    int *lines,
+			    int n);
+
+/*
+ * Call fn for every line that may differ between a and b.
+ * Only subtrees touched by edits are visited, so this is cheap for
+ * snapshots a few edits apart. Returns false (without calling fn) if
+ * a and b were not derived from the same load.
+ */
+bool snapshot_diff(const struct snapshot *a,
+		   const struct snapshot *b,
+		   void (*fn)(int line, void *arg),
+		   void *arg);
+
+/*
+ * Copy contents into dst (at least snapshot_text_len() + 1 bytes).
+ * Result is NUL-terminated.
+ */
+void snapshot_flatten(const struct snapshot *s, char *dst);
+
+#endif /* SNAPSHOT_H */
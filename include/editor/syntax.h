@@ -1,7 +1,19 @@
 /* include/editor/syntax.h
  *
  * Tree-sitter based syntax parsing.
- * Layer 3 - depends on core/ only.
+ * Layer 3 - depends on core/, editor/snapshot and editor/regex.
+ *
+ * Parsing runs on a worker thread. A new parse or edit cancels the one
+ * in flight; finished trees are handed back through syntax_poll(). The
+ * UI thread keeps using the last tree it adopted (edited so its offsets
+ * stay right) and has no tree at all until the first parse finishes.
+ * The parser reads snapshot lines in place through a TSInput callback,
+ * so no parse needs the document as one contiguous string.
+ *
+ * A large document is parsed as a forest: cut into sections at top
+ * level headings, each parsed on its own by one of several threads
+ * and reparsed alone when an edit falls in it. Every call below reads
+ * the forest as one tree.
  */
 
 #ifndef SYNTAX_H
@@ -12,45 +24,360 @@
 
 #include <core/arena.h>
 #include <core/str.h>
+#include <editor/snapshot.h>
+#include <editor/syntax_alloc.h>
 
 struct syntax_ctx; /* Opaque to hide treesitter details */
+struct TSLanguage; /* From tree_sitter/api.h, for grammars to register */
 
 #define SYNTAX_NODE_TYPE_MAX 32
-#define SYNTAX_VISIBLE_MAX   32
+#define SYNTAX_LANGUAGES_MAX 16
+#define SYNTAX_THREADS_MAX 64
+#define SYNTAX_SECTION_ROWS 4096 /* Fewest rows a section is cut at */
 
 struct syntax_node {
 	char type[SYNTAX_NODE_TYPE_MAX];
-	struct str text; /* View into source (valid while source lives) */
+	struct str text; /* Leaves: syntax_node_text(), else empty */
 	uint32_t start_row;
 	uint32_t start_col;
 	uint32_t end_row;
 	uint32_t end_col;
-	uint32_t start_byte; /* For str_slice into source */
+	uint32_t start_byte; /* Offsets into the flattened text */
 	uint32_t end_byte;
 	int depth;
 	bool is_named;
 };
 
+/* Every node overlapping a row range, grown in an arena */
 struct syntax_visible {
-	struct syntax_node nodes[SYNTAX_VISIBLE_MAX];
+	struct syntax_node *nodes;
+	int count;
+	int cap;
+};
+
+struct syntax_cursor; /* Opaque, pages through the nodes of rows */
+
+/* What a highlighted piece of text is, for the renderer to color */
+enum syntax_style {
+	SYNTAX_STYLE_NONE,
+	SYNTAX_STYLE_HEADING,
+	SYNTAX_STYLE_MARKER, /* Heading, list, quote and fence markers */
+	SYNTAX_STYLE_CODE,
+	SYNTAX_STYLE_CODE_INFO, /* Info string after an opening fence */
+	SYNTAX_STYLE_QUOTE,
+	SYNTAX_STYLE_LINK,
+	SYNTAX_STYLE_RULE, /* Thematic breaks, table delimiter rows */
+	SYNTAX_STYLE_HTML,
+	SYNTAX_STYLE_META, /* Front matter */
+	SYNTAX_STYLE_ESCAPE,
+	SYNTAX_STYLE_COUNT,
+};
+
+#define SYNTAX_SPAN_EOL UINT32_MAX /* Span end: up to the end of the line */
+
+/* Bytes [start, end) of one line drawn in style */
+struct syntax_span {
+	uint32_t start;
+	uint32_t end;
+	uint8_t style; /* enum syntax_style */
+};
+
+/* Spans of one row: sorted, non-overlapping, unstyled gaps omitted */
+struct syntax_line_spans {
+	struct syntax_span *spans;
 	int count;
 };
 
-struct syntax_ctx *syntax_create(struct arena *a);
+/* An atx or setext heading */
+struct syntax_heading {
+	uint32_t row; /* Where the heading starts */
+	uint32_t title_row; /* Title text: row and byte columns */
+	uint32_t title_start;
+	uint32_t title_end; /* SYNTAX_SPAN_EOL if it runs on */
+	uint8_t level; /* 1-6 */
+};
+
+/* Rows of a block that can fold: a section, list or fenced block */
+struct syntax_fold {
+	uint32_t start_row; /* Stays showing */
+	uint32_t end_row;   /* Last row of the block */
+};
+
+/* Position as tree-sitter counts it: row and byte column */
+struct syntax_point {
+	uint32_t row;
+	uint32_t col;
+};
+
+/* One edit, described in the text before and after it */
+struct syntax_change {
+	uint32_t start_byte;
+	uint32_t old_end_byte;
+	uint32_t new_end_byte;
+	struct syntax_point start;
+	struct syntax_point old_end;
+	struct syntax_point new_end;
+};
+
+/* Text whose syntactic structure differs between two trees */
+struct syntax_range {
+	uint32_t start_byte;
+	uint32_t end_byte;
+	struct syntax_point start;
+	struct syntax_point end;
+};
+
+/*
+ * notify (may be NULL) is called from the worker when a parse is ready
+ * for syntax_poll(); it must be thread-safe.
+ */
+struct syntax_ctx *
+syntax_create(struct arena *a, void (*notify)(void *), void *notify_arg);
 void syntax_destroy(struct syntax_ctx *ctx);
 
-/* Parse using str - takes view, no copy needed */
-bool syntax_parse(struct syntax_ctx *ctx, struct str source);
+/*
+ * Parse from scratch with up to threads threads (1 by default, at most
+ * SYNTAX_THREADS_MAX). With more than one, documents of more than
+ * SYNTAX_SECTION_ROWS rows are cut into sections, about four per
+ * thread, each starting on an atx heading of the document's top level
+ * after a blank row outside fenced blocks. The cuts stay where they
+ * are until the next parse from scratch, and blocks (folds included)
+ * end with their section.
+ */
+void syntax_set_threads(struct syntax_ctx *ctx, int threads);
+
+/* Parse snap from scratch in the background */
+void syntax_parse(struct syntax_ctx *ctx, struct snapshot *snap);
+
+/*
+ * Parse snap from scratch like syntax_parse(), but first only a window
+ * around rows [first_row, last_row], so a huge document has structure
+ * where it is shown long before the whole parse is done. syntax_poll()
+ * adopts the window's tree (the stats say partial), then the whole
+ * one, reporting as changed the rows outside the window and whatever
+ * inside parses differently with the rest of the text around it.
+ *
+ * The window is widened by some rows and its edges moved to blocks
+ * nothing above reaches into: headings after a blank row, else any
+ * block after one. A fenced block with such a line inside defeats
+ * that, and its rows may change when the whole tree arrives.
+ */
+void syntax_parse_viewport(struct syntax_ctx *ctx,
+			   struct snapshot *snap,
+			   uint32_t first_row,
+			   uint32_t last_row);
+
+/*
+ * Apply change to the tree now, then reparse snap (the text after the
+ * change) in the background, reusing every subtree the change did not
+ * touch; in a forest, only the section the change starts in. Without a
+ * tree to edit this is syntax_parse(). change must stay on one row.
+ */
+void syntax_edit(struct syntax_ctx *ctx,
+		 const struct syntax_change *change,
+		 struct snapshot *snap);
+
+/*
+ * Adopt the tree finished by the worker if it was parsed from the
+ * snapshot with version; older ones are dropped. Stores the ranges
+ * whose structure changed in *ranges (allocated from a; the whole
+ * document after a parse from scratch) and returns how many there are,
+ * or -1 if no tree was adopted. Text that changed without changing
+ * structure (say, a word inside a paragraph) is not reported: callers
+ * that cache what the text looks like must also drop edited rows.
+ * Injected fences edited since their last parse are reported whole.
+ */
+int syntax_poll(struct syntax_ctx *ctx,
+		uint64_t version,
+		struct arena *a,
+		struct syntax_range **ranges);
+
 bool syntax_has_tree(struct syntax_ctx *ctx);
 
-/* Get nodes intersecting row range */
+/*
+ * Start walking the named nodes overlapping rows [start_row, end_row]
+ * in document order, parents before children. Returns NULL (a cursor
+ * with no nodes) when there is no tree. snap is the text the tree was
+ * last edited to; leaf text is read from it. The cursor reads the
+ * current tree: delete it before the next syntax_edit or syntax_poll.
+ */
+struct syntax_cursor *syntax_cursor_new(struct syntax_ctx *ctx,
+					struct snapshot *snap,
+					uint32_t start_row,
+					uint32_t end_row);
+
+/*
+ * Store up to max next nodes in page. Returns how many, 0 once the
+ * walk is over, so a fixed page streams any number of nodes.
+ */
+int syntax_cursor_next(struct syntax_cursor *c,
+		       struct syntax_node *page,
+		       int max);
+
+void syntax_cursor_delete(struct syntax_cursor *c);
+
+/*
+ * Collect every node syntax_cursor_new would walk into out, allocated
+ * from a; out->nodes starts over on each call.
+ */
 void syntax_get_visible_nodes(struct syntax_ctx *ctx,
-			      struct str source,
+			      struct snapshot *snap,
 			      uint32_t start_row,
 			      uint32_t end_row,
+			      struct arena *a,
 			      struct syntax_visible *out);
 
-/* Get text for a node using str_slice (zero-copy) */
-struct str syntax_node_text(struct syntax_node *node, struct str source);
+/*
+ * Run the highlight query over rows [first_row, last_row] and store
+ * the spans of each row in out[row - first_row], allocated from a.
+ * Where captures nest, the innermost one wins. Rows come back empty
+ * until there is a tree.
+ */
+void syntax_highlight(struct syntax_ctx *ctx,
+		      uint32_t first_row,
+		      uint32_t last_row,
+		      struct arena *a,
+		      struct syntax_line_spans *out);
+
+/*
+ * Store the headings starting on rows [first_row, last_row] in *out
+ * (allocated from a) in document order and return how many.
+ */
+int syntax_headings(struct syntax_ctx *ctx,
+		    uint32_t first_row,
+		    uint32_t last_row,
+		    struct arena *a,
+		    struct syntax_heading **out);
+
+/*
+ * Find the block to fold at row: the outermost one starting on row,
+ * else the innermost one containing it. Blocks on a single row do not
+ * fold. Returns false if there is none or no tree yet.
+ */
+bool syntax_fold_at(struct syntax_ctx *ctx,
+		    uint32_t row,
+		    struct syntax_fold *out);
+
+/*
+ * Parse the content of fences whose info string is name as lang (a
+ * grammar's tree_sitter_<lang> function) and highlight it with the
+ * query source highlights, which may be NULL; captures named after a
+ * style (see syntax_highlight) color it, others are ignored. markdown
+ * and md are built in. Call before syntax_create. Returns false if the
+ * registry is full or name longer than 31 bytes.
+ *
+ * Fences are parsed lazily on the UI thread by syntax_highlight, only
+ * those it is asked to draw, then kept and reparsed incrementally
+ * after edits.
+ */
+bool syntax_register_language(const char *name,
+			      const struct TSLanguage *(*lang)(void),
+			      const char *highlights);
+
+/* A query of the user's, compiled against the markdown grammar */
+struct syntax_query;
+
+/* Copies of a ctx's trees and their text, readable on any thread */
+struct syntax_forest;
+
+/* Where one match of a syntax_query lies: the span of its captures */
+struct syntax_match {
+	uint32_t start_byte;
+	uint32_t end_byte;
+	struct syntax_point start;
+	struct syntax_point end;
+	uint32_t pattern; /* Index in the query source */
+};
+
+/*
+ * Compile source, tree-sitter query syntax, such as
+ *   (atx_heading (atx_h2_marker) (inline) @t (#match? @t "Y"))
+ * The predicates #eq? and #match? (editor/regex patterns, found
+ * anywhere in the text) and their #not- forms compare a capture with
+ * a string or, for #eq?, another capture; any other is an error. On
+ * failure returns NULL and points *error at a static description.
+ */
+struct syntax_query *syntax_query_new(struct str source, const char **error);
+void syntax_query_delete(struct syntax_query *q);
+
+/*
+ * Copy ctx's trees (tree-sitter shares their nodes, so this is cheap)
+ * for a search off the UI thread, along with the text they were edited
+ * to and the threads set for ctx. NULL when there is no tree yet.
+ */
+struct syntax_forest *syntax_forest_copy(struct syntax_ctx *ctx);
+void syntax_forest_delete(struct syntax_forest *f);
+
+/*
+ * Run q over f, on as many threads as f was copied with, each taking
+ * chunks of text in turn on its own copy of the trees. Patterns without
+ * a capture match nothing. Matches go to emit on the calling thread, n
+ * at a time in document order, as soon as every chunk before theirs is
+ * done; emit returns false to stop. Returns false if stopped, or
+ * cancelled by *cancel turning nonzero (checked between chunks and
+ * every few matches).
+ */
+bool syntax_query_run(const struct syntax_query *q,
+		      struct syntax_forest *f,
+		      const int *cancel,
+		      bool (*emit)(void *arg,
+				   const struct syntax_match *m,
+				   int n),
+		      void *arg);
+
+/* Calls of one operation and the time they took */
+struct syntax_timing {
+	uint64_t count;
+	uint64_t last_ns;
+	uint64_t total_ns;
+	uint64_t max_ns;
+};
+
+/*
+ * Counters of one syntax_ctx. A parse is timed from its job starting,
+ * timed-out slices included, and counted when syntax_poll() adopts its
+ * tree; one made stale by a later edit counts in dropped only.
+ */
+struct syntax_stats {
+	struct syntax_timing full_parse;
+	struct syntax_timing incremental_parse;
+	struct syntax_timing viewport_parse; /* Window of a viewport parse */
+	struct syntax_timing visible;	/* syntax_get_visible_nodes */
+	struct syntax_timing highlight; /* Fences it parses included */
+	struct syntax_timing headings;
+	uint64_t bytes_read; /* By the last adopted parse */
+	uint64_t bytes_read_total;
+	uint32_t changed_ranges; /* Returned by the last adopting poll */
+	uint32_t dropped;
+	uint32_t nodes;		/* In the current tree, anonymous too */
+	uint32_t visible_nodes; /* Last syntax_get_visible_nodes */
+	int injected;
+	int sections; /* Trees in the forest */
+	bool partial; /* The tree is a viewport parse's window */
+	struct syntax_account memory;
+};
+
+/*
+ * Copy the counters into out, zeroed without ctx. Nodes are counted by
+ * the worker as it parses, so this never walks a tree.
+ */
+void syntax_stats(struct syntax_ctx *ctx, struct syntax_stats *out);
+
+/*
+ * tree-sitter memory held for ctx: its trees (fences included), parsers
+ * and queries. Zero unless an accounting allocator is installed (see
+ * editor/syntax_alloc.h).
+ */
+void syntax_memory(struct syntax_ctx *ctx, struct syntax_account *out);
+
+/* Fences with a parsed tree kept, for tests and stats */
+int syntax_injected(struct syntax_ctx *ctx);
+
+/*
+ * Text of node on the row it starts on, a view into snap's line (valid
+ * while snap is retained), so the document is never flattened. A node
+ * spanning rows is cut at the end of its first row.
+ */
+struct str syntax_node_text(struct syntax_node *node, struct snapshot *snap);
 
 #endif /* SYNTAX_H */
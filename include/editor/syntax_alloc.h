@@ -0,0 +1,69 @@
+/* include/editor/syntax_alloc.h
+ *
+ * Accounting allocator for tree-sitter.
+ * Layer 3 - depends on core/ only.
+ *
+ * tree-sitter takes one allocator for the whole process. Once this one
+ * is installed, every block it hands out starts with a header naming
+ * the account it was charged to: the one the allocating thread last
+ * selected with syntax_alloc_charge(). A block freed on another thread
+ * (trees are built by a worker and dropped by the UI thread) is still
+ * credited to its account, so memory stays attributed to the
+ * syntax_ctx whose trees hold it.
+ *
+ * Pooled mode serves small blocks from size classes carved out of
+ * slabs. Each thread keeps a free list per class and trades half of it
+ * with a shared list only when it runs dry or grows long, so the thread
+ * that builds a tree and the one that frees it rarely take a lock.
+ * Pooled memory is kept for reuse, never returned to the system.
+ */
+
+#ifndef SYNTAX_ALLOC_H
+#define SYNTAX_ALLOC_H
+
+#include <stddef.h>
+
+enum syntax_alloc_mode {
+	SYNTAX_ALLOC_MALLOC,  /* tree-sitter's own malloc, nothing counted */
+	SYNTAX_ALLOC_COUNTED, /* malloc, with a header per block */
+	SYNTAX_ALLOC_POOLED,  /* Counted, small blocks from size classes */
+};
+
+/* Installed by the first syntax_create() unless chosen before */
+#define SYNTAX_ALLOC_DEFAULT SYNTAX_ALLOC_POOLED
+
+/* Bytes tree-sitter asked for, headers and pool slack excluded */
+struct syntax_account {
+	size_t bytes;  /* Live */
+	size_t peak;   /* Most ever live at once */
+	size_t blocks; /* Live */
+};
+
+/*
+ * Install mode. Only the first call has an effect; it must come before
+ * tree-sitter allocates anything, on one thread.
+ */
+void syntax_alloc_install(enum syntax_alloc_mode mode);
+enum syntax_alloc_mode syntax_alloc_mode(void);
+
+/*
+ * Charge the calling thread's allocations to acct (NULL: to the
+ * process total only) until the next call; returns the account charged
+ * before. An account must outlive every block charged to it.
+ */
+struct syntax_account *syntax_alloc_charge(struct syntax_account *acct);
+
+/* Snapshot of acct, which other threads may be updating */
+void syntax_alloc_read(const struct syntax_account *acct,
+		       struct syntax_account *out);
+
+/*
+ * Everything tree-sitter holds in the process. *pooled (may be NULL)
+ * gets the bytes pools took from the system, free blocks included.
+ */
+void syntax_alloc_total(struct syntax_account *out, size_t *pooled);
+
+/* Free what tree-sitter returned to the caller, like changed ranges */
+void syntax_alloc_free(void *p);
+
+#endif /* SYNTAX_ALLOC_H */
@@ -0,0 +1,65 @@
+/* include/editor/trigram.h
+ *
+ * Trigram posting index over buffer lines.
+ * Layer 3 - depends on core/ only.
+ *
+ * Every distinct 3-byte sequence maps to the sorted list of lines that
+ * contain it. A substring query of 3 or more bytes can only match lines
+ * present in the posting list of each of its trigrams, so intersecting
+ * those lists narrows a multi-GB buffer down to a handful of candidate
+ * lines that are then verified with str_find.
+ *
+ * Memory: each (trigram, line) pair costs a 4-byte line number, plus
+ * the slack of doubling lists. Prose and logs have close to one distinct
+ * trigram per byte of a line, so an index takes 3-4 times the text it
+ * covers; a build gives up once it holds more than its budget.
+ */
+
+#ifndef TRIGRAM_H
+#define TRIGRAM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <core/arena.h>
+#include <core/str.h>
+#include <editor/snapshot.h>
+
+#define TRIGRAM_MIN_QUERY 3
+
+struct trigram_index; /* Opaque */
+
+/*
+ * Index every line of snap (retained by the index). Returns NULL once
+ * the index holds more than budget bytes. Polls *cancel (may be NULL)
+ * and returns NULL once it becomes nonzero, so this can run on a worker
+ * thread.
+ */
+struct trigram_index *trigram_build(struct snapshot *snap,
+				    size_t budget,
+				    const int *cancel);
+void trigram_destroy(struct trigram_index *idx);
+
+/* Snapshot the index currently reflects */
+struct snapshot *trigram_snapshot(struct trigram_index *idx);
+
+/* Memory held, updates included (they are not held to the budget) */
+size_t trigram_bytes(const struct trigram_index *idx);
+
+/*
+ * Bring index up to date with snap by reindexing only the lines that
+ * changed since trigram_snapshot(). Returns false if snap comes from a
+ * different load, in which case the index must be rebuilt.
+ */
+bool trigram_update(struct trigram_index *idx, struct snapshot *snap);
+
+/*
+ * Sorted lines that may contain needle (at least TRIGRAM_MIN_QUERY
+ * bytes), allocated from arena. Returns the count.
+ */
+int trigram_candidates(struct trigram_index *idx,
+		       struct str needle,
+		       struct arena *a,
+		       int **out);
+
+#endif /* TRIGRAM_H */
@@ -1,7 +1,10 @@
 /* include/editor/view.h
  *
  * Viewport / scrolling logic.
- * Layer 3 - depends on core/ only.
+ * Layer 3 - depends on core/ and editor/fold.
+ *
+ * The window shows rows, the lines folds leave visible, around the
+ * cursor; first and last visible are the lines on the outermost rows.
  */
 
 #ifndef VIEW_H
@@ -9,19 +12,21 @@
 
 #include <stdbool.h>
 
+#include <editor/fold.h>
+
 struct view {
 	int first_visible_line;
 	int last_visible_line;
 	int cursor_line;
-	int lines_above;
+	int lines_above; /* Rows */
 	int lines_below;
 	bool needs_ast_update;
 };
 
 void view_init(struct view *v);
 bool view_update(struct view *v,
+		 const struct fold_map *folds,
 		 int cursor_line,
-		 int line_count,
 		 int window_h,
 		 int line_h,
 		 int menu_h);
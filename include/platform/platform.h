@@ -28,6 +28,7 @@ enum platform_event_type {
 	EVENT_RESIZE,
 	EVENT_FOCUS_IN,
 	EVENT_FOCUS_OUT,
+	EVENT_WAKE, /* platform_wake() was called from another thread */
 };
 
 struct platform_key_event {
@@ -60,4 +61,10 @@ void platform_present(struct platform *p);
 bool platform_wait_events(struct platform *p, int timeout_ms);
 bool platform_next_event(struct platform *p, struct platform_event *ev);
 
+/*
+ * Wake platform_wait_events() and queue an EVENT_WAKE.
+ * Safe to call from any thread; wakes before the next wait coalesce.
+ */
+void platform_wake(struct platform *p);
+
 #endif /* PLATFORM_H */
@@ -51,6 +51,10 @@ int font_measure_text(struct font_ctx *font,
 		      struct text_metrics *out);
 
 int font_char_index_to_x(struct font_ctx *font, struct str text, int index);
+
+/* x position of every byte boundary: out[i] for i in 0..text.len */
+void font_measure_prefix(struct font_ctx *font, struct str text, int *out);
+
 int font_x_to_char_index(struct font_ctx *font, struct str text, int target_x);
 
 int font_get_line_height(struct font_ctx *font);
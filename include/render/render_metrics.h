@@ -0,0 +1,35 @@
+/* include/render/render_metrics.h
+ *
+ * Per-line display metrics cache.
+ * Layer 1 - depends on core/ and render/render_font.
+ *
+ * Maps byte indices of a line to pixel x without walking the glyphs
+ * each time. The first lookup on a line records the x position of every
+ * byte boundary; later lookups on the same line are an array read.
+ *
+ * Lines are identified by (text.data, text.len, version). The version
+ * must change whenever the bytes behind text.data may have changed:
+ * pass buffer_version() for buffer lines, ui_input's version for the
+ * input box. The font is fixed for the life of the cache.
+ */
+
+#ifndef RENDER_METRICS_H
+#define RENDER_METRICS_H
+
+#include <stdint.h>
+
+#include <core/str.h>
+#include <render/render_font.h>
+
+struct line_metrics; /* Opaque */
+
+struct line_metrics *line_metrics_create(struct font_ctx *font);
+void line_metrics_destroy(struct line_metrics *lm);
+
+/* Same result as font_char_index_to_x */
+int line_metrics_index_to_x(struct line_metrics *lm,
+			    struct str text,
+			    uint64_t version,
+			    int index);
+
+#endif /* RENDER_METRICS_H */
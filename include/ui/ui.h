@@ -8,9 +8,13 @@
 
 #include <ui/ui_button.h>
 #include <ui/ui_ctx.h>
+#include <ui/ui_highlight.h>
 #include <ui/ui_input.h>
 #include <ui/ui_label.h>
 #include <ui/ui_menu_ast.h>
+#include <ui/ui_menu_outline.h>
+#include <ui/ui_menu_search.h>
+#include <ui/ui_menu_stats.h>
 #include <ui/ui_panel.h>
 #include <ui/ui_types.h>
 
@@ -11,6 +11,7 @@
 #include <stdint.h>
 
 #include <core/str.h>
+#include <render/render_metrics.h>
 #include <ui/ui_types.h>
 
 #define AVY_MAX_MATCHES 256
@@ -42,24 +43,35 @@ void avy_init(struct avy_state *avy);
 void avy_start(struct avy_state *avy, enum avy_direction dir);
 void avy_cancel(struct avy_state *avy);
 
-/* Takes lines array directly instead of buffer */
+/*
+ * Takes the visible lines directly instead of buffer: lines[i] is the
+ * text of buffer line line_nums[i], in ascending order. Folds may
+ * leave gaps between the numbers.
+ */
 void avy_set_char(struct avy_state *avy,
 		  char c,
 		  const struct str *lines,
-		  int line_count,
-		  int cursor_line,
-		  int first_visible,
-		  int last_visible);
+		  const int *line_nums,
+		  int count,
+		  int cursor_line);
 
 bool avy_input_hint(struct avy_state *avy, char c);
 struct avy_match *avy_get_selected(struct avy_state *avy);
 
+/*
+ * line_y_positions, line_texts and line_nums describe the visible
+ * lines other than the cursor line, top to bottom. Hints are placed
+ * with lm, so version must identify the storage of line_texts
+ * (buffer_version).
+ */
 void avy_draw_hints(struct ui_ctx *ctx,
 		    struct avy_state *avy,
+		    struct line_metrics *lm,
+		    uint64_t version,
 		    int *line_y_positions,
+		    const struct str *line_texts,
+		    const int *line_nums,
 		    int line_count,
-		    int first_visible_line,
-		    int cursor_line,
 		    int padding_x);
 
 #endif /* UI_AVY_H */
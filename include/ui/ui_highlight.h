@@ -0,0 +1,30 @@
+/* include/ui/ui_highlight.h
+ *
+ * Syntax-colored text line.
+ */
+
+#ifndef UI_HIGHLIGHT_H
+#define UI_HIGHLIGHT_H
+
+#include <core/str.h>
+#include <editor/syntax.h>
+#include <render/render_metrics.h>
+#include <ui/ui_types.h>
+
+/* Text color for style; SYNTAX_STYLE_NONE is fg_secondary */
+uint32_t ui_highlight_color(struct ui_ctx *ctx, enum syntax_style style);
+
+/*
+ * Draw line at (x, y) with each span in its style's color and the rest
+ * in fg_secondary. Span offsets are placed through lm; version is the
+ * line's, as for line_metrics_index_to_x.
+ */
+void ui_highlight_draw(struct ui_ctx *ctx,
+		       struct line_metrics *lm,
+		       uint64_t version,
+		       int x,
+		       int y,
+		       struct str line,
+		       const struct syntax_line_spans *spans);
+
+#endif /* UI_HIGHLIGHT_H */
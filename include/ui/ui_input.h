@@ -18,6 +18,7 @@ struct ui_input {
 	int len;
 	int cursor;
 	int scroll_offset;
+	uint64_t version; /* Changes whenever buf does */
 };
 
 void ui_input_init(struct ui_input *input);
@@ -0,0 +1,23 @@
+/* include/ui/ui_menu_outline.h
+ *
+ * Heading outline menu.
+ */
+
+#ifndef UI_MENU_OUTLINE_H
+#define UI_MENU_OUTLINE_H
+
+#include <editor/outline.h>
+#include <editor/snapshot.h>
+#include <ui/ui_types.h>
+
+/*
+ * Draw the headings around the one enclosing cursor_row, indented by
+ * level, titles read from snap. Only the rows that fit are visited.
+ */
+void menu_outline_draw(struct ui_ctx *ctx,
+		       ui_rect rect,
+		       const struct outline *outline,
+		       struct snapshot *snap,
+		       int cursor_row);
+
+#endif /* UI_MENU_OUTLINE_H */
@@ -0,0 +1,19 @@
+/* include/ui/ui_menu_search.h
+ *
+ * Incremental search menu.
+ */
+
+#ifndef UI_MENU_SEARCH_H
+#define UI_MENU_SEARCH_H
+
+#include <stdbool.h>
+
+#include <editor/search.h>
+#include <ui/ui_types.h>
+
+void menu_search_draw(struct ui_ctx *ctx,
+		      ui_rect rect,
+		      const struct search *search,
+		      bool found);
+
+#endif /* UI_MENU_SEARCH_H */
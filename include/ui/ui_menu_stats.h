@@ -0,0 +1,16 @@
+/* include/ui/ui_menu_stats.h
+ *
+ * Syntax performance counters panel.
+ */
+
+#ifndef UI_MENU_STATS_H
+#define UI_MENU_STATS_H
+
+#include <editor/syntax.h>
+#include <ui/ui_types.h>
+
+void menu_stats_draw(struct ui_ctx *ctx,
+		     ui_rect rect,
+		     const struct syntax_stats *stats);
+
+#endif /* UI_MENU_STATS_H */
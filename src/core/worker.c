@@ -0,0 +1,138 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <core/error.h>
+#include <core/memory.h>
+#include <core/worker.h>
+#include <pthread.h>
+
+struct worker {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	worker_fn run;
+	worker_free_fn free_job;
+	void (*notify)(void *);
+	void *notify_arg;
+
+	/* Guarded by lock */
+	void *pending;
+	bool quit;
+
+	int cancel; /* Atomic, read by the running job */
+};
+
+static void
+drop_pending(struct worker *w)
+{
+	if (w->pending && w->free_job)
+		w->free_job(w->pending);
+	w->pending = NULL;
+}
+
+static void *
+worker_main(void *arg)
+{
+	struct worker *w = arg;
+	void *job;
+
+	pthread_mutex_lock(&w->lock);
+	for (;;) {
+		while (!w->pending && !w->quit)
+			pthread_cond_wait(&w->cond, &w->lock);
+		if (w->quit)
+			break;
+
+		job = w->pending;
+		w->pending = NULL;
+		__atomic_store_n(&w->cancel, 0, __ATOMIC_RELEASE);
+		pthread_mutex_unlock(&w->lock);
+
+		w->run(w, job);
+		if (w->free_job)
+			w->free_job(job);
+
+		pthread_mutex_lock(&w->lock);
+	}
+	pthread_mutex_unlock(&w->lock);
+	return NULL;
+}
+
+struct worker *
+worker_create(worker_fn run,
+	      worker_free_fn free_job,
+	      void (*notify)(void *),
+	      void *notify_arg)
+{
+	struct worker *w;
+
+	w = xcalloc(1, sizeof(*w));
+	w->run = run;
+	w->free_job = free_job;
+	w->notify = notify;
+	w->notify_arg = notify_arg;
+
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_cond_init(&w->cond, NULL);
+	if (pthread_create(&w->thread, NULL, worker_main, w) != 0)
+		die("worker: pthread_create failed");
+	return w;
+}
+
+void
+worker_destroy(struct worker *w)
+{
+	if (!w)
+		return;
+
+	pthread_mutex_lock(&w->lock);
+	w->quit = true;
+	drop_pending(w);
+	__atomic_store_n(&w->cancel, 1, __ATOMIC_RELEASE);
+	pthread_cond_signal(&w->cond);
+	pthread_mutex_unlock(&w->lock);
+
+	pthread_join(w->thread, NULL);
+	pthread_cond_destroy(&w->cond);
+	pthread_mutex_destroy(&w->lock);
+	xfree(w);
+}
+
+void
+worker_submit(struct worker *w, void *job)
+{
+	pthread_mutex_lock(&w->lock);
+	drop_pending(w);
+	w->pending = job;
+	__atomic_store_n(&w->cancel, 1, __ATOMIC_RELEASE);
+	pthread_cond_signal(&w->cond);
+	pthread_mutex_unlock(&w->lock);
+}
+
+void
+worker_cancel(struct worker *w)
+{
+	pthread_mutex_lock(&w->lock);
+	drop_pending(w);
+	__atomic_store_n(&w->cancel, 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&w->lock);
+}
+
+bool
+worker_cancelled(struct worker *w)
+{
+	return __atomic_load_n(&w->cancel, __ATOMIC_ACQUIRE) != 0;
+}
+
+const int *
+worker_cancel_flag(struct worker *w)
+{
+	return &w->cancel;
+}
+
+void
+worker_notify(struct worker *w)
+{
+	if (w->notify)
+		w->notify(w->notify_arg);
+}
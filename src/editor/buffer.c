@@ -2,19 +2,16 @@
 
 #include <string.h>
 
-#include <core/afile.h>
 #include <core/arena.h>
 
-#define INITIAL_LINE_CAP 256
-
 void
 buffer_init(struct buffer *buf)
 {
 	arena_init(&buf->arena);
+	buf->snap = NULL;
 	buf->text = STR_EMPTY;
-	buf->lines = NULL;
+	buf->text_version = 0;
 	buf->line_count = 0;
-	buf->line_cap = 0;
 	buf->cursor_line = 0;
 	buf->path[0] = '\0';
 }
@@ -22,11 +19,12 @@ buffer_init(struct buffer *buf)
 void
 buffer_destroy(struct buffer *buf)
 {
+	snapshot_release(buf->snap);
 	arena_destroy(&buf->arena);
+	buf->snap = NULL;
 	buf->text = STR_EMPTY;
-	buf->lines = NULL;
+	buf->text_version = 0;
 	buf->line_count = 0;
-	buf->line_cap = 0;
 	buf->cursor_line = 0;
 	buf->path[0] = '\0';
 }
@@ -34,63 +32,55 @@ buffer_destroy(struct buffer *buf)
 bool
 buffer_load(struct buffer *buf, const char *path)
 {
-	struct str full;
-	int i, line_start;
-	int newline_count;
+	struct snapshot *snap;
+	int error;
 
-	/* Clear previous content */
-	arena_reset(
-	    &buf->arena); // or arena_destroy+arena_init, but reset is better
-	buf->text = STR_EMPTY;
-	buf->lines = NULL;
-	buf->line_count = 0;
-	buf->line_cap = 0;
-	buf->cursor_line = 0;
-
-	struct afile_result file_content = afile_read(&buf->arena, path);
-	if (file_content.error > 0)
+	snap = snapshot_load(path, &error);
+	if (!snap)
 		return false;
+	buffer_adopt(buf, path, snap);
+	return true;
+}
 
-	buf->text = file_content.content;
-	full = buf->text;
-
-	newline_count = 0;
-	for (i = 0; i < full.len; i++)
-		if (full.data[i] == '\n')
-			newline_count++;
-
-	buf->line_cap = newline_count + 1;
-
-	/* allocate from arena, not heap */
-	buf->lines = arena_array(&buf->arena, struct str, buf->line_cap);
-
-	line_start = 0;
-	buf->line_count = 0;
-	for (i = 0; i <= full.len; i++) {
-		if (i == full.len || full.data[i] == '\n') {
-			buf->lines[buf->line_count++] = str_from_parts(
-			    full.data + line_start, i - line_start);
-			line_start = i + 1;
-		}
-	}
+void
+buffer_adopt(struct buffer *buf, const char *path, struct snapshot *snap)
+{
+	/* Clear previous content */
+	snapshot_release(buf->snap);
+	arena_reset(&buf->arena);
+	buf->snap = snap;
+	buf->text = snapshot_base_text(snap);
+	buf->text_version = snapshot_version(snap);
+	buf->line_count = snapshot_line_count(snap);
+	buf->cursor_line = 0;
 
 	strncpy(buf->path, path, BUFFER_PATH_MAX - 1);
 	buf->path[BUFFER_PATH_MAX - 1] = '\0';
-	return true;
 }
 
 struct str
 buffer_get_text(struct buffer *buf)
 {
+	long len;
+	char *p;
+
+	if (!buf->snap || buf->text_version == snapshot_version(buf->snap))
+		return buf->text;
+
+	/* Edited since last call: flatten once per version */
+	arena_reset(&buf->arena);
+	len = snapshot_text_len(buf->snap);
+	p = arena_alloc(&buf->arena, (size_t)len + 1, 1);
+	snapshot_flatten(buf->snap, p);
+	buf->text = (struct str){p, (int)len};
+	buf->text_version = snapshot_version(buf->snap);
 	return buf->text;
 }
 
 struct str
 buffer_get_line(struct buffer *buf, int line_num)
 {
-	if (line_num < 0 || line_num >= buf->line_count)
-		return STR_EMPTY;
-	return buf->lines[line_num];
+	return snapshot_get_line(buf->snap, line_num);
 }
 
 struct str
@@ -99,6 +89,78 @@ buffer_get_current_line(struct buffer *buf)
 	return buffer_get_line(buf, buf->cursor_line);
 }
 
+bool
+buffer_replace_line(struct buffer *buf, int line_num, struct str text)
+{
+	struct snapshot *next;
+
+	next = snapshot_replace_line(buf->snap, line_num, text);
+	if (!next)
+		return false;
+
+	/* Readers holding the old snapshot keep it alive */
+	snapshot_release(buf->snap);
+	buf->snap = next;
+	return true;
+}
+
+struct snapshot *
+buffer_snapshot(struct buffer *buf)
+{
+	return snapshot_retain(buf->snap);
+}
+
+uint64_t
+buffer_version(struct buffer *buf)
+{
+	return snapshot_version(buf->snap);
+}
+
+bool
+buffer_is_current(struct buffer *buf, uint64_t version)
+{
+	return buf->snap && snapshot_version(buf->snap) == version;
+}
+
+struct buffer_pos
+buffer_offset_to_pos(struct buffer *buf, long offset)
+{
+	struct buffer_pos pos;
+
+	pos.line = snapshot_offset_line(buf->snap, offset);
+	pos.col = (int)(offset - snapshot_line_offset(buf->snap, pos.line));
+	if (pos.col < 0)
+		pos.col = 0;
+	return pos;
+}
+
+long
+buffer_pos_to_offset(struct buffer *buf, struct buffer_pos pos)
+{
+	return snapshot_line_offset(buf->snap, pos.line) + pos.col;
+}
+
+void
+buffer_offsets_to_pos(struct buffer *buf,
+		      const long *offsets,
+		      struct buffer_pos *out,
+		      int n)
+{
+	struct arena_mark m = arena_mark(&buf->arena);
+	int *lines = arena_array(&buf->arena, int, n);
+	long start = 0;
+	int i;
+
+	snapshot_offsets_lines(buf->snap, offsets, lines, n);
+	for (i = 0; i < n; i++) {
+		if (i == 0 || lines[i] != lines[i - 1])
+			start = snapshot_line_offset(buf->snap, lines[i]);
+		out[i].line = lines[i];
+		out[i].col = (int)(offsets[i] - start);
+	}
+	arena_pop(&buf->arena, m);
+}
+
 void
 buffer_move_down(struct buffer *buf, int n)
 {
@@ -0,0 +1,311 @@
+#include <editor/decor.h>
+
+#include <string.h>
+
+#include <core/memory.h>
+
+#define NIL (-1)
+
+/*
+ * Treap node. start, end and max_end are exact once every ancestor's
+ * pending shift has been pushed down; shift applies to the subtrees.
+ */
+struct decor_node {
+	struct decor d;
+	long max_end;
+	long shift; /* Pending for both kids */
+	uint32_t prio;
+	int left;
+	int right;
+};
+
+/* ============================================================
+ * NODE POOL
+ * ============================================================ */
+
+static int
+node_alloc(struct decor_tree *t, struct decor d)
+{
+	struct decor_node *n;
+	int id;
+
+	if (t->free_list != NIL) {
+		id = t->free_list;
+		t->free_list = t->nodes[id].left;
+	} else {
+		if (t->count == t->cap) {
+			t->cap = t->cap ? t->cap * 2 : 64;
+			t->nodes = xrealloc(
+			    t->nodes, (size_t)t->cap * sizeof(*t->nodes));
+		}
+		id = t->count++;
+	}
+
+	/* xorshift32 */
+	t->seed ^= t->seed << 13;
+	t->seed ^= t->seed >> 17;
+	t->seed ^= t->seed << 5;
+
+	n = &t->nodes[id];
+	n->d = d;
+	n->max_end = d.end;
+	n->shift = 0;
+	n->prio = t->seed;
+	n->left = NIL;
+	n->right = NIL;
+	return id;
+}
+
+static void
+node_free(struct decor_tree *t, int id)
+{
+	t->nodes[id].left = t->free_list;
+	t->free_list = id;
+}
+
+/* ============================================================
+ * TREAP
+ * ============================================================ */
+
+static void
+apply_shift(struct decor_tree *t, int id, long d)
+{
+	struct decor_node *n;
+
+	if (id == NIL || d == 0)
+		return;
+	n = &t->nodes[id];
+	n->d.start += d;
+	n->d.end += d;
+	n->max_end += d;
+	n->shift += d;
+}
+
+static void
+push(struct decor_tree *t, int id)
+{
+	struct decor_node *n = &t->nodes[id];
+
+	if (n->shift == 0)
+		return;
+	apply_shift(t, n->left, n->shift);
+	apply_shift(t, n->right, n->shift);
+	n->shift = 0;
+}
+
+static void
+pull(struct decor_tree *t, int id)
+{
+	struct decor_node *n = &t->nodes[id];
+
+	n->max_end = n->d.end;
+	if (n->left != NIL && t->nodes[n->left].max_end > n->max_end)
+		n->max_end = t->nodes[n->left].max_end;
+	if (n->right != NIL && t->nodes[n->right].max_end > n->max_end)
+		n->max_end = t->nodes[n->right].max_end;
+}
+
+/* Split into starts < key and starts >= key */
+static void
+split(struct decor_tree *t, int id, long key, int *l, int *r)
+{
+	struct decor_node *n;
+
+	if (id == NIL) {
+		*l = *r = NIL;
+		return;
+	}
+	push(t, id);
+	n = &t->nodes[id];
+	if (n->d.start < key) {
+		split(t, n->right, key, &n->right, r);
+		*l = id;
+	} else {
+		split(t, n->left, key, l, &n->left);
+		*r = id;
+	}
+	pull(t, id);
+}
+
+static int
+merge(struct decor_tree *t, int l, int r)
+{
+	if (l == NIL)
+		return r;
+	if (r == NIL)
+		return l;
+
+	if (t->nodes[l].prio > t->nodes[r].prio) {
+		push(t, l);
+		t->nodes[l].right = merge(t, t->nodes[l].right, r);
+		pull(t, l);
+		return l;
+	}
+	push(t, r);
+	t->nodes[r].left = merge(t, l, t->nodes[r].left);
+	pull(t, r);
+	return r;
+}
+
+/*
+ * Clamp ranges ending past pos into [pos, limit] after the bytes
+ * [pos, cut) were replaced by [pos, limit). Every start in this
+ * subtree is below cut, so order is preserved.
+ */
+static void
+clamp(struct decor_tree *t, int id, long pos, long cut, long limit)
+{
+	struct decor_node *n;
+	long d = limit - cut;
+
+	if (id == NIL || t->nodes[id].max_end <= pos)
+		return;
+
+	push(t, id);
+	n = &t->nodes[id];
+	if (n->d.start > limit)
+		n->d.start = limit;
+	if (n->d.end >= cut)
+		n->d.end += d;
+	else if (n->d.end > limit)
+		n->d.end = limit;
+
+	clamp(t, n->left, pos, cut, limit);
+	clamp(t, n->right, pos, cut, limit);
+	pull(t, id);
+}
+
+static void
+collect(struct decor_tree *t,
+	int id,
+	long lo,
+	long hi,
+	struct decor *out,
+	int *count)
+{
+	struct decor_node *n;
+
+	if (id == NIL || t->nodes[id].max_end < lo)
+		return;
+
+	push(t, id);
+	n = &t->nodes[id];
+	collect(t, n->left, lo, hi, out, count);
+	if (n->d.start >= hi)
+		return; /* Right subtree starts even later */
+	if (n->d.end > lo || (n->d.end == n->d.start && n->d.start >= lo)) {
+		if (out)
+			out[*count] = n->d;
+		(*count)++;
+	}
+	collect(t, n->right, lo, hi, out, count);
+}
+
+/* Free nodes of kind, appending survivors to keep in order */
+static void
+drain(struct decor_tree *t, int id, enum decor_kind kind, int *keep, int *n)
+{
+	int left, right;
+
+	if (id == NIL)
+		return;
+	push(t, id);
+	left = t->nodes[id].left;
+	right = t->nodes[id].right;
+
+	drain(t, left, kind, keep, n);
+	if (t->nodes[id].d.kind == kind) {
+		node_free(t, id);
+	} else {
+		t->nodes[id].left = t->nodes[id].right = NIL;
+		pull(t, id);
+		keep[(*n)++] = id;
+	}
+	drain(t, right, kind, keep, n);
+}
+
+/* ============================================================
+ * PUBLIC API
+ * ============================================================ */
+
+void
+decor_init(struct decor_tree *t)
+{
+	memset(t, 0, sizeof(*t));
+	t->free_list = NIL;
+	t->root = NIL;
+	t->seed = 2463534242u;
+}
+
+void
+decor_destroy(struct decor_tree *t)
+{
+	xfree(t->nodes);
+	memset(t, 0, sizeof(*t));
+	t->free_list = NIL;
+	t->root = NIL;
+}
+
+void
+decor_add(struct decor_tree *t, struct decor d)
+{
+	int l, r, id;
+
+	if (d.end < d.start)
+		d.end = d.start;
+
+	id = node_alloc(t, d);
+	split(t, t->root, d.start, &l, &r);
+	t->root = merge(t, merge(t, l, id), r);
+	t->size++;
+}
+
+void
+decor_clear(struct decor_tree *t, enum decor_kind kind)
+{
+	int *keep, i, n = 0;
+
+	if (t->size == 0)
+		return;
+
+	/* Survivors come out sorted: merging them in order rebuilds */
+	keep = xmalloc((size_t)t->size * sizeof(*keep));
+	drain(t, t->root, kind, keep, &n);
+	t->root = NIL;
+	for (i = 0; i < n; i++)
+		t->root = merge(t, t->root, keep[i]);
+	t->size = n;
+	xfree(keep);
+}
+
+void
+decor_edit(struct decor_tree *t, long pos, long old_len, long new_len)
+{
+	long cut = pos + old_len;
+	int l, r;
+
+	if (old_len == new_len)
+		return;
+
+	split(t, t->root, cut, &l, &r);
+	apply_shift(t, r, new_len - old_len);
+	clamp(t, l, pos, cut, pos + new_len);
+	t->root = merge(t, l, r);
+}
+
+int
+decor_query(struct decor_tree *t,
+	    long lo,
+	    long hi,
+	    struct arena *a,
+	    struct decor **out)
+{
+	int count = 0;
+
+	/* Count, then copy: keeps the result one exact allocation */
+	collect(t, t->root, lo, hi, NULL, &count);
+	*out = arena_array(a, struct decor, count ? count : 1);
+	count = 0;
+	collect(t, t->root, lo, hi, *out, &count);
+	return count;
+}
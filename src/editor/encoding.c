@@ -0,0 +1,358 @@
+#include <editor/encoding.h>
+
+#include <stdint.h>
+#include <string.h>
+
+/* Per-byte masks in memory order, so the word tests are endian-free */
+static const unsigned char ascii8[8] = {
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80};
+static const unsigned char ascii16le[8] = {
+    0x80, 0xFF, 0x80, 0xFF, 0x80, 0xFF, 0x80, 0xFF};
+static const unsigned char ascii16be[8] = {
+    0xFF, 0x80, 0xFF, 0x80, 0xFF, 0x80, 0xFF, 0x80};
+
+static uint64_t
+load64(const void *p)
+{
+	uint64_t w;
+
+	memcpy(&w, p, sizeof(w));
+	return w;
+}
+
+static char *
+put_utf8(unsigned cp, char *out)
+{
+	if (cp < 0x80) {
+		*out++ = (char)cp;
+	} else if (cp < 0x800) {
+		*out++ = (char)(0xC0 | (cp >> 6));
+		*out++ = (char)(0x80 | (cp & 0x3F));
+	} else if (cp < 0x10000) {
+		*out++ = (char)(0xE0 | (cp >> 12));
+		*out++ = (char)(0x80 | ((cp >> 6) & 0x3F));
+		*out++ = (char)(0x80 | (cp & 0x3F));
+	} else {
+		*out++ = (char)(0xF0 | (cp >> 18));
+		*out++ = (char)(0x80 | ((cp >> 12) & 0x3F));
+		*out++ = (char)(0x80 | ((cp >> 6) & 0x3F));
+		*out++ = (char)(0x80 | (cp & 0x3F));
+	}
+	return out;
+}
+
+/* ============================================================
+ * SNIFFING
+ * ============================================================ */
+
+/*
+ * Check len more bytes of UTF-8. *need holds the continuation bytes
+ * still due from the previous call, so a sequence may span calls; one
+ * cut off by the end of the input is left pending rather than refused.
+ */
+static bool
+utf8_valid(const unsigned char *p, size_t len, unsigned *need)
+{
+	uint64_t ascii = load64(ascii8);
+	size_t i = 0;
+
+	while (i < len) {
+		if (*need > 0) {
+			if ((p[i++] & 0xC0) != 0x80)
+				return false;
+			(*need)--;
+			continue;
+		}
+		if (i + 8 <= len && (load64(p + i) & ascii) == 0) {
+			i += 8;
+			continue;
+		}
+		if (p[i] >= 0xC2 && p[i] <= 0xDF)
+			*need = 1;
+		else if (p[i] >= 0xE0 && p[i] <= 0xEF)
+			*need = 2;
+		else if (p[i] >= 0xF0 && p[i] <= 0xF4)
+			*need = 3;
+		else if (p[i] >= 0x80)
+			return false;
+		i++;
+	}
+	return true;
+}
+
+struct text_format
+text_sniff(const char *data, size_t len)
+{
+	const unsigned char *p = (const unsigned char *)data;
+	struct text_format f = {TEXT_UTF8, false, TEXT_EOL_LF};
+	size_t i, pairs, zero_even = 0, zero_odd = 0;
+	unsigned need = 0;
+
+	if (len > TEXT_SNIFF_LEN)
+		len = TEXT_SNIFF_LEN;
+
+	f.bom = true;
+	if (len >= 3 && p[0] == 0xEF && p[1] == 0xBB && p[2] == 0xBF)
+		return f;
+	f.encoding = TEXT_UTF16LE;
+	if (len >= 2 && p[0] == 0xFF && p[1] == 0xFE)
+		return f;
+	f.encoding = TEXT_UTF16BE;
+	if (len >= 2 && p[0] == 0xFE && p[1] == 0xFF)
+		return f;
+	f.bom = false;
+
+	/* ASCII-heavy UTF-16 has a zero in every other byte */
+	pairs = len / 2;
+	for (i = 0; i + 1 < len; i += 2) {
+		zero_even += p[i] == 0;
+		zero_odd += p[i + 1] == 0;
+	}
+	if (pairs >= 2 && zero_odd * 10 >= pairs * 3 &&
+	    zero_even * 10 < pairs) {
+		f.encoding = TEXT_UTF16LE;
+		return f;
+	}
+	if (pairs >= 2 && zero_even * 10 >= pairs * 3 &&
+	    zero_odd * 10 < pairs) {
+		f.encoding = TEXT_UTF16BE;
+		return f;
+	}
+
+	f.encoding = utf8_valid(p, len, &need) ? TEXT_UTF8 : TEXT_LATIN1;
+	return f;
+}
+
+bool
+text_format_is_plain(struct text_format f)
+{
+	return f.encoding == TEXT_UTF8 && !f.bom && f.eol == TEXT_EOL_LF;
+}
+
+const char *
+text_encoding_name(enum text_encoding e)
+{
+	switch (e) {
+	case TEXT_UTF8:
+		return "UTF-8";
+	case TEXT_UTF16LE:
+		return "UTF-16LE";
+	case TEXT_UTF16BE:
+		return "UTF-16BE";
+	case TEXT_LATIN1:
+		return "Latin-1";
+	}
+	return "?";
+}
+
+size_t
+text_decoded_max(enum text_encoding e, size_t len)
+{
+	switch (e) {
+	case TEXT_UTF8:
+		return len;
+	case TEXT_LATIN1:
+		return len * 2;
+	case TEXT_UTF16LE:
+	case TEXT_UTF16BE:
+		/* 3 bytes per BMP unit, plus U+FFFD for torn leftovers */
+		return len / 2 * 3 + 6;
+	}
+	return len * 3;
+}
+
+/* ============================================================
+ * DECODING
+ * ============================================================ */
+
+void
+text_decoder_init(struct text_decoder *d, struct text_format f)
+{
+	memset(d, 0, sizeof(*d));
+	d->format = f;
+	d->format.eol = TEXT_EOL_LF;
+	if (f.bom)
+		d->bom_left = f.encoding == TEXT_UTF8 ? 3 : 2;
+}
+
+static char *
+decode_latin1(const unsigned char *in, size_t len, char *out)
+{
+	uint64_t ascii = load64(ascii8);
+	size_t i = 0;
+
+	while (i < len) {
+		if (i + 8 <= len && (load64(in + i) & ascii) == 0) {
+			memcpy(out, in + i, 8);
+			out += 8;
+			i += 8;
+			continue;
+		}
+		out = put_utf8(in[i++], out);
+	}
+	return out;
+}
+
+static char *
+put_unit(struct text_decoder *d, unsigned u, char *out)
+{
+	unsigned hi = d->high;
+
+	if (hi) {
+		d->high = 0;
+		if (u >= 0xDC00 && u <= 0xDFFF) {
+			u = 0x10000 + ((hi - 0xD800) << 10) + (u - 0xDC00);
+			return put_utf8(u, out);
+		}
+		out = put_utf8(0xFFFD, out);
+	}
+	if (u >= 0xD800 && u <= 0xDBFF) {
+		d->high = u;
+		return out;
+	}
+	if (u >= 0xDC00 && u <= 0xDFFF)
+		u = 0xFFFD;
+	return put_utf8(u, out);
+}
+
+static char *
+decode_utf16(struct text_decoder *d,
+	     const unsigned char *in,
+	     size_t len,
+	     char *out)
+{
+	bool be = d->format.encoding == TEXT_UTF16BE;
+	uint64_t ascii = load64(be ? ascii16be : ascii16le);
+	size_t i = 0, lo = be ? 1 : 0;
+	unsigned u;
+
+	if (d->has_carry && len > 0) {
+		u = be ? (unsigned)d->carry << 8 | in[0]
+		       : (unsigned)in[0] << 8 | d->carry;
+		d->has_carry = false;
+		out = put_unit(d, u, out);
+		i = 1;
+	}
+
+	while (i + 1 < len) {
+		/* Four ASCII units per step */
+		if (!d->high && i + 8 <= len &&
+		    (load64(in + i) & ascii) == 0) {
+			out[0] = (char)in[i + lo];
+			out[1] = (char)in[i + lo + 2];
+			out[2] = (char)in[i + lo + 4];
+			out[3] = (char)in[i + lo + 6];
+			out += 4;
+			i += 8;
+			continue;
+		}
+		u = be ? (unsigned)in[i] << 8 | in[i + 1]
+		       : (unsigned)in[i + 1] << 8 | in[i];
+		out = put_unit(d, u, out);
+		i += 2;
+	}
+
+	if (i < len) {
+		d->carry = in[i];
+		d->has_carry = true;
+	}
+	return out;
+}
+
+/* Fold CRLF to LF in [start, end), which follows earlier output */
+static char *
+fold_eol(struct text_decoder *d, char *start, char *end)
+{
+	char *r, *w, *next, *nl;
+
+	if (start == end)
+		return end;
+
+	if (!d->eol_known) {
+		nl = memchr(start, '\n', (size_t)(end - start));
+		if (nl) {
+			bool crlf = nl > start ? nl[-1] == '\r' : d->cr_last;
+
+			d->format.eol = crlf ? TEXT_EOL_CRLF : TEXT_EOL_LF;
+			d->eol_known = true;
+		}
+	}
+
+	/* CRLF split between chunks: drop the CR ending the last one */
+	if (d->cr_last && *start == '\n') {
+		memmove(start - 1, start, (size_t)(end - start));
+		start--;
+		end--;
+	}
+
+	r = memchr(start, '\r', (size_t)(end - start));
+	if (!r) {
+		d->cr_last = false;
+		return end;
+	}
+
+	w = r;
+	while (r < end) {
+		if (*r == '\r' && r + 1 < end && r[1] == '\n')
+			r++;
+		next = NULL;
+		if (r + 1 < end)
+			next = memchr(r + 1, '\r', (size_t)(end - r - 1));
+		if (!next)
+			next = end;
+		memmove(w, r, (size_t)(next - r));
+		w += next - r;
+		r = next;
+	}
+	d->cr_last = w[-1] == '\r';
+	return w;
+}
+
+char *
+text_decode(struct text_decoder *d, const char *in, size_t len, char *out)
+{
+	size_t skip = d->bom_left < len ? d->bom_left : len;
+	const unsigned char *p = (const unsigned char *)in + skip;
+	char *end;
+
+	d->bom_left -= skip;
+	len -= skip;
+
+	switch (d->format.encoding) {
+	case TEXT_UTF8:
+		/* Sniffed from the start only: the rest must bear it out */
+		if (!d->format.bom && !utf8_valid(p, len, &d->utf8_need)) {
+			d->format.encoding = TEXT_LATIN1;
+			return NULL;
+		}
+		if ((const char *)p != out)
+			memmove(out, p, len);
+		end = out + len;
+		break;
+	case TEXT_LATIN1:
+		end = decode_latin1(p, len, out);
+		break;
+	default:
+		end = decode_utf16(d, p, len, out);
+		break;
+	}
+	return fold_eol(d, out, end);
+}
+
+char *
+text_decode_finish(struct text_decoder *d, char *out)
+{
+	if (d->utf8_need > 0 && !d->format.bom) {
+		d->format.encoding = TEXT_LATIN1;
+		return NULL;
+	}
+	if (d->high) {
+		out = put_utf8(0xFFFD, out);
+		d->high = 0;
+	}
+	if (d->has_carry) {
+		out = put_utf8(0xFFFD, out);
+		d->has_carry = false;
+	}
+	return out;
+}
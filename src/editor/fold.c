@@ -0,0 +1,248 @@
+#include <editor/fold.h>
+
+#include <string.h>
+
+#include <core/memory.h>
+
+/* ============================================================
+ * SEGMENT TREE
+ * ============================================================ */
+
+/* Node 1 spans leaves [0, size); node n has children 2n and 2n + 1 */
+static void
+pull(struct fold_map *f, int node, int len)
+{
+	int *h = f->hidden;
+
+	if (f->cover[node] > 0)
+		h[node] = len;
+	else if (len == 1)
+		h[node] = 0;
+	else
+		h[node] = h[2 * node] + h[2 * node + 1];
+}
+
+/* Add delta to the cover of lines [a, b] under node, spanning [lo, hi) */
+static void
+cover(struct fold_map *f, int node, int lo, int hi, int a, int b, int delta)
+{
+	int mid = lo + (hi - lo) / 2;
+
+	if (b < lo || a >= hi)
+		return;
+	if (a <= lo && hi - 1 <= b) {
+		f->cover[node] += delta;
+	} else {
+		cover(f, 2 * node, lo, mid, a, b, delta);
+		cover(f, 2 * node + 1, mid, hi, a, b, delta);
+	}
+	pull(f, node, hi - lo);
+}
+
+/* Hidden lines among [0, line) */
+static int
+hidden_before(const struct fold_map *f, int line)
+{
+	int node = 1, lo = 0, hi = f->size, mid, acc = 0;
+
+	if (!f->cover)
+		return 0;
+	while (line > lo) {
+		if (f->cover[node] > 0)
+			return acc + (line < hi ? line : hi) - lo;
+		if (line >= hi)
+			return acc + f->hidden[node];
+		mid = lo + (hi - lo) / 2;
+		if (line <= mid) {
+			node = 2 * node;
+			hi = mid;
+		} else {
+			acc += f->hidden[2 * node];
+			node = 2 * node + 1;
+			lo = mid;
+		}
+	}
+	return acc;
+}
+
+static void
+tree_alloc(struct fold_map *f)
+{
+	f->size = 1;
+	while (f->size < f->line_count)
+		f->size *= 2;
+	f->cover = xcalloc((size_t)f->size * 2, sizeof(*f->cover));
+	f->hidden = xcalloc((size_t)f->size * 2, sizeof(*f->hidden));
+}
+
+/* ============================================================
+ * PUBLIC API
+ * ============================================================ */
+
+void
+fold_init(struct fold_map *f, int line_count)
+{
+	memset(f, 0, sizeof(*f));
+	f->line_count = line_count;
+}
+
+void
+fold_destroy(struct fold_map *f)
+{
+	xfree(f->cover);
+	xfree(f->hidden);
+	xfree(f->folds);
+	memset(f, 0, sizeof(*f));
+}
+
+/* First closed fold starting at or after line */
+static int
+lower_bound(const struct fold_map *f, int line)
+{
+	int lo = 0, hi = f->count, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (f->folds[mid].start < line)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+int
+fold_find(const struct fold_map *f, int line)
+{
+	int i = lower_bound(f, line);
+
+	return i < f->count && f->folds[i].start == line ? i : -1;
+}
+
+bool
+fold_close(struct fold_map *f, struct fold_range r)
+{
+	int i;
+
+	if (r.start < 0)
+		r.start = 0;
+	if (r.end >= f->line_count)
+		r.end = f->line_count - 1;
+	if (r.end <= r.start || fold_find(f, r.start) >= 0)
+		return false;
+	if (!f->cover)
+		tree_alloc(f);
+
+	if (f->count == f->cap) {
+		f->cap = f->cap ? f->cap * 2 : 16;
+		f->folds =
+		    xrealloc(f->folds, (size_t)f->cap * sizeof(*f->folds));
+	}
+	i = lower_bound(f, r.start);
+	memmove(&f->folds[i + 1],
+		&f->folds[i],
+		(size_t)(f->count - i) * sizeof(*f->folds));
+	f->folds[i] = r;
+	f->count++;
+	cover(f, 1, 0, f->size, r.start + 1, r.end, 1);
+	return true;
+}
+
+bool
+fold_open(struct fold_map *f, int line)
+{
+	int i = fold_find(f, line);
+	struct fold_range r;
+
+	if (i < 0)
+		return false;
+	r = f->folds[i];
+	memmove(&f->folds[i],
+		&f->folds[i + 1],
+		(size_t)(f->count - i - 1) * sizeof(*f->folds));
+	f->count--;
+	cover(f, 1, 0, f->size, r.start + 1, r.end, -1);
+	return true;
+}
+
+void
+fold_reveal(struct fold_map *f, int line)
+{
+	int i;
+
+	/* Only folds starting above line can hide it */
+	for (i = lower_bound(f, line) - 1; i >= 0 && fold_hidden(f, line); i--)
+		if (f->folds[i].end >= line)
+			fold_open(f, f->folds[i].start);
+}
+
+bool
+fold_hidden(const struct fold_map *f, int line)
+{
+	int node = 1, lo = 0, hi = f->size, mid;
+
+	if (!f->cover || line < 0 || line >= f->line_count)
+		return false;
+	for (;;) {
+		if (f->cover[node] > 0)
+			return true;
+		if (hi - lo == 1)
+			return false;
+		mid = lo + (hi - lo) / 2;
+		if (line < mid) {
+			node = 2 * node;
+			hi = mid;
+		} else {
+			node = 2 * node + 1;
+			lo = mid;
+		}
+	}
+}
+
+int
+fold_rows(const struct fold_map *f)
+{
+	return f->line_count - (f->cover ? f->hidden[1] : 0);
+}
+
+int
+fold_line_to_row(const struct fold_map *f, int line)
+{
+	int row;
+
+	if (line >= f->line_count)
+		line = f->line_count - 1;
+	if (line <= 0)
+		return 0;
+	row = line - hidden_before(f, line);
+	return fold_hidden(f, line) ? row - 1 : row;
+}
+
+int
+fold_row_to_line(const struct fold_map *f, int row)
+{
+	int node = 1, lo = 0, hi = f->size, mid, left;
+	int rows = fold_rows(f);
+
+	if (row >= rows)
+		row = rows - 1;
+	if (row < 0)
+		row = 0;
+	if (!f->cover)
+		return row;
+
+	/* Padding leaves past line_count are never reached: row is less */
+	while (hi - lo > 1) {
+		mid = lo + (hi - lo) / 2;
+		left = (mid - lo) - f->hidden[2 * node];
+		if (row < left) {
+			node = 2 * node;
+			hi = mid;
+		} else {
+			row -= left;
+			node = 2 * node + 1;
+			lo = mid;
+		}
+	}
+	return lo;
+}
@@ -0,0 +1,207 @@
+#include <editor/highlight.h>
+
+#include <string.h>
+
+#include <core/arena.h>
+#include <core/memory.h>
+
+#define TABLE_SIZE (2 * HIGHLIGHT_CACHE_ROWS) /* Power of two */
+#define NO_ROW	   UINT32_MAX
+
+struct entry {
+	uint32_t row; /* NO_ROW when the slot is free */
+	int count; /* -1 once dropped; the slot keeps its row */
+	struct syntax_span *spans;
+};
+
+struct highlight_cache {
+	struct arena arena; /* Spans of every row cached since the clear */
+	struct entry *table;
+	int rows; /* Slots holding a row, dropped or not */
+	size_t bytes; /* Spans allocated from arena */
+	uint32_t edit_first; /* Rows edited since the last update */
+	uint32_t edit_last; /* edit_first > edit_last when there are none */
+	uint64_t misses;
+};
+
+/* ============================================================
+ * TABLE
+ * ============================================================ */
+
+/* Slot holding row, or the free slot it would go in */
+static struct entry *
+find(struct highlight_cache *hc, uint32_t row)
+{
+	uint32_t i = (row * 2654435769u) & (TABLE_SIZE - 1);
+
+	while (hc->table[i].row != row && hc->table[i].row != NO_ROW)
+		i = (i + 1) & (TABLE_SIZE - 1);
+	return &hc->table[i];
+}
+
+static bool
+cached(struct highlight_cache *hc, uint32_t row)
+{
+	struct entry *e = find(hc, row);
+
+	return e->row == row && e->count >= 0;
+}
+
+static void
+store(struct highlight_cache *hc, uint32_t row, struct syntax_line_spans l)
+{
+	struct entry *e = find(hc, row);
+
+	if (e->row == NO_ROW) {
+		e->row = row;
+		hc->rows++;
+	}
+	e->count = l.count;
+	e->spans = l.spans;
+	hc->bytes += (size_t)l.count * sizeof(*l.spans);
+}
+
+static void
+drop(struct highlight_cache *hc, uint32_t first, uint32_t last)
+{
+	struct entry *e;
+	uint32_t row;
+	int i;
+
+	if (first > last || hc->rows == 0)
+		return;
+
+	/* Probe row by row unless there are more rows than entries */
+	if (last - first < (uint32_t)hc->rows) {
+		for (row = first; row <= last; row++) {
+			e = find(hc, row);
+			if (e->row == row)
+				e->count = -1;
+		}
+		return;
+	}
+	for (i = 0; i < TABLE_SIZE; i++) {
+		e = &hc->table[i];
+		if (e->row != NO_ROW && e->row >= first && e->row <= last)
+			e->count = -1;
+	}
+}
+
+/* ============================================================
+ * PUBLIC API
+ * ============================================================ */
+
+struct highlight_cache *
+highlight_cache_create(void)
+{
+	struct highlight_cache *hc = xcalloc(1, sizeof(*hc));
+
+	arena_init(&hc->arena);
+	hc->table = xmalloc(TABLE_SIZE * sizeof(*hc->table));
+	hc->edit_first = NO_ROW;
+	highlight_cache_clear(hc);
+	return hc;
+}
+
+void
+highlight_cache_destroy(struct highlight_cache *hc)
+{
+	if (!hc)
+		return;
+	arena_destroy(&hc->arena);
+	xfree(hc->table);
+	xfree(hc);
+}
+
+void
+highlight_cache_clear(struct highlight_cache *hc)
+{
+	int i;
+
+	arena_reset(&hc->arena);
+	for (i = 0; i < TABLE_SIZE; i++)
+		hc->table[i].row = NO_ROW;
+	hc->rows = 0;
+	hc->bytes = 0;
+}
+
+void
+highlight_cache_get(struct highlight_cache *hc,
+		    struct syntax_ctx *ctx,
+		    uint32_t first_row,
+		    uint32_t last_row,
+		    struct syntax_line_spans *out)
+{
+	uint32_t row, end, r, n = last_row - first_row + 1;
+	struct entry *e;
+
+	if (last_row < first_row)
+		return;
+	if (!syntax_has_tree(ctx)) {
+		memset(out, 0, n * sizeof(*out));
+		return;
+	}
+
+	/* Start over rather than grow; the rows asked for must all fit */
+	if (hc->rows + n > HIGHLIGHT_CACHE_ROWS ||
+	    hc->bytes > HIGHLIGHT_CACHE_BYTES)
+		highlight_cache_clear(hc);
+	if (n > HIGHLIGHT_CACHE_ROWS) {
+		hc->misses += n;
+		syntax_highlight(ctx, first_row, last_row, &hc->arena, out);
+		return;
+	}
+
+	for (row = first_row; row <= last_row; row = end + 1) {
+		e = find(hc, row);
+		if (e->row == row && e->count >= 0) {
+			out[row - first_row].spans = e->spans;
+			out[row - first_row].count = e->count;
+			end = row;
+			continue;
+		}
+
+		/* One query for the whole run of rows missing */
+		for (end = row; end < last_row && !cached(hc, end + 1); end++)
+			;
+		syntax_highlight(
+		    ctx, row, end, &hc->arena, &out[row - first_row]);
+		hc->misses += end - row + 1;
+		for (r = row; r <= end; r++)
+			store(hc, r, out[r - first_row]);
+	}
+}
+
+void
+highlight_cache_edit(struct highlight_cache *hc, uint32_t row)
+{
+	drop(hc, row, row);
+	if (hc->edit_first > hc->edit_last) {
+		hc->edit_first = row;
+		hc->edit_last = row;
+	} else if (row < hc->edit_first) {
+		hc->edit_first = row;
+	} else if (row > hc->edit_last) {
+		hc->edit_last = row;
+	}
+}
+
+void
+highlight_cache_update(struct highlight_cache *hc,
+		       const struct syntax_range *ranges,
+		       int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+		drop(hc, ranges[i].start.row, ranges[i].end.row);
+	drop(hc, hc->edit_first, hc->edit_last);
+	hc->edit_first = NO_ROW;
+	hc->edit_last = 0;
+}
+
+uint64_t
+highlight_cache_misses(const struct highlight_cache *hc)
+{
+	return hc->misses;
+}
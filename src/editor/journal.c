@@ -0,0 +1,415 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <editor/journal.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <core/afile.h>
+#include <core/arena.h>
+#include <core/error.h>
+#include <core/memory.h>
+
+#define JOURNAL_MAGIC "WLJRNL01"
+#define RECORD_HEAD   8 /* u32 line, u32 len */
+#define RECORD_TAIL   4 /* u32 checksum */
+
+struct journal_header {
+	char magic[8];
+	uint64_t doc_size;
+	int64_t doc_mtime_sec;
+	int64_t doc_mtime_nsec;
+};
+
+struct jbuf {
+	char *data;
+	size_t len;
+	size_t cap;
+};
+
+struct journal {
+	int fd;
+	int latency_ms;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wake; /* Flusher: records pending, sync, or quit */
+	pthread_cond_t done; /* Syncers: durable advanced */
+
+	/* Guarded by lock */
+	struct jbuf pending;  /* Appended, not yet handed to write() */
+	struct jbuf flushing; /* Owned by the flusher while unlocked */
+	struct timespec first_pending; /* When pending became non-empty */
+	uint64_t appended; /* Records appended */
+	uint64_t durable;  /* Records known to be on disk */
+	uint64_t fsyncs;
+	bool urgent; /* A syncer is waiting: skip the latency window */
+	bool quit;
+	int error;
+};
+
+/* ============================================================
+ * FORMAT
+ * ============================================================ */
+
+static uint32_t
+fnv1a(uint32_t h, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		h = (h ^ p[i]) * 16777619u;
+	return h;
+}
+
+static uint32_t
+record_sum(const char *head, const char *text, uint32_t len)
+{
+	return fnv1a(fnv1a(2166136261u, head, RECORD_HEAD), text, len);
+}
+
+static bool
+header_for(const char *doc_path, struct journal_header *h)
+{
+	struct stat st;
+
+	if (stat(doc_path, &st) != 0)
+		return false;
+	memset(h, 0, sizeof(*h));
+	memcpy(h->magic, JOURNAL_MAGIC, sizeof(h->magic));
+	h->doc_size = (uint64_t)st.st_size;
+	h->doc_mtime_sec = (int64_t)st.st_mtim.tv_sec;
+	h->doc_mtime_nsec = (int64_t)st.st_mtim.tv_nsec;
+	return true;
+}
+
+/* a is not older than b */
+static bool
+mtime_not_before(const struct stat *a, const struct stat *b)
+{
+	if (a->st_mtim.tv_sec != b->st_mtim.tv_sec)
+		return a->st_mtim.tv_sec > b->st_mtim.tv_sec;
+	return a->st_mtim.tv_nsec >= b->st_mtim.tv_nsec;
+}
+
+/*
+ * Walk the journal for doc_path, calling fn (if any) per record.
+ * Returns the record count, or -1 if there is no journal valid for
+ * the document. *end is the offset just past the last good record.
+ */
+static int
+scan(const char *doc_path,
+     const char *path,
+     void (*fn)(int line, struct str text, void *arg),
+     void *arg,
+     long *end)
+{
+	struct journal_header want;
+	struct stat doc_st, j_st;
+	struct afile_result fr;
+	struct arena a;
+	const char *p, *limit;
+	uint32_t line, len, sum;
+	int count = 0;
+
+	*end = 0;
+	if (stat(doc_path, &doc_st) != 0 || stat(path, &j_st) != 0)
+		return -1;
+	if (!mtime_not_before(&j_st, &doc_st) || !header_for(doc_path, &want))
+		return -1;
+
+	arena_init(&a);
+	fr = afile_read(&a, path);
+	if (fr.error || fr.content.len < (int)sizeof(want) ||
+	    memcmp(fr.content.data, &want, sizeof(want)) != 0) {
+		arena_destroy(&a);
+		return -1;
+	}
+
+	p = fr.content.data + sizeof(want);
+	limit = fr.content.data + fr.content.len;
+	while (limit - p >= RECORD_HEAD + RECORD_TAIL) {
+		memcpy(&line, p, 4);
+		memcpy(&len, p + 4, 4);
+		if ((size_t)(limit - p) <
+		    RECORD_HEAD + (size_t)len + RECORD_TAIL)
+			break; /* Torn write */
+		memcpy(&sum, p + RECORD_HEAD + len, 4);
+		if (sum != record_sum(p, p + RECORD_HEAD, len))
+			break;
+
+		if (fn)
+			fn((int)line,
+			   str_from_parts(p + RECORD_HEAD, (int)len),
+			   arg);
+		count++;
+		p += RECORD_HEAD + len + RECORD_TAIL;
+	}
+
+	*end = (long)(p - fr.content.data);
+	arena_destroy(&a);
+	return count;
+}
+
+bool
+journal_path(const char *doc_path, char *out, size_t size)
+{
+	const char *slash = strrchr(doc_path, '/');
+	int dir_len = slash ? (int)(slash - doc_path) + 1 : 0;
+	int n;
+
+	n = snprintf(out,
+		     size,
+		     "%.*s.%s.journal",
+		     dir_len,
+		     doc_path,
+		     doc_path + dir_len);
+	return n > 0 && (size_t)n < size;
+}
+
+int
+journal_replay(const char *doc_path,
+	       void (*fn)(int line, struct str text, void *arg),
+	       void *arg)
+{
+	char path[JOURNAL_PATH_MAX];
+	long end;
+	int count;
+
+	if (!journal_path(doc_path, path, sizeof(path)))
+		return 0;
+	count = scan(doc_path, path, fn, arg, &end);
+	return count > 0 ? count : 0;
+}
+
+/* ============================================================
+ * FLUSHER THREAD
+ * ============================================================ */
+
+static void
+jbuf_append(struct jbuf *b, const void *data, size_t len)
+{
+	if (b->len + len > b->cap) {
+		b->cap = b->cap ? b->cap * 2 : 4096;
+		while (b->cap < b->len + len)
+			b->cap *= 2;
+		b->data = xrealloc(b->data, b->cap);
+	}
+	memcpy(b->data + b->len, data, len);
+	b->len += len;
+}
+
+static int
+write_all(int fd, const char *data, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = write(fd, data, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno;
+		}
+		data += n;
+		len -= (size_t)n;
+	}
+	return 0;
+}
+
+static void *
+flusher_main(void *arg)
+{
+	struct journal *j = arg;
+	struct timespec deadline;
+	struct jbuf tmp;
+	uint64_t target;
+	int err;
+
+	pthread_mutex_lock(&j->lock);
+	for (;;) {
+		while (j->pending.len == 0 && !j->quit)
+			pthread_cond_wait(&j->wake, &j->lock);
+		if (j->pending.len == 0)
+			break; /* Quitting with nothing left */
+
+		/* Let more records join the group until the oldest is due */
+		deadline = j->first_pending;
+		deadline.tv_sec += j->latency_ms / 1000;
+		deadline.tv_nsec += (long)(j->latency_ms % 1000) * 1000000;
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+		while (!j->quit && !j->urgent &&
+		       pthread_cond_timedwait(&j->wake, &j->lock, &deadline) !=
+			   ETIMEDOUT)
+			;
+		j->urgent = false;
+
+		tmp = j->flushing;
+		j->flushing = j->pending;
+		j->pending = tmp;
+		j->pending.len = 0;
+		target = j->appended;
+		pthread_mutex_unlock(&j->lock);
+
+		err = write_all(j->fd, j->flushing.data, j->flushing.len);
+		if (!err && fdatasync(j->fd) != 0)
+			err = errno;
+
+		pthread_mutex_lock(&j->lock);
+		j->flushing.len = 0;
+		j->fsyncs++;
+		if (err && !j->error)
+			j->error = err;
+		j->durable = target;
+		pthread_cond_broadcast(&j->done);
+	}
+	pthread_mutex_unlock(&j->lock);
+	return NULL;
+}
+
+/* ============================================================
+ * PUBLIC API
+ * ============================================================ */
+
+struct journal *
+journal_open(const char *doc_path, int latency_ms, int *error)
+{
+	char path[JOURNAL_PATH_MAX];
+	struct journal_header h;
+	pthread_condattr_t attr;
+	struct journal *j;
+	long end;
+	int fd;
+
+	if (!journal_path(doc_path, path, sizeof(path))) {
+		*error = ENAMETOOLONG;
+		return NULL;
+	}
+	if (!header_for(doc_path, &h)) {
+		*error = errno;
+		return NULL;
+	}
+
+	if (scan(doc_path, path, NULL, NULL, &end) >= 0) {
+		/* Keep valid records, drop a torn tail */
+		fd = open(path, O_WRONLY | O_CLOEXEC);
+		if (fd >= 0 && (ftruncate(fd, end) != 0 ||
+				lseek(fd, end, SEEK_SET) < 0)) {
+			close(fd);
+			fd = -1;
+		}
+	} else {
+		fd = open(path,
+			  O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+			  0600);
+		if (fd >= 0 && (write_all(fd, (const char *)&h, sizeof(h)) ||
+				fdatasync(fd) != 0)) {
+			close(fd);
+			fd = -1;
+		}
+	}
+	if (fd < 0) {
+		*error = errno;
+		return NULL;
+	}
+
+	j = xcalloc(1, sizeof(*j));
+	j->fd = fd;
+	j->latency_ms = latency_ms > 0 ? latency_ms : 0;
+
+	/* Deadlines come from CLOCK_MONOTONIC */
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_mutex_init(&j->lock, NULL);
+	pthread_cond_init(&j->wake, &attr);
+	pthread_cond_init(&j->done, NULL);
+	pthread_condattr_destroy(&attr);
+
+	if (pthread_create(&j->thread, NULL, flusher_main, j) != 0)
+		die("journal: pthread_create failed");
+
+	*error = 0;
+	return j;
+}
+
+void
+journal_close(struct journal *j)
+{
+	if (!j)
+		return;
+
+	pthread_mutex_lock(&j->lock);
+	j->quit = true;
+	pthread_cond_signal(&j->wake);
+	pthread_mutex_unlock(&j->lock);
+	pthread_join(j->thread, NULL);
+
+	close(j->fd);
+	pthread_cond_destroy(&j->wake);
+	pthread_cond_destroy(&j->done);
+	pthread_mutex_destroy(&j->lock);
+	xfree(j->pending.data);
+	xfree(j->flushing.data);
+	xfree(j);
+}
+
+void
+journal_append(struct journal *j, int line, struct str text)
+{
+	char head[RECORD_HEAD];
+	uint32_t l = (uint32_t)line, len = (uint32_t)text.len, sum;
+
+	memcpy(head, &l, 4);
+	memcpy(head + 4, &len, 4);
+	sum = record_sum(head, text.data, len);
+
+	pthread_mutex_lock(&j->lock);
+	if (j->pending.len == 0) {
+		clock_gettime(CLOCK_MONOTONIC, &j->first_pending);
+		pthread_cond_signal(&j->wake);
+	}
+	jbuf_append(&j->pending, head, RECORD_HEAD);
+	jbuf_append(&j->pending, text.data, len);
+	jbuf_append(&j->pending, &sum, RECORD_TAIL);
+	j->appended++;
+	pthread_mutex_unlock(&j->lock);
+}
+
+int
+journal_sync(struct journal *j)
+{
+	uint64_t target;
+	int err;
+
+	pthread_mutex_lock(&j->lock);
+	target = j->appended;
+	if (j->durable < target) {
+		j->urgent = true;
+		pthread_cond_signal(&j->wake);
+	}
+	while (j->durable < target)
+		pthread_cond_wait(&j->done, &j->lock);
+	err = j->error;
+	pthread_mutex_unlock(&j->lock);
+	return err;
+}
+
+uint64_t
+journal_fsync_count(struct journal *j)
+{
+	uint64_t n;
+
+	pthread_mutex_lock(&j->lock);
+	n = j->fsyncs;
+	pthread_mutex_unlock(&j->lock);
+	return n;
+}
@@ -0,0 +1,314 @@
+#include <editor/line_index.h>
+
+#include <string.h>
+
+#define LINE_INDEX_MAGIC 0x5844494e494c4c57ull /* "WLLINIDX" */
+
+/* Everything is in words so the block can be mapped from a file */
+struct line_index {
+	uint64_t magic;
+	uint64_t kind;
+	uint64_t count;
+	uint64_t universe;
+	uint64_t pushed;     /* count once complete */
+	uint64_t low_bits;   /* EF: bits per low part */
+	uint64_t low_words;  /* EF: words of packed low parts */
+	uint64_t high_words; /* EF: words of the unary high parts */
+	uint64_t words[];    /* Array, or low | high | samples */
+};
+
+/* ============================================================
+ * LAYOUT
+ * ============================================================ */
+
+static uint64_t
+ef_low_bits(uint64_t count, uint64_t universe)
+{
+	uint64_t l = 0;
+
+	while (count && (universe / count) >> (l + 1))
+		l++;
+	return l;
+}
+
+static uint64_t
+sample_words(uint64_t count)
+{
+	return (count + LINE_INDEX_SAMPLE - 1) / LINE_INDEX_SAMPLE;
+}
+
+static uint64_t
+data_words(const struct line_index *idx)
+{
+	if (idx->kind == LINE_INDEX_ARRAY)
+		return idx->count;
+	return idx->low_words + idx->high_words + sample_words(idx->count);
+}
+
+static uint64_t *
+low_part(const struct line_index *idx)
+{
+	return (uint64_t *)idx->words;
+}
+
+static uint64_t *
+high_part(const struct line_index *idx)
+{
+	return (uint64_t *)idx->words + idx->low_words;
+}
+
+static uint64_t *
+samples(const struct line_index *idx)
+{
+	return (uint64_t *)idx->words + idx->low_words + idx->high_words;
+}
+
+static void
+layout(struct line_index *idx,
+       enum line_index_kind kind,
+       uint64_t count,
+       uint64_t universe)
+{
+	memset(idx, 0, sizeof(*idx));
+	idx->magic = LINE_INDEX_MAGIC;
+	idx->kind = kind;
+	idx->count = count;
+	idx->universe = universe;
+	if (kind == LINE_INDEX_EF) {
+		idx->low_bits = ef_low_bits(count, universe);
+		idx->low_words = (count * idx->low_bits + 63) / 64;
+		idx->high_words =
+		    (count + (universe >> idx->low_bits) + 1 + 63) / 64;
+	}
+}
+
+size_t
+line_index_size(enum line_index_kind kind, uint64_t count, uint64_t universe)
+{
+	struct line_index idx;
+
+	layout(&idx, kind, count, universe);
+	return sizeof(idx) + data_words(&idx) * sizeof(uint64_t);
+}
+
+/* ============================================================
+ * BUILDING
+ * ============================================================ */
+
+struct line_index *
+line_index_init(void *mem,
+		enum line_index_kind kind,
+		uint64_t count,
+		uint64_t universe)
+{
+	struct line_index *idx = mem;
+
+	layout(idx, kind, count, universe);
+	memset(idx->words, 0, data_words(idx) * sizeof(uint64_t));
+	return idx;
+}
+
+void
+line_index_push(struct line_index *idx, uint64_t value)
+{
+	uint64_t i = idx->pushed++, l = idx->low_bits, bit, high;
+	uint64_t *low;
+
+	if (idx->kind == LINE_INDEX_ARRAY) {
+		idx->words[i] = value;
+		return;
+	}
+
+	if (l) {
+		low = low_part(idx);
+		bit = i * l;
+		low[bit / 64] |= (value & ((1ull << l) - 1)) << (bit % 64);
+		if (bit % 64 + l > 64)
+			low[bit / 64 + 1] |=
+			    (value & ((1ull << l) - 1)) >> (64 - bit % 64);
+	}
+
+	/* The i-th one sits at high + i */
+	high = (value >> l) + i;
+	high_part(idx)[high / 64] |= 1ull << (high % 64);
+	if (i % LINE_INDEX_SAMPLE == 0)
+		samples(idx)[i / LINE_INDEX_SAMPLE] = high;
+}
+
+/* ============================================================
+ * LOOKUP
+ * ============================================================ */
+
+enum line_index_kind
+line_index_kind(const struct line_index *idx)
+{
+	return (enum line_index_kind)idx->kind;
+}
+
+uint64_t
+line_index_count(const struct line_index *idx)
+{
+	return idx->count;
+}
+
+size_t
+line_index_bytes(const struct line_index *idx)
+{
+	return sizeof(*idx) + data_words(idx) * sizeof(uint64_t);
+}
+
+/* SWAR popcount: the builtin is a libcall without -mpopcnt */
+static unsigned
+popcount64(uint64_t w)
+{
+	w -= (w >> 1) & 0x5555555555555555ull;
+	w = (w & 0x3333333333333333ull) + ((w >> 2) & 0x3333333333333333ull);
+	w = (w + (w >> 4)) & 0x0F0F0F0F0F0F0F0Full;
+	return (unsigned)((w * 0x0101010101010101ull) >> 56);
+}
+
+/* Position of the k-th (from 0) set bit of w, k < popcount64(w) */
+static unsigned
+select_in_word(uint64_t w, unsigned k)
+{
+	uint64_t bytes, sums;
+	unsigned byte = 0;
+
+	/* Running popcount up to and including each byte */
+	bytes = w - ((w >> 1) & 0x5555555555555555ull);
+	bytes = (bytes & 0x3333333333333333ull) +
+		((bytes >> 2) & 0x3333333333333333ull);
+	bytes = (bytes + (bytes >> 4)) & 0x0F0F0F0F0F0F0F0Full;
+	sums = bytes * 0x0101010101010101ull;
+	while (((sums >> (byte * 8)) & 0xFF) <= k)
+		byte++;
+	if (byte)
+		k -= (unsigned)((sums >> (byte * 8 - 8)) & 0xFF);
+
+	/* Drop the k lower ones of that byte */
+	w = (w >> (byte * 8)) & 0xFF;
+	while (k--)
+		w &= w - 1;
+	return byte * 8 + (unsigned)__builtin_ctzll(w);
+}
+
+/* Low bits of the i-th offset */
+static uint64_t
+low_of(const struct line_index *idx, uint64_t i)
+{
+	const uint64_t *low = low_part(idx);
+	uint64_t l = idx->low_bits, bit = i * l, lo;
+
+	if (!l)
+		return 0;
+	lo = low[bit / 64] >> (bit % 64);
+	if (bit % 64 + l > 64)
+		lo |= low[bit / 64 + 1] << (64 - bit % 64);
+	return lo & ((1ull << l) - 1);
+}
+
+/*
+ * Bit position of the i-th one of the high part. Never reads past the
+ * bitvector: without enough ones, the position just past it.
+ */
+static uint64_t
+select1(const struct line_index *idx, uint64_t i)
+{
+	const uint64_t *high = high_part(idx);
+	uint64_t pos = samples(idx)[i / LINE_INDEX_SAMPLE];
+	uint64_t k = i % LINE_INDEX_SAMPLE, word = pos / 64, w;
+	unsigned c;
+
+	/* The sample is itself the (i - k)-th one; count on from it */
+	w = high[word] & (~0ull << (pos % 64));
+	for (;;) {
+		c = popcount64(w);
+		if (k < c)
+			return word * 64 + select_in_word(w, (unsigned)k);
+		k -= c;
+		if (++word == idx->high_words)
+			return word * 64;
+		w = high[word];
+	}
+}
+
+uint64_t
+line_index_get(const struct line_index *idx, uint64_t i)
+{
+	if (idx->kind == LINE_INDEX_ARRAY)
+		return idx->words[i];
+	return (select1(idx, i) - i) << idx->low_bits | low_of(idx, i);
+}
+
+/* ============================================================
+ * CHECKING
+ * ============================================================ */
+
+/* Offsets strictly ascending and below universe, as pushed */
+static bool
+array_valid(const struct line_index *idx)
+{
+	uint64_t i;
+
+	for (i = 0; i < idx->count; i++)
+		if (idx->words[i] >= idx->universe ||
+		    (i > 0 && idx->words[i] <= idx->words[i - 1]))
+			return false;
+	return true;
+}
+
+/*
+ * Decode every offset in one walk over the ones of the high part: there
+ * must be exactly count, each sample must point at its one, and the
+ * offsets must ascend below universe as pushed.
+ */
+static bool
+ef_valid(const struct line_index *idx)
+{
+	const uint64_t *high = high_part(idx), *smp = samples(idx);
+	uint64_t i = 0, word, w, pos, value, prev = 0;
+
+	for (word = 0; word < idx->high_words; word++) {
+		for (w = high[word]; w; w &= w - 1) {
+			pos = word * 64 + (uint64_t)__builtin_ctzll(w);
+			if (i == idx->count)
+				return false;
+			if (i % LINE_INDEX_SAMPLE == 0 &&
+			    smp[i / LINE_INDEX_SAMPLE] != pos)
+				return false;
+			value = (pos - i) << idx->low_bits | low_of(idx, i);
+			if (value >= idx->universe || (i > 0 && value <= prev))
+				return false;
+			prev = value;
+			i++;
+		}
+	}
+	return i == idx->count;
+}
+
+const struct line_index *
+line_index_check(const void *mem, size_t len)
+{
+	const struct line_index *idx = mem;
+	struct line_index want;
+
+	if (len < sizeof(*idx) || idx->magic != LINE_INDEX_MAGIC ||
+	    idx->kind > LINE_INDEX_EF || idx->pushed != idx->count)
+		return NULL;
+
+	/* Derived fields must be what the header implies */
+	layout(&want,
+	       (enum line_index_kind)idx->kind,
+	       idx->count,
+	       idx->universe);
+	if (want.low_bits != idx->low_bits ||
+	    want.low_words != idx->low_words ||
+	    want.high_words != idx->high_words ||
+	    data_words(idx) > (len - sizeof(*idx)) / sizeof(uint64_t))
+		return NULL;
+
+	/* The contents are read as trusted from here on */
+	if (idx->kind == LINE_INDEX_ARRAY ? !array_valid(idx) : !ef_valid(idx))
+		return NULL;
+	return idx;
+}
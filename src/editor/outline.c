@@ -0,0 +1,138 @@
+#include <editor/outline.h>
+
+#include <string.h>
+
+#include <core/memory.h>
+
+#define NO_ROW UINT32_MAX
+
+/* First entry whose row is >= row */
+static int
+lower_bound(const struct outline *o, uint32_t row)
+{
+	int lo = 0, hi = o->count, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (o->entries[mid].row < row)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* Replace the entries of rows [first, last] by the n in h */
+static void
+splice(struct outline *o,
+       uint32_t first,
+       uint32_t last,
+       const struct syntax_heading *h,
+       int n)
+{
+	int lo = lower_bound(o, first);
+	int hi = lower_bound(o, last + 1);
+	int count = o->count - (hi - lo) + n;
+
+	if (count > o->cap) {
+		o->cap = count > 2 * o->cap ? count : 2 * o->cap;
+		o->entries = xrealloc(o->entries,
+				      (size_t)o->cap * sizeof(*o->entries));
+	}
+	memmove(&o->entries[lo + n],
+		&o->entries[hi],
+		(size_t)(o->count - hi) * sizeof(*o->entries));
+	if (n)
+		memcpy(&o->entries[lo], h, (size_t)n * sizeof(*h));
+	o->count = count;
+}
+
+static void
+requery(struct outline *o,
+	struct syntax_ctx *ctx,
+	uint32_t first,
+	uint32_t last,
+	struct arena *scratch)
+{
+	struct syntax_heading *h;
+	int n;
+
+	/* A setext heading starts on the row above its underline */
+	if (first > 0)
+		first--;
+	n = syntax_headings(ctx, first, last, scratch, &h);
+	splice(o, first, last, h, n);
+}
+
+void
+outline_init(struct outline *o)
+{
+	memset(o, 0, sizeof(*o));
+	o->edit_first = NO_ROW;
+}
+
+void
+outline_destroy(struct outline *o)
+{
+	xfree(o->entries);
+	memset(o, 0, sizeof(*o));
+}
+
+void
+outline_edit(struct outline *o, uint32_t row)
+{
+	if (o->edit_first > o->edit_last) {
+		o->edit_first = row;
+		o->edit_last = row;
+	} else if (row < o->edit_first) {
+		o->edit_first = row;
+	} else if (row > o->edit_last) {
+		o->edit_last = row;
+	}
+}
+
+void
+outline_update(struct outline *o,
+	       struct syntax_ctx *ctx,
+	       const struct syntax_range *ranges,
+	       int count,
+	       struct arena *scratch)
+{
+	struct arena_mark m = arena_mark(scratch);
+	int i;
+
+	for (i = 0; i < count; i++)
+		requery(
+		    o, ctx, ranges[i].start.row, ranges[i].end.row, scratch);
+	if (o->edit_first <= o->edit_last)
+		requery(o, ctx, o->edit_first, o->edit_last, scratch);
+	o->edit_first = NO_ROW;
+	o->edit_last = 0;
+	arena_pop(scratch, m);
+}
+
+int
+outline_enclosing(const struct outline *o, uint32_t row)
+{
+	return lower_bound(o, row + 1) - 1;
+}
+
+int
+outline_next(const struct outline *o, uint32_t row)
+{
+	int i = lower_bound(o, row + 1);
+
+	return i < o->count ? i : -1;
+}
+
+int
+outline_prev(const struct outline *o, uint32_t row)
+{
+	return lower_bound(o, row) - 1;
+}
+
+long
+outline_offset(const struct outline *o, int i, struct snapshot *snap)
+{
+	return snapshot_line_offset(snap, (int)o->entries[i].row);
+}
@@ -0,0 +1,950 @@
+#include <editor/regex.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <core/arena.h>
+#include <core/memory.h>
+
+#define LITERAL_MAX   64
+#define DFA_CACHE_MAX 1024 /* States kept before the cache is flushed */
+#define DFA_TABLE     (DFA_CACHE_MAX * 2)
+#define MAX_DEPTH     256 /* Parenthesis nesting */
+
+/* ============================================================
+ * TYPES
+ * ============================================================ */
+
+struct byteset {
+	uint64_t bits[4];
+};
+
+enum node_type {
+	NODE_EMPTY,
+	NODE_SET, /* One byte from a set */
+	NODE_CAT,
+	NODE_ALT,
+	NODE_STAR,
+	NODE_PLUS,
+	NODE_QUEST,
+	NODE_BOL,
+	NODE_EOL,
+};
+
+struct re_node {
+	enum node_type type;
+	int a, b; /* Children */
+	int set;  /* NODE_SET: index into sets */
+	int ch;	  /* NODE_SET: the byte if the set holds exactly one */
+};
+
+enum nfa_op {
+	NFA_SET,
+	NFA_SPLIT,
+	NFA_BOL,
+	NFA_EOL,
+	NFA_MATCH,
+};
+
+struct nfa_state {
+	enum nfa_op op;
+	int out;
+	int out1; /* NFA_SPLIT only */
+	int set;  /* NFA_SET only */
+};
+
+struct dfa_state {
+	int *set; /* Sorted NFA states, epsilon-closed */
+	int n;
+	uint32_t hash;
+	bool accept;	 /* Contains NFA_MATCH */
+	bool accept_eol; /* Reaches NFA_MATCH through $ */
+	int next[256];	 /* -1 until computed */
+};
+
+struct dfa {
+	bool unanchored; /* Restart the NFA at every position */
+	struct arena arena; /* State sets, dropped on flush */
+	struct dfa_state *states;
+	int count;
+	int cap;
+	int table[DFA_TABLE]; /* Interning hash table, -1 = free */
+	int start[2];	      /* Indexed by at_bol, -1 until computed */
+};
+
+enum {
+	DFA_ANCHORED,
+	DFA_UNANCHORED,
+};
+
+struct regex {
+	struct arena arena; /* AST, NFA and byte sets */
+
+	struct re_node *nodes;
+	int node_count;
+	struct byteset *sets;
+	int set_count;
+
+	struct nfa_state *nfa;
+	int nfa_count;
+	int nfa_start;
+
+	char literal[LITERAL_MAX];
+	int literal_len;
+
+	/* Scratch for closures */
+	int *mark;
+	int mark_gen;
+	int *stack;
+	int *scratch;
+
+	/* Thread lists and their start offsets for leftmost_start() */
+	int *threads[2];
+	int *starts[2];
+
+	struct dfa dfa[2];
+};
+
+/* ============================================================
+ * BYTE SETS
+ * ============================================================ */
+
+static void
+set_add(struct byteset *s, int c)
+{
+	s->bits[c >> 6] |= (uint64_t)1 << (c & 63);
+}
+
+static void
+set_add_range(struct byteset *s, int lo, int hi)
+{
+	int c;
+
+	for (c = lo; c <= hi; c++)
+		set_add(s, c);
+}
+
+static bool
+set_has(const struct byteset *s, int c)
+{
+	return (s->bits[c >> 6] >> (c & 63)) & 1;
+}
+
+static void
+set_negate(struct byteset *s)
+{
+	int i;
+
+	for (i = 0; i < 4; i++)
+		s->bits[i] = ~s->bits[i];
+}
+
+/* Returns the only byte in s, or -1 */
+static int
+set_single(const struct byteset *s)
+{
+	int c, found = -1;
+
+	for (c = 0; c < 256; c++) {
+		if (!set_has(s, c))
+			continue;
+		if (found >= 0)
+			return -1;
+		found = c;
+	}
+	return found;
+}
+
+/* Add \d \w \s (or their negations) to s. Returns false if not a class */
+static bool
+set_add_class(struct byteset *s, char esc)
+{
+	struct byteset c = {{0}};
+
+	switch (esc) {
+	case 'd':
+	case 'D':
+		set_add_range(&c, '0', '9');
+		break;
+	case 'w':
+	case 'W':
+		set_add_range(&c, 'a', 'z');
+		set_add_range(&c, 'A', 'Z');
+		set_add_range(&c, '0', '9');
+		set_add(&c, '_');
+		break;
+	case 's':
+	case 'S':
+		set_add(&c, ' ');
+		set_add_range(&c, '\t', '\r');
+		break;
+	default:
+		return false;
+	}
+
+	if (esc >= 'A' && esc <= 'Z')
+		set_negate(&c);
+	for (int i = 0; i < 4; i++)
+		s->bits[i] |= c.bits[i];
+	return true;
+}
+
+static int
+escape_byte(char esc)
+{
+	switch (esc) {
+	case 'n':
+		return '\n';
+	case 't':
+		return '\t';
+	case 'r':
+		return '\r';
+	case 'f':
+		return '\f';
+	case 'v':
+		return '\v';
+	default:
+		return (unsigned char)esc;
+	}
+}
+
+/* ============================================================
+ * PARSER (pattern -> AST)
+ * ============================================================ */
+
+struct parser {
+	struct regex *re;
+	const char *p;
+	const char *end;
+	const char *error;
+	int depth;
+};
+
+static int
+new_node(struct regex *re, enum node_type type, int a, int b)
+{
+	struct re_node *n = &re->nodes[re->node_count];
+
+	n->type = type;
+	n->a = a;
+	n->b = b;
+	n->set = -1;
+	n->ch = -1;
+	return re->node_count++;
+}
+
+static int
+new_set_node(struct regex *re, struct byteset *set)
+{
+	int id = new_node(re, NODE_SET, -1, -1);
+
+	re->sets[re->set_count] = *set;
+	re->nodes[id].set = re->set_count++;
+	re->nodes[id].ch = set_single(set);
+	return id;
+}
+
+static bool
+at_end(struct parser *ps)
+{
+	return ps->p >= ps->end;
+}
+
+static int parse_alt(struct parser *ps);
+
+static int
+parse_class(struct parser *ps)
+{
+	struct byteset set = {{0}};
+	bool negate = false, first = true;
+	int lo, hi;
+
+	/* Opening '[' already consumed */
+	if (!at_end(ps) && *ps->p == '^') {
+		negate = true;
+		ps->p++;
+	}
+
+	while (!at_end(ps) && (*ps->p != ']' || first)) {
+		first = false;
+
+		if (*ps->p == '\\' && ps->p + 1 < ps->end) {
+			if (set_add_class(&set, ps->p[1])) {
+				ps->p += 2;
+				continue;
+			}
+			lo = escape_byte(ps->p[1]);
+			ps->p += 2;
+		} else {
+			lo = (unsigned char)*ps->p++;
+		}
+
+		hi = lo;
+		if (ps->p + 1 < ps->end && *ps->p == '-' && ps->p[1] != ']') {
+			ps->p++;
+			if (*ps->p == '\\' && ps->p + 1 < ps->end) {
+				hi = escape_byte(ps->p[1]);
+				ps->p += 2;
+			} else {
+				hi = (unsigned char)*ps->p++;
+			}
+			if (hi < lo) {
+				ps->error = "invalid range in class";
+				return -1;
+			}
+		}
+		set_add_range(&set, lo, hi);
+	}
+
+	if (at_end(ps)) {
+		ps->error = "missing ]";
+		return -1;
+	}
+	ps->p++; /* ']' */
+
+	if (negate)
+		set_negate(&set);
+	return new_set_node(ps->re, &set);
+}
+
+static int
+parse_atom(struct parser *ps)
+{
+	struct byteset set = {{0}};
+	char c = *ps->p++;
+	int n;
+
+	switch (c) {
+	case '(':
+		if (++ps->depth > MAX_DEPTH) {
+			ps->error = "parentheses nested too deeply";
+			return -1;
+		}
+		n = parse_alt(ps);
+		if (n < 0)
+			return -1;
+		if (at_end(ps) || *ps->p != ')') {
+			ps->error = "missing )";
+			return -1;
+		}
+		ps->p++;
+		ps->depth--;
+		return n;
+	case '[':
+		return parse_class(ps);
+	case '.':
+		set_negate(&set);
+		return new_set_node(ps->re, &set);
+	case '^':
+		return new_node(ps->re, NODE_BOL, -1, -1);
+	case '$':
+		return new_node(ps->re, NODE_EOL, -1, -1);
+	case '*':
+	case '+':
+	case '?':
+		ps->error = "nothing to repeat";
+		return -1;
+	case '\\':
+		if (at_end(ps)) {
+			ps->error = "trailing backslash";
+			return -1;
+		}
+		c = *ps->p++;
+		if (!set_add_class(&set, c))
+			set_add(&set, escape_byte(c));
+		return new_set_node(ps->re, &set);
+	default:
+		set_add(&set, (unsigned char)c);
+		return new_set_node(ps->re, &set);
+	}
+}
+
+static int
+parse_repeat(struct parser *ps)
+{
+	int n = parse_atom(ps);
+
+	while (n >= 0 && !at_end(ps)) {
+		switch (*ps->p) {
+		case '*':
+			n = new_node(ps->re, NODE_STAR, n, -1);
+			break;
+		case '+':
+			n = new_node(ps->re, NODE_PLUS, n, -1);
+			break;
+		case '?':
+			n = new_node(ps->re, NODE_QUEST, n, -1);
+			break;
+		default:
+			return n;
+		}
+		ps->p++;
+	}
+	return n;
+}
+
+static int
+parse_cat(struct parser *ps)
+{
+	int n = -1, r;
+
+	while (!at_end(ps) && *ps->p != '|' && *ps->p != ')') {
+		r = parse_repeat(ps);
+		if (r < 0)
+			return -1;
+		n = n < 0 ? r : new_node(ps->re, NODE_CAT, n, r);
+	}
+	return n < 0 ? new_node(ps->re, NODE_EMPTY, -1, -1) : n;
+}
+
+static int
+parse_alt(struct parser *ps)
+{
+	int n = parse_cat(ps), r;
+
+	while (n >= 0 && !at_end(ps) && *ps->p == '|') {
+		ps->p++;
+		r = parse_cat(ps);
+		if (r < 0)
+			return -1;
+		n = new_node(ps->re, NODE_ALT, n, r);
+	}
+	return n;
+}
+
+/* ============================================================
+ * REQUIRED LITERAL (prefilter)
+ * ============================================================ */
+
+struct lit {
+	char s[LITERAL_MAX];
+	int len;
+};
+
+static void
+lit_keep_longest(struct lit *best, const struct lit *cand)
+{
+	if (cand->len > best->len)
+		*best = *cand;
+}
+
+static void required_literal(struct regex *re, int id, struct lit *best);
+
+/*
+ * Walk a concatenation left to right, growing run over consecutive
+ * single-byte atoms; anything else ends the run.
+ */
+static void
+walk_cat(struct regex *re, int id, struct lit *run, struct lit *best)
+{
+	const struct re_node *n = &re->nodes[id];
+
+	if (n->type == NODE_CAT) {
+		walk_cat(re, n->a, run, best);
+		walk_cat(re, n->b, run, best);
+		return;
+	}
+	if (n->type == NODE_SET && n->ch >= 0) {
+		if (run->len < LITERAL_MAX)
+			run->s[run->len++] = (char)n->ch;
+		lit_keep_longest(best, run);
+		return;
+	}
+	if (n->type == NODE_BOL || n->type == NODE_EOL)
+		return; /* Zero-width: run continues across anchors */
+
+	run->len = 0;
+	required_literal(re, id, best);
+}
+
+static void
+required_literal(struct regex *re, int id, struct lit *best)
+{
+	const struct re_node *n = &re->nodes[id];
+	struct lit run = {{0}, 0};
+
+	switch (n->type) {
+	case NODE_CAT:
+		walk_cat(re, id, &run, best);
+		break;
+	case NODE_SET:
+		if (n->ch >= 0)
+			walk_cat(re, id, &run, best);
+		break;
+	case NODE_PLUS:
+		required_literal(re, n->a, best);
+		break;
+	default:
+		/* Alternation and optional parts guarantee nothing */
+		break;
+	}
+}
+
+/* ============================================================
+ * NFA CONSTRUCTION (AST -> Thompson NFA, built back to front)
+ * ============================================================ */
+
+static int
+new_state(struct regex *re, enum nfa_op op, int out, int out1)
+{
+	struct nfa_state *s = &re->nfa[re->nfa_count];
+
+	s->op = op;
+	s->out = out;
+	s->out1 = out1;
+	s->set = -1;
+	return re->nfa_count++;
+}
+
+/* Compile node so that it continues at next. Returns the entry state */
+static int
+compile_node(struct regex *re, int id, int next)
+{
+	const struct re_node *n = &re->nodes[id];
+	int s, entry;
+
+	switch (n->type) {
+	case NODE_EMPTY:
+		return next;
+	case NODE_SET:
+		s = new_state(re, NFA_SET, next, -1);
+		re->nfa[s].set = n->set;
+		return s;
+	case NODE_CAT:
+		return compile_node(re, n->a, compile_node(re, n->b, next));
+	case NODE_ALT:
+		entry = compile_node(re, n->a, next);
+		s = compile_node(re, n->b, next);
+		return new_state(re, NFA_SPLIT, entry, s);
+	case NODE_QUEST:
+		entry = compile_node(re, n->a, next);
+		return new_state(re, NFA_SPLIT, entry, next);
+	case NODE_STAR:
+		s = new_state(re, NFA_SPLIT, -1, next);
+		re->nfa[s].out = compile_node(re, n->a, s);
+		return s;
+	case NODE_PLUS:
+		s = new_state(re, NFA_SPLIT, -1, next);
+		entry = compile_node(re, n->a, s);
+		re->nfa[s].out = entry;
+		return entry;
+	case NODE_BOL:
+		return new_state(re, NFA_BOL, next, -1);
+	case NODE_EOL:
+		return new_state(re, NFA_EOL, next, -1);
+	}
+	return next;
+}
+
+/* ============================================================
+ * LAZY DFA
+ * ============================================================ */
+
+/* Epsilon closure of s appended to set (states marked with mark_gen) */
+static void
+add_closure(struct regex *re, int s, bool at_bol, int *set, int *n)
+{
+	int sp = 0;
+
+	re->stack[sp++] = s;
+	while (sp > 0) {
+		s = re->stack[--sp];
+		if (s < 0 || re->mark[s] == re->mark_gen)
+			continue;
+		re->mark[s] = re->mark_gen;
+
+		switch (re->nfa[s].op) {
+		case NFA_SPLIT:
+			re->stack[sp++] = re->nfa[s].out1;
+			re->stack[sp++] = re->nfa[s].out;
+			break;
+		case NFA_BOL:
+			if (at_bol)
+				re->stack[sp++] = re->nfa[s].out;
+			break;
+		default:
+			set[(*n)++] = s;
+			break;
+		}
+	}
+}
+
+static int
+cmp_int(const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
+
+static uint32_t
+hash_set(const int *set, int n)
+{
+	uint32_t h = 2166136261u;
+	int i;
+
+	for (i = 0; i < n; i++)
+		h = (h ^ (uint32_t)set[i]) * 16777619u;
+	return h;
+}
+
+static void
+dfa_flush(struct dfa *d)
+{
+	arena_reset(&d->arena);
+	d->count = 0;
+	memset(d->table, -1, sizeof(d->table));
+	d->start[0] = d->start[1] = -1;
+}
+
+static void
+dfa_init(struct dfa *d, bool unanchored)
+{
+	d->unanchored = unanchored;
+	arena_init(&d->arena);
+	d->states = NULL;
+	d->cap = 0;
+	dfa_flush(d);
+}
+
+static void
+dfa_free(struct dfa *d)
+{
+	arena_destroy(&d->arena);
+	xfree(d->states);
+}
+
+/* Find or add the DFA state for a sorted NFA set */
+static int
+dfa_intern(struct regex *re, struct dfa *d, const int *set, int n)
+{
+	struct dfa_state *st;
+	uint32_t h = hash_set(set, n);
+	uint32_t slot = h & (DFA_TABLE - 1);
+	int i, id;
+
+	while ((id = d->table[slot]) >= 0) {
+		st = &d->states[id];
+		if (st->hash == h && st->n == n &&
+		    memcmp(st->set, set, (size_t)n * sizeof(int)) == 0)
+			return id;
+		slot = (slot + 1) & (DFA_TABLE - 1);
+	}
+
+	if (d->count == d->cap) {
+		d->cap = d->cap ? d->cap * 2 : 16;
+		d->states =
+		    xrealloc(d->states, (size_t)d->cap * sizeof(*d->states));
+	}
+
+	id = d->count++;
+	d->table[slot] = id;
+	st = &d->states[id];
+	st->set = arena_array(&d->arena, int, n);
+	memcpy(st->set, set, (size_t)n * sizeof(int));
+	st->n = n;
+	st->hash = h;
+	st->accept = false;
+	st->accept_eol = false;
+	memset(st->next, -1, sizeof(st->next));
+
+	for (i = 0; i < n; i++)
+		if (re->nfa[set[i]].op == NFA_MATCH)
+			st->accept = true;
+
+	/* Would the match state be reached if the line ended here? */
+	if (!st->accept) {
+		int m = 0;
+
+		re->mark_gen++;
+		for (i = 0; i < n; i++)
+			if (re->nfa[st->set[i]].op == NFA_EOL)
+				add_closure(re,
+					    re->nfa[st->set[i]].out,
+					    false,
+					    re->scratch,
+					    &m);
+		for (i = 0; i < m; i++)
+			if (re->nfa[re->scratch[i]].op == NFA_MATCH)
+				st->accept_eol = true;
+	}
+	return id;
+}
+
+static int
+dfa_start(struct regex *re, struct dfa *d, bool at_bol)
+{
+	int n = 0;
+
+	if (d->start[at_bol] >= 0)
+		return d->start[at_bol];
+
+	if (d->count >= DFA_CACHE_MAX)
+		dfa_flush(d);
+
+	re->mark_gen++;
+	add_closure(re, re->nfa_start, at_bol, re->scratch, &n);
+	qsort(re->scratch, (size_t)n, sizeof(int), cmp_int);
+	d->start[at_bol] = dfa_intern(re, d, re->scratch, n);
+	return d->start[at_bol];
+}
+
+static int
+dfa_next(struct regex *re, struct dfa *d, int si, unsigned char c)
+{
+	const struct dfa_state *st = &d->states[si];
+	bool flushed = false;
+	int i, n = 0, next;
+
+	if (st->next[c] >= 0)
+		return st->next[c];
+
+	re->mark_gen++;
+	for (i = 0; i < st->n; i++) {
+		const struct nfa_state *s = &re->nfa[st->set[i]];
+		if (s->op == NFA_SET && set_has(&re->sets[s->set], c))
+			add_closure(re, s->out, false, re->scratch, &n);
+	}
+	if (d->unanchored)
+		add_closure(re, re->nfa_start, false, re->scratch, &n);
+	qsort(re->scratch, (size_t)n, sizeof(int), cmp_int);
+
+	/* Cache full: start over, the caller only holds the new state */
+	if (d->count >= DFA_CACHE_MAX) {
+		dfa_flush(d);
+		flushed = true;
+	}
+
+	next = dfa_intern(re, d, re->scratch, n);
+	if (!flushed)
+		d->states[si].next[c] = next;
+	return next;
+}
+
+/* Longest match starting exactly at pos, or -1 */
+static int
+match_at(struct regex *re, struct str text, int pos)
+{
+	struct dfa *d = &re->dfa[DFA_ANCHORED];
+	int s, i, end = -1;
+
+	s = dfa_start(re, d, pos == 0);
+	if (d->states[s].accept)
+		end = pos;
+
+	for (i = pos; i < text.len; i++) {
+		s = dfa_next(re, d, s, (unsigned char)text.data[i]);
+		if (d->states[s].n == 0)
+			return end; /* Dead state */
+		if (d->states[s].accept)
+			end = i + 1;
+	}
+	if (d->states[s].accept_eol)
+		end = text.len;
+	return end;
+}
+
+/* Does any match start at or after from? One pass over the text */
+static bool
+match_exists(struct regex *re, struct str text, int from)
+{
+	struct dfa *d = &re->dfa[DFA_UNANCHORED];
+	int s, i;
+
+	s = dfa_start(re, d, from == 0);
+	if (d->states[s].accept)
+		return true;
+
+	for (i = from; i < text.len; i++) {
+		s = dfa_next(re, d, s, (unsigned char)text.data[i]);
+		if (d->states[s].accept)
+			return true;
+	}
+	return d->states[s].accept_eol;
+}
+
+/* Does a thread on state s reach the match state if the line ends? */
+static bool
+accepts_at_eol(struct regex *re, int s)
+{
+	int i, n = 0;
+
+	if (re->nfa[s].op == NFA_MATCH)
+		return true;
+	if (re->nfa[s].op != NFA_EOL)
+		return false;
+	re->mark_gen++;
+	add_closure(re, re->nfa[s].out, false, re->scratch, &n);
+	for (i = 0; i < n; i++)
+		if (re->nfa[re->scratch[i]].op == NFA_MATCH)
+			return true;
+	return false;
+}
+
+/*
+ * Leftmost offset at or after from where a match starts, or -1. One pass
+ * over the NFA: threads are kept in order of start, so the first thread
+ * to reach a state holds the earliest start for it. Once a match is seen
+ * no new threads are seeded, and the pass ends when no thread with an
+ * earlier start survives.
+ */
+static int
+leftmost_start(struct regex *re, struct str text, int from)
+{
+	int *cur = re->threads[0], *next = re->threads[1];
+	int *cs = re->starts[0], *ns = re->starts[1], *tmp;
+	int i, k, j, cn = 0, nn, best = -1;
+	unsigned char c;
+
+	re->mark_gen++;
+	add_closure(re, re->nfa_start, from == 0, cur, &cn);
+	for (k = 0; k < cn; k++)
+		cs[k] = from;
+
+	for (i = from;; i++) {
+		for (k = 0; k < cn; k++) {
+			if (best >= 0 && cs[k] >= best)
+				break;
+			if (re->nfa[cur[k]].op == NFA_MATCH ||
+			    (i == text.len && accepts_at_eol(re, cur[k]))) {
+				best = cs[k];
+				break;
+			}
+		}
+		if (i == text.len)
+			break;
+
+		c = (unsigned char)text.data[i];
+		re->mark_gen++;
+		nn = 0;
+		for (k = 0; k < cn; k++) {
+			const struct nfa_state *s = &re->nfa[cur[k]];
+
+			if (best >= 0 && cs[k] >= best)
+				break;
+			if (s->op != NFA_SET || !set_has(&re->sets[s->set], c))
+				continue;
+			j = nn;
+			add_closure(re, s->out, false, next, &nn);
+			for (; j < nn; j++)
+				ns[j] = cs[k];
+		}
+		if (best < 0) {
+			j = nn;
+			add_closure(re, re->nfa_start, false, next, &nn);
+			for (; j < nn; j++)
+				ns[j] = i + 1;
+		}
+		if (nn == 0)
+			break;
+
+		tmp = cur, cur = next, next = tmp;
+		tmp = cs, cs = ns, ns = tmp;
+		cn = nn;
+	}
+	return best;
+}
+
+/* ============================================================
+ * PUBLIC API
+ * ============================================================ */
+
+struct regex *
+regex_compile(struct str pattern, const char **error)
+{
+	struct regex *re;
+	struct parser ps;
+	struct lit best = {{0}, 0};
+	int root, max_nodes;
+
+	re = xcalloc(1, sizeof(*re));
+	arena_init(&re->arena);
+
+	/* Each pattern byte yields at most two nodes */
+	max_nodes = 2 * pattern.len + 2;
+	re->nodes = arena_array(&re->arena, struct re_node, max_nodes);
+	re->sets = arena_array(&re->arena, struct byteset, pattern.len + 1);
+	re->nfa = arena_array(&re->arena, struct nfa_state, max_nodes + 1);
+
+	ps.re = re;
+	ps.p = pattern.data;
+	ps.end = pattern.data + pattern.len;
+	ps.error = NULL;
+	ps.depth = 0;
+
+	root = parse_alt(&ps);
+	if (root >= 0 && !at_end(&ps))
+		ps.error = "unmatched )";
+	if (root < 0 || ps.error) {
+		*error = ps.error;
+		arena_destroy(&re->arena);
+		xfree(re);
+		return NULL;
+	}
+
+	required_literal(re, root, &best);
+	memcpy(re->literal, best.s, (size_t)best.len);
+	re->literal_len = best.len;
+
+	re->nfa_start =
+	    compile_node(re, root, new_state(re, NFA_MATCH, -1, -1));
+
+	re->mark = arena_array0(&re->arena, int, re->nfa_count);
+	re->stack = arena_array(&re->arena, int, 2 * re->nfa_count + 1);
+	re->scratch = arena_array(&re->arena, int, re->nfa_count);
+	re->threads[0] = arena_array(&re->arena, int, re->nfa_count);
+	re->threads[1] = arena_array(&re->arena, int, re->nfa_count);
+	re->starts[0] = arena_array(&re->arena, int, re->nfa_count);
+	re->starts[1] = arena_array(&re->arena, int, re->nfa_count);
+
+	dfa_init(&re->dfa[DFA_ANCHORED], false);
+	dfa_init(&re->dfa[DFA_UNANCHORED], true);
+
+	*error = NULL;
+	return re;
+}
+
+void
+regex_destroy(struct regex *re)
+{
+	if (!re)
+		return;
+	dfa_free(&re->dfa[DFA_ANCHORED]);
+	dfa_free(&re->dfa[DFA_UNANCHORED]);
+	arena_destroy(&re->arena);
+	xfree(re);
+}
+
+bool
+regex_find(struct regex *re,
+	   struct str text,
+	   int from,
+	   struct regex_match *out)
+{
+	struct str lit = regex_required_literal(re);
+	int start;
+
+	if (from < 0 || from > text.len)
+		return false;
+
+	/* Prefilter: cheap rejection of lines lacking the literal */
+	if (!str_empty(lit) &&
+	    !str_find(str_slice(text, from, text.len), lit).found)
+		return false;
+
+	/* The DFA rejects most lines; only matching ones pay for the NFA */
+	if (!match_exists(re, text, from))
+		return false;
+
+	start = leftmost_start(re, text, from);
+	if (start < 0)
+		return false;
+	out->start = start;
+	out->end = match_at(re, text, start);
+	return true;
+}
+
+struct str
+regex_required_literal(const struct regex *re)
+{
+	return str_from_parts(re->literal, re->literal_len);
+}
@@ -0,0 +1,644 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <editor/search.h>
+
+#include <pthread.h>
+#include <string.h>
+
+#include <core/memory.h>
+#include <editor/regex.h>
+
+#define SCAN_BATCH	 256  /* Hits collected before publishing */
+#define SCAN_CANCEL_LINES 64  /* Lines between cancellation checks */
+#define SCAN_REPORT_LINES 8192 /* Lines between progress reports */
+
+/* ============================================================
+ * BACKGROUND INDEXING
+ * ============================================================ */
+
+struct index_job {
+	struct search *search;
+	struct snapshot *snap;
+};
+
+static void
+index_job_run(struct worker *w, void *arg)
+{
+	struct index_job *job = arg;
+	struct trigram_index *idx, *stale;
+
+	idx = trigram_build(
+	    job->snap, SEARCH_INDEX_BUDGET, worker_cancel_flag(w));
+	if (!idx) {
+		if (worker_cancelled(w))
+			return;
+		__atomic_store_n(&job->search->too_large, 1, __ATOMIC_RELEASE);
+		worker_notify(w);
+		return;
+	}
+
+	/* Replace an index the UI thread never picked up */
+	stale =
+	    __atomic_exchange_n(&job->search->built, idx, __ATOMIC_ACQ_REL);
+	trigram_destroy(stale);
+	worker_notify(w);
+}
+
+static void
+index_job_free(void *arg)
+{
+	struct index_job *job = arg;
+
+	snapshot_release(job->snap);
+	xfree(job);
+}
+
+/* ============================================================
+ * REGEX SCAN (worker side)
+ * ============================================================ */
+
+/* Hand-over point between the regex worker and the UI thread */
+struct search_stream {
+	pthread_mutex_t lock;
+	/* Guarded by lock */
+	unsigned generation; /* Of the newest scan; older ones drop hits */
+	struct search_hit *pending;
+	int pending_count;
+	int pending_cap;
+	int lines;
+	bool done;
+};
+
+struct regex_job {
+	struct search_stream *stream;
+	unsigned generation;
+	struct snapshot *snap;
+	struct regex *re; /* Owned by the job: a regex is single-thread */
+	struct syntax_query *query;   /* Or a structural query, owned */
+	struct syntax_forest *forest; /* And the trees it runs on */
+	int first;
+	int last;
+
+	/* Worker private */
+	struct worker *w;
+	struct search_hit batch[SCAN_BATCH];
+	int batch_count;
+	int lines;
+	int hits;
+};
+
+/*
+ * Move the job's batch into the stream. Returns false if a newer scan
+ * has started, in which case the hits are dropped.
+ */
+static bool
+publish(struct worker *w, struct regex_job *job, bool done)
+{
+	struct search_stream *st = job->stream;
+	bool current;
+	int need;
+
+	pthread_mutex_lock(&st->lock);
+	current = st->generation == job->generation;
+	if (current) {
+		need = st->pending_count + job->batch_count;
+		if (need > st->pending_cap) {
+			st->pending_cap = need > 2 * st->pending_cap
+					      ? need
+					      : 2 * st->pending_cap;
+			st->pending =
+			    xrealloc(st->pending,
+				     (size_t)st->pending_cap *
+					 sizeof(*st->pending));
+		}
+		if (job->batch_count > 0)
+			memcpy(&st->pending[st->pending_count],
+			       job->batch,
+			       (size_t)job->batch_count * sizeof(*job->batch));
+		st->pending_count = need;
+		st->lines = job->lines;
+		st->done = done;
+	}
+	pthread_mutex_unlock(&st->lock);
+
+	job->batch_count = 0;
+	if (current)
+		worker_notify(w);
+	return current;
+}
+
+/* Scan lines [from, to). Returns false once cancelled or superseded */
+static bool
+scan_lines(struct worker *w, struct regex_job *job, int from, int to)
+{
+	struct regex_match m;
+	struct str text;
+	int line, at;
+
+	for (line = from; line < to; line++) {
+		if ((line - from) % SCAN_CANCEL_LINES == 0 &&
+		    worker_cancelled(w))
+			return false;
+
+		text = snapshot_get_line(job->snap, line);
+		at = 0;
+		while (job->hits < SEARCH_HITS_MAX &&
+		       regex_find(job->re, text, at, &m)) {
+			job->batch[job->batch_count].line = line;
+			job->batch[job->batch_count].start = m.start;
+			job->batch[job->batch_count].end = m.end;
+			job->hits++;
+			if (++job->batch_count == SCAN_BATCH &&
+			    !publish(w, job, false))
+				return false;
+			/* Step over empty matches */
+			at = m.end > m.start ? m.end : m.end + 1;
+			if (at > text.len)
+				break;
+		}
+
+		job->lines++;
+		if (job->lines % SCAN_REPORT_LINES == 0 &&
+		    !publish(w, job, false))
+			return false;
+	}
+	return true;
+}
+
+/* Take matches of a structural query as hits, in document order */
+static bool
+emit_matches(void *arg, const struct syntax_match *m, int n)
+{
+	struct regex_job *job = arg;
+	struct search_hit *hit;
+	int i, len;
+
+	for (i = 0; i < n; i++) {
+		if (job->hits == SEARCH_HITS_MAX)
+			return false;
+		len = snapshot_get_line(job->snap, (int)m[i].start.row).len;
+		hit = &job->batch[job->batch_count];
+		hit->line = (int)m[i].start.row;
+		hit->start = (int)m[i].start.col;
+		hit->end = m[i].end.row == m[i].start.row ? (int)m[i].end.col
+							  : len;
+		if (hit->end > len)
+			hit->end = len;
+		job->lines = hit->line + 1;
+		job->hits++;
+		if (++job->batch_count == SCAN_BATCH &&
+		    !publish(job->w, job, false))
+			return false;
+	}
+	return true;
+}
+
+static void
+regex_job_run(struct worker *w, void *arg)
+{
+	struct regex_job *job = arg;
+	int n = snapshot_line_count(job->snap);
+	int first = job->first < n ? job->first : n;
+	int last = job->last < n ? job->last + 1 : n;
+
+	if (job->query) {
+		/* The whole text at once, spread over threads */
+		job->w = w;
+		if (!syntax_query_run(job->query,
+				      job->forest,
+				      worker_cancel_flag(w),
+				      emit_matches,
+				      job) &&
+		    job->hits < SEARCH_HITS_MAX)
+			return;
+		job->lines = n;
+		publish(w, job, true);
+		return;
+	}
+
+	/* Viewport first so its highlights show up right away */
+	if (!scan_lines(w, job, first, last) || !publish(w, job, false))
+		return;
+	if (!scan_lines(w, job, last, n) || !scan_lines(w, job, 0, first))
+		return;
+	publish(w, job, true);
+}
+
+static void
+regex_job_free(void *arg)
+{
+	struct regex_job *job = arg;
+
+	regex_destroy(job->re);
+	syntax_query_delete(job->query);
+	syntax_forest_delete(job->forest);
+	snapshot_release(job->snap);
+	xfree(job);
+}
+
+/* ============================================================
+ * REGEX SCAN (UI side)
+ * ============================================================ */
+
+static void
+clear_hits(struct search *s)
+{
+	int i;
+
+	for (i = 0; i < SEARCH_RUN_COUNT; i++)
+		s->runs[i].count = 0;
+	s->scan_id++;
+	s->scan_lines = 0;
+	s->scan_done = false;
+}
+
+/* Cancel the running scan and forget its hits */
+static void
+stop_scan(struct search *s)
+{
+	pthread_mutex_lock(&s->stream->lock);
+	s->stream->generation++;
+	s->stream->pending_count = 0;
+	s->stream->lines = 0;
+	s->stream->done = false;
+	pthread_mutex_unlock(&s->stream->lock);
+
+	worker_cancel(s->regex_worker);
+	clear_hits(s);
+}
+
+static void
+start_scan(struct search *s, struct buffer *buf)
+{
+	struct syntax_forest *forest = NULL;
+	struct syntax_query *query = NULL;
+	struct regex *re = NULL;
+	struct regex_job *job;
+
+	stop_scan(s);
+	s->regex_error = NULL;
+	if (s->query_len == 0)
+		return;
+
+	if (s->structural) {
+		query = syntax_query_new(search_get_query(s), &s->regex_error);
+		if (!query)
+			return;
+		forest = syntax_forest_copy(s->syntax);
+		if (!forest) {
+			/* search_syntax_changed() starts over with a tree */
+			syntax_query_delete(query);
+			s->regex_error = "waiting for the syntax tree";
+			return;
+		}
+	} else {
+		re = regex_compile(search_get_query(s), &s->regex_error);
+		if (!re)
+			return;
+	}
+
+	job = xcalloc(1, sizeof(*job));
+	job->stream = s->stream;
+	job->generation = s->stream->generation; /* Only the UI writes it */
+	job->snap = buffer_snapshot(buf);
+	job->re = re;
+	job->query = query;
+	job->forest = forest;
+	job->first = s->view_first;
+	job->last = s->view_last;
+	job->batch_count = 0;
+	job->lines = 0;
+	job->hits = 0;
+
+	s->scan_first = job->first;
+	s->scan_last = job->last;
+	worker_submit(s->regex_worker, job);
+}
+
+static void
+run_push(struct search_run *run, const struct search_hit *hit)
+{
+	if (run->count == run->cap) {
+		run->cap = run->cap ? run->cap * 2 : 64;
+		run->hits =
+		    xrealloc(run->hits, (size_t)run->cap * sizeof(*run->hits));
+	}
+	run->hits[run->count++] = *hit;
+}
+
+static int
+run_of(const struct search *s, int line)
+{
+	if (line < s->scan_first)
+		return SEARCH_RUN_ABOVE;
+	if (line <= s->scan_last)
+		return SEARCH_RUN_VIEW;
+	return SEARCH_RUN_BELOW;
+}
+
+/* Collect hits streamed since the last call. Returns true if any */
+static bool
+drain_hits(struct search *s)
+{
+	struct search_stream *st = s->stream;
+	bool changed;
+	int i;
+
+	pthread_mutex_lock(&st->lock);
+	for (i = 0; i < st->pending_count; i++)
+		run_push(&s->runs[run_of(s, st->pending[i].line)],
+			 &st->pending[i]);
+	changed = st->pending_count > 0 || st->lines != s->scan_lines ||
+		  st->done != s->scan_done;
+	s->scan_lines = st->lines;
+	s->scan_done = st->done;
+	st->pending_count = 0;
+	pthread_mutex_unlock(&st->lock);
+	return changed;
+}
+
+/* First hit in run with line >= line */
+static int
+run_lower_bound(const struct search_run *run, int line)
+{
+	int lo = 0, hi = run->count;
+
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+		if (run->hits[mid].line < line)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* Line of the nearest hit from from in dir, or -1 */
+static int
+next_hit_line(const struct search *s, int from, int dir)
+{
+	const struct search_run *run;
+	int r, i;
+
+	if (dir > 0) {
+		for (r = run_of(s, from); r < SEARCH_RUN_COUNT; r++) {
+			run = &s->runs[r];
+			i = run_lower_bound(run, from);
+			if (i < run->count)
+				return run->hits[i].line;
+		}
+	} else {
+		for (r = run_of(s, from); r >= 0; r--) {
+			run = &s->runs[r];
+			i = run_lower_bound(run, from + 1) - 1;
+			if (i >= 0)
+				return run->hits[i].line;
+		}
+	}
+	return -1;
+}
+
+int
+search_hit_count(const struct search *s)
+{
+	int i, n = 0;
+
+	for (i = 0; i < SEARCH_RUN_COUNT; i++)
+		n += s->runs[i].count;
+	return n;
+}
+
+void
+search_init(struct search *s, void (*notify)(void *), void *notify_arg)
+{
+	memset(s, 0, sizeof(*s));
+	arena_init(&s->arena);
+	s->worker =
+	    worker_create(index_job_run, index_job_free, notify, notify_arg);
+
+	s->stream = xcalloc(1, sizeof(*s->stream));
+	pthread_mutex_init(&s->stream->lock, NULL);
+	s->regex_worker =
+	    worker_create(regex_job_run, regex_job_free, notify, notify_arg);
+}
+
+void
+search_destroy(struct search *s)
+{
+	int i;
+
+	worker_destroy(s->worker);
+	worker_destroy(s->regex_worker);
+	pthread_mutex_destroy(&s->stream->lock);
+	xfree(s->stream->pending);
+	xfree(s->stream);
+	for (i = 0; i < SEARCH_RUN_COUNT; i++)
+		xfree(s->runs[i].hits);
+	trigram_destroy(s->index);
+	trigram_destroy(s->built);
+	arena_destroy(&s->arena);
+	memset(s, 0, sizeof(*s));
+}
+
+void
+search_index(struct search *s, struct buffer *buf)
+{
+	struct index_job *job;
+
+	if (s->indexing || search_index_too_large(s))
+		return;
+	s->indexing = true;
+	job = xmalloc(sizeof(*job));
+	job->search = s;
+	job->snap = buffer_snapshot(buf);
+	worker_submit(s->worker, job);
+}
+
+bool
+search_poll(struct search *s, struct buffer *buf)
+{
+	struct trigram_index *idx;
+	bool changed = search_is_scan(s) && drain_hits(s);
+
+	idx = __atomic_exchange_n(&s->built, NULL, __ATOMIC_ACQ_REL);
+	if (!idx) {
+		if (s->indexing && search_index_too_large(s)) {
+			s->indexing = false; /* Queries keep scanning lines */
+			return true;
+		}
+		return changed;
+	}
+
+	s->indexing = false;
+	if (!trigram_update(idx, buf->snap)) {
+		/* Built from a file that has since been reloaded */
+		trigram_destroy(idx);
+		search_index(s, buf);
+		return changed;
+	}
+
+	trigram_destroy(s->index);
+	s->index = idx;
+	if (!search_is_scan(s))
+		search_set_query(s, buf, search_get_query(s));
+	return true;
+}
+
+void
+search_sync(struct search *s, struct buffer *buf)
+{
+	if (s->index && !trigram_update(s->index, buf->snap)) {
+		trigram_destroy(s->index);
+		s->index = NULL;
+		search_index(s, buf);
+	}
+
+	/* Hits refer to the old text: rescan the new snapshot */
+	if (search_is_scan(s))
+		start_scan(s, buf);
+}
+
+void
+search_syntax_changed(struct search *s, struct buffer *buf)
+{
+	if (s->structural)
+		start_scan(s, buf);
+}
+
+bool
+search_is_indexed(const struct search *s)
+{
+	return s->index != NULL;
+}
+
+bool
+search_index_too_large(const struct search *s)
+{
+	return __atomic_load_n(&s->too_large, __ATOMIC_ACQUIRE);
+}
+
+/* ============================================================
+ * QUERIES
+ * ============================================================ */
+
+void
+search_set_query(struct search *s, struct buffer *buf, struct str query)
+{
+	int len = query.len;
+
+	if (len > SEARCH_QUERY_MAX)
+		len = SEARCH_QUERY_MAX;
+	memmove(s->query, query.data, (size_t)len);
+	s->query[len] = '\0';
+	s->query_len = len;
+
+	if (search_is_scan(s)) {
+		start_scan(s, buf);
+		return;
+	}
+
+	arena_reset(&s->arena);
+	s->candidates = NULL;
+	s->candidate_count = buf->line_count;
+	s->scan_all = true;
+
+	if (!s->index && len >= TRIGRAM_MIN_QUERY)
+		search_index(s, buf); /* First use */
+	if (s->index && len >= TRIGRAM_MIN_QUERY) {
+		s->candidate_count = trigram_candidates(
+		    s->index, search_get_query(s), &s->arena, &s->candidates);
+		s->scan_all = false;
+	}
+}
+
+void
+search_set_viewport(struct search *s, int first, int last)
+{
+	s->view_first = first;
+	s->view_last = last;
+}
+
+void
+search_set_regex(struct search *s, struct buffer *buf, bool regex)
+{
+	if (s->regex == regex)
+		return;
+	s->regex = regex;
+	s->structural = false;
+	s->regex_error = NULL;
+	if (!regex)
+		stop_scan(s);
+	search_set_query(s, buf, search_get_query(s));
+}
+
+void
+search_set_structural(struct search *s,
+		      struct buffer *buf,
+		      struct syntax_ctx *syntax,
+		      bool structural)
+{
+	s->syntax = syntax;
+	if (s->structural == structural)
+		return;
+	s->structural = structural;
+	s->regex = false;
+	s->regex_error = NULL;
+	if (!structural)
+		stop_scan(s);
+	search_set_query(s, buf, search_get_query(s));
+}
+
+bool
+search_is_scan(const struct search *s)
+{
+	return s->regex || s->structural;
+}
+
+struct str
+search_get_query(const struct search *s)
+{
+	return str_from_parts(s->query, s->query_len);
+}
+
+int
+search_next(struct search *s, struct buffer *buf, int from, int dir)
+{
+	struct str q = search_get_query(s);
+	int i, lo, hi, line;
+
+	if (str_empty(q))
+		return -1;
+
+	if (search_is_scan(s))
+		return next_hit_line(s, from, dir);
+
+	if (s->scan_all) {
+		/* No index: scan lines directly */
+		for (line = from; line >= 0 && line < buf->line_count;
+		     line += dir)
+			if (str_find(buffer_get_line(buf, line), q).found)
+				return line;
+		return -1;
+	}
+
+	/* Binary search for the first candidate at or past from */
+	lo = 0;
+	hi = s->candidate_count;
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+		if (s->candidates[mid] < from)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	i = lo;
+	if (dir < 0 && (i == s->candidate_count || s->candidates[i] > from))
+		i--;
+
+	for (; i >= 0 && i < s->candidate_count; i += dir) {
+		line = s->candidates[i];
+		if (str_find(buffer_get_line(buf, line), q).found)
+			return line;
+	}
+	return -1;
+}
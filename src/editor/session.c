@@ -0,0 +1,340 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <editor/session.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <core/arena.h>
+#include <core/memory.h>
+
+#define SESSION_MAGIC "WLSESS02"
+
+struct session_header {
+	char magic[8];
+	struct session_key key;
+	int32_t cursor_line;
+	int32_t line_count;
+	int32_t decor_count;
+	int32_t pad;
+	uint64_t index_off; /* struct line_index of line_count + 1 */
+	uint64_t index_len;
+	uint64_t decor_off; /* decor_count x struct session_decor */
+};
+
+struct session_decor {
+	int64_t start;
+	int64_t end;
+	int32_t kind;
+	int32_t data;
+};
+
+struct session {
+	int refs; /* The handle plus every snapshot base using the index */
+	void *map;
+	size_t map_len;
+	const struct session_header *h;
+	const struct line_index *lines;
+};
+
+/* ============================================================
+ * HELPERS
+ * ============================================================ */
+
+static bool
+key_eq(const struct session_key *a, const struct session_key *b)
+{
+	return a->size == b->size && a->mtime_sec == b->mtime_sec &&
+	       a->mtime_nsec == b->mtime_nsec;
+}
+
+static int
+write_all(int fd, const void *data, size_t len)
+{
+	const char *p = data;
+	ssize_t n;
+
+	while (len > 0) {
+		n = write(fd, p, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno;
+		}
+		p += n;
+		len -= (size_t)n;
+	}
+	return 0;
+}
+
+static void
+session_unref(void *arg)
+{
+	struct session *s = arg;
+
+	if (__atomic_sub_fetch(&s->refs, 1, __ATOMIC_ACQ_REL) != 0)
+		return;
+	munmap(s->map, s->map_len);
+	xfree(s);
+}
+
+/* Sections must lie inside the file and the index must be aligned */
+static bool
+header_valid(const struct session_header *h, size_t len)
+{
+	uint64_t decor_len;
+
+	if (memcmp(h->magic, SESSION_MAGIC, sizeof(h->magic)) != 0 ||
+	    h->line_count < 1 || h->decor_count < 0 || h->index_off % 8)
+		return false;
+	decor_len = (uint64_t)h->decor_count * sizeof(struct session_decor);
+	return h->index_off <= len && h->index_len <= len - h->index_off &&
+	       h->decor_off <= len && decor_len <= len - h->decor_off;
+}
+
+/* ============================================================
+ * PUBLIC API
+ * ============================================================ */
+
+bool
+session_path(const char *doc_path, char *out, size_t size)
+{
+	const char *slash = strrchr(doc_path, '/');
+	int dir_len = slash ? (int)(slash - doc_path) + 1 : 0;
+	int n;
+
+	n = snprintf(out,
+		     size,
+		     "%.*s.%s.session",
+		     dir_len,
+		     doc_path,
+		     doc_path + dir_len);
+	return n > 0 && (size_t)n < size;
+}
+
+bool
+session_key(const char *doc_path, struct session_key *key)
+{
+	struct stat st;
+
+	if (stat(doc_path, &st) != 0)
+		return false;
+	memset(key, 0, sizeof(*key));
+	key->size = (uint64_t)st.st_size;
+	key->mtime_sec = (int64_t)st.st_mtim.tv_sec;
+	key->mtime_nsec = (int64_t)st.st_mtim.tv_nsec;
+	return true;
+}
+
+struct session *
+session_open(const char *doc_path, const struct session_key *key)
+{
+	char path[SESSION_PATH_MAX];
+	struct session *s;
+	struct stat st;
+	void *map;
+	int fd;
+
+	if (!session_path(doc_path, path, sizeof(path)))
+		return NULL;
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) != 0 ||
+	    (size_t)st.st_size < sizeof(struct session_header)) {
+		close(fd);
+		return NULL;
+	}
+	map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return NULL;
+
+	s = xcalloc(1, sizeof(*s));
+	s->refs = 1;
+	s->map = map;
+	s->map_len = (size_t)st.st_size;
+	s->h = map;
+	if (!header_valid(s->h, s->map_len) || !key_eq(&s->h->key, key)) {
+		session_unref(s);
+		return NULL;
+	}
+	s->lines = line_index_check((const char *)map + s->h->index_off,
+				    s->h->index_len);
+	if (!s->lines ||
+	    line_index_count(s->lines) != (uint64_t)s->h->line_count + 1) {
+		session_unref(s);
+		return NULL;
+	}
+	return s;
+}
+
+void
+session_close(struct session *s)
+{
+	if (s)
+		session_unref(s);
+}
+
+struct snapshot *
+session_load(struct session *s, const char *doc_path, int *error)
+{
+	struct snapshot *snap;
+
+	__atomic_add_fetch(&s->refs, 1, __ATOMIC_RELAXED);
+	snap = snapshot_map(doc_path, s->lines, session_unref, s, error);
+	if (!snap)
+		session_unref(s);
+	return snap;
+}
+
+struct session_state
+session_state(const struct session *s)
+{
+	struct session_state st;
+
+	st.cursor_line = s->h->cursor_line;
+	return st;
+}
+
+void
+session_restore_decor(const struct session *s, struct decor_tree *t)
+{
+	const struct session_decor *sd;
+	struct decor d;
+	int i;
+
+	sd = (const struct session_decor *)((const char *)s->map +
+					    s->h->decor_off);
+	for (i = 0; i < s->h->decor_count; i++) {
+		if (sd[i].kind < 0 || sd[i].kind >= DECOR_KIND_COUNT)
+			continue;
+		d.start = (long)sd[i].start;
+		d.end = (long)sd[i].end;
+		d.kind = (enum decor_kind)sd[i].kind;
+		d.data = sd[i].data;
+		decor_add(t, d);
+	}
+}
+
+/* Rewrite state and decorations of a cache whose index is current */
+static int
+save_in_place(const char *path,
+	      const struct session_header *h,
+	      const struct session_decor *sd)
+{
+	size_t decor_len = (size_t)h->decor_count * sizeof(*sd);
+	int fd, err = 0;
+
+	fd = open(path, O_WRONLY | O_CLOEXEC);
+	if (fd < 0)
+		return errno;
+
+	/* Decorations first: the header is what makes them visible */
+	errno = 0;
+	if (pwrite(fd, sd, decor_len, (off_t)h->decor_off) !=
+		(ssize_t)decor_len ||
+	    ftruncate(fd, (off_t)(h->decor_off + decor_len)) != 0 ||
+	    pwrite(fd, h, sizeof(*h), 0) != (ssize_t)sizeof(*h) ||
+	    fdatasync(fd) != 0)
+		err = errno ? errno : EIO;
+	close(fd);
+	return err;
+}
+
+/* Write a new cache beside the old one and rename it over */
+static int
+save_full(const char *path,
+	  const struct session_header *h,
+	  const struct line_index *lines,
+	  const struct session_decor *sd)
+{
+	char tmp[SESSION_PATH_MAX + 4];
+	int fd, err;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd < 0)
+		return errno;
+
+	err = write_all(fd, h, sizeof(*h));
+	if (!err)
+		err = write_all(fd, lines, h->index_len);
+	if (!err)
+		err = write_all(fd, sd, (size_t)h->decor_count * sizeof(*sd));
+	if (!err && fdatasync(fd) != 0)
+		err = errno;
+	close(fd);
+	if (!err && rename(tmp, path) != 0)
+		err = errno;
+	if (err)
+		unlink(tmp);
+	return err;
+}
+
+int
+session_save(const char *doc_path,
+	     const struct session_key *key,
+	     struct snapshot *snap,
+	     const struct session_state *state,
+	     struct decor_tree *t)
+{
+	char path[SESSION_PATH_MAX];
+	const struct line_index *lines = snapshot_base_index(snap);
+	int line_count = snapshot_line_count(snap);
+	struct session_header h;
+	struct session_decor *sd;
+	struct session *old;
+	struct decor *d;
+	struct arena a;
+	int i, n, err;
+
+	if (!session_path(doc_path, path, sizeof(path)))
+		return ENAMETOOLONG;
+	if (!text_format_is_plain(snapshot_format(snap)))
+		return 0; /* Decoded text has no index into the file */
+	if (!lines ||
+	    line_index_get(lines, (uint64_t)line_count) != key->size + 1)
+		return EINVAL; /* snap is not the version key names */
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, SESSION_MAGIC, sizeof(h.magic));
+	h.key = *key;
+	h.cursor_line = state->cursor_line;
+	h.line_count = line_count;
+	h.index_off = sizeof(h);
+	h.index_len = line_index_bytes(lines);
+	h.decor_off = h.index_off + h.index_len;
+
+	arena_init(&a);
+	n = decor_query(t, 0, LONG_MAX, &a, &d);
+	sd = arena_array(&a, struct session_decor, n ? n : 1);
+	for (i = 0; i < n; i++) {
+		if (d[i].kind == DECOR_SEARCH_HIT)
+			continue; /* Derived from the search */
+		sd[h.decor_count].start = d[i].start;
+		sd[h.decor_count].end = d[i].end;
+		sd[h.decor_count].kind = (int32_t)d[i].kind;
+		sd[h.decor_count].data = d[i].data;
+		h.decor_count++;
+	}
+
+	/* The index only changes with the document */
+	old = session_open(doc_path, key);
+	if (old && old->h->line_count == line_count) {
+		session_close(old);
+		err = save_in_place(path, &h, sd);
+	} else {
+		session_close(old);
+		err = save_full(path, &h, lines, sd);
+	}
+
+	arena_destroy(&a);
+	return err;
+}
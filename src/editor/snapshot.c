@@ -0,0 +1,725 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <editor/snapshot.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <core/afile.h>
+#include <core/arena.h>
+#include <core/memory.h>
+#include <editor/encoding.h>
+#include <editor/line_index.h>
+
+#define SNAPSHOT_MASK (SNAPSHOT_FANOUT - 1)
+#define LOAD_CHUNK    (1 << 16) /* Bytes read and decoded per step */
+#define EF_MIN_LINES  (1 << 20) /* Compress indexes from this many lines */
+
+/*
+ * Loaded file contents. Immutable once built and shared by every
+ * snapshot derived from the same load.
+ */
+struct snap_base {
+	int refs;
+	struct arena arena;
+	struct str text; /* Decoded: UTF-8, LF */
+	struct text_format format; /* What the file was before decoding */
+	const struct line_index *lines; /* line_count + 1 starts */
+	int line_count;
+	void *map; /* text is mapped rather than read */
+	size_t map_len;
+	void (*done)(void *arg); /* Owner of a borrowed index */
+	void *done_arg;
+};
+
+/* Replacement text for one edited line */
+struct snap_line {
+	int refs;
+	int len;
+	char data[];
+};
+
+/*
+ * Persistent tree node. Kids are snap_node at inner levels and
+ * snap_line at the leaf level (shift 0). NULL means "not edited".
+ *
+ * Edits change line lengths, so byte offsets drift from the base
+ * index. Each node records that drift: delta for its whole
+ * subtree and before[i] for kids 0..i-1, which makes the offset of a
+ * line the base offset plus one before[] per level.
+ */
+struct snap_node {
+	int refs;
+	long delta;
+	long before[SNAPSHOT_FANOUT];
+	void *kids[SNAPSHOT_FANOUT];
+};
+
+struct snapshot {
+	int refs;
+	uint64_t version;
+	long len;  /* Total bytes including newlines between lines */
+	int shift; /* Shift of the root level, multiple of SNAPSHOT_BITS */
+	struct snap_base *base;
+	struct snap_node *root; /* NULL until the first edit */
+};
+
+static uint64_t next_version;
+
+/* ============================================================
+ * REFCOUNTING
+ * ============================================================ */
+
+static void
+ref_inc(int *refs)
+{
+	__atomic_add_fetch(refs, 1, __ATOMIC_RELAXED);
+}
+
+/* Returns true when the last reference was dropped */
+static bool
+ref_dec(int *refs)
+{
+	return __atomic_sub_fetch(refs, 1, __ATOMIC_ACQ_REL) == 0;
+}
+
+static void
+base_release(struct snap_base *b)
+{
+	if (!ref_dec(&b->refs))
+		return;
+	if (b->map)
+		munmap(b->map, b->map_len);
+	if (b->done)
+		b->done(b->done_arg);
+	arena_destroy(&b->arena);
+	xfree(b);
+}
+
+static void
+node_retain(void *kid)
+{
+	/* refs is the first member of both snap_node and snap_line */
+	if (kid)
+		ref_inc((int *)kid);
+}
+
+static void
+node_release(struct snap_node *node, int shift)
+{
+	int i;
+
+	if (!node || !ref_dec(&node->refs))
+		return;
+
+	for (i = 0; i < SNAPSHOT_FANOUT; i++) {
+		if (!node->kids[i])
+			continue;
+		if (shift == 0) {
+			struct snap_line *l = node->kids[i];
+			if (ref_dec(&l->refs))
+				xfree(l);
+		} else {
+			node_release(node->kids[i], shift - SNAPSHOT_BITS);
+		}
+	}
+	xfree(node);
+}
+
+/* ============================================================
+ * LIFECYCLE
+ * ============================================================ */
+
+static struct snapshot *
+snapshot_new(struct snap_base *base, long len, int shift)
+{
+	struct snapshot *s = xcalloc(1, sizeof(*s));
+
+	s->refs = 1;
+	s->version = __atomic_add_fetch(&next_version, 1, __ATOMIC_RELAXED);
+	s->len = len;
+	s->shift = shift;
+	s->base = base;
+	return s;
+}
+
+/* First snapshot of a freshly built base */
+static struct snapshot *
+base_snapshot(struct snap_base *b)
+{
+	int shift = 0;
+
+	/* Smallest tree that addresses every line */
+	while ((long)b->line_count > (long)SNAPSHOT_FANOUT << shift)
+		shift += SNAPSHOT_BITS;
+	return snapshot_new(b, b->text.len, shift);
+}
+
+/* Read up to len bytes, short only at end of file */
+static ssize_t
+read_full(int fd, char *buf, size_t len)
+{
+	size_t got = 0;
+	ssize_t n;
+
+	while (got < len) {
+		n = read(fd, buf + got, len - got);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return -1;
+		if (n == 0)
+			break;
+		got += (size_t)n;
+	}
+	return (ssize_t)got;
+}
+
+/*
+ * Stream the file through the decoder into one arena block, stopping
+ * at the size it was sized for. UTF-8 chunks after the first are read
+ * straight into place and decoded there. Should a later chunk show
+ * the file is not UTF-8 after all, the block is dropped and the file
+ * read again as Latin-1.
+ */
+static int
+base_read_text(struct snap_base *b, int fd, size_t size)
+{
+	struct text_decoder dec;
+	struct text_format format;
+	struct arena_mark mark;
+	char *chunk, *text, *end, *buf;
+	size_t cap, got, want;
+	bool sniffed = false;
+	ssize_t n;
+	int err = 0;
+
+	chunk = xmalloc(LOAD_CHUNK);
+	mark = arena_mark(&b->arena);
+again:
+	n = read_full(fd, chunk, size < LOAD_CHUNK ? size : LOAD_CHUNK);
+	if (n < 0) {
+		err = errno;
+		goto out;
+	}
+
+	if (!sniffed)
+		format = text_sniff(chunk, (size_t)n);
+	text_decoder_init(&dec, format);
+	cap = text_decoded_max(dec.format.encoding, size);
+	if (cap >= INT_MAX) {
+		err = EFBIG;
+		goto out;
+	}
+	text = arena_alloc(&b->arena, cap + 1, 1);
+	end = text_decode(&dec, chunk, (size_t)n, text);
+	got = (size_t)n;
+
+	while (end && got < size) {
+		want = size - got < LOAD_CHUNK ? size - got : LOAD_CHUNK;
+		buf = dec.format.encoding == TEXT_UTF8 ? end : chunk;
+		n = read_full(fd, buf, want);
+		if (n < 0) {
+			err = errno;
+			goto out;
+		}
+		if (n == 0)
+			break; /* Shrank since fstat */
+		end = text_decode(&dec, buf, (size_t)n, end);
+		got += (size_t)n;
+	}
+
+	if (end)
+		end = text_decode_finish(&dec, end);
+	if (!end) {
+		/* Latin-1 decodes anything: this happens at most once */
+		arena_pop(&b->arena, mark);
+		format = dec.format;
+		sniffed = true;
+		if (lseek(fd, 0, SEEK_SET) < 0) {
+			err = errno;
+			goto out;
+		}
+		goto again;
+	}
+
+	*end = '\0';
+	b->text = str_from_parts(text, (int)(end - text));
+	b->format = dec.format;
+out:
+	xfree(chunk);
+	return err;
+}
+
+struct snapshot *
+snapshot_load(const char *path, int *error)
+{
+	enum line_index_kind kind;
+	struct line_index *lines;
+	struct snap_base *b;
+	const char *p, *end;
+	uint64_t universe;
+	struct stat st;
+	int n, fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		*error = errno;
+		return NULL;
+	}
+	if (fstat(fd, &st) != 0) {
+		*error = errno;
+		close(fd);
+		return NULL;
+	}
+
+	b = xcalloc(1, sizeof(*b));
+	b->refs = 1;
+	arena_init(&b->arena);
+
+	*error = base_read_text(b, fd, (size_t)st.st_size);
+	close(fd);
+	if (*error) {
+		base_release(b);
+		return NULL;
+	}
+	end = b->text.data + b->text.len;
+
+	/* Count, size the index, then fill it: no intermediate array */
+	n = 1;
+	for (p = b->text.data; (p = memchr(p, '\n', (size_t)(end - p))); p++)
+		n++;
+
+	kind = n + 1 >= EF_MIN_LINES ? LINE_INDEX_EF : LINE_INDEX_ARRAY;
+	universe = (uint64_t)b->text.len + 2;
+	lines = line_index_init(
+	    arena_alloc(&b->arena,
+			line_index_size(kind, (uint64_t)n + 1, universe),
+			sizeof(uint64_t)),
+	    kind,
+	    (uint64_t)n + 1,
+	    universe);
+	line_index_push(lines, 0);
+	for (p = b->text.data; (p = memchr(p, '\n', (size_t)(end - p))); p++)
+		line_index_push(lines, (uint64_t)(p - b->text.data) + 1);
+	line_index_push(lines, (uint64_t)b->text.len + 1);
+	b->lines = lines;
+	b->line_count = n;
+
+	*error = 0;
+	return base_snapshot(b);
+}
+
+/* Map fd, or read it when the mapping would not end in a NUL */
+static int
+base_map_text(struct snap_base *b, int fd, const char *path, off_t size)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	struct afile_result fr;
+	void *map;
+
+	/* Bytes past EOF in the last page read as zero */
+	if (size > 0 && page > 0 && size % page != 0) {
+		map = mmap(NULL, (size_t)size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map != MAP_FAILED) {
+			b->map = map;
+			b->map_len = (size_t)size;
+			b->text = str_from_parts(map, (int)size);
+			return 0;
+		}
+	}
+
+	fr = afile_read(&b->arena, path);
+	if (fr.error)
+		return fr.error;
+	if (fr.content.len != size)
+		return EINVAL; /* Changed under us */
+	b->text = fr.content;
+	return 0;
+}
+
+struct snapshot *
+snapshot_map(const char *path,
+	     const struct line_index *lines,
+	     void (*done)(void *arg),
+	     void *arg,
+	     int *error)
+{
+	uint64_t count = line_index_count(lines);
+	struct snap_base *b;
+	struct stat st;
+	int fd, err;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		*error = errno;
+		return NULL;
+	}
+	if (fstat(fd, &st) != 0) {
+		*error = errno;
+		close(fd);
+		return NULL;
+	}
+	if (st.st_size >= INT_MAX || count < 2 || count > INT_MAX ||
+	    line_index_get(lines, count - 1) != (uint64_t)st.st_size + 1) {
+		*error = EINVAL;
+		close(fd);
+		return NULL;
+	}
+
+	b = xcalloc(1, sizeof(*b));
+	b->refs = 1;
+	arena_init(&b->arena);
+	err = base_map_text(b, fd, path, st.st_size);
+	close(fd);
+	if (!err) {
+		/* Needs decoding: only snapshot_load does that */
+		b->format = text_sniff(b->text.data, (size_t)b->text.len);
+		if (!text_format_is_plain(b->format))
+			err = EINVAL;
+	}
+	if (err) {
+		*error = err;
+		base_release(b);
+		return NULL;
+	}
+
+	/* Only now: a failed map must not release the caller's index */
+	b->lines = lines;
+	b->line_count = (int)count - 1;
+	b->done = done;
+	b->done_arg = arg;
+
+	*error = 0;
+	return base_snapshot(b);
+}
+
+struct snapshot *
+snapshot_retain(struct snapshot *s)
+{
+	if (s)
+		ref_inc(&s->refs);
+	return s;
+}
+
+void
+snapshot_release(struct snapshot *s)
+{
+	if (!s || !ref_dec(&s->refs))
+		return;
+	node_release(s->root, s->shift);
+	base_release(s->base);
+	xfree(s);
+}
+
+/* ============================================================
+ * EDITING
+ * ============================================================ */
+
+static uint64_t
+base_start(const struct snap_base *b, int line)
+{
+	return line_index_get(b->lines, (uint64_t)line);
+}
+
+static long
+base_line_len(const struct snap_base *b, int line)
+{
+	return (long)(base_start(b, line + 1) - base_start(b, line) - 1);
+}
+
+/* Bytes edits added to the kid holding line (negative if removed) */
+static long
+kid_delta(const struct snap_base *b, const void *kid, int shift, int line)
+{
+	if (!kid)
+		return 0;
+	if (shift == 0)
+		return ((const struct snap_line *)kid)->len -
+		       base_line_len(b, line);
+	return ((const struct snap_node *)kid)->delta;
+}
+
+/* Copy the path to line, sharing every untouched subtree */
+static struct snap_node *
+path_copy(const struct snap_base *b,
+	  struct snap_node *node,
+	  int shift,
+	  int line,
+	  struct snap_line *val)
+{
+	struct snap_node *copy;
+	long d;
+	int i, slot;
+
+	copy = xcalloc(1, sizeof(*copy));
+	copy->refs = 1;
+	slot = (line >> shift) & SNAPSHOT_MASK;
+
+	if (node) {
+		memcpy(copy->kids, node->kids, sizeof(copy->kids));
+		memcpy(copy->before, node->before, sizeof(copy->before));
+		copy->delta = node->delta;
+		for (i = 0; i < SNAPSHOT_FANOUT; i++)
+			if (i != slot)
+				node_retain(copy->kids[i]);
+	}
+
+	if (shift == 0) {
+		copy->kids[slot] = val;
+	} else {
+		copy->kids[slot] = path_copy(b,
+					     node ? node->kids[slot] : NULL,
+					     shift - SNAPSHOT_BITS,
+					     line,
+					     val);
+	}
+
+	/* Shift the offsets of every later kid by the change */
+	d = kid_delta(b, copy->kids[slot], shift, line) -
+	    kid_delta(b, node ? node->kids[slot] : NULL, shift, line);
+	for (i = slot + 1; i < SNAPSHOT_FANOUT; i++)
+		copy->before[i] += d;
+	copy->delta += d;
+	return copy;
+}
+
+struct snapshot *
+snapshot_replace_line(struct snapshot *s, int line, struct str text)
+{
+	struct snapshot *ns;
+	struct snap_line *l;
+	struct str old;
+
+	if (!s || line < 0 || line >= s->base->line_count)
+		return NULL;
+
+	l = xmalloc(sizeof(*l) + (size_t)text.len);
+	l->refs = 1;
+	l->len = text.len;
+	if (text.len)
+		memcpy(l->data, text.data, (size_t)text.len);
+
+	old = snapshot_get_line(s, line);
+	ref_inc(&s->base->refs);
+	ns = snapshot_new(s->base, s->len - old.len + text.len, s->shift);
+	ns->root = path_copy(s->base, s->root, s->shift, line, l);
+	return ns;
+}
+
+/* ============================================================
+ * QUERIES
+ * ============================================================ */
+
+uint64_t
+snapshot_version(const struct snapshot *s)
+{
+	return s ? s->version : 0;
+}
+
+int
+snapshot_line_count(const struct snapshot *s)
+{
+	return s ? s->base->line_count : 0;
+}
+
+bool
+snapshot_is_edited(const struct snapshot *s)
+{
+	return s && s->root != NULL;
+}
+
+struct str
+snapshot_get_line(const struct snapshot *s, int line)
+{
+	const struct snap_base *b;
+	const struct snap_node *node;
+	int shift;
+
+	if (!s || line < 0 || line >= s->base->line_count)
+		return STR_EMPTY;
+
+	node = s->root;
+	shift = s->shift;
+	while (node) {
+		void *kid = node->kids[(line >> shift) & SNAPSHOT_MASK];
+		if (shift == 0) {
+			const struct snap_line *l = kid;
+			if (l)
+				return str_from_parts(l->data, l->len);
+			break;
+		}
+		node = kid;
+		shift -= SNAPSHOT_BITS;
+	}
+
+	b = s->base;
+	return str_from_parts(b->text.data + base_start(b, line),
+			      (int)base_line_len(b, line));
+}
+
+static void
+diff_nodes(const struct snap_node *a,
+	   const struct snap_node *b,
+	   int shift,
+	   int first_line,
+	   void (*fn)(int line, void *arg),
+	   void *arg)
+{
+	int i;
+
+	if (a == b)
+		return;
+
+	for (i = 0; i < SNAPSHOT_FANOUT; i++) {
+		void *ka = a ? a->kids[i] : NULL;
+		void *kb = b ? b->kids[i] : NULL;
+		int line = first_line + (i << shift);
+
+		if (ka == kb)
+			continue;
+		if (shift == 0)
+			fn(line, arg);
+		else
+			diff_nodes(
+			    ka, kb, shift - SNAPSHOT_BITS, line, fn, arg);
+	}
+}
+
+bool
+snapshot_diff(const struct snapshot *a,
+	      const struct snapshot *b,
+	      void (*fn)(int line, void *arg),
+	      void *arg)
+{
+	if (!a || !b || a->base != b->base)
+		return false;
+	diff_nodes(a->root, b->root, a->shift, 0, fn, arg);
+	return true;
+}
+
+long
+snapshot_line_offset(const struct snapshot *s, int line)
+{
+	const struct snap_node *node;
+	long off;
+	int shift, slot;
+
+	if (!s || line <= 0)
+		return 0;
+	if (line >= s->base->line_count)
+		return s->len + 1;
+
+	off = (long)base_start(s->base, line);
+	node = s->root;
+	shift = s->shift;
+	while (node) {
+		slot = (line >> shift) & SNAPSHOT_MASK;
+		off += node->before[slot];
+		if (shift == 0)
+			break;
+		node = node->kids[slot];
+		shift -= SNAPSHOT_BITS;
+	}
+	return off;
+}
+
+/* Last line in [lo, hi] starting at or before offset; lo must qualify */
+static int
+line_search(const struct snapshot *s, long offset, int lo, int hi)
+{
+	while (lo < hi) {
+		int mid = lo + (hi - lo + 1) / 2;
+		if (snapshot_line_offset(s, mid) <= offset)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	return lo;
+}
+
+int
+snapshot_offset_line(const struct snapshot *s, long offset)
+{
+	if (!s || offset <= 0)
+		return 0;
+	return line_search(s, offset, 0, s->base->line_count - 1);
+}
+
+void
+snapshot_offsets_lines(const struct snapshot *s,
+		       const long *offsets,
+		       int *lines,
+		       int n)
+{
+	int i, lo, step, line = 0, last = snapshot_line_count(s) - 1;
+	long off;
+
+	for (i = 0; i < n; i++) {
+		off = offsets[i];
+
+		/* Most offsets stay on the current line */
+		if (line < last && snapshot_line_offset(s, line + 1) <= off) {
+			/* Gallop forward, then binary search the gap */
+			lo = line + 1;
+			step = 1;
+			while (lo + step <= last &&
+			       snapshot_line_offset(s, lo + step) <= off) {
+				lo += step;
+				step *= 2;
+			}
+			line = line_search(
+			    s, off, lo, lo + step <= last ? lo + step : last);
+		}
+		lines[i] = line;
+	}
+}
+
+struct str
+snapshot_base_text(const struct snapshot *s)
+{
+	return s ? s->base->text : STR_EMPTY;
+}
+
+struct text_format
+snapshot_format(const struct snapshot *s)
+{
+	struct text_format plain = {TEXT_UTF8, false, TEXT_EOL_LF};
+
+	return s ? s->base->format : plain;
+}
+
+const struct line_index *
+snapshot_base_index(const struct snapshot *s)
+{
+	return s ? s->base->lines : NULL;
+}
+
+long
+snapshot_text_len(const struct snapshot *s)
+{
+	return s ? s->len : 0;
+}
+
+void
+snapshot_flatten(const struct snapshot *s, char *dst)
+{
+	int i, n;
+
+	n = snapshot_line_count(s);
+	for (i = 0; i < n; i++) {
+		struct str l = snapshot_get_line(s, i);
+		if (l.len) {
+			memcpy(dst, l.data, (size_t)l.len);
+			dst += l.len;
+		}
+		if (i + 1 < n)
+			*dst++ = '\n';
+	}
+	*dst = '\0';
+}
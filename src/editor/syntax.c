@@ -1,150 +1,2693 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <editor/syntax.h>
 
-#include <string.h>
-#include <tree_sitter/api.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <tree_sitter/api.h>
+
+#include <core/arena.h>
+#include <core/error.h>
+#include <core/memory.h>
+#include <core/worker.h>
+#include <editor/regex.h>
+
+#define PARSE_SLICE_US  10000 /* Parse time between cancellation checks */
+#define INJECT_PARSE_US 20000 /* Fences bigger than this stay plain code */
+#define INJECT_MAX	64    /* Fence trees kept, least recently used go */
+#define LANGUAGE_NAME_MAX 32
+#define VIEWPORT_MARGIN 256  /* Rows parsed first beyond those asked */
+#define VIEWPORT_SNAP	4096 /* Rows a window edge looks for a block */
+#define QUERY_CHUNK_BYTES (256 << 10) /* Text a search thread takes */
+
+extern const TSLanguage *tree_sitter_markdown(void);
+
+/* Capture names are the lowercase style names after SYNTAX_STYLE_ */
+static const char highlight_query[] =
+    "[(atx_heading) (setext_heading)] @heading\n"
+    "[(atx_h1_marker) (atx_h2_marker) (atx_h3_marker) (atx_h4_marker)\n"
+    " (atx_h5_marker) (atx_h6_marker) (setext_h1_underline)\n"
+    " (setext_h2_underline) (block_quote_marker)\n"
+    " (fenced_code_block_delimiter) (list_marker_plus)\n"
+    " (list_marker_minus) (list_marker_star) (list_marker_dot)\n"
+    " (list_marker_parenthesis) (task_list_marker_checked)\n"
+    " (task_list_marker_unchecked)] @marker\n"
+    "[(fenced_code_block) (indented_code_block)] @code\n"
+    "(info_string) @code_info\n"
+    "(block_quote) @quote\n"
+    "[(link_label) (link_destination) (link_title)] @link\n"
+    "[(thematic_break) (pipe_table_delimiter_row)] @rule\n"
+    "(html_block) @html\n"
+    "[(minus_metadata) (plus_metadata)] @meta\n"
+    "[(backslash_escape) (entity_reference)\n"
+    " (numeric_character_reference)] @escape\n";
+
+static const char *const style_names[SYNTAX_STYLE_COUNT] = {
+    [SYNTAX_STYLE_NONE] = "none",
+    [SYNTAX_STYLE_HEADING] = "heading",
+    [SYNTAX_STYLE_MARKER] = "marker",
+    [SYNTAX_STYLE_CODE] = "code",
+    [SYNTAX_STYLE_CODE_INFO] = "code_info",
+    [SYNTAX_STYLE_QUOTE] = "quote",
+    [SYNTAX_STYLE_LINK] = "link",
+    [SYNTAX_STYLE_RULE] = "rule",
+    [SYNTAX_STYLE_HTML] = "html",
+    [SYNTAX_STYLE_META] = "meta",
+    [SYNTAX_STYLE_ESCAPE] = "escape",
+};
+
+/* Fences whose content is parsed as the language their info names */
+static const char fence_query[] = "(fenced_code_block\n"
+				  "  (info_string (language) @language)\n"
+				  "  (code_fence_content) @content)\n";
+
+enum { FENCE_LANGUAGE, FENCE_CONTENT }; /* Capture ids in fence_query */
+
+static const char heading_query[] = "[(atx_heading) (setext_heading)] @h\n";
+
+/* A language a fence can name; the host markdown comes first */
+struct language {
+	char name[LANGUAGE_NAME_MAX];
+	const TSLanguage *(*lang)(void);
+	const char *highlights; /* Query source, may be NULL */
+};
+
+static struct language languages[SYNTAX_LANGUAGES_MAX] = {
+    {"markdown", tree_sitter_markdown, highlight_query},
+    {"md", tree_sitter_markdown, highlight_query},
+};
+static int language_count = 2;
+
+/*
+ * Rows [start_row, end_row) of the document and the tree parsed over
+ * them. Unless the document was parsed in sections there is one, over
+ * every row. Rows stay put: lines are replaced, never inserted.
+ */
+struct section {
+	uint32_t start_row;
+	uint32_t end_row; /* UINT32_MAX for the last */
+	TSTree *tree;
+	uint32_t nodes; /* In tree, counted by the worker */
+	bool dirty;	/* Edited since parsed, UI thread only */
+};
+
+/* Trees finished by the worker, waiting for the UI thread */
+struct parse_result {
+	struct section *sections;
+	int *index; /* Section each replaces; NULL: a new forest */
+	int count;
+	uint64_t version; /* Of the snapshot it was parsed from */
+	bool full;	  /* Parsed from scratch */
+	bool viewport;	  /* Only the job's window */
+	bool whole;	  /* Everything changed */
+	TSRange *changed; /* Otherwise, against the trees replaced */
+	uint32_t changed_count;
+	uint32_t changed_cap;
+	uint64_t parse_ns;   /* From the job starting to the trees */
+	uint64_t bytes_read; /* Handed to the parsers by the readers */
+};
+
+struct parse_job {
+	struct syntax_ctx *ctx;
+	struct snapshot *snap;
+	struct section *old; /* Edited copies of the sections to reparse */
+	int *index;	     /* Their place in the forest */
+	int old_count;	     /* 0: parse from scratch */
+	int threads;	     /* From scratch, sections parsed at once */
+	bool viewport;	     /* Parse window alone first */
+	TSRange window;
+};
+
+/* A language's highlight query, compiled on first use */
+struct lang_query {
+	TSQuery *query;
+	uint8_t *capture_style; /* enum syntax_style per capture id */
+	bool failed;
+};
+
+/*
+ * A fence parsed as the language its info string names. Its tree is
+ * in document coordinates, limited to the fence content by included
+ * ranges, so edits apply to it as they do to the host tree.
+ */
+struct injection {
+	int lang; /* Index into languages[] */
+	uint32_t start_byte; /* Of the code_fence_content, kept edited */
+	uint32_t end_byte;
+	TSTree *tree; /* NULL if the parse ran out of time */
+	bool dirty;  /* Edited since parsed */
+	bool report; /* Edited since the last poll; only syntax_poll clears */
+	uint64_t used; /* ctx->tick when last highlighted */
+};
+
+/* Reads the snapshot a line at a time, remembering the last line */
+struct snapshot_reader {
+	struct snapshot *snap;
+	long len;
+	int line;
+	long line_start;
+	uint64_t bytes; /* Handed out so far */
+};
+
+struct syntax_ctx {
+	TSParser *parser; /* Worker only */
+	TSParser *helpers[SYNTAX_THREADS_MAX - 1]; /* Lent to helper threads */
+	int threads; /* Set on the UI thread, copied into jobs */
+	struct section *forest; /* UI thread only, by row */
+	int forest_count;
+	struct worker *worker;
+	struct parse_result *ready; /* Atomic hand-over to the UI thread */
+	size_t cancel; /* Atomic, read by the parser while it runs */
+
+	/* Highlighting and injections, UI thread only */
+	struct snapshot *snap; /* Text the UI last handed in */
+	TSQueryCursor *query_cursor;
+	struct lang_query queries[SYNTAX_LANGUAGES_MAX];
+	TSQuery *fences;
+	TSQuery *headings;
+	TSParser *inject_parser;
+	struct injection inject[INJECT_MAX];
+	int inject_count;
+	uint64_t tick; /* Bumped by each syntax_highlight */
+
+	/* tree-sitter memory of trees, parsers and queries */
+	struct syntax_account mem;
+
+	/* Counters, UI thread only */
+	struct syntax_stats stats;
+};
+
+/* ============================================================
+ * STATS
+ * ============================================================ */
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void
+timing_add(struct syntax_timing *t, uint64_t ns)
+{
+	t->count++;
+	t->last_ns = ns;
+	t->total_ns += ns;
+	if (ns > t->max_ns)
+		t->max_ns = ns;
+}
+
+/* Every node of tree, anonymous ones included */
+static uint32_t
+count_nodes(const TSTree *tree)
+{
+	TSTreeCursor c = ts_tree_cursor_new(ts_tree_root_node(tree));
+	uint32_t n = 1;
+
+	for (;;) {
+		if (ts_tree_cursor_goto_first_child(&c)) {
+			n++;
+			continue;
+		}
+		while (!ts_tree_cursor_goto_next_sibling(&c)) {
+			if (!ts_tree_cursor_goto_parent(&c)) {
+				ts_tree_cursor_delete(&c);
+				return n;
+			}
+		}
+		n++;
+	}
+}
+
+/* ============================================================
+ * SNAPSHOT INPUT
+ * ============================================================ */
+
+/* TSInput read callback: the rest of the line holding byte */
+static const char *
+snapshot_read(void *payload, uint32_t byte, TSPoint pos, uint32_t *read)
+{
+	struct snapshot_reader *r = payload;
+	struct str line;
+	long off = (long)byte, col;
+
+	(void)pos;
+	if (off >= r->len) {
+		*read = 0;
+		return "";
+	}
+
+	/* Parsers mostly read on from where they stopped */
+	line = snapshot_get_line(r->snap, r->line);
+	if (off < r->line_start || off > r->line_start + line.len) {
+		if (off == r->line_start + line.len + 1) {
+			r->line++;
+		} else {
+			r->line = snapshot_offset_line(r->snap, off);
+		}
+		r->line_start = snapshot_line_offset(r->snap, r->line);
+		line = snapshot_get_line(r->snap, r->line);
+	}
+
+	col = off - r->line_start;
+	if (col == line.len) {
+		*read = 1;
+		r->bytes++;
+		return "\n";
+	}
+	*read = (uint32_t)(line.len - col);
+	r->bytes += *read;
+	return line.data + col;
+}
+
+static TSInput
+snapshot_input(struct snapshot_reader *r, struct snapshot *snap)
+{
+	TSInput in;
+
+	r->snap = snap;
+	r->len = snapshot_text_len(snap);
+	r->line = 0;
+	r->line_start = 0;
+	r->bytes = 0;
+	in.payload = r;
+	in.read = snapshot_read;
+	in.encoding = TSInputEncodingUTF8;
+	return in;
+}
+
+/* ============================================================
+ * BACKGROUND PARSING
+ * ============================================================ */
+
+static void
+result_free(struct parse_result *res)
+{
+	int i;
+
+	if (!res)
+		return;
+	for (i = 0; i < res->count; i++)
+		if (res->sections[i].tree)
+			ts_tree_delete(res->sections[i].tree);
+	xfree(res->sections);
+	xfree(res->index);
+	xfree(res->changed);
+	xfree(res);
+}
+
+static struct parse_result *
+result_new(struct parse_job *job, int count, uint64_t start)
+{
+	struct parse_result *res = xcalloc(1, sizeof(*res));
+
+	res->sections = xcalloc((size_t)count, sizeof(*res->sections));
+	res->count = count;
+	res->version = snapshot_version(job->snap);
+	res->parse_ns = now_ns() - start;
+	return res;
+}
+
+static void
+result_add(struct parse_result *res, TSRange r)
+{
+	if (res->changed_count == res->changed_cap) {
+		res->changed_cap =
+		    res->changed_cap ? res->changed_cap * 2 : 16;
+		res->changed = xrealloc(
+		    res->changed, res->changed_cap * sizeof(*res->changed));
+	}
+	res->changed[res->changed_count++] = r;
+}
+
+/*
+ * Add the n ranges tree-sitter returned in r, freeing them, cut to
+ * bound (may be NULL): a section compared with a tree over other rows
+ * differs everywhere outside it.
+ */
+static void
+result_changed(struct parse_result *res,
+	       TSRange *r,
+	       uint32_t n,
+	       const TSRange *bound)
+{
+	TSRange c;
+	uint32_t i;
+
+	for (i = 0; i < n; i++) {
+		c = r[i];
+		if (bound && c.start_byte < bound->start_byte) {
+			c.start_byte = bound->start_byte;
+			c.start_point = bound->start_point;
+		}
+		if (bound && c.end_byte > bound->end_byte) {
+			c.end_byte = bound->end_byte;
+			c.end_point = bound->end_point;
+		}
+		if (c.start_byte < c.end_byte)
+			result_add(res, c);
+	}
+	syntax_alloc_free(r); /* Allocated by tree-sitter */
+}
+
+static TSParser *
+parser_new(struct syntax_ctx *ctx)
+{
+	TSParser *parser = ts_parser_new();
+
+	if (!parser ||
+	    !ts_parser_set_language(parser, tree_sitter_markdown())) {
+		ts_parser_delete(parser);
+		return NULL;
+	}
+	ts_parser_set_timeout_micros(parser, PARSE_SLICE_US);
+	ts_parser_set_cancellation_flag(parser, &ctx->cancel);
+	return parser;
+}
+
+/* Parse in slices until done or cancelled; NULL if cancelled */
+static TSTree *
+parse_slices(struct worker *w,
+	     TSParser *parser,
+	     const TSTree *old,
+	     struct snapshot *snap,
+	     uint64_t *bytes)
+{
+	struct snapshot_reader r;
+	TSTree *tree;
+
+	/* A timed-out parse resumes where it stopped, reading on */
+	do {
+		tree = ts_parser_parse(parser, old, snapshot_input(&r, snap));
+		*bytes += r.bytes;
+	} while (!tree && !worker_cancelled(w));
+	return tree;
+}
+
+/*
+ * Hand res to the UI thread, replacing one it never picked up. The worker
+ * alone publishes, so res can still be marked once the slot is emptied:
+ * changes against a window tree the UI never adopted mean nothing to it.
+ */
+static void
+publish(struct worker *w, struct syntax_ctx *ctx, struct parse_result *res)
+{
+	struct parse_result *stale;
+
+	stale = __atomic_exchange_n(&ctx->ready, NULL, __ATOMIC_ACQ_REL);
+	if (stale && stale->viewport)
+		res->whole = true;
+	result_free(stale);
+	__atomic_store_n(&ctx->ready, res, __ATOMIC_RELEASE);
+	worker_notify(w);
+}
+
+/* ============================================================
+ * SECTIONS
+ * ============================================================ */
+
+static bool
+is_blank(struct str line)
+{
+	int i;
+
+	for (i = 0; i < line.len; i++)
+		if (line.data[i] != ' ' && line.data[i] != '\t' &&
+		    line.data[i] != '\r')
+			return false;
+	return true;
+}
+
+/*
+ * Length of the fence marker line starts with, its char in *ch, and
+ * whether nothing follows it in *bare (only such can close); or 0.
+ */
+static int
+fence_marker(struct str line, char *ch, bool *bare)
+{
+	int i = 0, n = 0;
+
+	while (i < line.len && i < 3 && line.data[i] == ' ')
+		i++;
+	if (i == line.len || (line.data[i] != '`' && line.data[i] != '~'))
+		return 0;
+	*ch = line.data[i];
+	while (i + n < line.len && line.data[i + n] == *ch)
+		n++;
+	*bare = is_blank(str_from_parts(line.data + i + n, line.len - i - n));
+	return n >= 3 ? n : 0;
+}
+
+/* Level of the atx heading on line, or 0 */
+static int
+atx_level(struct str line)
+{
+	int i = 0, n = 0;
+
+	while (i < line.len && i < 3 && line.data[i] == ' ')
+		i++;
+	while (i + n < line.len && line.data[i + n] == '#')
+		n++;
+	if (n == 0 || n > 6)
+		return 0;
+	if (i + n < line.len && line.data[i + n] != ' ' &&
+	    line.data[i + n] != '\t')
+		return 0;
+	return n;
+}
+
+/* Whether line could underline a setext heading with c ('=' or '-') */
+static bool
+is_underline(struct str line, char c)
+{
+	int i = 0;
+
+	while (i < line.len && i < 3 && line.data[i] == ' ')
+		i++;
+	if (i == line.len || line.data[i] != c)
+		return false;
+	while (i < line.len && line.data[i] == c)
+		i++;
+	return is_blank(str_from_parts(line.data + i, line.len - i));
+}
+
+/* Bytes of s in snap */
+static TSRange
+section_range(struct snapshot *snap, const struct section *s)
+{
+	TSRange r;
+
+	r.start_byte = (uint32_t)snapshot_line_offset(snap, (int)s->start_row);
+	r.start_point.row = s->start_row;
+	r.start_point.column = 0;
+	if (s->end_row == UINT32_MAX) {
+		r.end_byte = UINT32_MAX;
+		r.end_point.row = UINT32_MAX;
+		r.end_point.column = UINT32_MAX;
+	} else {
+		r.end_byte =
+		    (uint32_t)snapshot_line_offset(snap, (int)s->end_row);
+		r.end_point.row = s->end_row;
+		r.end_point.column = 0;
+	}
+	return r;
+}
+
+/*
+ * Calls fn(arg, row, line, level) on each row of snap outside fenced
+ * blocks, with level the top level heading starting there (1-6) or 0.
+ * Setext underlines are reported as headings where the text is not
+ * known to be a paragraph: splitting may not rely on them being text.
+ */
+static void
+each_block_row(struct snapshot *snap,
+	       void (*fn)(void *, int, struct str, int),
+	       void *arg)
+{
+	int lines = snapshot_line_count(snap), row, fence = 0, n;
+	struct str line;
+	bool blank = true, bare;
+	char fch = 0, ch;
+
+	for (row = 0; row < lines; row++) {
+		line = snapshot_get_line(snap, row);
+		n = fence_marker(line, &ch, &bare);
+		if (fence) {
+			if (n >= fence && ch == fch && bare)
+				fence = 0;
+			blank = false;
+			continue;
+		}
+		if (n) {
+			fence = n;
+			fch = ch;
+		}
+		if (!blank && is_underline(line, '='))
+			fn(arg, row, line, 1);
+		else if (!blank && is_underline(line, '-'))
+			fn(arg, row, line, 2);
+		else
+			fn(arg, row, line, n ? 0 : atx_level(line));
+		blank = is_blank(line);
+	}
+}
+
+struct splitter {
+	int top;  /* Lowest heading level in the text */
+	int rows; /* At least, per section */
+	int start;
+	bool blank; /* The row before was */
+	struct section *s;
+	int count;
+	int cap;
+};
+
+static void
+find_top(void *arg, int row, struct str line, int level)
+{
+	struct splitter *sp = arg;
+
+	(void)row;
+	(void)line;
+	if (level && level < sp->top)
+		sp->top = level;
+}
+
+static void
+find_cuts(void *arg, int row, struct str line, int level)
+{
+	struct splitter *sp = arg;
+
+	/* A top heading closes every section the grammar has open */
+	if (level == sp->top && sp->blank && line.len > 0 &&
+	    line.data[0] == '#' && row - sp->start >= sp->rows) {
+		if (sp->count == sp->cap) {
+			sp->cap = sp->cap ? sp->cap * 2 : 16;
+			sp->s = xrealloc(
+			    sp->s, (size_t)sp->cap * sizeof(*sp->s));
+		}
+		sp->s[sp->count].start_row = (uint32_t)sp->start;
+		sp->s[sp->count++].end_row = (uint32_t)row;
+		sp->start = row;
+	}
+	sp->blank = is_blank(line);
+}
+
+/*
+ * Cut snap into sections of at least rows rows. Each starts on an atx
+ * heading of the top level in column 0 after a blank row, outside
+ * fenced blocks: no block reaches across, so every section parses as
+ * it would in the whole document. Returns how many, their rows in
+ * *out and their bytes in *ranges.
+ */
+static int
+split_sections(struct snapshot *snap,
+	       int rows,
+	       struct section **out,
+	       TSRange **ranges)
+{
+	struct splitter sp = {0};
+	TSRange *r;
+	int i;
+
+	sp.top = 7;
+	sp.rows = rows;
+	sp.blank = true;
+	if (rows < snapshot_line_count(snap)) {
+		each_block_row(snap, find_top, &sp);
+		each_block_row(snap, find_cuts, &sp);
+	}
+	sp.s = xrealloc(sp.s, (size_t)(sp.count + 1) * sizeof(*sp.s));
+	sp.s[sp.count].start_row = (uint32_t)sp.start;
+	sp.s[sp.count++].end_row = UINT32_MAX;
+
+	r = xmalloc((size_t)sp.count * sizeof(*r));
+	for (i = 0; i < sp.count; i++) {
+		sp.s[i].tree = NULL;
+		sp.s[i].nodes = 0;
+		sp.s[i].dirty = false;
+		r[i] = section_range(snap, &sp.s[i]);
+	}
+	*out = sp.s;
+	*ranges = r;
+	return sp.count;
+}
+
+/* Sections parsed from scratch by the worker and its helper threads */
+struct section_work {
+	struct syntax_ctx *ctx;
+	struct worker *w;
+	struct snapshot *snap;
+	struct section *sections;
+	const TSRange *ranges;
+	int count;
+	int next;	/* Atomic: the first section no thread took */
+	uint64_t bytes; /* Atomic */
+};
+
+struct helper {
+	struct section_work *work;
+	TSParser *parser;
+	pthread_t thread;
+};
+
+/* Take sections until none is left or the job is cancelled */
+static void
+parse_sections(struct section_work *sw, TSParser *parser)
+{
+	uint64_t bytes = 0;
+	TSTree *tree;
+	int i;
+
+	while ((i = __atomic_fetch_add(&sw->next, 1, __ATOMIC_RELAXED)) <
+	       sw->count) {
+		ts_parser_reset(parser);
+		ts_parser_set_included_ranges(parser, &sw->ranges[i], 1);
+		tree = parse_slices(sw->w, parser, NULL, sw->snap, &bytes);
+		if (!tree)
+			break;
+		sw->sections[i].tree = tree;
+		sw->sections[i].nodes = count_nodes(tree);
+	}
+	ts_parser_set_included_ranges(parser, NULL, 0);
+	__atomic_add_fetch(&sw->bytes, bytes, __ATOMIC_RELAXED);
+}
+
+static void *
+helper_run(void *arg)
+{
+	struct helper *h = arg;
+
+	syntax_alloc_charge(&h->work->ctx->mem);
+	parse_sections(h->work, h->parser);
+	return NULL;
+}
+
+/*
+ * Parse job->snap from scratch: in sections spread over job->threads
+ * threads, or as one tree with one thread. NULL if cancelled.
+ */
+static struct parse_result *
+parse_forest(struct worker *w,
+	     struct parse_job *job,
+	     uint64_t start,
+	     TSRange **ranges)
+{
+	struct syntax_ctx *ctx = job->ctx;
+	struct helper helpers[SYNTAX_THREADS_MAX - 1];
+	struct section_work sw = {0};
+	struct parse_result *res;
+	int lines = snapshot_line_count(job->snap), rows, threads, i;
+
+	rows = lines / (job->threads * 4);
+	if (job->threads <= 1)
+		rows = lines;
+	else if (rows < SYNTAX_SECTION_ROWS)
+		rows = SYNTAX_SECTION_ROWS;
+
+	sw.ctx = ctx;
+	sw.w = w;
+	sw.snap = job->snap;
+	sw.count = split_sections(job->snap, rows, &sw.sections, ranges);
+	sw.ranges = *ranges;
+	threads = job->threads < sw.count ? job->threads : sw.count;
+
+	for (i = 0; i < threads - 1; i++) {
+		if (!ctx->helpers[i])
+			ctx->helpers[i] = parser_new(ctx);
+		helpers[i].work = &sw;
+		helpers[i].parser = ctx->helpers[i];
+		if (pthread_create(
+			&helpers[i].thread, NULL, helper_run, &helpers[i]))
+			die("pthread_create failed");
+	}
+	parse_sections(&sw, ctx->parser);
+	for (i = 0; i < threads - 1; i++)
+		pthread_join(helpers[i].thread, NULL);
+
+	res = xcalloc(1, sizeof(*res));
+	res->sections = sw.sections;
+	res->count = sw.count;
+	res->version = snapshot_version(job->snap);
+	res->bytes_read = sw.bytes;
+	res->parse_ns = now_ns() - start;
+	for (i = 0; i < sw.count; i++) {
+		if (!sw.sections[i].tree) {
+			result_free(res); /* Cancelled */
+			return NULL;
+		}
+	}
+	return res;
+}
+
+/* Reparse the edited sections of job against their old trees */
+static struct parse_result *
+parse_edited(struct worker *w, struct parse_job *job, uint64_t start)
+{
+	struct syntax_ctx *ctx = job->ctx;
+	struct parse_result *res;
+	const TSTree *old;
+	TSRange range, *r;
+	uint32_t n;
+	int i;
+
+	res = result_new(job, job->old_count, start);
+	res->index = xmalloc((size_t)job->old_count * sizeof(*res->index));
+	for (i = 0; i < job->old_count; i++) {
+		old = job->old[i].tree;
+		res->index[i] = job->index[i];
+		res->sections[i] = job->old[i];
+
+		/*
+		 * Rows are never inserted, so a section keeps its rows; an
+		 * edited tree's ranges may have grown over its neighbour's.
+		 */
+		range = section_range(job->snap, &job->old[i]);
+		ts_parser_set_included_ranges(ctx->parser, &range, 1);
+		res->sections[i].tree = parse_slices(
+		    w, ctx->parser, old, job->snap, &res->bytes_read);
+		if (!res->sections[i].tree) {
+			result_free(res);
+			res = NULL;
+			break;
+		}
+		res->sections[i].nodes = count_nodes(res->sections[i].tree);
+		r = ts_tree_get_changed_ranges(old, res->sections[i].tree, &n);
+		result_changed(res, r, n, NULL);
+	}
+	ts_parser_set_included_ranges(ctx->parser, NULL, 0);
+	if (res)
+		res->parse_ns = now_ns() - start;
+	return res;
+}
+
+/*
+ * A viewport job publishes the tree of its window, then parses the
+ * whole text from scratch and reports what differs from the window's
+ * tree: the rows outside it, and inside only what the rows around
+ * changed, which snapping the window to block boundaries avoids.
+ */
+static void
+parse_job_run(struct worker *w, void *arg)
+{
+	struct parse_job *job = arg;
+	struct syntax_ctx *ctx = job->ctx;
+	struct parse_result *res;
+	uint64_t start = now_ns(), bytes = 0;
+	TSRange *ranges = NULL, *r;
+	TSTree *partial = NULL;
+	uint32_t n;
+	int i;
+
+	/*
+	 * The UI thread raises the flag before submitting, so a job that
+	 * starts is the newest one. A flag raised just before an older job
+	 * started and cleared it here is caught by the slice timeout.
+	 */
+	__atomic_store_n(&ctx->cancel, 0, __ATOMIC_RELEASE);
+	syntax_alloc_charge(&ctx->mem); /* This worker serves ctx alone */
+	ts_parser_reset(ctx->parser);
+
+	if (job->old_count > 0) {
+		res = parse_edited(w, job, start);
+		if (res)
+			publish(w, ctx, res);
+		return;
+	}
+
+	if (job->viewport) {
+		ts_parser_set_included_ranges(ctx->parser, &job->window, 1);
+		partial =
+		    parse_slices(w, ctx->parser, NULL, job->snap, &bytes);
+		ts_parser_set_included_ranges(ctx->parser, NULL, 0);
+		if (!partial)
+			return;
+		res = result_new(job, 1, start);
+		res->sections[0].start_row = job->window.start_point.row;
+		res->sections[0].end_row = job->window.end_point.row;
+		res->sections[0].tree = ts_tree_copy(partial);
+		res->sections[0].nodes = count_nodes(partial);
+		res->full = res->viewport = res->whole = true;
+		res->bytes_read = bytes;
+		publish(w, ctx, res);
+		start = now_ns();
+	}
+
+	res = parse_forest(w, job, start, &ranges);
+	if (res && partial) {
+		for (i = 0; i < res->count; i++) {
+			if (ranges[i].end_byte <= job->window.start_byte ||
+			    ranges[i].start_byte >= job->window.end_byte) {
+				result_add(res, ranges[i]);
+				continue;
+			}
+			r = ts_tree_get_changed_ranges(
+			    partial, res->sections[i].tree, &n);
+			result_changed(res, r, n, &ranges[i]);
+		}
+		res->parse_ns = now_ns() - start; /* Changed ranges included */
+	}
+	if (res) {
+		res->full = true;
+		res->whole = !partial;
+		publish(w, ctx, res);
+	}
+	xfree(ranges);
+	if (partial)
+		ts_tree_delete(partial);
+}
+
+static void
+parse_job_free(void *arg)
+{
+	struct parse_job *job = arg;
+	int i;
+
+	for (i = 0; i < job->old_count; i++)
+		ts_tree_delete(job->old[i].tree);
+	xfree(job->old);
+	xfree(job->index);
+	snapshot_release(job->snap);
+	xfree(job);
+}
+
+static struct parse_job *
+job_new(struct syntax_ctx *ctx, struct snapshot *snap)
+{
+	struct parse_job *job = xcalloc(1, sizeof(*job));
+
+	job->ctx = ctx;
+	job->snap = snapshot_retain(snap);
+	job->threads = ctx->threads;
+	return job;
+}
+
+static void
+submit(struct syntax_ctx *ctx, struct parse_job *job)
+{
+	/* Stop the running parse now rather than at its next slice */
+	__atomic_store_n(&ctx->cancel, 1, __ATOMIC_RELEASE);
+	worker_submit(ctx->worker, job);
+}
+
+/* Reparse every section edited since it was parsed */
+static void
+submit_edited(struct syntax_ctx *ctx, struct snapshot *snap)
+{
+	struct parse_job *job = job_new(ctx, snap);
+	int i, n = 0;
+
+	for (i = 0; i < ctx->forest_count; i++)
+		n += ctx->forest[i].dirty;
+	job->old = xmalloc((size_t)n * sizeof(*job->old));
+	job->index = xmalloc((size_t)n * sizeof(*job->index));
+	for (i = 0; i < ctx->forest_count; i++) {
+		if (!ctx->forest[i].dirty)
+			continue;
+		job->old[job->old_count] = ctx->forest[i];
+		job->old[job->old_count].tree =
+		    ts_tree_copy(ctx->forest[i].tree);
+		job->index[job->old_count++] = i;
+	}
+	submit(ctx, job);
+}
+
+static void
+forest_free(struct syntax_ctx *ctx)
+{
+	int i;
+
+	for (i = 0; i < ctx->forest_count; i++)
+		ts_tree_delete(ctx->forest[i].tree);
+	xfree(ctx->forest);
+	ctx->forest = NULL;
+	ctx->forest_count = 0;
+}
+
+/* Index of the section holding row; there must be a forest */
+static int
+section_of(struct syntax_ctx *ctx, uint32_t row)
+{
+	int lo = 0, hi = ctx->forest_count - 1, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo + 1) / 2;
+		if (ctx->forest[mid].start_row <= row)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	return lo;
+}
+
+/*
+ * Highlight query of language i, compiled on first use. The host's is
+ * fixed, so its errors are bugs; a registered one that fails is left
+ * unhighlighted.
+ */
+static struct lang_query *
+lang_query(struct syntax_ctx *ctx, int i)
+{
+	struct lang_query *q = &ctx->queries[i];
+	const char *src = languages[i].highlights, *name;
+	uint32_t id, n, len, err_offset;
+	TSQueryError err;
+	int st;
+
+	if (q->query || q->failed)
+		return q->query ? q : NULL;
+	if (!src) {
+		q->failed = true;
+		return NULL;
+	}
+	q->query = ts_query_new(languages[i].lang(),
+				src,
+				(uint32_t)strlen(src),
+				&err_offset,
+				&err);
+	if (!q->query) {
+		if (i == 0)
+			die("syntax: highlight query error %d at %u\n",
+			    (int)err,
+			    err_offset);
+		warn("syntax: %s highlight query error %d at %u",
+		     languages[i].name,
+		     (int)err,
+		     err_offset);
+		q->failed = true;
+		return NULL;
+	}
+
+	n = ts_query_capture_count(q->query);
+	q->capture_style = xcalloc(n ? n : 1, 1);
+	for (id = 0; id < n; id++) {
+		name = ts_query_capture_name_for_id(q->query, id, &len);
+		for (st = 0; st < SYNTAX_STYLE_COUNT; st++)
+			if (strlen(style_names[st]) == len &&
+			    memcmp(style_names[st], name, len) == 0)
+				q->capture_style[id] = (uint8_t)st;
+	}
+	return q;
+}
+
+static void
+init_highlights(struct syntax_ctx *ctx)
+{
+	uint32_t err_offset;
+	TSQueryError err;
+
+	lang_query(ctx, 0);
+	ctx->query_cursor = ts_query_cursor_new();
+	ctx->fences = ts_query_new(tree_sitter_markdown(),
+				   fence_query,
+				   sizeof(fence_query) - 1,
+				   &err_offset,
+				   &err);
+	if (!ctx->fences)
+		die("syntax: fence query error %d at %u\n",
+		    (int)err,
+		    err_offset);
+	ctx->headings = ts_query_new(tree_sitter_markdown(),
+				     heading_query,
+				     sizeof(heading_query) - 1,
+				     &err_offset,
+				     &err);
+	if (!ctx->headings)
+		die("syntax: heading query error %d at %u\n",
+		    (int)err,
+		    err_offset);
+	ctx->inject_parser = ts_parser_new();
+	ts_parser_set_timeout_micros(ctx->inject_parser, INJECT_PARSE_US);
+}
+
+static void
+inject_clear(struct syntax_ctx *ctx)
+{
+	int i;
+
+	for (i = 0; i < ctx->inject_count; i++)
+		if (ctx->inject[i].tree)
+			ts_tree_delete(ctx->inject[i].tree);
+	ctx->inject_count = 0;
+}
+
+/* Keep the latest snapshot: injected fences are parsed from it */
+static void
+set_snapshot(struct syntax_ctx *ctx, struct snapshot *snap)
+{
+	snapshot_retain(snap);
+	if (ctx->snap)
+		snapshot_release(ctx->snap);
+	ctx->snap = snap;
+}
+
+/*
+ * Move injections along with an edit. One the edit starts before is
+ * dropped, one it touches is edited and reparsed on its next use.
+ */
+static void
+inject_edit(struct syntax_ctx *ctx, const TSInputEdit *edit)
+{
+	struct injection *in;
+	int64_t delta = (int64_t)edit->new_end_byte - edit->old_end_byte;
+	int i;
+
+	for (i = 0; i < ctx->inject_count; i++) {
+		in = &ctx->inject[i];
+		if (edit->start_byte > in->end_byte)
+			continue;
+		if (edit->old_end_byte < in->start_byte) {
+			in->start_byte = (uint32_t)(in->start_byte + delta);
+			in->end_byte = (uint32_t)(in->end_byte + delta);
+		} else if (edit->start_byte < in->start_byte) {
+			if (in->tree)
+				ts_tree_delete(in->tree);
+			ctx->inject[i--] = ctx->inject[--ctx->inject_count];
+			continue;
+		} else {
+			in->end_byte = in->end_byte >= edit->old_end_byte
+					   ? (uint32_t)(in->end_byte + delta)
+					   : edit->new_end_byte;
+			in->dirty = true;
+			in->report = true;
+		}
+		if (in->tree)
+			ts_tree_edit(in->tree, edit);
+	}
+}
+
+/* ============================================================
+ * PUBLIC API
+ * ============================================================ */
+
+struct syntax_ctx *
+syntax_create(struct arena *a, void (*notify)(void *), void *notify_arg)
+{
+	struct syntax_ctx *ctx = arena_new0(a, struct syntax_ctx);
+	struct syntax_account *prev;
+
+	syntax_alloc_install(SYNTAX_ALLOC_DEFAULT);
+	prev = syntax_alloc_charge(&ctx->mem);
+	ctx->parser = parser_new(ctx);
+	if (!ctx->parser) {
+		syntax_alloc_charge(prev);
+		return NULL;
+	}
+	ctx->threads = 1;
+	init_highlights(ctx);
+	syntax_alloc_charge(prev);
+
+	ctx->worker =
+	    worker_create(parse_job_run, parse_job_free, notify, notify_arg);
+	return ctx;
+}
+
+void
+syntax_destroy(struct syntax_ctx *ctx)
+{
+	int i;
+
+	if (!ctx)
+		return;
+	__atomic_store_n(&ctx->cancel, 1, __ATOMIC_RELEASE);
+	worker_destroy(ctx->worker);
+	result_free(ctx->ready);
+	inject_clear(ctx);
+	for (i = 0; i < language_count; i++) {
+		if (ctx->queries[i].query)
+			ts_query_delete(ctx->queries[i].query);
+		xfree(ctx->queries[i].capture_style);
+	}
+	ts_query_delete(ctx->fences);
+	ts_query_delete(ctx->headings);
+	ts_query_cursor_delete(ctx->query_cursor);
+	ts_parser_delete(ctx->inject_parser);
+	if (ctx->snap)
+		snapshot_release(ctx->snap);
+	forest_free(ctx);
+	for (i = 0; i < SYNTAX_THREADS_MAX - 1; i++)
+		if (ctx->helpers[i])
+			ts_parser_delete(ctx->helpers[i]);
+	if (ctx->parser)
+		ts_parser_delete(ctx->parser);
+}
+
+void
+syntax_set_threads(struct syntax_ctx *ctx, int threads)
+{
+	if (!ctx)
+		return;
+	if (threads < 1)
+		threads = 1;
+	if (threads > SYNTAX_THREADS_MAX)
+		threads = SYNTAX_THREADS_MAX;
+	ctx->threads = threads;
+}
+
+void
+syntax_parse(struct syntax_ctx *ctx, struct snapshot *snap)
+{
+	if (!ctx)
+		return;
+	set_snapshot(ctx, snap);
+	inject_clear(ctx);
+	submit(ctx, job_new(ctx, snap));
+}
+
+/*
+ * Nothing above row reaches into it: it is a heading after a blank row
+ * (or, if heading is false, any text after one), or an end of snap.
+ */
+static bool
+is_block_start(struct snapshot *snap, int row, bool heading)
+{
+	struct str line;
+
+	if (row <= 0 || row >= snapshot_line_count(snap))
+		return true;
+	line = snapshot_get_line(snap, row);
+	if (heading ? line.len == 0 || line.data[0] != '#' : is_blank(line))
+		return false;
+	return is_blank(snapshot_get_line(snap, row - 1));
+}
+
+/*
+ * The block start nearest row going by dir (1 or -1), a heading if one
+ * is close, else any block; row itself if there is neither.
+ */
+static int
+snap_row(struct snapshot *snap, int row, int dir)
+{
+	int i;
+
+	for (i = 0; i < VIEWPORT_SNAP; i++)
+		if (is_block_start(snap, row + dir * i, true))
+			return row + dir * i;
+	for (i = 0; i < VIEWPORT_SNAP; i++)
+		if (is_block_start(snap, row + dir * i, false))
+			return row + dir * i;
+	return row;
+}
+
+void
+syntax_parse_viewport(struct syntax_ctx *ctx,
+		      struct snapshot *snap,
+		      uint32_t first_row,
+		      uint32_t last_row)
+{
+	int lines = snapshot_line_count(snap);
+	int first = (int)first_row - VIEWPORT_MARGIN;
+	int end = (int)last_row + 1 + VIEWPORT_MARGIN;
+	struct parse_job *job;
+
+	if (!ctx)
+		return;
+	first = snap_row(snap, first < 0 ? 0 : first, -1);
+	end = snap_row(snap, end > lines ? lines : end, 1);
+	if (first <= 0 && end >= lines) {
+		syntax_parse(ctx, snap);
+		return;
+	}
+
+	set_snapshot(ctx, snap);
+	inject_clear(ctx);
+	job = job_new(ctx, snap);
+	job->viewport = true;
+	job->window.start_byte = (uint32_t)snapshot_line_offset(snap, first);
+	job->window.start_point.row = (uint32_t)first;
+	if (end < lines) {
+		job->window.end_byte =
+		    (uint32_t)snapshot_line_offset(snap, end);
+		job->window.end_point.row = (uint32_t)end;
+	} else {
+		job->window.end_byte = UINT32_MAX;
+		job->window.end_point.row = UINT32_MAX;
+		job->window.end_point.column = UINT32_MAX;
+	}
+	submit(ctx, job);
+}
+
+static TSPoint
+ts_point(struct syntax_point p)
+{
+	TSPoint tp = {p.row, p.col};
+
+	return tp;
+}
+
+static struct syntax_point
+point_from_ts(TSPoint tp)
+{
+	struct syntax_point p = {tp.row, tp.column};
+
+	return p;
+}
+
+void
+syntax_edit(struct syntax_ctx *ctx,
+	    const struct syntax_change *change,
+	    struct snapshot *snap)
+{
+	struct syntax_account *prev;
+	struct parse_job *job;
+	TSInputEdit edit;
+	int i;
+
+	if (!ctx)
+		return;
+	set_snapshot(ctx, snap);
+	if (ctx->forest_count == 0) {
+		submit(ctx, job_new(ctx, snap));
+		return;
+	}
+
+	edit.start_byte = change->start_byte;
+	edit.old_end_byte = change->old_end_byte;
+	edit.new_end_byte = change->new_end_byte;
+	edit.start_point = ts_point(change->start);
+	edit.old_end_point = ts_point(change->old_end);
+	edit.new_end_point = ts_point(change->new_end);
+
+	/* The edited trees keep valid offsets until the new ones arrive */
+	prev = syntax_alloc_charge(&ctx->mem);
+	for (i = 0; i < ctx->forest_count; i++)
+		ts_tree_edit(ctx->forest[i].tree, &edit);
+	inject_edit(ctx, &edit);
+	if (ctx->stats.partial) {
+		/* Still the window: parse it again, then the rest */
+		job = job_new(ctx, snap);
+		job->viewport = true;
+		job->window = section_range(snap, &ctx->forest[0]);
+		submit(ctx, job);
+	} else {
+		ctx->forest[section_of(ctx, change->start.row)].dirty = true;
+		submit_edited(ctx, snap);
+	}
+	syntax_alloc_charge(prev);
+}
+
+/* Rows of an injected fence, from the text it was edited to */
+static struct syntax_range
+fence_range(struct snapshot *snap, const struct injection *in)
+{
+	struct syntax_range r;
+	int row;
+
+	r.start_byte = in->start_byte;
+	r.end_byte = in->end_byte;
+	row = snapshot_offset_line(snap, in->start_byte);
+	r.start.row = (uint32_t)row;
+	r.start.col = r.start_byte - (uint32_t)snapshot_line_offset(snap, row);
+	row = snapshot_offset_line(snap, in->end_byte);
+	r.end.row = (uint32_t)row;
+	r.end.col = r.end_byte - (uint32_t)snapshot_line_offset(snap, row);
+	return r;
+}
+
+int
+syntax_poll(struct syntax_ctx *ctx,
+	    uint64_t version,
+	    struct arena *a,
+	    struct syntax_range **ranges)
+{
+	struct parse_result *res;
+	struct syntax_range *out;
+	struct injection *in;
+	TSNode root;
+	uint32_t i, count, edited = 0, end_byte;
+	TSPoint end;
+
+	*ranges = NULL;
+	if (!ctx)
+		return -1;
+	res = __atomic_exchange_n(&ctx->ready, NULL, __ATOMIC_ACQ_REL);
+	if (!res)
+		return -1;
+	if (res->version != version) {
+		/* Edited since: the parse of the newer text is on its way */
+		ctx->stats.dropped++;
+		result_free(res);
+		return -1;
+	}
+	timing_add(res->viewport ? &ctx->stats.viewport_parse
+		   : res->full	 ? &ctx->stats.full_parse
+				 : &ctx->stats.incremental_parse,
+		   res->parse_ns);
+	ctx->stats.bytes_read = res->bytes_read;
+	ctx->stats.bytes_read_total += res->bytes_read;
+	ctx->stats.partial = res->viewport;
+
+	if (!res->index) {
+		/* A new forest; res frees what is left of the old one */
+		forest_free(ctx);
+		ctx->forest = res->sections;
+		ctx->forest_count = res->count;
+		res->sections = NULL;
+		res->count = 0;
+	}
+	for (i = 0; res->index && i < (uint32_t)res->count; i++) {
+		ts_tree_delete(ctx->forest[res->index[i]].tree);
+		ctx->forest[res->index[i]].tree = res->sections[i].tree;
+		ctx->forest[res->index[i]].nodes = res->sections[i].nodes;
+		ctx->forest[res->index[i]].dirty = false;
+		res->sections[i].tree = NULL;
+	}
+	ctx->stats.sections = ctx->forest_count;
+	ctx->stats.nodes = 0;
+	for (i = 0; i < (uint32_t)ctx->forest_count; i++)
+		ctx->stats.nodes += ctx->forest[i].nodes;
+	root = ts_tree_root_node(ctx->forest[ctx->forest_count - 1].tree);
+	end_byte = ts_node_end_byte(root);
+	end = ts_node_end_point(root);
+
+	count = res->whole ? 1 : res->changed_count;
+	for (i = 0; !res->whole && i < (uint32_t)ctx->inject_count; i++)
+		edited += ctx->inject[i].report;
+	out = arena_array(a, struct syntax_range, count + edited + 1);
+	if (res->whole) {
+		out[0].start_byte = 0;
+		out[0].end_byte = end_byte;
+		out[0].start.row = 0;
+		out[0].start.col = 0;
+		out[0].end = point_from_ts(end);
+	}
+	for (i = 0; !res->whole && i < count; i++) {
+		out[i].start_byte = res->changed[i].start_byte;
+		out[i].end_byte = res->changed[i].end_byte;
+		out[i].start = point_from_ts(res->changed[i].start_point);
+		out[i].end = point_from_ts(res->changed[i].end_point);
+		if (out[i].end_byte > end_byte) { /* The last section's */
+			out[i].end_byte = end_byte;
+			out[i].end = point_from_ts(end);
+		}
+	}
+
+	/*
+	 * Reparsing an edited fence may restyle any row of it, whether the
+	 * reparse is still due or a render already did it
+	 */
+	for (i = 0; i < (uint32_t)ctx->inject_count; i++) {
+		in = &ctx->inject[i];
+		if (edited > 0 && in->report)
+			out[count++] = fence_range(ctx->snap, in);
+		in->report = false;
+	}
+	*ranges = out;
+	ctx->stats.changed_ranges = count;
+	result_free(res);
+	return (int)count;
+}
+
+bool
+syntax_has_tree(struct syntax_ctx *ctx)
+{
+	return ctx && ctx->forest_count > 0;
+}
+
+/* Zero-copy: a view into the line the node starts on */
+struct str
+syntax_node_text(struct syntax_node *node, struct snapshot *snap)
+{
+	struct str line;
+	uint32_t end;
+
+	if (node->start_row >= (uint32_t)snapshot_line_count(snap))
+		return STR_EMPTY;
+	line = snapshot_get_line(snap, (int)node->start_row);
+	end = node->end_row == node->start_row ? node->end_col
+					       : (uint32_t)line.len;
+	if (end > (uint32_t)line.len)
+		end = (uint32_t)line.len;
+	if (node->start_col >= end)
+		return STR_EMPTY;
+	return str_slice(line, (int)node->start_col, (int)end);
+}
+
+/* A TSTreeCursor stopped at the next node to report */
+struct syntax_cursor {
+	struct syntax_ctx *ctx;
+	TSTreeCursor c;
+	struct snapshot *snap;
+	TSPoint from; /* Start of the first row */
+	uint32_t end_row;
+	int section; /* Walked by c */
+	int depth;
+	bool done;
+	bool root_done; /* The sections' roots make one document node */
+};
+
+static void
+fill_node(struct syntax_node *n,
+	  TSNode node,
+	  struct snapshot *snap,
+	  int depth)
+{
+	TSPoint start = ts_node_start_point(node);
+	TSPoint end = ts_node_end_point(node);
+
+	strncpy(n->type, ts_node_type(node), SYNTAX_NODE_TYPE_MAX - 1);
+	n->type[SYNTAX_NODE_TYPE_MAX - 1] = '\0';
+
+	n->start_row = start.row;
+	n->start_col = start.column;
+	n->end_row = end.row;
+	n->end_col = end.column;
+	n->start_byte = ts_node_start_byte(node);
+	n->end_byte = ts_node_end_byte(node);
+	n->depth = depth;
+	n->is_named = true;
+
+	/* Store text view for leaf nodes */
+	if (ts_node_child_count(node) == 0)
+		n->text = syntax_node_text(n, snap);
+	else
+		n->text = STR_EMPTY;
+}
+
+/*
+ * Step to the next node in document order. The cursor descends
+ * straight into the first child reaching the first row, so subtrees
+ * above the viewport are never entered.
+ */
+static void
+cursor_advance(struct syntax_cursor *sc)
+{
+	if (ts_tree_cursor_goto_first_child_for_point(&sc->c, sc->from) >= 0) {
+		sc->depth++;
+		return;
+	}
+	while (!ts_tree_cursor_goto_next_sibling(&sc->c)) {
+		if (!ts_tree_cursor_goto_parent(&sc->c)) {
+			sc->done = true;
+			return;
+		}
+		sc->depth--;
+	}
+}
+
+struct syntax_cursor *
+syntax_cursor_new(struct syntax_ctx *ctx,
+		  struct snapshot *snap,
+		  uint32_t start_row,
+		  uint32_t end_row)
+{
+	struct syntax_account *prev;
+	struct syntax_cursor *sc;
+
+	if (!ctx || ctx->forest_count == 0)
+		return NULL;
+	sc = xcalloc(1, sizeof(*sc));
+	sc->ctx = ctx;
+	sc->section = section_of(ctx, start_row);
+	prev = syntax_alloc_charge(&ctx->mem);
+	sc->c = ts_tree_cursor_new(
+	    ts_tree_root_node(ctx->forest[sc->section].tree));
+	syntax_alloc_charge(prev);
+	sc->snap = snap;
+	sc->from.row = start_row;
+	sc->end_row = end_row;
+	return sc;
+}
+
+/* Move on to the next section overlapping the rows, if any */
+static bool
+cursor_next_section(struct syntax_cursor *sc)
+{
+	struct syntax_ctx *ctx = sc->ctx;
+
+	if (sc->section + 1 >= ctx->forest_count ||
+	    ctx->forest[sc->section + 1].start_row > sc->end_row)
+		return false;
+	sc->section++;
+	ts_tree_cursor_reset(&sc->c,
+			     ts_tree_root_node(ctx->forest[sc->section].tree));
+	sc->depth = 0;
+	sc->done = false;
+	return true;
+}
+
+/* The document node: the roots of the first and last sections joined */
+static void
+fill_root(struct syntax_node *n, struct syntax_cursor *sc)
+{
+	struct syntax_ctx *ctx = sc->ctx;
+	TSNode first = ts_tree_root_node(ctx->forest[0].tree);
+	TSNode last =
+	    ts_tree_root_node(ctx->forest[ctx->forest_count - 1].tree);
+	TSPoint p;
 
-#include <core/arena.h>
+	fill_node(n, first, sc->snap, 0);
+	p = ts_node_end_point(last);
+	n->end_row = p.row;
+	n->end_col = p.column;
+	n->end_byte = ts_node_end_byte(last);
+}
 
-extern const TSLanguage *tree_sitter_markdown(void);
+/*
+ * The walk ends at the first node starting below end_row: every node
+ * after it in document order starts later still, in its section and
+ * in those after.
+ */
+int
+syntax_cursor_next(struct syntax_cursor *sc,
+		   struct syntax_node *page,
+		   int max)
+{
+	TSNode node;
+	int n = 0;
 
-struct syntax_ctx {
-	TSParser *parser;
-	TSTree *tree;
+	while (sc && n < max) {
+		if (sc->done && !cursor_next_section(sc))
+			break;
+		node = ts_tree_cursor_current_node(&sc->c);
+		if (ts_node_start_point(node).row > sc->end_row) {
+			sc->done = true;
+			continue;
+		}
+		if (sc->depth > 0 && ts_node_is_named(node))
+			fill_node(&page[n++], node, sc->snap, sc->depth);
+		else if (sc->depth == 0 && !sc->root_done)
+			fill_root(&page[n++], sc);
+		sc->root_done = true;
+		cursor_advance(sc);
+	}
+	return n;
+}
+
+void
+syntax_cursor_delete(struct syntax_cursor *sc)
+{
+	if (!sc)
+		return;
+	ts_tree_cursor_delete(&sc->c);
+	xfree(sc);
+}
+
+void
+syntax_get_visible_nodes(struct syntax_ctx *ctx,
+			 struct snapshot *snap,
+			 uint32_t start_row,
+			 uint32_t end_row,
+			 struct arena *a,
+			 struct syntax_visible *out)
+{
+	struct syntax_cursor *sc;
+	struct syntax_node *grown;
+	uint64_t start;
+	int n;
+
+	out->nodes = NULL;
+	out->count = 0;
+	out->cap = 0;
+	start = now_ns();
+	sc = syntax_cursor_new(ctx, snap, start_row, end_row);
+	if (!sc)
+		return;
+
+	/* Fill the free tail a page at a time, doubling when it is full */
+	do {
+		if (out->count == out->cap) {
+			out->cap = out->cap ? out->cap * 2 : 64;
+			grown = arena_array(a, struct syntax_node, out->cap);
+			if (out->count)
+				memcpy(grown,
+				       out->nodes,
+				       (size_t)out->count * sizeof(*grown));
+			out->nodes = grown;
+		}
+		n = syntax_cursor_next(
+		    sc, &out->nodes[out->count], out->cap - out->count);
+		out->count += n;
+	} while (n > 0);
+	syntax_cursor_delete(sc);
+	timing_add(&ctx->stats.visible, now_ns() - start);
+	ctx->stats.visible_nodes = (uint32_t)out->count;
+}
+
+/* ============================================================
+ * HIGHLIGHTING
+ * ============================================================ */
+
+/* The part of one capture that falls on one row */
+struct piece {
+	uint32_t row;
+	uint32_t start; /* Columns, end may be SYNTAX_SPAN_EOL */
+	uint32_t end;
+	uint32_t node_start; /* Byte range of the node, for nesting order */
+	uint32_t node_end;
+	uint8_t style;
 };
 
-struct syntax_ctx *
-syntax_create(struct arena *a)
+struct pieces {
+	struct piece *v;
+	int count;
+	int cap;
+};
+
+/* By row, then outer nodes before the nodes inside them */
+static int
+piece_cmp(const void *pa, const void *pb)
 {
-	struct syntax_ctx *ctx = arena_new0(a, struct syntax_ctx);
+	const struct piece *a = pa, *b = pb;
 
-	ctx->parser = ts_parser_new();
-	if (!ctx->parser)
-		return NULL;
+	if (a->row != b->row)
+		return a->row < b->row ? -1 : 1;
+	if (a->node_start != b->node_start)
+		return a->node_start < b->node_start ? -1 : 1;
+	if (a->node_end != b->node_end)
+		return a->node_end > b->node_end ? -1 : 1;
+	return 0;
+}
 
-	if (!ts_parser_set_language(ctx->parser, tree_sitter_markdown())) {
-		ts_parser_delete(ctx->parser);
-		return NULL;
+/*
+ * Paint sp over the sorted, disjoint spans[0..*n), trimming or
+ * splitting whatever it covers. spans has room for two more.
+ */
+static void
+paint(struct syntax_span *spans, int *n, struct syntax_span sp)
+{
+	struct syntax_span out[2];
+	int i, j, k, count = *n;
+
+	if (sp.start >= sp.end)
+		return;
+
+	/* spans[i..j) overlap sp */
+	for (i = 0; i < count && spans[i].end <= sp.start; i++)
+		;
+	for (j = i; j < count && spans[j].start < sp.end; j++)
+		;
+
+	/* Keep the parts of the first and last sticking out of sp */
+	k = 0;
+	if (i < j && spans[i].start < sp.start) {
+		out[k] = spans[i];
+		out[k++].end = sp.start;
+	}
+	if (i < j && spans[j - 1].end > sp.end) {
+		out[k] = spans[j - 1];
+		out[k++].start = sp.end;
+	}
+
+	/* Replace spans[i..j) by head, sp, tail */
+	memmove(&spans[i + k + 1],
+		&spans[j],
+		(size_t)(count - j) * sizeof(*spans));
+	count += k + 1 - (j - i);
+	if (k > 0 && out[0].end == sp.start) {
+		spans[i++] = out[0];
+		spans[i++] = sp;
+		if (k > 1)
+			spans[i] = out[1];
+	} else {
+		spans[i++] = sp;
+		if (k > 0)
+			spans[i] = out[0];
+	}
+	*n = count;
+}
+
+/*
+ * Included ranges of a fence: its content minus the block_continuation
+ * prefixes ("> ", list indent) the host grammar puts on each line.
+ * Returns how many, in *ranges (xmalloc'd).
+ */
+static uint32_t
+fence_ranges(TSNode content, TSRange **ranges)
+{
+	uint32_t i, n = 0, count = ts_node_named_child_count(content);
+	TSRange *r = xmalloc((count + 1) * sizeof(*r));
+	TSNode child;
+	TSPoint at = ts_node_start_point(content);
+	uint32_t at_byte = ts_node_start_byte(content);
+
+	for (i = 0; i <= count; i++) {
+		if (i < count) {
+			child = ts_node_named_child(content, i);
+			if (strcmp(ts_node_type(child), "block_continuation"))
+				continue;
+		} else {
+			child = content; /* The tail after the last prefix */
+		}
+		if (ts_node_start_byte(child) > at_byte || i == count) {
+			r[n].start_byte = at_byte;
+			r[n].start_point = at;
+			r[n].end_byte = i < count ? ts_node_start_byte(child)
+						  : ts_node_end_byte(child);
+			r[n].end_point = i < count ? ts_node_start_point(child)
+						   : ts_node_end_point(child);
+			if (r[n].end_byte > r[n].start_byte)
+				n++;
+		}
+		at_byte = ts_node_end_byte(child);
+		at = ts_node_end_point(child);
+	}
+	*ranges = r;
+	return n;
+}
+
+/* Registered language a (language) node names, or -1 */
+static int
+language_of(struct syntax_ctx *ctx, TSNode node)
+{
+	TSPoint start = ts_node_start_point(node);
+	TSPoint end = ts_node_end_point(node);
+	struct str line, name;
+	int i;
+
+	if (start.row != end.row ||
+	    start.row >= (uint32_t)snapshot_line_count(ctx->snap))
+		return -1;
+	line = snapshot_get_line(ctx->snap, (int)start.row);
+	if (end.column > (uint32_t)line.len)
+		return -1; /* Host tree not caught up with an edit yet */
+	name = str_slice(line, (int)start.column, (int)end.column);
+	for (i = 0; i < language_count; i++)
+		if (str_eq(name, str_from_cstr(languages[i].name)))
+			return i;
+	return -1;
+}
+
+/* Slot for a new injection, evicting the least recently used */
+static struct injection *
+inject_alloc(struct syntax_ctx *ctx)
+{
+	struct injection *in, *lru = NULL;
+	int i;
+
+	if (ctx->inject_count < INJECT_MAX)
+		return &ctx->inject[ctx->inject_count++];
+	for (i = 0; i < ctx->inject_count; i++) {
+		in = &ctx->inject[i];
+		if (!lru || in->used < lru->used)
+			lru = in;
+	}
+	if (lru->used == ctx->tick)
+		return NULL; /* All on screen */
+	if (lru->tree)
+		ts_tree_delete(lru->tree);
+	return lru;
+}
+
+/*
+ * Make sure the fence with content is parsed as lang: reuse its tree
+ * if nothing changed, reparse incrementally if it was edited.
+ */
+static void
+inject_fence(struct syntax_ctx *ctx, int lang, TSNode content)
+{
+	uint32_t start = ts_node_start_byte(content);
+	uint32_t end = ts_node_end_byte(content), n;
+	struct snapshot_reader r;
+	struct injection *in = NULL;
+	TSRange *ranges;
+	TSTree *tree;
+	int i;
+
+	for (i = 0; i < ctx->inject_count && !in; i++)
+		if (ctx->inject[i].start_byte == start &&
+		    ctx->inject[i].lang == lang)
+			in = &ctx->inject[i];
+	if (in && !in->dirty && in->end_byte == end) {
+		in->used = ctx->tick;
+		return;
+	}
+	if (!in) {
+		in = inject_alloc(ctx);
+		if (!in)
+			return;
+		memset(in, 0, sizeof(*in));
+		in->lang = lang;
+		in->start_byte = start;
+	}
+	in->end_byte = end;
+	in->used = ctx->tick;
+	in->dirty = false;
+
+	n = fence_ranges(content, &ranges);
+	ts_parser_set_language(ctx->inject_parser, languages[lang].lang());
+	tree = NULL;
+	if (n > 0 && ts_parser_set_included_ranges(ctx->inject_parser,
+						   ranges,
+						   n))
+		tree = ts_parser_parse(ctx->inject_parser,
+				       in->tree,
+				       snapshot_input(&r, ctx->snap));
+	xfree(ranges);
+	if (!tree)
+		ts_parser_reset(ctx->inject_parser); /* Left plain code */
+	if (in->tree)
+		ts_tree_delete(in->tree);
+	in->tree = tree;
+}
+
+/* Parse the registered fences overlapping [lo, hi) that need it */
+static void
+inject_visible(struct syntax_ctx *ctx, TSPoint lo, TSPoint hi)
+{
+	TSNode language, content;
+	TSQueryMatch m;
+	bool found;
+	int lang, s;
+	uint16_t i;
+
+	s = section_of(ctx, lo.row);
+	for (; s < ctx->forest_count && ctx->forest[s].start_row < hi.row;
+	     s++) {
+		ts_query_cursor_set_point_range(ctx->query_cursor, lo, hi);
+		ts_query_cursor_exec(ctx->query_cursor,
+				     ctx->fences,
+				     ts_tree_root_node(ctx->forest[s].tree));
+		while (ts_query_cursor_next_match(ctx->query_cursor, &m)) {
+			found = false;
+			for (i = 0; i < m.capture_count; i++) {
+				if (m.captures[i].index == FENCE_LANGUAGE) {
+					language = m.captures[i].node;
+					found = true;
+				} else {
+					content = m.captures[i].node;
+				}
+			}
+			if (!found || m.capture_count != 2)
+				continue;
+			lang = language_of(ctx, language);
+			if (lang >= 0)
+				inject_fence(ctx, lang, content);
+		}
+	}
+}
+
+/* Pieces of the captures of q in tree on rows [first_row, last_row] */
+static void
+collect(struct syntax_ctx *ctx,
+	struct lang_query *q,
+	TSTree *tree,
+	uint32_t first_row,
+	uint32_t last_row,
+	struct pieces *ps)
+{
+	TSPoint lo = {first_row, 0}, hi = {last_row + 1, 0};
+	TSPoint start, end;
+	TSQueryMatch match;
+	struct piece *p;
+	uint32_t row, r0, r1, idx;
+	TSNode node;
+	uint8_t style;
+
+	ts_query_cursor_set_point_range(ctx->query_cursor, lo, hi);
+	ts_query_cursor_exec(
+	    ctx->query_cursor, q->query, ts_tree_root_node(tree));
+	while (ts_query_cursor_next_capture(ctx->query_cursor, &match, &idx)) {
+		node = match.captures[idx].node;
+		style = q->capture_style[match.captures[idx].index];
+		start = ts_node_start_point(node);
+		end = ts_node_end_point(node);
+		if (style == SYNTAX_STYLE_NONE)
+			continue;
+
+		/* Split the capture into one piece per visible row */
+		r0 = start.row > first_row ? start.row : first_row;
+		r1 = end.row < last_row ? end.row : last_row;
+		for (row = r0; row <= r1; row++) {
+			if (row == end.row && end.column == 0 &&
+			    row != start.row)
+				break; /* Ends with the newline before */
+			if (ps->count == ps->cap) {
+				ps->cap = ps->cap ? ps->cap * 2 : 64;
+				ps->v = xrealloc(
+				    ps->v, (size_t)ps->cap * sizeof(*ps->v));
+			}
+			p = &ps->v[ps->count++];
+			p->row = row;
+			p->start = row == start.row ? start.column : 0;
+			p->end = row == end.row ? end.column : SYNTAX_SPAN_EOL;
+			p->node_start = ts_node_start_byte(node);
+			p->node_end = ts_node_end_byte(node);
+			p->style = style;
+		}
 	}
-	return ctx;
 }
 
+/*
+ * Fences are painted after the host: their nodes start inside the
+ * fence, so they sort after the @code capture around them.
+ */
 void
-syntax_destroy(struct syntax_ctx *ctx)
+syntax_highlight(struct syntax_ctx *ctx,
+		 uint32_t first_row,
+		 uint32_t last_row,
+		 struct arena *a,
+		 struct syntax_line_spans *out)
 {
-	if (!ctx)
+	uint32_t rows = last_row - first_row + 1, idx;
+	TSPoint lo = {first_row, 0}, hi = {last_row + 1, 0};
+	struct pieces ps = {NULL, 0, 0};
+	struct syntax_account *prev;
+	struct injection *in;
+	uint64_t start;
+	struct lang_query *q;
+	struct syntax_span sp;
+	struct piece *p;
+	int i, j, per_row;
+
+	memset(out, 0, rows * sizeof(*out));
+	if (!ctx || ctx->forest_count == 0 || last_row < first_row)
 		return;
-	if (ctx->tree)
-		ts_tree_delete(ctx->tree);
-	if (ctx->parser)
-		ts_parser_delete(ctx->parser);
+
+	/* Fence trees and lazily compiled queries belong to ctx */
+	start = now_ns();
+	prev = syntax_alloc_charge(&ctx->mem);
+	ctx->tick++;
+	inject_visible(ctx, lo, hi);
+	i = section_of(ctx, first_row);
+	for (; i < ctx->forest_count && ctx->forest[i].start_row <= last_row;
+	     i++)
+		collect(ctx,
+			lang_query(ctx, 0),
+			ctx->forest[i].tree,
+			first_row,
+			last_row,
+			&ps);
+	for (i = 0; i < ctx->inject_count; i++) {
+		in = &ctx->inject[i];
+		if (in->used != ctx->tick || !in->tree)
+			continue;
+		q = lang_query(ctx, in->lang);
+		if (q)
+			collect(ctx, q, in->tree, first_row, last_row, &ps);
+	}
+
+	if (ps.count > 1)
+		qsort(ps.v, (size_t)ps.count, sizeof(*ps.v), piece_cmp);
+	for (i = 0; i < ps.count; i = j) {
+		for (j = i; j < ps.count && ps.v[j].row == ps.v[i].row; j++)
+			;
+		per_row = j - i;
+		idx = ps.v[i].row - first_row;
+		out[idx].spans =
+		    arena_array(a, struct syntax_span, 2 * per_row + 1);
+		for (p = &ps.v[i]; p < &ps.v[j]; p++) {
+			sp.start = p->start;
+			sp.end = p->end;
+			sp.style = p->style;
+			paint(out[idx].spans, &out[idx].count, sp);
+		}
+	}
+	xfree(ps.v);
+	syntax_alloc_charge(prev);
+	timing_add(&ctx->stats.highlight, now_ns() - start);
 }
 
-bool
-syntax_parse(struct syntax_ctx *ctx, struct str source)
+/* ============================================================
+ * HEADINGS
+ * ============================================================ */
+
+/* Level from the marker or underline; title from heading_content */
+static void
+fill_heading(struct syntax_heading *h, TSNode node)
 {
-	TSTree *new_tree;
+	TSNode child, title;
+	TSPoint start, end;
+	const char *type;
+	uint32_t i, n = ts_node_named_child_count(node);
 
-	if (!ctx || str_empty(source))
-		return false;
+	h->row = ts_node_start_point(node).row;
+	h->level = 1;
+	for (i = 0; i < n; i++) {
+		child = ts_node_named_child(node, i);
+		type = ts_node_type(child);
+		if (strncmp(type, "atx_h", 5) == 0)
+			h->level = (uint8_t)(type[5] - '0');
+		else if (strcmp(type, "setext_h2_underline") == 0)
+			h->level = 2;
+	}
+
+	title = ts_node_child_by_field_name(
+	    node, "heading_content", sizeof("heading_content") - 1);
+	if (ts_node_is_null(title)) {
+		h->title_row = h->row;
+		h->title_start = h->title_end = 0;
+		return;
+	}
+	start = ts_node_start_point(title);
+	end = ts_node_end_point(title);
+	h->title_row = start.row;
+	h->title_start = start.column;
+	h->title_end = end.row == start.row ? end.column : SYNTAX_SPAN_EOL;
+}
+
+int
+syntax_headings(struct syntax_ctx *ctx,
+		uint32_t first_row,
+		uint32_t last_row,
+		struct arena *a,
+		struct syntax_heading **out)
+{
+	TSPoint lo = {first_row, 0}, hi = {last_row + 1, 0};
+	struct syntax_heading *h = NULL, *grown;
+	TSQueryMatch m;
+	TSNode node;
+	uint64_t start;
+	int n = 0, cap = 0, s;
+
+	*out = NULL;
+	if (!ctx || ctx->forest_count == 0 || last_row < first_row)
+		return 0;
+
+	start = now_ns();
+	s = section_of(ctx, first_row);
+	for (; s < ctx->forest_count && ctx->forest[s].start_row <= last_row;
+	     s++) {
+		ts_query_cursor_set_point_range(ctx->query_cursor, lo, hi);
+		ts_query_cursor_exec(ctx->query_cursor,
+				     ctx->headings,
+				     ts_tree_root_node(ctx->forest[s].tree));
+		while (ts_query_cursor_next_match(ctx->query_cursor, &m)) {
+			node = m.captures[0].node;
+			if (ts_node_start_point(node).row < first_row)
+				continue; /* Starts above, reaches into rows */
+			if (n == cap) {
+				cap = cap ? cap * 2 : 64;
+				grown =
+				    arena_array(a, struct syntax_heading, cap);
+				if (n)
+					memcpy(grown,
+					       h,
+					       (size_t)n * sizeof(*h));
+				h = grown;
+			}
+			fill_heading(&h[n++], node);
+		}
+	}
+	timing_add(&ctx->stats.headings, now_ns() - start);
+	*out = h;
+	return n;
+}
+
+/* ============================================================
+ * FOLDS
+ * ============================================================ */
+
+static bool
+is_foldable(TSNode node)
+{
+	const char *type = ts_node_type(node);
+
+	return strcmp(type, "section") == 0 || strcmp(type, "list") == 0 ||
+	       strcmp(type, "fenced_code_block") == 0;
+}
+
+/* Last row holding text of node: one ending at column 0 stops above */
+static uint32_t
+last_row(TSNode node)
+{
+	TSPoint end = ts_node_end_point(node);
+
+	if (end.column == 0 && end.row > ts_node_start_point(node).row)
+		return end.row - 1;
+	return end.row;
+}
+
+bool
+syntax_fold_at(struct syntax_ctx *ctx, uint32_t row, struct syntax_fold *out)
+{
+	struct syntax_account *prev;
+	TSPoint at = {row, 1}; /* Past the nodes ending where row starts */
+	TSTreeCursor c;
+	TSNode node, starting = {0}, inner = {0};
+	uint32_t start;
 
-	new_tree = ts_parser_parse_string(
-	    ctx->parser, NULL, str_data(source), (uint32_t)str_len(source));
-	if (!new_tree)
+	if (!ctx || ctx->forest_count == 0)
 		return false;
 
-	if (ctx->tree)
-		ts_tree_delete(ctx->tree);
-	ctx->tree = new_tree;
+	/* No block crosses a section's edge */
+	prev = syntax_alloc_charge(&ctx->mem);
+	c = ts_tree_cursor_new(
+	    ts_tree_root_node(ctx->forest[section_of(ctx, row)].tree));
+	/* Down through the first child reaching into row, at each level */
+	while (ts_tree_cursor_goto_first_child_for_point(&c, at) >= 0) {
+		node = ts_tree_cursor_current_node(&c);
+		start = ts_node_start_point(node).row;
+		if (start > row)
+			break;
+		if (!is_foldable(node) || last_row(node) <= start)
+			continue;
+		if (start == row && ts_node_is_null(starting))
+			starting = node;
+		inner = node;
+	}
+	ts_tree_cursor_delete(&c);
+	syntax_alloc_charge(prev);
 
+	node = ts_node_is_null(starting) ? inner : starting;
+	if (ts_node_is_null(node))
+		return false;
+	out->start_row = ts_node_start_point(node).row;
+	out->end_row = last_row(node);
 	return true;
 }
 
-bool
-syntax_has_tree(struct syntax_ctx *ctx)
+/* ============================================================
+ * STRUCTURAL SEARCH
+ * ============================================================ */
+
+/* #eq?, #match? and their #not- forms, on one capture of a pattern */
+struct query_pred {
+	uint32_t pattern;
+	uint32_t capture;
+	int64_t other;	  /* Capture compared with, or -1: value */
+	struct str value; /* Literal or pattern, owned by the query */
+	bool negate;
+	bool regex;
+};
+
+struct syntax_query {
+	TSQuery *query;
+	struct query_pred *preds; /* By pattern */
+	uint32_t *first;	  /* Per pattern, its first predicate */
+	int pred_count;
+};
+
+struct syntax_forest {
+	struct snapshot *snap; /* The text the trees were edited to */
+	TSTree **trees;	       /* In document order */
+	int count;
+	int threads;
+};
+
+static const char *
+query_error(TSQueryError err)
 {
-	return ctx && ctx->tree != NULL;
+	switch (err) {
+	case TSQueryErrorNodeType:
+		return "unknown node type";
+	case TSQueryErrorField:
+		return "unknown field";
+	case TSQueryErrorCapture:
+		return "unknown capture";
+	case TSQueryErrorStructure:
+		return "impossible pattern";
+	case TSQueryErrorLanguage:
+		return "language mismatch";
+	default:
+		return "syntax error";
+	}
 }
 
-/* Zero-copy text extraction using str_slice */
-struct str
-syntax_node_text(struct syntax_node *node, struct str source)
+/* Parse the predicates of pattern into q; NULL or a description */
+static const char *
+query_preds(struct syntax_query *q, uint32_t pattern, int *cap)
 {
-	return str_slice(source, node->start_byte, node->end_byte);
+	const TSQueryPredicateStep *s;
+	struct query_pred *p;
+	struct regex *re;
+	const char *name, *err;
+	uint32_t n, i, len;
+
+	s = ts_query_predicates_for_pattern(q->query, pattern, &n);
+	for (i = 0; i < n; i += 4) {
+		/* Every supported predicate is: name, capture, argument */
+		if (i + 3 >= n ||
+		    s[i].type != TSQueryPredicateStepTypeString ||
+		    s[i + 1].type != TSQueryPredicateStepTypeCapture ||
+		    s[i + 2].type == TSQueryPredicateStepTypeDone ||
+		    s[i + 3].type != TSQueryPredicateStepTypeDone)
+			return "bad predicate";
+		if (q->pred_count == *cap) {
+			*cap = *cap ? *cap * 2 : 8;
+			q->preds = xrealloc(
+			    q->preds, (size_t)*cap * sizeof(*q->preds));
+		}
+		p = &q->preds[q->pred_count];
+		name = ts_query_string_value_for_id(
+		    q->query, s[i].value_id, &len);
+		p->negate = len > 4 && strncmp(name, "not-", 4) == 0;
+		if (p->negate) {
+			name += 4;
+			len -= 4;
+		}
+		if (len == 3 && strncmp(name, "eq?", 3) == 0)
+			p->regex = false;
+		else if (len == 6 && strncmp(name, "match?", 6) == 0)
+			p->regex = true;
+		else
+			return "unknown predicate";
+		p->pattern = pattern;
+		p->capture = s[i + 1].value_id;
+		p->other = -1;
+		p->value = STR_EMPTY;
+		if (s[i + 2].type == TSQueryPredicateStepTypeCapture) {
+			p->other = s[i + 2].value_id;
+		} else {
+			name = ts_query_string_value_for_id(
+			    q->query, s[i + 2].value_id, &len);
+			p->value = str_from_parts(name, (int)len);
+		}
+		if (p->regex && p->other >= 0)
+			return "match? needs a pattern";
+		if (p->regex) {
+			re = regex_compile(p->value, &err);
+			if (!re)
+				return err;
+			regex_destroy(re);
+		}
+		q->pred_count++;
+	}
+	return NULL;
 }
 
-/* Recursive helper to collect visible nodes */
-static void
-collect_nodes(TSNode node,
-	      struct str source,
-	      uint32_t start_row,
-	      uint32_t end_row,
-	      int depth,
-	      struct syntax_visible *out)
+struct syntax_query *
+syntax_query_new(struct str source, const char **error)
 {
-	TSPoint start, end;
-	uint32_t i, child_count;
+	struct syntax_query *q;
+	struct syntax_account *prev;
+	uint32_t offset, i, n;
+	TSQueryError err;
+	int cap = 0;
+
+	q = xcalloc(1, sizeof(*q));
+	prev = syntax_alloc_charge(NULL);
+	q->query = ts_query_new(tree_sitter_markdown(),
+				source.data,
+				(uint32_t)source.len,
+				&offset,
+				&err);
+	syntax_alloc_charge(prev);
+	if (!q->query) {
+		*error = query_error(err);
+		xfree(q);
+		return NULL;
+	}
+
+	n = ts_query_pattern_count(q->query);
+	q->first = xmalloc((n + 1) * sizeof(*q->first));
+	for (i = 0; i < n; i++) {
+		q->first[i] = (uint32_t)q->pred_count;
+		*error = query_preds(q, i, &cap);
+		if (*error) {
+			syntax_query_delete(q);
+			return NULL;
+		}
+	}
+	q->first[n] = (uint32_t)q->pred_count;
+	return q;
+}
 
-	if (out->count >= SYNTAX_VISIBLE_MAX)
+void
+syntax_query_delete(struct syntax_query *q)
+{
+	if (!q)
 		return;
+	ts_query_delete(q->query);
+	xfree(q->preds);
+	xfree(q->first);
+	xfree(q);
+}
 
-	start = ts_node_start_point(node);
-	end = ts_node_end_point(node);
+struct syntax_forest *
+syntax_forest_copy(struct syntax_ctx *ctx)
+{
+	struct syntax_account *prev;
+	struct syntax_forest *f;
+	int i;
+
+	if (!ctx || ctx->forest_count == 0)
+		return NULL;
+	f = xcalloc(1, sizeof(*f));
+	f->snap = snapshot_retain(ctx->snap);
+	f->count = ctx->forest_count;
+	f->threads = ctx->threads;
+	f->trees = xmalloc((size_t)f->count * sizeof(*f->trees));
+	prev = syntax_alloc_charge(&ctx->mem);
+	for (i = 0; i < f->count; i++)
+		f->trees[i] = ts_tree_copy(ctx->forest[i].tree);
+	syntax_alloc_charge(prev);
+	return f;
+}
 
-	/* Skip if entirely outside visible range */
-	if (end.row < start_row || start.row > end_row)
+void
+syntax_forest_delete(struct syntax_forest *f)
+{
+	int i;
+
+	if (!f)
 		return;
+	for (i = 0; i < f->count; i++)
+		ts_tree_delete(f->trees[i]);
+	xfree(f->trees);
+	snapshot_release(f->snap);
+	xfree(f);
+}
 
-	/* Add named nodes only */
-	if (ts_node_is_named(node)) {
-		struct syntax_node *n = &out->nodes[out->count];
+/* Matches found in one chunk of the text, waiting to be emitted */
+struct query_chunk {
+	struct syntax_match *m;
+	int count;
+	int cap;
+	int done; /* Atomic */
+};
+
+struct query_work {
+	const struct syntax_query *q;
+	struct syntax_forest *f;
+	struct query_chunk *chunks;
+	int count;
+	uint32_t size; /* Bytes a chunk */
+	int next;      /* Atomic: the first chunk no thread took */
+	const int *cancel;
+	int stop; /* Atomic: cancelled, or emit had enough */
+};
+
+/* What one thread needs to run a query: none of it is shareable */
+struct query_run {
+	struct query_work *work;
+	TSTree **trees; /* This thread's copies of the forest's */
+	TSQueryCursor *cursor;
+	struct regex **re; /* Per predicate, NULL unless match? */
+	char *buf[2];	   /* Text of nodes spanning rows, two at once */
+	int buf_cap[2];
+	pthread_t thread;
+};
+
+static bool
+query_stopped(struct query_work *work)
+{
+	return __atomic_load_n(&work->stop, __ATOMIC_RELAXED) ||
+	       __atomic_load_n(work->cancel, __ATOMIC_RELAXED);
+}
 
-		strncpy(n->type, ts_node_type(node), SYNTAX_NODE_TYPE_MAX - 1);
-		n->type[SYNTAX_NODE_TYPE_MAX - 1] = '\0';
+/* Text of node, joined with '\n' across rows into buf[slot] */
+static struct str
+query_text(struct query_run *run, TSNode node, int slot)
+{
+	struct snapshot *snap = run->work->f->snap;
+	TSPoint start = ts_node_start_point(node);
+	TSPoint end = ts_node_end_point(node);
+	struct str line;
+	uint32_t row;
+	int len = 0, from, to;
+
+	for (row = start.row; row <= end.row; row++) {
+		line = snapshot_get_line(snap, (int)row);
+		from = row == start.row ? (int)start.column : 0;
+		to = row == end.row ? (int)end.column : line.len;
+		if (start.row == end.row)
+			return str_slice(line, from, to);
+		line = str_slice(line, from, to);
+		if (len + line.len + 1 > run->buf_cap[slot]) {
+			run->buf_cap[slot] = (len + line.len + 1) * 2;
+			run->buf[slot] = xrealloc(run->buf[slot],
+						  (size_t)run->buf_cap[slot]);
+		}
+		memcpy(run->buf[slot] + len, line.data, (size_t)line.len);
+		len += line.len;
+		if (row < end.row)
+			run->buf[slot][len++] = '\n';
+	}
+	return str_from_parts(run->buf[slot], len);
+}
 
-		n->start_row = start.row;
-		n->start_col = start.column;
-		n->end_row = end.row;
-		n->end_col = end.column;
-		n->start_byte = ts_node_start_byte(node);
-		n->end_byte = ts_node_end_byte(node);
-		n->depth = depth;
-		n->is_named = true;
+/* Whether every capture named by p in m passes it */
+static bool
+query_pred_holds(struct query_run *run,
+		 const TSQueryMatch *m,
+		 const struct query_pred *p,
+		 struct regex *re)
+{
+	struct regex_match rm;
+	struct str a, b;
+	uint16_t i, j;
+	bool ok;
 
-		/* Store text view for leaf nodes (using str_slice) */
-		if (ts_node_child_count(node) == 0) {
-			n->text =
-			    str_slice(source, n->start_byte, n->end_byte);
+	for (i = 0; i < m->capture_count; i++) {
+		if (m->captures[i].index != p->capture)
+			continue;
+		a = query_text(run, m->captures[i].node, 0);
+		if (re) {
+			ok = regex_find(re, a, 0, &rm);
+		} else if (p->other < 0) {
+			ok = str_eq(a, p->value);
 		} else {
-			n->text = STR_EMPTY;
+			ok = true;
+			for (j = 0; ok && j < m->capture_count; j++) {
+				if (m->captures[j].index != p->other)
+					continue;
+				b = query_text(run, m->captures[j].node, 1);
+				ok = str_eq(a, b);
+			}
 		}
+		if (ok == p->negate)
+			return false;
+	}
+	return true;
+}
+
+static int
+match_cmp(const void *pa, const void *pb)
+{
+	const struct syntax_match *a = pa, *b = pb;
+
+	if (a->start_byte != b->start_byte)
+		return a->start_byte < b->start_byte ? -1 : 1;
+	if (a->end_byte != b->end_byte)
+		return a->end_byte < b->end_byte ? -1 : 1;
+	return 0;
+}
+
+/* Collect the matches starting in chunk i, sorted */
+static void
+query_chunk(struct query_run *run, int i)
+{
+	struct query_work *work = run->work;
+	const struct syntax_query *q = work->q;
+	struct query_chunk *c = &work->chunks[i];
+	uint32_t from = (uint32_t)i * work->size, to = from + work->size;
+	struct syntax_match sm;
+	TSQueryMatch m;
+	TSNode root, node;
+	uint32_t k, b, pattern;
+	uint16_t j;
+	int t;
+	bool pass;
 
-		out->count++;
+	for (t = 0; t < work->f->count && !query_stopped(work); t++) {
+		root = ts_tree_root_node(run->trees[t]);
+		if (ts_node_end_byte(root) <= from ||
+		    ts_node_start_byte(root) >= to)
+			continue;
+		ts_query_cursor_set_byte_range(run->cursor, from, to);
+		ts_query_cursor_exec(run->cursor, q->query, root);
+		while (ts_query_cursor_next_match(run->cursor, &m)) {
+			if (m.capture_count == 0)
+				continue;
+			sm.start_byte = UINT32_MAX;
+			sm.end_byte = 0;
+			for (j = 0; j < m.capture_count; j++) {
+				node = m.captures[j].node;
+				b = ts_node_start_byte(node);
+				if (b < sm.start_byte) {
+					sm.start_byte = b;
+					sm.start = point_from_ts(
+					    ts_node_start_point(node));
+				}
+				b = ts_node_end_byte(node);
+				if (b > sm.end_byte) {
+					sm.end_byte = b;
+					sm.end = point_from_ts(
+					    ts_node_end_point(node));
+				}
+			}
+			/* Its own chunk has a match reaching into others */
+			if (sm.start_byte < from || sm.start_byte >= to)
+				continue;
+			pattern = m.pattern_index;
+			pass = true;
+			for (k = q->first[pattern];
+			     pass && k < q->first[pattern + 1];
+			     k++)
+				pass = query_pred_holds(
+				    run, &m, &q->preds[k], run->re[k]);
+			if (!pass)
+				continue;
+			sm.pattern = pattern;
+			if (c->count == c->cap) {
+				c->cap = c->cap ? c->cap * 2 : 16;
+				c->m = xrealloc(
+				    c->m, (size_t)c->cap * sizeof(*c->m));
+			}
+			c->m[c->count++] = sm;
+			if (c->count % 256 == 0 && query_stopped(work))
+				break;
+		}
 	}
+	if (c->count > 1)
+		qsort(c->m, (size_t)c->count, sizeof(*c->m), match_cmp);
+	__atomic_store_n(&c->done, 1, __ATOMIC_RELEASE);
+}
+
+static void
+run_init(struct query_run *run, struct query_work *work)
+{
+	const struct syntax_query *q = work->q;
+	const char *err;
+	int i;
+
+	memset(run, 0, sizeof(*run));
+	run->work = work;
+	run->trees = xmalloc((size_t)work->f->count * sizeof(*run->trees));
+	for (i = 0; i < work->f->count; i++)
+		run->trees[i] = ts_tree_copy(work->f->trees[i]);
+	run->cursor = ts_query_cursor_new();
+	run->re = xcalloc(q->pred_count ? (size_t)q->pred_count : 1,
+			  sizeof(*run->re));
+	for (i = 0; i < q->pred_count; i++)
+		if (q->preds[i].regex)
+			run->re[i] = regex_compile(q->preds[i].value, &err);
+}
+
+static void
+run_destroy(struct query_run *run)
+{
+	int i;
+
+	for (i = 0; i < run->work->q->pred_count; i++)
+		regex_destroy(run->re[i]);
+	xfree(run->re);
+	for (i = 0; i < run->work->f->count; i++)
+		ts_tree_delete(run->trees[i]);
+	xfree(run->trees);
+	xfree(run->buf[0]);
+	xfree(run->buf[1]);
+	ts_query_cursor_delete(run->cursor);
+}
+
+/* Take chunks until none is left; true if one was taken */
+static bool
+query_next(struct query_run *run)
+{
+	struct query_work *work = run->work;
+	int i;
+
+	if (query_stopped(work))
+		return false;
+	i = __atomic_fetch_add(&work->next, 1, __ATOMIC_RELAXED);
+	if (i >= work->count)
+		return false;
+	query_chunk(run, i);
+	return true;
+}
+
+static void *
+query_thread(void *arg)
+{
+	struct query_run *run = arg;
+
+	while (query_next(run))
+		;
+	return NULL;
+}
+
+/* Hand the finished chunks from *emitted on to emit, in order */
+static void
+query_emit(struct query_work *work,
+	   int *emitted,
+	   bool (*emit)(void *, const struct syntax_match *, int),
+	   void *arg)
+{
+	struct query_chunk *c;
 
-	/* Recurse to children */
-	child_count = ts_node_child_count(node);
-	for (i = 0; i < child_count && out->count < SYNTAX_VISIBLE_MAX; i++) {
-		collect_nodes(ts_node_child(node, i),
-			      source,
-			      start_row,
-			      end_row,
-			      depth + 1,
-			      out);
+	while (*emitted < work->count) {
+		c = &work->chunks[*emitted];
+		if (!__atomic_load_n(&c->done, __ATOMIC_ACQUIRE))
+			break;
+		if (!query_stopped(work) && c->count > 0 &&
+		    !emit(arg, c->m, c->count))
+			__atomic_store_n(&work->stop, 1, __ATOMIC_RELAXED);
+		xfree(c->m);
+		c->m = NULL;
+		(*emitted)++;
 	}
 }
 
+bool
+syntax_query_run(const struct syntax_query *q,
+		 struct syntax_forest *f,
+		 const int *cancel,
+		 bool (*emit)(void *, const struct syntax_match *, int),
+		 void *arg)
+{
+	struct query_run runs[SYNTAX_THREADS_MAX];
+	struct query_work work = {0};
+	long len = snapshot_text_len(f->snap);
+	int threads = f->threads, emitted = 0, i;
+	bool done;
+
+	work.q = q;
+	work.f = f;
+	work.cancel = cancel;
+	work.size = QUERY_CHUNK_BYTES;
+	work.count = (int)(len / QUERY_CHUNK_BYTES) + 1;
+	work.chunks = xcalloc((size_t)work.count, sizeof(*work.chunks));
+	if (threads > work.count)
+		threads = work.count;
+
+	for (i = 0; i < threads; i++)
+		run_init(&runs[i], &work);
+	for (i = 1; i < threads; i++)
+		if (pthread_create(
+			&runs[i].thread, NULL, query_thread, &runs[i]))
+			die("pthread_create failed");
+
+	/* Stream what is done in order, between chunks of our own */
+	while (query_next(&runs[0]))
+		query_emit(&work, &emitted, emit, arg);
+	for (i = 1; i < threads; i++)
+		pthread_join(runs[i].thread, NULL);
+	query_emit(&work, &emitted, emit, arg);
+
+	done = !query_stopped(&work);
+	for (i = 0; i < threads; i++)
+		run_destroy(&runs[i]);
+	for (i = emitted; i < work.count; i++)
+		xfree(work.chunks[i].m);
+	xfree(work.chunks);
+	return done;
+}
+
+/* ============================================================
+ * LANGUAGES
+ * ============================================================ */
+
+bool
+syntax_register_language(const char *name,
+			 const struct TSLanguage *(*lang)(void),
+			 const char *highlights)
+{
+	struct language *l;
+
+	if (language_count == SYNTAX_LANGUAGES_MAX ||
+	    strlen(name) >= LANGUAGE_NAME_MAX)
+		return false;
+	l = &languages[language_count++];
+	strcpy(l->name, name);
+	l->lang = lang;
+	l->highlights = highlights;
+	return true;
+}
+
 void
-syntax_get_visible_nodes(struct syntax_ctx *ctx,
-			 struct str source,
-			 uint32_t start_row,
-			 uint32_t end_row,
-			 struct syntax_visible *out)
+syntax_memory(struct syntax_ctx *ctx, struct syntax_account *out)
 {
-	out->count = 0;
+	if (!ctx) {
+		memset(out, 0, sizeof(*out));
+		return;
+	}
+	syntax_alloc_read(&ctx->mem, out);
+}
 
-	if (!ctx || !ctx->tree)
+void
+syntax_stats(struct syntax_ctx *ctx, struct syntax_stats *out)
+{
+	if (!ctx) {
+		memset(out, 0, sizeof(*out));
 		return;
+	}
+	*out = ctx->stats;
+	out->injected = syntax_injected(ctx);
+	syntax_memory(ctx, &out->memory);
+}
+
+int
+syntax_injected(struct syntax_ctx *ctx)
+{
+	int i, n = 0;
 
-	TSNode root = ts_tree_root_node(ctx->tree);
-	collect_nodes(root, source, start_row, end_row, 0, out);
+	for (i = 0; ctx && i < ctx->inject_count; i++)
+		n += ctx->inject[i].tree != NULL;
+	return n;
 }
@@ -0,0 +1,358 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <editor/syntax_alloc.h>
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tree_sitter/api.h>
+
+#include <core/error.h>
+#include <core/memory.h>
+
+#define HEADER	    16 /* sizeof(struct header), keeps blocks aligned */
+#define CLASS_STEP  16
+#define CLASS_MAX   512 /* Largest pooled block, header included */
+#define CLASS_COUNT (CLASS_MAX / CLASS_STEP)
+#define SLAB_BYTES  (64 * 1024)
+#define CACHE_MAX   256 /* Free blocks a thread keeps per class */
+
+/* Largest request served from a pool */
+#define POOL_SIZE_MAX (CLASS_MAX - HEADER)
+
+struct header {
+	struct syntax_account *acct; /* NULL: the process total only */
+	size_t size;		     /* As requested */
+};
+
+/* A free pooled block, linked through its first word */
+struct free_block {
+	struct free_block *next;
+};
+
+/* Free blocks of one class shared by all threads */
+struct pool {
+	pthread_mutex_t lock;
+	struct free_block *head;
+	int count;
+};
+
+/* One thread's free blocks, handed back to the pools when it exits */
+struct cache {
+	struct free_block *head[CLASS_COUNT];
+	int count[CLASS_COUNT];
+	bool registered;
+};
+
+static enum syntax_alloc_mode mode = SYNTAX_ALLOC_MALLOC;
+static bool installed;
+static struct syntax_account total;
+
+static struct pool pools[CLASS_COUNT];
+static pthread_mutex_t slab_lock = PTHREAD_MUTEX_INITIALIZER;
+static void *slabs; /* Chained through their first word, kept reachable */
+static size_t pooled;
+static pthread_key_t cache_key;
+
+static __thread struct cache cache;
+static __thread struct syntax_account *charged;
+
+/* ============================================================
+ * ACCOUNTING
+ * ============================================================ */
+
+static void
+charge(struct syntax_account *a, size_t size)
+{
+	size_t now, peak;
+
+	now = __atomic_add_fetch(&a->bytes, size, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&a->blocks, 1, __ATOMIC_RELAXED);
+	peak = __atomic_load_n(&a->peak, __ATOMIC_RELAXED);
+	while (now > peak &&
+	       !__atomic_compare_exchange_n(&a->peak,
+					    &peak,
+					    now,
+					    true,
+					    __ATOMIC_RELAXED,
+					    __ATOMIC_RELAXED))
+		;
+}
+
+static void
+credit(struct syntax_account *a, size_t size)
+{
+	__atomic_sub_fetch(&a->bytes, size, __ATOMIC_RELAXED);
+	__atomic_sub_fetch(&a->blocks, 1, __ATOMIC_RELAXED);
+}
+
+/* ============================================================
+ * POOLS
+ * ============================================================ */
+
+static int
+class_of(size_t size)
+{
+	return (int)((size + HEADER - 1) / CLASS_STEP);
+}
+
+static void
+cache_push(int c, struct free_block *b)
+{
+	b->next = cache.head[c];
+	cache.head[c] = b;
+	cache.count[c]++;
+}
+
+/* Move up to n blocks of class c from the cache to its pool */
+static void
+cache_give(struct cache *from, int c, int n)
+{
+	struct free_block *first = from->head[c], *last = first;
+	int moved = 1;
+
+	if (!first || n <= 0)
+		return;
+	while (moved < n && last->next) {
+		last = last->next;
+		moved++;
+	}
+	from->head[c] = last->next;
+	from->count[c] -= moved;
+
+	pthread_mutex_lock(&pools[c].lock);
+	last->next = pools[c].head;
+	pools[c].head = first;
+	pools[c].count += moved;
+	pthread_mutex_unlock(&pools[c].lock);
+}
+
+/* pthread key destructor: the exiting thread's blocks go back */
+static void
+cache_flush(void *arg)
+{
+	struct cache *from = arg;
+	int c;
+
+	for (c = 0; c < CLASS_COUNT; c++)
+		cache_give(from, c, from->count[c]);
+}
+
+/* Refill the empty cache of class c from its pool or a new slab */
+static void
+cache_fill(int c)
+{
+	size_t bsize = (size_t)(c + 1) * CLASS_STEP;
+	struct free_block *b;
+	char *slab, *p;
+	int n = 0;
+
+	if (!cache.registered) {
+		pthread_setspecific(cache_key, &cache);
+		cache.registered = true;
+	}
+
+	pthread_mutex_lock(&pools[c].lock);
+	while (pools[c].head && n < CACHE_MAX / 2) {
+		b = pools[c].head;
+		pools[c].head = b->next;
+		cache_push(c, b);
+		n++;
+	}
+	pools[c].count -= n;
+	pthread_mutex_unlock(&pools[c].lock);
+	if (n > 0)
+		return;
+
+	slab = xmalloc(SLAB_BYTES);
+	pthread_mutex_lock(&slab_lock);
+	*(void **)slab = slabs;
+	slabs = slab;
+	pooled += SLAB_BYTES;
+	pthread_mutex_unlock(&slab_lock);
+
+	/* The first HEADER bytes hold the chain, keeping blocks aligned */
+	for (p = slab + HEADER; p + bsize <= slab + SLAB_BYTES; p += bsize)
+		cache_push(c, (struct free_block *)p);
+}
+
+static struct header *
+pool_get(int c)
+{
+	struct free_block *b;
+
+	if (!cache.head[c])
+		cache_fill(c);
+	b = cache.head[c];
+	cache.head[c] = b->next;
+	cache.count[c]--;
+	return (struct header *)b;
+}
+
+static void
+pool_put(int c, struct header *h)
+{
+	cache_push(c, (struct free_block *)h);
+	if (cache.count[c] > CACHE_MAX)
+		cache_give(&cache, c, CACHE_MAX / 2);
+}
+
+static bool
+is_pooled(size_t size)
+{
+	return mode == SYNTAX_ALLOC_POOLED && size <= POOL_SIZE_MAX;
+}
+
+/* ============================================================
+ * TREE-SITTER CALLBACKS
+ * ============================================================ */
+
+static void *
+alloc_for(struct syntax_account *acct, size_t size)
+{
+	struct header *h;
+
+	if (is_pooled(size))
+		h = pool_get(class_of(size));
+	else
+		h = xmalloc(HEADER + size);
+	h->acct = acct;
+	h->size = size;
+	charge(&total, size);
+	if (acct)
+		charge(acct, size);
+	return (char *)h + HEADER;
+}
+
+static void *
+ts_alloc(size_t size)
+{
+	return alloc_for(charged, size);
+}
+
+static void
+ts_dealloc(void *p)
+{
+	struct header *h;
+
+	if (!p)
+		return;
+	h = (struct header *)((char *)p - HEADER);
+	credit(&total, h->size);
+	if (h->acct)
+		credit(h->acct, h->size);
+	if (is_pooled(h->size))
+		pool_put(class_of(h->size), h);
+	else
+		xfree(h);
+}
+
+static void *
+ts_calloc(size_t n, size_t size)
+{
+	void *p;
+
+	if (size && n > SIZE_MAX / size)
+		die("tree-sitter calloc(%zu, %zu) overflows", n, size);
+	p = ts_alloc(n * size);
+	memset(p, 0, n * size);
+	return p;
+}
+
+/* A block keeps the account it was first charged to */
+static void *
+ts_realloc(void *p, size_t size)
+{
+	struct header *h;
+	void *q;
+
+	if (!p)
+		return ts_alloc(size);
+	h = (struct header *)((char *)p - HEADER);
+
+	if (!is_pooled(h->size) && !is_pooled(size)) {
+		credit(&total, h->size);
+		if (h->acct)
+			credit(h->acct, h->size);
+		h = xrealloc(h, HEADER + size);
+		h->size = size;
+		charge(&total, size);
+		if (h->acct)
+			charge(h->acct, size);
+		return (char *)h + HEADER;
+	}
+
+	q = alloc_for(h->acct, size);
+	memcpy(q, p, h->size < size ? h->size : size);
+	ts_dealloc(p);
+	return q;
+}
+
+/* ============================================================
+ * PUBLIC API
+ * ============================================================ */
+
+void
+syntax_alloc_install(enum syntax_alloc_mode m)
+{
+	int c;
+
+	if (installed)
+		return;
+	installed = true;
+	mode = m;
+	if (m == SYNTAX_ALLOC_MALLOC)
+		return;
+
+	if (pthread_key_create(&cache_key, cache_flush) != 0)
+		die("pthread_key_create failed");
+	for (c = 0; c < CLASS_COUNT; c++)
+		pthread_mutex_init(&pools[c].lock, NULL);
+	ts_set_allocator(ts_alloc, ts_calloc, ts_realloc, ts_dealloc);
+}
+
+enum syntax_alloc_mode
+syntax_alloc_mode(void)
+{
+	return mode;
+}
+
+struct syntax_account *
+syntax_alloc_charge(struct syntax_account *acct)
+{
+	struct syntax_account *prev = charged;
+
+	charged = acct;
+	return prev;
+}
+
+void
+syntax_alloc_read(const struct syntax_account *acct,
+		  struct syntax_account *out)
+{
+	out->bytes = __atomic_load_n(&acct->bytes, __ATOMIC_RELAXED);
+	out->peak = __atomic_load_n(&acct->peak, __ATOMIC_RELAXED);
+	out->blocks = __atomic_load_n(&acct->blocks, __ATOMIC_RELAXED);
+}
+
+void
+syntax_alloc_total(struct syntax_account *out, size_t *pooled_out)
+{
+	syntax_alloc_read(&total, out);
+	if (pooled_out) {
+		pthread_mutex_lock(&slab_lock);
+		*pooled_out = pooled;
+		pthread_mutex_unlock(&slab_lock);
+	}
+}
+
+void
+syntax_alloc_free(void *p)
+{
+	if (mode == SYNTAX_ALLOC_MALLOC)
+		free(p);
+	else
+		ts_dealloc(p);
+}
@@ -0,0 +1,339 @@
+#include <editor/trigram.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <core/memory.h>
+
+#define INITIAL_SLOTS	 4096u
+#define CANCEL_INTERVAL	 4096 /* Lines between cancellation checks */
+
+/* Sorted line numbers containing one trigram. cap == 0 marks a free slot */
+struct posting {
+	uint32_t key;
+	int count;
+	int cap;
+	uint32_t *lines;
+};
+
+struct trigram_index {
+	struct snapshot *snap;
+	struct posting *slots; /* Open addressing, linear probing */
+	uint32_t cap;	       /* Power of two */
+	uint32_t used;
+	size_t bytes; /* Held by slots and posting lists */
+};
+
+static uint32_t
+trigram_key(const char *p)
+{
+	const unsigned char *u = (const unsigned char *)p;
+
+	return (uint32_t)u[0] << 16 | (uint32_t)u[1] << 8 | (uint32_t)u[2];
+}
+
+/* ============================================================
+ * HASH TABLE
+ * ============================================================ */
+
+static uint32_t
+slot_of(uint32_t key, uint32_t cap)
+{
+	return (key * 0x9E3779B1u) & (cap - 1);
+}
+
+static struct posting *
+find_posting(struct trigram_index *idx, uint32_t key)
+{
+	uint32_t i = slot_of(key, idx->cap);
+
+	while (idx->slots[i].cap) {
+		if (idx->slots[i].key == key)
+			return &idx->slots[i];
+		i = (i + 1) & (idx->cap - 1);
+	}
+	return NULL;
+}
+
+static void
+grow_table(struct trigram_index *idx)
+{
+	struct posting *old = idx->slots;
+	uint32_t old_cap = idx->cap;
+	uint32_t i, j;
+
+	idx->cap = old_cap ? old_cap * 2 : INITIAL_SLOTS;
+	idx->slots = xcalloc(idx->cap, sizeof(*idx->slots));
+	idx->bytes += (size_t)(idx->cap - old_cap) * sizeof(*idx->slots);
+
+	for (i = 0; i < old_cap; i++) {
+		if (!old[i].cap)
+			continue;
+		j = slot_of(old[i].key, idx->cap);
+		while (idx->slots[j].cap)
+			j = (j + 1) & (idx->cap - 1);
+		idx->slots[j] = old[i];
+	}
+	xfree(old);
+}
+
+static struct posting *
+get_posting(struct trigram_index *idx, uint32_t key)
+{
+	struct posting *p;
+	uint32_t i;
+
+	p = find_posting(idx, key);
+	if (p)
+		return p;
+
+	/* Keep load factor under 70% */
+	if ((idx->used + 1) * 10 > idx->cap * 7)
+		grow_table(idx);
+
+	i = slot_of(key, idx->cap);
+	while (idx->slots[i].cap)
+		i = (i + 1) & (idx->cap - 1);
+
+	p = &idx->slots[i];
+	p->key = key;
+	p->count = 0;
+	p->cap = 4;
+	p->lines = xmalloc((size_t)p->cap * sizeof(*p->lines));
+	idx->bytes += (size_t)p->cap * sizeof(*p->lines);
+	idx->used++;
+	return p;
+}
+
+/* ============================================================
+ * POSTING LISTS
+ * ============================================================ */
+
+/* First position in p whose line is >= line */
+static int
+lower_bound(const uint32_t *lines, int count, uint32_t line)
+{
+	int lo = 0, hi = count;
+
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+		if (lines[mid] < line)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static void
+posting_insert(struct trigram_index *idx, struct posting *p, uint32_t line)
+{
+	int at;
+
+	/* Fast path: lines arrive in increasing order during builds */
+	if (p->count == 0 || p->lines[p->count - 1] < line) {
+		at = p->count;
+	} else {
+		at = lower_bound(p->lines, p->count, line);
+		if (p->lines[at] == line)
+			return;
+	}
+
+	if (p->count == p->cap) {
+		idx->bytes += (size_t)p->cap * sizeof(*p->lines);
+		p->cap *= 2;
+		p->lines =
+		    xrealloc(p->lines, (size_t)p->cap * sizeof(*p->lines));
+	}
+	memmove(&p->lines[at + 1],
+		&p->lines[at],
+		(size_t)(p->count - at) * sizeof(*p->lines));
+	p->lines[at] = line;
+	p->count++;
+}
+
+static void
+posting_remove(struct posting *p, uint32_t line)
+{
+	int at = lower_bound(p->lines, p->count, line);
+
+	if (at == p->count || p->lines[at] != line)
+		return;
+	memmove(&p->lines[at],
+		&p->lines[at + 1],
+		(size_t)(p->count - at - 1) * sizeof(*p->lines));
+	p->count--;
+}
+
+static void
+index_line(struct trigram_index *idx, int line, struct str text)
+{
+	int i;
+
+	for (i = 0; i + 2 < text.len; i++)
+		posting_insert(idx,
+			       get_posting(idx, trigram_key(text.data + i)),
+			       (uint32_t)line);
+}
+
+static void
+unindex_line(struct trigram_index *idx, int line, struct str text)
+{
+	struct posting *p;
+	int i;
+
+	for (i = 0; i + 2 < text.len; i++) {
+		p = find_posting(idx, trigram_key(text.data + i));
+		if (p)
+			posting_remove(p, (uint32_t)line);
+	}
+}
+
+/* ============================================================
+ * PUBLIC API
+ * ============================================================ */
+
+struct trigram_index *
+trigram_build(struct snapshot *snap, size_t budget, const int *cancel)
+{
+	struct trigram_index *idx;
+	int line, n;
+
+	idx = xcalloc(1, sizeof(*idx));
+	idx->snap = snapshot_retain(snap);
+	grow_table(idx);
+
+	n = snapshot_line_count(snap);
+	for (line = 0; line < n; line++) {
+		if (cancel && line % CANCEL_INTERVAL == 0 &&
+		    __atomic_load_n(cancel, __ATOMIC_ACQUIRE)) {
+			trigram_destroy(idx);
+			return NULL;
+		}
+		index_line(idx, line, snapshot_get_line(snap, line));
+		if (idx->bytes > budget) {
+			trigram_destroy(idx);
+			return NULL;
+		}
+	}
+	return idx;
+}
+
+void
+trigram_destroy(struct trigram_index *idx)
+{
+	uint32_t i;
+
+	if (!idx)
+		return;
+	for (i = 0; i < idx->cap; i++)
+		if (idx->slots[i].cap)
+			xfree(idx->slots[i].lines);
+	xfree(idx->slots);
+	snapshot_release(idx->snap);
+	xfree(idx);
+}
+
+struct snapshot *
+trigram_snapshot(struct trigram_index *idx)
+{
+	return idx->snap;
+}
+
+size_t
+trigram_bytes(const struct trigram_index *idx)
+{
+	return idx->bytes;
+}
+
+struct update_ctx {
+	struct trigram_index *idx;
+	struct snapshot *snap;
+};
+
+static void
+update_line(int line, void *arg)
+{
+	struct update_ctx *u = arg;
+
+	unindex_line(u->idx, line, snapshot_get_line(u->idx->snap, line));
+	index_line(u->idx, line, snapshot_get_line(u->snap, line));
+}
+
+bool
+trigram_update(struct trigram_index *idx, struct snapshot *snap)
+{
+	struct update_ctx u = {idx, snap};
+
+	if (idx->snap == snap)
+		return true;
+	if (!snapshot_diff(idx->snap, snap, update_line, &u))
+		return false;
+
+	snapshot_release(idx->snap);
+	idx->snap = snapshot_retain(snap);
+	return true;
+}
+
+static int
+cmp_posting_count(const void *a, const void *b)
+{
+	const struct posting *pa = *(const struct posting *const *)a;
+	const struct posting *pb = *(const struct posting *const *)b;
+
+	return pa->count - pb->count;
+}
+
+int
+trigram_candidates(struct trigram_index *idx,
+		   struct str needle,
+		   struct arena *a,
+		   int **out)
+{
+	struct posting **lists;
+	int nlists, i, j, k, count;
+	int *res;
+
+	*out = NULL;
+	if (needle.len < TRIGRAM_MIN_QUERY)
+		return 0;
+
+	nlists = needle.len - 2;
+	lists = arena_array(a, struct posting *, nlists);
+	for (i = 0; i < nlists; i++) {
+		lists[i] = find_posting(idx, trigram_key(needle.data + i));
+		if (!lists[i] || lists[i]->count == 0)
+			return 0;
+	}
+
+	/* Intersect starting from the rarest trigram */
+	qsort(lists, (size_t)nlists, sizeof(*lists), cmp_posting_count);
+
+	count = lists[0]->count;
+	res = arena_array(a, int, count);
+	for (j = 0; j < count; j++)
+		res[j] = (int)lists[0]->lines[j];
+
+	for (i = 1; i < nlists && count > 0; i++) {
+		const struct posting *p = lists[i];
+		int from = 0;
+
+		if (p == lists[i - 1])
+			continue;
+		k = 0;
+		for (j = 0; j < count; j++) {
+			from += lower_bound(p->lines + from,
+					    p->count - from,
+					    (uint32_t)res[j]);
+			if (from == p->count)
+				break;
+			if (p->lines[from] == (uint32_t)res[j])
+				res[k++] = res[j];
+		}
+		count = k;
+	}
+
+	*out = res;
+	return count;
+}
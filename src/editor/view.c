@@ -13,8 +13,8 @@ view_init(struct view *v)
 
 bool
 view_update(struct view *v,
+	    const struct fold_map *folds,
 	    int cursor_line,
-	    int line_count,
 	    int window_h,
 	    int line_h,
 	    int menu_h)
@@ -24,13 +24,9 @@ view_update(struct view *v,
 	int lines_above = input_y / line_h;
 	int lines_below = (window_h - input_y - input_h - menu_h) / line_h;
 
-	int first = cursor_line - lines_above;
-	if (first < 0)
-		first = 0;
-
-	int last = cursor_line + lines_below;
-	if (last >= line_count)
-		last = line_count - 1;
+	int cursor_row = fold_line_to_row(folds, cursor_line);
+	int first = fold_row_to_line(folds, cursor_row - lines_above);
+	int last = fold_row_to_line(folds, cursor_row + lines_below);
 
 	bool changed =
 	    (first != v->first_visible_line || last != v->last_visible_line);
@@ -1,14 +1,26 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <core/arena.h>
 #include <core/error.h>
 #include <core/str.h>
 #include <editor/buffer.h>
+#include <editor/decor.h>
+#include <editor/fold.h>
+#include <editor/highlight.h>
+#include <editor/journal.h>
+#include <editor/outline.h>
+#include <editor/search.h>
+#include <editor/session.h>
 #include <editor/syntax.h>
 #include <editor/view.h>
 #include <platform/platform.h>
 #include <render/render_font.h>
+#include <render/render_metrics.h>
 #include <render/render_primitives.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
 #include <ui/ui.h>
 #include <ui/ui_avy.h>
 #include <ui/ui_menu_actions.h>
@@ -17,6 +29,9 @@
 #include <xkbcommon/xkbcommon-keysyms.h>
 
 #define MENU_ROWS 15
+#define JOURNAL_LATENCY_MS 50 /* Edits may be lost up to this old */
+#define VIEWPORT_PARSE_BYTES (16 << 20) /* Bigger: parse the window first */
+#define VIEWPORT_PARSE_ROWS  128	/* Rows each side of the cursor */
 
 /* ============================================================
  * APPLICATION STATE
@@ -32,26 +47,44 @@
  *   AVY_CHAR --[printable]--> NORMAL (if no matches)
  *   AVY_HINT --[hint char]--> AVY_ACTION (when unique)
  *   AVY_ACTION --[j]--> NORMAL (after jump)
- *   ANY --[Escape]--> NORMAL
+ *   NORMAL --[Ctrl-S]--> SEARCH
+ *   SEARCH --[Return]--> NORMAL (cursor stays on match)
+ *   ANY --[Escape]--> NORMAL (SEARCH restores the cursor)
  */
 enum app_mode {
 	MODE_NORMAL,	 /* Normal editing */
 	MODE_AVY_CHAR,	 /* Waiting for search character */
 	MODE_AVY_HINT,	 /* Waiting for hint selection */
 	MODE_AVY_ACTION, /* Waiting for action key */
+	MODE_SEARCH,	 /* Incremental search, typing query */
 };
 
 struct app_state {
+	struct arena arena; /* Scratch for per-key work */
 	bool running;
 	bool needs_redraw;
 	struct ui_input input;
 	struct buffer buffer;
 	struct font_ctx *font;
+	struct line_metrics *metrics; /* Pixel x of visible lines */
 	struct syntax_ctx *syntax;
+	struct highlight_cache *highlights; /* Spans of rows seen */
+	struct outline outline;		    /* Every heading, by row */
+	struct fold_map folds;		    /* Closed, rows to lines */
+	bool show_outline;		    /* Menu lists the outline */
+	bool show_stats;		    /* Syntax counters beside it */
 	struct view view;
 	struct syntax_visible visible_ast;
+	struct arena ast_arena; /* visible_ast, reset when it is rebuilt */
 	enum app_mode mode;
 	struct avy_state avy;
+	struct search search;
+	int search_origin; /* Cursor line when search started */
+	bool search_found;
+	struct journal *journal; /* NULL if the journal could not open */
+	struct decor_tree decor;
+	unsigned decor_scan; /* search.scan_id mirrored into decor */
+	int decor_synced[SEARCH_RUN_COUNT]; /* Hits already mirrored */
 };
 
 /* ============================================================
@@ -71,6 +104,181 @@ sync_input_to_buffer(struct app_state *app)
 	ui_input_set_text(&app->input, line);
 }
 
+/*
+ * Reparse after line's text of old_len bytes at offset became new_len
+ * bytes long, reusing the unchanged parts of the tree.
+ */
+static void
+reparse_line(struct app_state *app,
+	     int line,
+	     long offset,
+	     int old_len,
+	     int new_len)
+{
+	struct syntax_change change;
+
+	change.start_byte = (uint32_t)offset;
+	change.old_end_byte = (uint32_t)(offset + old_len);
+	change.new_end_byte = (uint32_t)(offset + new_len);
+	change.start.row = (uint32_t)line;
+	change.start.col = 0;
+	change.old_end.row = (uint32_t)line;
+	change.old_end.col = (uint32_t)old_len;
+	change.new_end.row = (uint32_t)line;
+	change.new_end.col = (uint32_t)new_len;
+	syntax_edit(app->syntax, &change, app->buffer.snap);
+	highlight_cache_edit(app->highlights, (uint32_t)line);
+	outline_edit(&app->outline, (uint32_t)line);
+}
+
+/*
+ * Closed folds whose rows changed structure follow the block starting
+ * on their first row, or open if none does any more. Backwards, so
+ * reclosing a fold leaves the ones still to visit where they were.
+ */
+static void
+refold(struct app_state *app, const struct syntax_range *ranges, int n)
+{
+	struct fold_range f;
+	struct syntax_fold sf;
+	bool found;
+	int i, r;
+
+	for (i = app->folds.count - 1; i >= 0; i--) {
+		f = app->folds.folds[i];
+		for (r = 0; r < n; r++)
+			if (ranges[r].start.row <= (uint32_t)f.end &&
+			    ranges[r].end.row >= (uint32_t)f.start)
+				break;
+		if (r == n)
+			continue;
+		found = syntax_fold_at(app->syntax, (uint32_t)f.start, &sf) &&
+			sf.start_row == (uint32_t)f.start;
+		if (found && sf.end_row == (uint32_t)f.end)
+			continue;
+		fold_open(&app->folds, f.start);
+		if (found) {
+			f.end = (int)sf.end_row;
+			fold_close(&app->folds, f);
+		}
+	}
+	fold_reveal(&app->folds, app->buffer.cursor_line);
+}
+
+/* Adopt a tree the parser finished. Returns true if there was one */
+static bool
+poll_syntax(struct app_state *app)
+{
+	struct arena_mark m = arena_mark(&app->arena);
+	struct syntax_range *ranges;
+	int n;
+
+	n = syntax_poll(app->syntax,
+			buffer_version(&app->buffer),
+			&app->arena,
+			&ranges);
+	if (n >= 0) {
+		highlight_cache_update(app->highlights, ranges, n);
+		outline_update(
+		    &app->outline, app->syntax, ranges, n, &app->arena);
+		refold(app, ranges, n);
+	}
+	if (n > 0)
+		search_syntax_changed(&app->search, &app->buffer);
+	arena_pop(&app->arena, m);
+	if (n < 0)
+		return false;
+	app->view.needs_ast_update = true;
+	return true;
+}
+
+/*
+ * Write the input box back into the current buffer line.
+ * Starts a reparse; the AST view follows once it is adopted.
+ */
+static void
+commit_input_line(struct app_state *app)
+{
+	struct str text = str_from_parts(app->input.buf, app->input.len);
+	struct str old = buffer_get_current_line(&app->buffer);
+	struct buffer_pos pos = {app->buffer.cursor_line, 0};
+	long offset = buffer_pos_to_offset(&app->buffer, pos);
+
+	if (str_eq(text, old))
+		return;
+	if (!buffer_replace_line(&app->buffer, app->buffer.cursor_line, text))
+		return;
+
+	if (app->journal)
+		journal_append(app->journal, app->buffer.cursor_line, text);
+	decor_edit(&app->decor, offset, old.len, text.len);
+
+	if (app->syntax)
+		reparse_line(
+		    app, app->buffer.cursor_line, offset, old.len, text.len);
+	app->view.needs_ast_update = true; /* Offsets moved */
+	search_sync(&app->search, &app->buffer);
+}
+
+/* Move the cursor to the next (dir > 0) or previous heading, if any */
+static void
+jump_heading(struct app_state *app, int dir)
+{
+	uint32_t row = (uint32_t)app->buffer.cursor_line;
+	int i;
+
+	i = dir > 0 ? outline_next(&app->outline, row)
+		    : outline_prev(&app->outline, row);
+	if (i < 0)
+		return;
+	app->buffer.cursor_line = (int)app->outline.entries[i].row;
+	fold_reveal(&app->folds, app->buffer.cursor_line);
+	sync_input_to_buffer(app);
+}
+
+/*
+ * Open the fold on the cursor line, else close the block there. From
+ * inside a block the enclosing one closes and the cursor moves to its
+ * first line, which stays showing.
+ */
+static void
+toggle_fold(struct app_state *app)
+{
+	struct syntax_fold sf;
+	struct fold_range r;
+
+	if (fold_open(&app->folds, app->buffer.cursor_line))
+		return;
+	if (!syntax_fold_at(
+		app->syntax, (uint32_t)app->buffer.cursor_line, &sf))
+		return;
+	r.start = (int)sf.start_row;
+	r.end = (int)sf.end_row;
+	if (!fold_close(&app->folds, r))
+		return;
+	if (app->buffer.cursor_line != r.start) {
+		app->buffer.cursor_line = r.start;
+		sync_input_to_buffer(app);
+	}
+}
+
+/* Move the cursor by n visible rows, stepping over closed folds */
+static void
+move_rows(struct app_state *app, int n)
+{
+	int row = fold_line_to_row(&app->folds, app->buffer.cursor_line);
+
+	app->buffer.cursor_line = fold_row_to_line(&app->folds, row + n);
+	sync_input_to_buffer(app);
+}
+
+/* Apply one journal record over the freshly loaded buffer */
+static void
+replay_line(int line, struct str text, void *arg)
+{
+	buffer_replace_line(arg, line, text); /* Ignores lines out of range */
+}
+
 /* ============================================================
  * INPUT HANDLING
  * ============================================================ */
@@ -91,6 +299,10 @@ static bool handle_key_avy_action(struct app_state *app,
 				  uint32_t keysym,
 				  uint32_t mods,
 				  uint32_t codepoint);
+static bool handle_key_search(struct app_state *app,
+			      uint32_t keysym,
+			      uint32_t mods,
+			      uint32_t codepoint);
 static void execute_jump_action(struct app_state *app,
 				struct avy_match *match);
 
@@ -102,6 +314,12 @@ handle_key(struct app_state *app,
 {
 	/* Escape always cancels avy mode from any state */
 	if (keysym == XKB_KEY_Escape) {
+		if (app->mode == MODE_SEARCH) {
+			app->buffer.cursor_line = app->search_origin;
+			sync_input_to_buffer(app);
+			search_set_query(
+			    &app->search, &app->buffer, STR_EMPTY);
+		}
 		if (app->mode != MODE_NORMAL) {
 			app->mode = MODE_NORMAL;
 			avy_cancel(&app->avy);
@@ -122,6 +340,9 @@ handle_key(struct app_state *app,
 
 	case MODE_AVY_ACTION:
 		return handle_key_avy_action(app, keysym, mods, codepoint);
+
+	case MODE_SEARCH:
+		return handle_key_search(app, keysym, mods, codepoint);
 	}
 
 	return false;
@@ -146,16 +367,45 @@ handle_key_normal(struct app_state *app,
 		return true;
 	}
 
-	/* Buffer navigation keys (Ctrl-N, Ctrl-P) */
+	/* Alt-n and Alt-p jump between headings */
+	if ((mods & MOD_ALT) &&
+	    (keysym == XKB_KEY_n || keysym == XKB_KEY_p)) {
+		jump_heading(app, keysym == XKB_KEY_n ? 1 : -1);
+		return true;
+	}
+
+	/* Tab folds or unfolds at the cursor, Shift-Tab opens every fold */
+	if (keysym == XKB_KEY_Tab) {
+		toggle_fold(app);
+		return true;
+	}
+	if (keysym == XKB_KEY_ISO_Left_Tab) {
+		while (app->folds.count > 0)
+			fold_open(&app->folds, app->folds.folds[0].start);
+		return true;
+	}
+
+	/* Buffer navigation and panel keys (Ctrl-N/P/S/O/T) */
 	if (mods & MOD_CTRL) {
 		switch (keysym) {
+		case XKB_KEY_s:
+			app->mode = MODE_SEARCH;
+			app->search_origin = app->buffer.cursor_line;
+			app->search_found = false;
+			search_set_query(
+			    &app->search, &app->buffer, STR_EMPTY);
+			return true;
 		case XKB_KEY_n:
-			buffer_move_down(&app->buffer, 1);
-			sync_input_to_buffer(app);
+			move_rows(app, 1);
 			return true;
 		case XKB_KEY_p:
-			buffer_move_up(&app->buffer, 1);
-			sync_input_to_buffer(app);
+			move_rows(app, -1);
+			return true;
+		case XKB_KEY_o:
+			app->show_outline = !app->show_outline;
+			return true;
+		case XKB_KEY_t:
+			app->show_stats = !app->show_stats;
 			return true;
 		}
 	}
@@ -177,8 +427,8 @@ handle_key_normal(struct app_state *app,
 		}
 		break;
 	case XKB_KEY_Return:
-		warn("Submitted: %s\n", ui_input_get_text(&app->input));
-		return false;
+		commit_input_line(app);
+		return true;
 	}
 
 	return false;
@@ -195,13 +445,34 @@ handle_key_avy_char(struct app_state *app,
 
 	/* Wait for a printable ASCII character */
 	if (codepoint >= 32 && codepoint < 127) {
+		struct arena_mark m = arena_mark(&app->arena);
+		int line = app->buffer.cursor_line;
+		int row = fold_line_to_row(&app->folds, line);
+		int first = row - app->view.lines_above;
+		int last = row + app->view.lines_below;
+		int rows = fold_rows(&app->folds);
+		struct str *lines;
+		int *nums, n = 0;
+
+		/* avy only looks at the rows in the window */
+		if (first < 0)
+			first = 0;
+		if (last >= rows)
+			last = rows - 1;
+		lines = arena_array(&app->arena, struct str, last - first + 1);
+		nums = arena_array(&app->arena, int, last - first + 1);
+		for (row = first; row <= last; row++, n++) {
+			nums[n] = fold_row_to_line(&app->folds, row);
+			lines[n] = buffer_get_line(&app->buffer, nums[n]);
+		}
+
 		avy_set_char(&app->avy,
 			     (char)codepoint,
-			     app->buffer.lines,
-			     app->buffer.line_count,
-			     app->buffer.cursor_line,
-			     app->view.first_visible_line,
-			     app->view.last_visible_line);
+			     lines,
+			     nums,
+			     n,
+			     app->buffer.cursor_line);
+		arena_pop(&app->arena, m);
 
 		if (app->avy.match_count == 0) {
 			/* No matches found, cancel */
@@ -273,6 +544,118 @@ handle_key_avy_action(struct app_state *app,
 	return false;
 }
 
+/*
+ * Move cursor to the next match in dir, starting at from.
+ * Wraps around the buffer once; leaves the cursor alone if nothing
+ * matches.
+ */
+static void
+search_jump(struct app_state *app, int from, int dir)
+{
+	int line;
+
+	line = search_next(&app->search, &app->buffer, from, dir);
+	/* A scan still running may yet find a match before wrapping */
+	if (line < 0 &&
+	    (!search_is_scan(&app->search) || app->search.scan_done))
+		line = search_next(&app->search,
+				   &app->buffer,
+				   dir > 0 ? 0 : app->buffer.line_count - 1,
+				   dir);
+
+	app->search_found = line >= 0;
+	if (line >= 0) {
+		app->buffer.cursor_line = line;
+		fold_reveal(&app->folds, line);
+		sync_input_to_buffer(app);
+	}
+}
+
+static bool
+handle_key_search(struct app_state *app,
+		  uint32_t keysym,
+		  uint32_t mods,
+		  uint32_t codepoint)
+{
+	char q[SEARCH_QUERY_MAX + 1];
+	struct str query = search_get_query(&app->search);
+	int len = str_len(query);
+
+	/* Alt-r toggles regex queries */
+	if ((mods & MOD_ALT) && keysym == XKB_KEY_r) {
+		search_set_viewport(&app->search,
+				    app->view.first_visible_line,
+				    app->view.last_visible_line);
+		search_set_regex(
+		    &app->search, &app->buffer, !app->search.regex);
+		app->buffer.cursor_line = app->search_origin;
+		sync_input_to_buffer(app);
+		app->search_found = false;
+		if (len > 0)
+			search_jump(app, app->search_origin, 1);
+		return true;
+	}
+
+	/* Alt-s toggles structural queries over the syntax tree */
+	if ((mods & MOD_ALT) && keysym == XKB_KEY_s) {
+		search_set_viewport(&app->search,
+				    app->view.first_visible_line,
+				    app->view.last_visible_line);
+		search_set_structural(&app->search,
+				      &app->buffer,
+				      app->syntax,
+				      !app->search.structural);
+		app->buffer.cursor_line = app->search_origin;
+		sync_input_to_buffer(app);
+		app->search_found = false;
+		if (len > 0)
+			search_jump(app, app->search_origin, 1);
+		return true;
+	}
+
+	if (mods & MOD_CTRL) {
+		switch (keysym) {
+		case XKB_KEY_s:
+			search_jump(app, app->buffer.cursor_line + 1, 1);
+			return true;
+		case XKB_KEY_r:
+			search_jump(app, app->buffer.cursor_line - 1, -1);
+			return true;
+		}
+		return false;
+	}
+
+	switch (keysym) {
+	case XKB_KEY_Return:
+		app->mode = MODE_NORMAL;
+		search_set_query(&app->search, &app->buffer, STR_EMPTY);
+		return true;
+	case XKB_KEY_BackSpace:
+		if (len == 0)
+			return false;
+		len--;
+		break;
+	default:
+		if (codepoint < 32 || codepoint >= 127 ||
+		    len >= SEARCH_QUERY_MAX)
+			return false;
+		memcpy(q, str_data(query), (size_t)len);
+		q[len++] = (char)codepoint;
+		query = str_from_parts(q, len);
+		break;
+	}
+
+	/* Refine from where the search started, like isearch */
+	search_set_viewport(&app->search,
+			    app->view.first_visible_line,
+			    app->view.last_visible_line);
+	search_set_query(&app->search, &app->buffer, str_slice(query, 0, len));
+	app->search_found = false;
+	if (len > 0)
+		search_jump(app, app->search_origin, 1);
+	return true;
+}
+
 /*
  * Execute the jump action: move target line to input box.
  *
@@ -302,6 +685,208 @@ execute_jump_action(struct app_state *app, struct avy_match *match)
  * RENDERING
  * ============================================================ */
 
+/* Mirror search hits streamed since the last frame into decorations */
+static void
+sync_search_decor(struct app_state *app)
+{
+	const struct search_hit *hit;
+	struct buffer_pos pos;
+	struct decor d;
+	int r, i;
+
+	if (app->decor_scan != app->search.scan_id) {
+		decor_clear(&app->decor, DECOR_SEARCH_HIT);
+		memset(app->decor_synced, 0, sizeof(app->decor_synced));
+		app->decor_scan = app->search.scan_id;
+	}
+
+	for (r = 0; r < SEARCH_RUN_COUNT; r++) {
+		const struct search_run *run = &app->search.runs[r];
+
+		for (i = app->decor_synced[r]; i < run->count; i++) {
+			hit = &run->hits[i];
+			pos.line = hit->line;
+			pos.col = hit->start;
+			d.start = buffer_pos_to_offset(&app->buffer, pos);
+			d.end = d.start + (hit->end - hit->start);
+			d.kind = DECOR_SEARCH_HIT;
+			d.data = 0;
+			decor_add(&app->decor, d);
+		}
+		app->decor_synced[r] = run->count;
+	}
+}
+
+/*
+ * Draw the parts of decorations that fall on one visible line, behind
+ * its text. decors is the frame's query result.
+ */
+static void
+draw_decorations(struct ui_ctx *ctx,
+		 struct app_state *app,
+		 const struct decor *decors,
+		 int count,
+		 int line_num,
+		 struct str line,
+		 int x,
+		 int y)
+{
+	uint64_t version = buffer_version(&app->buffer);
+	struct buffer_pos pos = {line_num, 0};
+	long ls = buffer_pos_to_offset(&app->buffer, pos);
+	long le = ls + line.len;
+	long start, end;
+	int i, x0, x1;
+
+	for (i = 0; i < count && decors[i].start <= le; i++) {
+		if (decors[i].end < ls)
+			continue;
+		start = decors[i].start > ls ? decors[i].start - ls : 0;
+		end = decors[i].end < le ? decors[i].end - ls : line.len;
+
+		x0 = line_metrics_index_to_x(
+		    app->metrics, line, version, (int)start);
+		x1 = line_metrics_index_to_x(
+		    app->metrics, line, version, (int)end);
+		ui_rect r = {x + x0,
+			     y,
+			     x1 > x0 ? x1 - x0 : 2,
+			     font_get_line_height(ctx->render.font)};
+		draw_rect(&ctx->render,
+			  r,
+			  decors[i].kind == DECOR_SEARCH_HIT
+			      ? ctx->theme.bg_active
+			      : ctx->theme.success);
+	}
+}
+
+/* After a closed fold's first line, how many lines it hides */
+static void
+draw_fold_marker(struct ui_ctx *ctx,
+		 struct app_state *app,
+		 uint64_t version,
+		 int line_num,
+		 struct str line,
+		 int x,
+		 int y)
+{
+	int i = fold_find(&app->folds, line_num);
+	char label[32];
+
+	if (i < 0)
+		return;
+	snprintf(label,
+		 sizeof(label),
+		 "  ... %d lines",
+		 app->folds.folds[i].end - line_num);
+	x += line_metrics_index_to_x(app->metrics, line, version, line.len);
+	ui_label_draw_colored(
+	    ctx, x, y, str_from_cstr(label), ctx->theme.fg_muted);
+}
+
+/*
+ * Decorations on the lines shown, lines[0..n) ascending, queried once
+ * per run of consecutive lines so those folds hide are never visited.
+ * One starting before the previous run's end was returned by it already.
+ */
+static int
+query_decor(struct app_state *app,
+	    const int *lines,
+	    int n,
+	    struct decor **out)
+{
+	struct buffer_pos lo = {0, 0}, hi = {0, 0};
+	struct decor *all = NULL, *run, *grown;
+	long prev_hi = -1, hi_off;
+	int count = 0, cap = 0, got, i, j, k;
+
+	for (i = 0; i < n; i = j) {
+		for (j = i + 1; j < n && lines[j] == lines[j - 1] + 1; j++)
+			;
+		lo.line = lines[i];
+		hi.line = lines[j - 1] + 1;
+		hi_off = buffer_pos_to_offset(&app->buffer, hi);
+		got = decor_query(&app->decor,
+				  buffer_pos_to_offset(&app->buffer, lo),
+				  hi_off,
+				  &app->arena,
+				  &run);
+		for (k = 0; k < got; k++) {
+			if (run[k].start < prev_hi)
+				continue;
+			if (count == cap) {
+				cap = cap ? cap * 2 : got;
+				grown = arena_array(
+				    &app->arena, struct decor, cap);
+				if (count > 0)
+					memcpy(grown,
+					       all,
+					       (size_t)count * sizeof(*all));
+				all = grown;
+			}
+			all[count++] = run[k];
+		}
+		prev_hi = hi_off;
+	}
+	*out = all;
+	return count;
+}
+
+/*
+ * Highlight spans of lines[0..n) into out[0..n), queried per run of
+ * consecutive lines. Each run's spans are copied to the frame arena:
+ * the cache only keeps them valid until its next call.
+ */
+static void
+query_spans(struct app_state *app,
+	    const int *lines,
+	    int n,
+	    struct syntax_line_spans *out)
+{
+	struct syntax_span *copy;
+	int i, j, k;
+
+	for (i = 0; i < n; i = j) {
+		for (j = i + 1; j < n && lines[j] == lines[j - 1] + 1; j++)
+			;
+		highlight_cache_get(app->highlights,
+				    app->syntax,
+				    (uint32_t)lines[i],
+				    (uint32_t)lines[j - 1],
+				    &out[i]);
+		for (k = i; k < j; k++) {
+			if (out[k].count == 0)
+				continue;
+			copy = arena_array(
+			    &app->arena, struct syntax_span, out[k].count);
+			memcpy(copy,
+			       out[k].spans,
+			       (size_t)out[k].count * sizeof(*copy));
+			out[k].spans = copy;
+		}
+	}
+}
+
+/* Decorations, highlighted text and fold marker of one shown line */
+static void
+draw_line(struct ui_ctx *ctx,
+	  struct app_state *app,
+	  const struct decor *decors,
+	  int decor_count,
+	  const struct syntax_line_spans *spans,
+	  int line_num,
+	  int x,
+	  int y)
+{
+	uint64_t version = buffer_version(&app->buffer);
+	struct str line = buffer_get_line(&app->buffer, line_num);
+
+	draw_decorations(
+	    ctx, app, decors, decor_count, line_num, line, x, y);
+	ui_highlight_draw(ctx, app->metrics, version, x, y, line, spans);
+	draw_fold_marker(ctx, app, version, line_num, line, x, y);
+}
+
 static void
 render(struct app_state *app, struct framebuffer *fb)
 {
@@ -310,16 +895,24 @@ render(struct app_state *app, struct framebuffer *fb)
 	int input_y, input_h;
 	int lines_above, lines_below;
 	int y, i, line_num;
-	struct str line;
 	int padding_x = 8;
+	bool ast_stale;
 
 	/*
 	 * Track Y positions of visible lines for hint overlay.
 	 * 128 entries is more than enough for any reasonable screen.
 	 */
 	int line_y_positions[128];
+	struct str line_texts[128];
+	int line_nums[128];
 	int visible_line_count = 0;
-	int first_visible = 0;
+
+	struct arena_mark scratch = arena_mark(&app->arena);
+	struct decor *decors;
+	int decor_count;
+	struct syntax_line_spans *spans;
+	int cursor_row, first_row, last_row, shown;
+	int *lines; /* Line on each row from first_row to last_row */
 
 	ui_ctx_init(&ctx, fb, app->font);
 	ui_ctx_clear(&ctx);
@@ -330,19 +923,22 @@ render(struct app_state *app, struct framebuffer *fb)
 	input_h = line_h + 4;
 	input_y = (fb->height - input_h) / 2;
 
+	ast_stale = app->view.needs_ast_update;
 	if (view_update(&app->view,
+			&app->folds,
 			app->buffer.cursor_line,
-			app->buffer.line_count,
 			fb->height,
 			line_h,
-			menu_h)) {
+			menu_h) ||
+	    ast_stale) {
 		if (syntax_has_tree(app->syntax)) {
-			struct str source = buffer_get_text(&app->buffer);
+			arena_reset(&app->ast_arena);
 			syntax_get_visible_nodes(
 			    app->syntax,
-			    source,
+			    app->buffer.snap,
 			    (uint32_t)app->view.first_visible_line,
 			    (uint32_t)app->view.last_visible_line,
+			    &app->ast_arena,
 			    &app->visible_ast);
 		}
 	}
@@ -350,33 +946,58 @@ render(struct app_state *app, struct framebuffer *fb)
 	lines_above = input_y / line_h;
 	lines_below = (fb->height - input_y - input_h - menu_h) / line_h;
 
-	/* Calculate first visible line for coordinate mapping */
-	first_visible = app->buffer.cursor_line - lines_above;
-	if (first_visible < 0)
-		first_visible = 0;
+	/* Rows the window shows, and the line folds leave on each */
+	cursor_row = fold_line_to_row(&app->folds, app->buffer.cursor_line);
+	first_row = cursor_row - lines_above;
+	if (first_row < 0)
+		first_row = 0;
+	last_row = cursor_row + lines_below;
+	if (last_row >= fold_rows(&app->folds))
+		last_row = fold_rows(&app->folds) - 1;
+	shown = last_row - first_row + 1;
+	lines = arena_array(&app->arena, int, shown);
+	for (i = 0; i < shown; i++)
+		lines[i] = fold_row_to_line(&app->folds, first_row + i);
+
+	/* Decorations and highlight spans of every shown line, at once */
+	sync_search_decor(app);
+	decor_count = query_decor(app, lines, shown, &decors);
+	spans = arena_array(&app->arena, struct syntax_line_spans, shown);
+	query_spans(app, lines, shown, spans);
 
 	/* Draw lines above cursor */
 	for (i = 0; i < lines_above; i++) {
-		line_num = app->buffer.cursor_line - (lines_above - i);
-		if (line_num < 0)
-			continue;
+		int row = cursor_row - (lines_above - i);
 
+		if (row < 0)
+			continue;
+		line_num = lines[row - first_row];
 		y = i * line_h;
 
 		/* Record Y position for this line (for hint overlay) */
 		if (visible_line_count < 128) {
-			line_y_positions[visible_line_count++] = y;
+			line_y_positions[visible_line_count] = y;
+			line_nums[visible_line_count] = line_num;
+			line_texts[visible_line_count++] =
+			    buffer_get_line(&app->buffer, line_num);
 		}
 
-		line = buffer_get_line(&app->buffer, line_num);
-		ui_label_draw_colored(
-		    &ctx, padding_x, y, line, ctx.theme.fg_secondary);
+		draw_line(&ctx,
+			  app,
+			  decors,
+			  decor_count,
+			  &spans[row - first_row],
+			  line_num,
+			  padding_x,
+			  y);
 	}
 
 	/* Draw input box */
 	{
 		int cursor_x;
 		ui_rect input_bg = {0, input_y, fb->width, input_h};
+		struct str text =
+		    str_from_parts(app->input.buf, app->input.len);
 		draw_rect(&ctx.render, input_bg, ctx.theme.bg_hover);
 
 		int text_y = input_y + (input_h - line_h) / 2;
@@ -385,41 +1006,60 @@ render(struct app_state *app, struct framebuffer *fb)
 				      text_y,
 				      str_from_cstr(app->input.buf),
 				      ctx.theme.fg_primary);
+		draw_fold_marker(&ctx,
+				 app,
+				 app->input.version,
+				 app->buffer.cursor_line,
+				 text,
+				 padding_x,
+				 text_y);
 
 		cursor_x = padding_x +
-			   font_char_index_to_x(ctx.render.font,
-						str_from_cstr(app->input.buf),
-						app->input.cursor);
+			   line_metrics_index_to_x(app->metrics,
+						   text,
+						   app->input.version,
+						   app->input.cursor);
 		ui_rect cursor_rect = {cursor_x, text_y, 2, line_h};
 		draw_rect(&ctx.render, cursor_rect, ctx.theme.accent);
 	}
 
 	/* Draw lines below cursor */
 	for (i = 0; i < lines_below; i++) {
-		line_num = app->buffer.cursor_line + 1 + i;
-		if (line_num >= app->buffer.line_count)
-			break;
+		int row = cursor_row + 1 + i;
 
+		if (row > last_row)
+			break;
+		line_num = lines[row - first_row];
 		y = input_y + input_h + (i * line_h);
 
 		/* Record Y position for this line */
 		if (visible_line_count < 128) {
-			line_y_positions[visible_line_count++] = y;
+			line_y_positions[visible_line_count] = y;
+			line_nums[visible_line_count] = line_num;
+			line_texts[visible_line_count++] =
+			    buffer_get_line(&app->buffer, line_num);
 		}
 
-		line = buffer_get_line(&app->buffer, line_num);
-		ui_label_draw_colored(
-		    &ctx, padding_x, y, line, ctx.theme.fg_secondary);
+		draw_line(&ctx,
+			  app,
+			  decors,
+			  decor_count,
+			  &spans[row - first_row],
+			  line_num,
+			  padding_x,
+			  y);
 	}
 
 	/* Draw hint overlays when in hint selection mode */
 	if (app->mode == MODE_AVY_HINT) {
 		avy_draw_hints(&ctx,
 			       &app->avy,
+			       app->metrics,
+			       buffer_version(&app->buffer),
 			       line_y_positions,
+			       line_texts,
+			       line_nums,
 			       visible_line_count,
-			       first_visible,
-			       app->buffer.cursor_line,
 			       padding_x);
 	}
 
@@ -431,7 +1071,24 @@ render(struct app_state *app, struct framebuffer *fb)
 		menu_rect.w = fb->width;
 		menu_rect.h = menu_h;
 
-		if (app->mode == MODE_AVY_ACTION) {
+		/* Syntax counters take the right part of the menu */
+		if (app->show_stats) {
+			struct syntax_stats st;
+			ui_rect stats_rect = menu_rect;
+
+			menu_rect.w = fb->width / 2;
+			stats_rect.x = menu_rect.w;
+			stats_rect.w = fb->width - menu_rect.w;
+			syntax_stats(app->syntax, &st);
+			menu_stats_draw(&ctx, stats_rect, &st);
+		}
+
+		if (app->mode == MODE_SEARCH) {
+			menu_search_draw(&ctx,
+					 menu_rect,
+					 &app->search,
+					 app->search_found);
+		} else if (app->mode == MODE_AVY_ACTION) {
 			/* Show action menu with target context */
 			struct avy_match *match = avy_get_selected(&app->avy);
 			if (match) {
@@ -443,6 +1100,12 @@ render(struct app_state *app, struct framebuffer *fb)
 						  target_line,
 						  &app->visible_ast);
 			}
+		} else if (app->show_outline) {
+			menu_outline_draw(&ctx,
+					  menu_rect,
+					  &app->outline,
+					  app->buffer.snap,
+					  app->buffer.cursor_line);
 		} else {
 			/* Show AST debug view (default) */
 			menu_ast_draw(&ctx,
@@ -451,20 +1114,35 @@ render(struct app_state *app, struct framebuffer *fb)
 				      app->buffer.cursor_line);
 		}
 	}
+
+	arena_pop(&app->arena, scratch);
 }
 
 /* ============================================================
  * MAIN
  * ============================================================ */
 
+/* Called from worker threads to wake the main loop */
+static void
+wake_main_loop(void *arg)
+{
+	platform_wake(arg);
+}
+
 int
 main(int argc, char *argv[])
 {
 	struct platform *platform;
 	struct arena app_arena;
 	struct app_state app = {0};
+	struct session_key session_key_at_load;
+	struct session *session = NULL;
+	struct timespec started;
+	bool first_frame = true, warm_start = false;
 	const char *filepath;
 
+	clock_gettime(CLOCK_MONOTONIC, &started);
+
 	/* Init avy */
 	app.mode = MODE_NORMAL;
 	avy_init(&app.avy);
@@ -477,29 +1155,66 @@ main(int argc, char *argv[])
 		die("Usage: %s <file>\n", argv[0]);
 	filepath = argv[1];
 
-	/* Initialize buffer and load file */
+	/* Initialize buffer: map the session cache, else load the file */
 	buffer_init(&app.buffer);
-	if (!buffer_load(&app.buffer, filepath))
+	if (!session_key(filepath, &session_key_at_load))
+		die("Failed to load: %s\n", filepath);
+	session = session_open(filepath, &session_key_at_load);
+	if (session) {
+		int err;
+		struct snapshot *snap = session_load(session, filepath, &err);
+
+		if (snap) {
+			buffer_adopt(&app.buffer, filepath, snap);
+		} else {
+			session_close(session);
+			session = NULL;
+		}
+	}
+	if (!session && !buffer_load(&app.buffer, filepath))
 		die("Failed to load: %s\n", filepath);
 
+	/* Recover edits from a previous session, then keep journaling */
+	{
+		int n = journal_replay(filepath, replay_line, &app.buffer);
+		int err;
+
+		if (n > 0)
+			dbg("Replayed %d journaled edits\n", n);
+		app.journal =
+		    journal_open(filepath, JOURNAL_LATENCY_MS, &err);
+		if (!app.journal)
+			warn("no edit journal: %s", strerror(err));
+	}
+
 	view_init(&app.view);
 
 	/* Initialize application arena (font, syntax, platform) */
 	arena_init(&app_arena);
-
-	app.syntax = syntax_create(&app_arena);
-	if (app.syntax) {
-		struct str source = buffer_get_text(&app.buffer);
-		syntax_parse(app.syntax, source);
-	}
+	arena_init(&app.arena);
+	arena_init(&app.ast_arena);
 
 	/* Load font */
 	app.font =
 	    font_create(&app_arena, "assets/fonts/JetBrainsMono-Regular.ttf", 20);
 	if (!app.font)
 		die("Failed to load font\n");
+	app.metrics = line_metrics_create(app.font);
+
+	/* Put the cursor and bookmarks back where the last session left */
+	decor_init(&app.decor);
+	if (session) {
+		struct session_state st = session_state(session);
+
+		if (st.cursor_line >= 0 &&
+		    st.cursor_line < app.buffer.line_count)
+			app.buffer.cursor_line = st.cursor_line;
+		session_restore_decor(session, &app.decor);
+		session_close(session);
+		warm_start = true;
+	}
 
-	/* Initialize input with first line */
+	/* Initialize input with the cursor line */
 	ui_input_init(&app.input);
 	{
 		struct str line = buffer_get_current_line(&app.buffer);
@@ -515,9 +1230,32 @@ main(int argc, char *argv[])
 	if (!platform)
 		die("Failed to create platform\n");
 
+	/* Index for incremental search, built in the background */
+	search_init(&app.search, wake_main_loop, platform);
+
+	/* Text shows plain until the first tree arrives */
+	app.syntax = syntax_create(&app_arena, wake_main_loop, platform);
+	syntax_set_threads(app.syntax, (int)sysconf(_SC_NPROCESSORS_ONLN));
+	if (snapshot_text_len(app.buffer.snap) >= VIEWPORT_PARSE_BYTES) {
+		int line = app.buffer.cursor_line;
+		int first = line > VIEWPORT_PARSE_ROWS
+				? line - VIEWPORT_PARSE_ROWS
+				: 0;
+
+		syntax_parse_viewport(app.syntax,
+				      app.buffer.snap,
+				      (uint32_t)first,
+				      (uint32_t)(line + VIEWPORT_PARSE_ROWS));
+	} else {
+		syntax_parse(app.syntax, app.buffer.snap);
+	}
+	app.highlights = highlight_cache_create();
+	outline_init(&app.outline);
+	fold_init(&app.folds, app.buffer.line_count);
+
 	printf("=== Single-Line Input Demo ===\n");
 	printf("Type text. Readline shortcuts work.\n");
-	printf("Enter to submit, Escape to quit.\n\n");
+	printf("Enter writes the line back, Escape to quit.\n\n");
 
 	/* Main loop */
 	while (app.running) {
@@ -530,6 +1268,16 @@ main(int argc, char *argv[])
 				render(&app, fb);
 				platform_present(platform);
 			}
+			if (first_frame) {
+				struct timespec now;
+
+				clock_gettime(CLOCK_MONOTONIC, &now);
+				dbg("First frame after %.1f ms (%s)\n",
+				    (now.tv_sec - started.tv_sec) * 1e3 +
+					(now.tv_nsec - started.tv_nsec) / 1e6,
+				    warm_start ? "session" : "cold");
+				first_frame = false;
+			}
 			app.needs_redraw = false;
 		}
 
@@ -551,6 +1299,18 @@ main(int argc, char *argv[])
 			case EVENT_RESIZE:
 				app.needs_redraw = true;
 				break;
+			case EVENT_WAKE:
+				if (poll_syntax(&app))
+					app.needs_redraw = true;
+				if (!search_poll(&app.search, &app.buffer))
+					break;
+				/* Jump to the first streamed match */
+				if (app.mode == MODE_SEARCH &&
+				    !app.search_found && app.search.query_len)
+					search_jump(
+					    &app, app.search_origin, 1);
+				app.needs_redraw = true;
+				break;
 			default:
 				break;
 			}
@@ -558,8 +1318,28 @@ main(int argc, char *argv[])
 	}
 
 	/* Cleanup (reverse order of initialization) */
-	platform_destroy(platform);
+	{
+		struct session_state st = {app.buffer.cursor_line};
+		int err = session_save(filepath,
+				       &session_key_at_load,
+				       app.buffer.snap,
+				       &st,
+				       &app.decor);
+
+		if (err)
+			warn("no session cache: %s", strerror(err));
+	}
+	fold_destroy(&app.folds);
+	outline_destroy(&app.outline);
+	highlight_cache_destroy(app.highlights);
 	syntax_destroy(app.syntax);
+	search_destroy(&app.search);
+	journal_close(app.journal);
+	decor_destroy(&app.decor);
+	platform_destroy(platform);
+	line_metrics_destroy(app.metrics);
+	arena_destroy(&app.ast_arena);
+	arena_destroy(&app.arena);
 	arena_destroy(&app_arena);
 	buffer_destroy(&app.buffer);
 
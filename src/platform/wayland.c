@@ -8,6 +8,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
 #include <time.h>
 #include <unistd.h>
 #include <wayland-client-core.h>
@@ -94,6 +95,9 @@ struct platform {
 
 	/* Event queue */
 	struct event_queue events;
+
+	/* Cross-thread wakeup (eventfd), polled next to the display fd */
+	int wake_fd;
 };
 
 /* ============================================================
@@ -683,10 +687,17 @@ platform_create(struct arena *a, const char *title, int width, int height)
 
 	event_queue_init(&p->events);
 
+	p->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (p->wake_fd < 0) {
+		perror("eventfd");
+		return NULL;
+	}
+
 	/* Connect to Wayland display */
 	p->display = wl_display_connect(NULL);
 	if (!p->display) {
 		fprintf(stderr, "Failed to connect to Wayland display\n");
+		close(p->wake_fd);
 		return NULL;
 	}
 
@@ -695,6 +706,7 @@ platform_create(struct arena *a, const char *title, int width, int height)
 	if (!p->xkb_context) {
 		fprintf(stderr, "Failed to create XKB context\n");
 		wl_display_disconnect(p->display);
+		close(p->wake_fd);
 		return NULL;
 	}
 
@@ -811,12 +823,16 @@ platform_destroy(struct platform *p)
 	if (p->display) {
 		wl_display_disconnect(p->display);
 	}
+
+	if (p->wake_fd >= 0) {
+		close(p->wake_fd);
+	}
 }
 
 bool
 platform_wait_events(struct platform *p, int timeout_ms)
 {
-	struct pollfd fds[1];
+	struct pollfd fds[2];
 	int ret;
 
 	/* Prepare to read events */
@@ -833,8 +849,10 @@ platform_wait_events(struct platform *p, int timeout_ms)
 	/* Blocking poll for events */
 	fds[0].fd = wl_display_get_fd(p->display);
 	fds[0].events = POLLIN;
+	fds[1].fd = p->wake_fd;
+	fds[1].events = POLLIN;
 
-	ret = poll(fds, 1, timeout_ms); /* BLOCKS here */
+	ret = poll(fds, 2, timeout_ms); /* BLOCKS here */
 
 	if (ret > 0 && (fds[0].revents & POLLIN)) {
 		if (wl_display_read_events(p->display) < 0) {
@@ -845,6 +863,17 @@ platform_wait_events(struct platform *p, int timeout_ms)
 		wl_display_cancel_read(p->display);
 	}
 
+	if (ret > 0 && (fds[1].revents & POLLIN)) {
+		struct platform_event ev = {0};
+		uint64_t count;
+
+		/* Drain counter; any number of wakes becomes one event */
+		if (read(p->wake_fd, &count, sizeof(count)) > 0) {
+			ev.type = EVENT_WAKE;
+			event_queue_push(&p->events, &ev);
+		}
+	}
+
 	return !p->closed;
 }
 
@@ -854,6 +883,16 @@ platform_next_event(struct platform *p, struct platform_event *out)
 	return event_queue_pop(&p->events, out);
 }
 
+void
+platform_wake(struct platform *p)
+{
+	uint64_t one = 1;
+
+	/* Only fails with EAGAIN when the counter is saturated: still woken */
+	if (write(p->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+		perror("platform_wake");
+}
+
 bool
 platform_should_close(struct platform *p)
 {
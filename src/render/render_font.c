@@ -524,6 +524,28 @@ font_char_index_to_x(struct font_ctx *font, struct str text, int index)
 	return x;
 }
 
+void
+font_measure_prefix(struct font_ctx *font, struct str text, int *out)
+{
+	int x;
+	int i;
+
+	x = 0;
+	out[0] = 0;
+
+	for (i = 0; i < text.len; i++) {
+		struct glyph_info *glyph;
+		int c;
+
+		c = (unsigned char)text.data[i];
+		glyph = font ? get_glyph(font, c) : NULL;
+		if (glyph) {
+			x += glyph->advance_x;
+		}
+		out[i + 1] = x;
+	}
+}
+
 int
 font_x_to_char_index(struct font_ctx *font, struct str text, int target_x)
 {
@@ -0,0 +1,102 @@
+#include <render/render_metrics.h>
+
+#include <core/memory.h>
+
+/* ============================================================
+ * CONSTANTS
+ * ============================================================ */
+
+/* Direct-mapped: a screenful of lines plus slack for collisions */
+#define METRICS_SLOTS 512
+
+/* ============================================================
+ * CACHE STRUCTURES
+ * ============================================================ */
+
+struct metrics_entry {
+	const char *data;
+	int len;
+	uint64_t version;
+	int cap;
+	int *x; /* x of each byte boundary, len + 1 entries */
+};
+
+struct line_metrics {
+	struct font_ctx *font;
+	struct metrics_entry slots[METRICS_SLOTS];
+};
+
+/* ============================================================
+ * LOOKUP
+ * ============================================================ */
+
+static uint32_t
+slot_of(struct str text, uint64_t version)
+{
+	uint64_t h = (uint64_t)(uintptr_t)text.data;
+
+	h ^= (uint64_t)text.len * 0x9E3779B97F4A7C15u;
+	h ^= version * 0xC2B2AE3D27D4EB4Fu;
+	h ^= h >> 29;
+	return (uint32_t)(h * 0xBF58476D1CE4E5B9u >> 40) % METRICS_SLOTS;
+}
+
+/* Prefix widths of text, measured on first use */
+static const int *
+get_prefix(struct line_metrics *lm, struct str text, uint64_t version)
+{
+	struct metrics_entry *e = &lm->slots[slot_of(text, version)];
+
+	if (e->data == text.data && e->len == text.len &&
+	    e->version == version)
+		return e->x;
+
+	if (e->cap < text.len + 1) {
+		e->cap = text.len + 1;
+		e->x = xrealloc(e->x, (size_t)e->cap * sizeof(*e->x));
+	}
+	font_measure_prefix(lm->font, text, e->x);
+
+	e->data = text.data;
+	e->len = text.len;
+	e->version = version;
+	return e->x;
+}
+
+/* ============================================================
+ * PUBLIC API
+ * ============================================================ */
+
+struct line_metrics *
+line_metrics_create(struct font_ctx *font)
+{
+	struct line_metrics *lm = xcalloc(1, sizeof(*lm)); /* No live slot */
+
+	lm->font = font;
+	return lm;
+}
+
+void
+line_metrics_destroy(struct line_metrics *lm)
+{
+	int i;
+
+	if (!lm)
+		return;
+	for (i = 0; i < METRICS_SLOTS; i++)
+		xfree(lm->slots[i].x);
+	xfree(lm);
+}
+
+int
+line_metrics_index_to_x(struct line_metrics *lm,
+			struct str text,
+			uint64_t version,
+			int index)
+{
+	if (!text.data || index <= 0)
+		return 0;
+	if (index > text.len)
+		index = text.len;
+	return get_prefix(lm, text, version)[index];
+}
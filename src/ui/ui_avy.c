@@ -77,74 +77,47 @@ is_word_start(const char *data, int len, int col)
 	return !isalnum((unsigned char)data[col - 1]) && data[col - 1] != '_';
 }
 
+/* Add the word starts of line matching c, up to AVY_MAX_MATCHES */
+static void
+match_line(struct avy_state *avy, char c, struct str line, int line_num)
+{
+	const char *data = str_data(line);
+	int len = str_len(line);
+	int col;
+
+	for (col = 0; col < len && avy->match_count < AVY_MAX_MATCHES; col++) {
+		/* Match exact case at word starts only */
+		if (data[col] == c && is_word_start(data, len, col)) {
+			avy->matches[avy->match_count].line = line_num;
+			avy->matches[avy->match_count].col = col;
+			avy->match_count++;
+		}
+	}
+}
+
 void
 avy_set_char(struct avy_state *avy,
 	     char c,
 	     const struct str *lines,
-	     int line_count,
-	     int cursor_line,
-	     int first_visible,
-	     int last_visible)
+	     const int *line_nums,
+	     int count,
+	     int cursor_line)
 {
-	int line_num, col;
-	const char *data;
-	int len;
+	int i;
 
 	avy->search_char = c;
 	avy->match_count = 0;
 
 	if (avy->direction == AVY_DIR_UP) {
 		/* Search lines above cursor (from closest to furthest) */
-		for (line_num = cursor_line - 1;
-		     line_num >= first_visible &&
-		     avy->match_count < AVY_MAX_MATCHES;
-		     line_num--) {
-			if (line_num < 0 || line_num >= line_count)
-				continue;
-			data = str_data(lines[line_num]);
-			len = str_len(lines[line_num]);
-
-			for (col = 0; col < len; col++) {
-				/* Match exact case at word starts only */
-				if (data[col] == c &&
-				    is_word_start(data, len, col)) {
-					avy->matches[avy->match_count].line =
-					    line_num;
-					avy->matches[avy->match_count].col =
-					    col;
-					avy->match_count++;
-					if (avy->match_count >=
-					    AVY_MAX_MATCHES)
-						break;
-				}
-			}
-		}
+		for (i = count - 1; i >= 0; i--)
+			if (line_nums[i] < cursor_line)
+				match_line(avy, c, lines[i], line_nums[i]);
 	} else {
 		/* Search lines below cursor (from closest to furthest) */
-		for (line_num = cursor_line + 1;
-		     line_num <= last_visible &&
-		     avy->match_count < AVY_MAX_MATCHES;
-		     line_num++) {
-			if (line_num < 0 || line_num >= line_count)
-				continue;
-			data = str_data(lines[line_num]);
-			len = str_len(lines[line_num]);
-
-			for (col = 0; col < len; col++) {
-				/* Match exact case at word starts only */
-				if (data[col] == c &&
-				    is_word_start(data, len, col)) {
-					avy->matches[avy->match_count].line =
-					    line_num;
-					avy->matches[avy->match_count].col =
-					    col;
-					avy->match_count++;
-					if (avy->match_count >=
-					    AVY_MAX_MATCHES)
-						break;
-				}
-			}
-		}
+		for (i = 0; i < count; i++)
+			if (line_nums[i] > cursor_line)
+				match_line(avy, c, lines[i], line_nums[i]);
 	}
 
 	/* Generate hint labels for all matches */
@@ -200,41 +173,43 @@ avy_get_selected(struct avy_state *avy)
 void
 avy_draw_hints(struct ui_ctx *ctx,
 	       struct avy_state *avy,
+	       struct line_metrics *lm,
+	       uint64_t version,
 	       int *line_y_positions,
+	       const struct str *line_texts,
+	       const int *line_nums,
 	       int line_count,
-	       int first_visible_line,
-	       int cursor_line,
 	       int padding_x)
 {
 	int i;
 	int line_idx;
 	int x, y;
-	int char_w, line_h;
-	int hint_len, hint_w;
+	int line_h, hint_w;
 	struct avy_match *m;
+	struct str hint;
 	ui_rect bg;
 
-	/* Get character width (monospace assumption) */
-	char_w = font_char_index_to_x(ctx->render.font, STR_LIT("M"), 1);
 	line_h = font_get_line_height(ctx->render.font);
 
 	for (i = 0; i < avy->match_count; i++) {
 		m = &avy->matches[i];
 
 		/* Map buffer line to visible line index */
-		line_idx = m->line - first_visible_line;
-		if (m->line > cursor_line)
-			line_idx--; /* Account for cursor line gap (input box) */
-		if (line_idx < 0 || line_idx >= line_count)
+		for (line_idx = 0; line_idx < line_count; line_idx++)
+			if (line_nums[line_idx] == m->line)
+				break;
+		if (line_idx == line_count)
 			continue;
 
 		/* Calculate pixel position */
 		y = line_y_positions[line_idx];
-		x = padding_x + (m->col * char_w);
+		x = padding_x +
+		    line_metrics_index_to_x(
+			lm, line_texts[line_idx], version, m->col);
 
 		/* Draw hint background (contrasting box) */
-		hint_len = (int)strlen(m->hint);
-		hint_w = hint_len * char_w + 4;
+		hint = str_from_cstr(m->hint);
+		hint_w = font_measure_text(ctx->render.font, hint, NULL) + 4;
 		bg.x = x - 2;
 		bg.y = y;
 		bg.w = hint_w;
@@ -242,7 +217,6 @@ avy_draw_hints(struct ui_ctx *ctx,
 		draw_rect(&ctx->render, bg, ctx->theme.bg_active);
 
 		/* Draw hint text in blue */
-		ui_label_draw_colored(
-		    ctx, x, y, str_from_cstr(m->hint), ZENBURN_BLUE);
+		ui_label_draw_colored(ctx, x, y, hint, ZENBURN_BLUE);
 	}
 }
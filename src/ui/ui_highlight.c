@@ -0,0 +1,103 @@
+/* src/ui/ui_highlight.c */
+
+#include <ui/ui_highlight.h>
+
+#include <ui/ui_label.h>
+
+uint32_t
+ui_highlight_color(struct ui_ctx *ctx, enum syntax_style style)
+{
+	switch (style) {
+	case SYNTAX_STYLE_HEADING:
+		return ctx->theme.accent;
+	case SYNTAX_STYLE_MARKER:
+		return 0xFFDFAF8F; /* Zenburn orange */
+	case SYNTAX_STYLE_CODE:
+		return ctx->theme.success;
+	case SYNTAX_STYLE_CODE_INFO:
+		return 0xFF8CD0D3; /* Zenburn blue */
+	case SYNTAX_STYLE_QUOTE:
+		return 0xFF9FC59F; /* Zenburn light green */
+	case SYNTAX_STYLE_LINK:
+		return 0xFF93E0E3; /* Zenburn cyan */
+	case SYNTAX_STYLE_RULE:
+		return ctx->theme.fg_muted;
+	case SYNTAX_STYLE_HTML:
+		return 0xFFCC9393; /* Zenburn red */
+	case SYNTAX_STYLE_META:
+		return 0xFFDC8CC3; /* Zenburn magenta */
+	case SYNTAX_STYLE_ESCAPE:
+		return 0xFFE3CEAB; /* Zenburn pale yellow */
+	case SYNTAX_STYLE_NONE:
+	default:
+		return ctx->theme.fg_secondary;
+	}
+}
+
+/* Draw line[start, end) where it would be in the whole line */
+static void
+draw_piece(struct ui_ctx *ctx,
+	   struct line_metrics *lm,
+	   uint64_t version,
+	   int x,
+	   int y,
+	   struct str line,
+	   int start,
+	   int end,
+	   uint32_t color)
+{
+	if (start >= end)
+		return;
+	x += line_metrics_index_to_x(lm, line, version, start);
+	ui_label_draw_colored(
+	    ctx, x, y, str_slice(line, start, end), color);
+}
+
+void
+ui_highlight_draw(struct ui_ctx *ctx,
+		  struct line_metrics *lm,
+		  uint64_t version,
+		  int x,
+		  int y,
+		  struct str line,
+		  const struct syntax_line_spans *spans)
+{
+	const struct syntax_span *sp;
+	int at = 0, start, end, i;
+
+	for (i = 0; spans && i < spans->count; i++) {
+		sp = &spans->spans[i];
+		if (sp->start >= (uint32_t)line.len)
+			break;
+		start = (int)sp->start;
+		end = sp->end < (uint32_t)line.len ? (int)sp->end : line.len;
+		draw_piece(ctx,
+			   lm,
+			   version,
+			   x,
+			   y,
+			   line,
+			   at,
+			   start,
+			   ctx->theme.fg_secondary);
+		draw_piece(ctx,
+			   lm,
+			   version,
+			   x,
+			   y,
+			   line,
+			   start,
+			   end,
+			   ui_highlight_color(ctx, sp->style));
+		at = end;
+	}
+	draw_piece(ctx,
+		   lm,
+		   version,
+		   x,
+		   y,
+		   line,
+		   at,
+		   line.len,
+		   ctx->theme.fg_secondary);
+}
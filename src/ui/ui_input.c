@@ -10,10 +10,20 @@
  * LIFECYCLE
  * ============================================================ */
 
+/* Give buf a version no earlier contents had (UI thread only) */
+static void
+input_touch(struct ui_input *in)
+{
+	static uint64_t versions;
+
+	in->version = ++versions;
+}
+
 void
 ui_input_init(struct ui_input *input)
 {
 	memset(input, 0, sizeof(*input));
+	input_touch(input);
 }
 
 void
@@ -35,6 +45,7 @@ ui_input_set_text(struct ui_input *input, struct str text)
 	input->len = len;
 	input->cursor = len; /* Cursor at end */
 	input->scroll_offset = 0;
+	input_touch(input);
 }
 
 const char *
@@ -92,6 +103,7 @@ input_insert_char(struct ui_input *in, char c)
 	in->buf[in->cursor] = c;
 	in->cursor++;
 	in->len++;
+	input_touch(in);
 	return true;
 }
 
@@ -105,6 +117,7 @@ input_delete_char(struct ui_input *in)
 		&in->buf[in->cursor + 1],
 		in->len - in->cursor);
 	in->len--;
+	input_touch(in);
 	return true;
 }
 
@@ -126,6 +139,7 @@ input_kill_line(struct ui_input *in)
 
 	in->buf[in->cursor] = '\0';
 	in->len = in->cursor;
+	input_touch(in);
 	return true;
 }
 
@@ -138,6 +152,7 @@ input_kill_line_back(struct ui_input *in)
 	memmove(&in->buf[0], &in->buf[in->cursor], in->len - in->cursor + 1);
 	in->len -= in->cursor;
 	in->cursor = 0;
+	input_touch(in);
 	return true;
 }
 
@@ -154,6 +169,7 @@ input_kill_word_back(struct ui_input *in)
 	    &in->buf[new_pos], &in->buf[in->cursor], in->len - in->cursor + 1);
 	in->len -= (in->cursor - new_pos);
 	in->cursor = new_pos;
+	input_touch(in);
 	return true;
 }
 
@@ -169,6 +185,7 @@ input_kill_word(struct ui_input *in)
 	memmove(
 	    &in->buf[in->cursor], &in->buf[end_pos], in->len - end_pos + 1);
 	in->len -= (end_pos - in->cursor);
+	input_touch(in);
 	return true;
 }
 
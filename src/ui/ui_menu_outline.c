@@ -0,0 +1,77 @@
+#include <ui/ui_menu_outline.h>
+
+#include <stdio.h>
+
+#include <ui/ui_label.h>
+#include <ui/ui_panel.h>
+
+#define INDENT_SPACES 2
+#define MAX_LINE      128
+#define MAX_TITLE     60
+
+void
+menu_outline_draw(struct ui_ctx *ctx,
+		  ui_rect rect,
+		  const struct outline *outline,
+		  struct snapshot *snap,
+		  int cursor_row)
+{
+	int line_h = ui_label_height(ctx);
+	int padding = 8;
+	int max_lines = (rect.h - padding * 2) / line_h;
+	int y = rect.y + padding;
+	int current, top, i;
+	const struct syntax_heading *h;
+	char line[MAX_LINE];
+	struct str text, title;
+	uint32_t end;
+
+	/* Background */
+	ui_panel_draw(ctx, rect, ctx->theme.bg_hover, UI_PANEL_FLAT);
+
+	if (max_lines <= 0)
+		return;
+
+	/* Header */
+	snprintf(line, MAX_LINE, "Outline (%d headings):", outline->count);
+	ui_label_draw_colored(
+	    ctx, rect.x + padding, y, str_from_cstr(line), ctx->theme.accent);
+	y += line_h;
+	max_lines--;
+
+	/* Keep the enclosing heading in the middle of the slice shown */
+	current = outline_enclosing(outline, (uint32_t)cursor_row);
+	top = current - max_lines / 2;
+	if (top > outline->count - max_lines)
+		top = outline->count - max_lines;
+	if (top < 0)
+		top = 0;
+
+	for (i = top; i < outline->count && i < top + max_lines; i++) {
+		h = &outline->entries[i];
+		text = snapshot_get_line(snap, (int)h->title_row);
+		end = h->title_end < (uint32_t)text.len ? h->title_end
+							: (uint32_t)text.len;
+		title = h->title_start < end
+			    ? str_slice(text, (int)h->title_start, (int)end)
+			    : STR_EMPTY;
+		if (str_len(title) > MAX_TITLE)
+			title = str_slice(title, 0, MAX_TITLE);
+
+		snprintf(line,
+			 MAX_LINE,
+			 "%*s%.*s  :%u",
+			 (h->level - 1) * INDENT_SPACES,
+			 "",
+			 str_len(title),
+			 str_data(title),
+			 h->row + 1);
+		ui_label_draw_colored(ctx,
+				      rect.x + padding,
+				      y,
+				      str_from_cstr(line),
+				      i == current ? ctx->theme.fg_primary
+						   : ctx->theme.fg_secondary);
+		y += line_h;
+	}
+}
@@ -0,0 +1,87 @@
+#include <ui/ui_menu_search.h>
+
+#include <stdio.h>
+
+#include <ui/ui_label.h>
+#include <ui/ui_panel.h>
+
+#define MAX_LINE 128
+
+void
+menu_search_draw(struct ui_ctx *ctx,
+		 ui_rect rect,
+		 const struct search *search,
+		 bool found)
+{
+	int line_h = ui_label_height(ctx);
+	int padding = 8;
+	int x = rect.x + padding;
+	int y = rect.y + padding;
+	char line[MAX_LINE];
+	struct str query = search_get_query(search);
+
+	/* Background */
+	ui_panel_draw(ctx, rect, ctx->theme.bg_hover, UI_PANEL_FLAT);
+
+	snprintf(line,
+		 MAX_LINE,
+		 "%s: %.*s",
+		 search->structural ? "Structural search"
+		 : search->regex    ? "Regex search"
+				    : "Search",
+		 str_len(query),
+		 str_data(query));
+	ui_label_draw_colored(
+	    ctx, x, y, str_from_cstr(line), ctx->theme.accent);
+	y += line_h;
+
+	/* Match status */
+	if (!str_empty(query)) {
+		ui_label_draw_colored(
+		    ctx,
+		    x,
+		    y,
+		    found ? STR_LIT("  match") : STR_LIT("  no match"),
+		    found ? ctx->theme.fg_primary : ctx->theme.fg_muted);
+		y += line_h;
+	}
+
+	/* Scan or index status */
+	if (search_is_scan(search) && search->regex_error) {
+		snprintf(line, MAX_LINE, "  error: %s", search->regex_error);
+	} else if (search_is_scan(search)) {
+		snprintf(line,
+			 MAX_LINE,
+			 "  %d hits in %d lines%s",
+			 search_hit_count(search),
+			 search->scan_lines,
+			 search->scan_done ? "" : " (scanning...)");
+	} else if (search->query_len < TRIGRAM_MIN_QUERY) {
+		snprintf(line,
+			 MAX_LINE,
+			 "  query shorter than %d bytes (scanning lines)",
+			 TRIGRAM_MIN_QUERY);
+	} else if (search_index_too_large(search)) {
+		snprintf(
+		    line, MAX_LINE, "  too large to index (scanning lines)");
+	} else if (search->scan_all) {
+		snprintf(line, MAX_LINE, "  indexing... (scanning lines)");
+	} else {
+		snprintf(line,
+			 MAX_LINE,
+			 "  %d candidate lines",
+			 search->candidate_count);
+	}
+	ui_label_draw_colored(
+	    ctx, x, y, str_from_cstr(line), ctx->theme.fg_secondary);
+	y += line_h;
+
+	y += line_h / 2;
+	ui_label_draw_colored(
+	    ctx,
+	    x,
+	    y,
+	    STR_LIT("[C-s] next  [C-r] prev  [M-r] regex  [M-s] structure  "
+		    "[Ret] accept"),
+	    ctx->theme.fg_muted);
+}
@@ -0,0 +1,112 @@
+#include <ui/ui_menu_stats.h>
+
+#include <stdio.h>
+
+#include <ui/ui_label.h>
+#include <ui/ui_panel.h>
+
+#define MAX_LINE 128
+
+static double
+ms(uint64_t ns)
+{
+	return (double)ns / 1e6;
+}
+
+static double
+mb(uint64_t bytes)
+{
+	return (double)bytes / (1 << 20);
+}
+
+/* "name  count  last  avg  max", times in milliseconds */
+static void
+format_timing(char *line, const char *name, const struct syntax_timing *t)
+{
+	snprintf(line,
+		 MAX_LINE,
+		 "%-11s %6llu %8.2f %8.2f %8.2f",
+		 name,
+		 (unsigned long long)t->count,
+		 ms(t->last_ns),
+		 t->count ? ms(t->total_ns / t->count) : 0.0,
+		 ms(t->max_ns));
+}
+
+void
+menu_stats_draw(struct ui_ctx *ctx,
+		ui_rect rect,
+		const struct syntax_stats *st)
+{
+	const struct {
+		const char *name;
+		const struct syntax_timing *t;
+	} rows[] = {
+	    {"full parse", &st->full_parse},
+	    {"incremental", &st->incremental_parse},
+	    {"viewport", &st->viewport_parse},
+	    {"visible", &st->visible},
+	    {"highlight", &st->highlight},
+	    {"headings", &st->headings},
+	};
+	int line_h = ui_label_height(ctx);
+	int padding = 8;
+	int max_lines = (rect.h - padding * 2) / line_h;
+	int x = rect.x + padding;
+	int y = rect.y + padding;
+	char line[MAX_LINE];
+	int i, n = 0;
+
+	/* Background */
+	ui_panel_draw(ctx, rect, ctx->theme.bg_hover, UI_PANEL_FLAT);
+
+	if (max_lines <= 0)
+		return;
+
+	ui_label_draw_colored(ctx,
+			      x,
+			      y,
+			      STR_LIT("Syntax (ms)  calls     last      avg"
+				      "      max"),
+			      ctx->theme.accent);
+	y += line_h;
+	n++;
+
+	for (i = 0; i < (int)(sizeof(rows) / sizeof(rows[0])); i++) {
+		if (n++ >= max_lines)
+			return;
+		format_timing(line, rows[i].name, rows[i].t);
+		ui_label_draw_colored(
+		    ctx, x, y, str_from_cstr(line), ctx->theme.fg_primary);
+		y += line_h;
+	}
+
+	if (n++ >= max_lines)
+		return;
+	snprintf(line,
+		 MAX_LINE,
+		 "read %.2f MB last, %.1f MB total  changed %u  dropped %u",
+		 mb(st->bytes_read),
+		 mb(st->bytes_read_total),
+		 st->changed_ranges,
+		 st->dropped);
+	ui_label_draw_colored(
+	    ctx, x, y, str_from_cstr(line), ctx->theme.fg_secondary);
+	y += line_h;
+
+	if (n++ >= max_lines)
+		return;
+	snprintf(line,
+		 MAX_LINE,
+		 "nodes %u%s in %d  visible %u  fences %d  "
+		 "memory %.1f MB (peak %.1f)",
+		 st->nodes,
+		 st->partial ? " (window)" : "",
+		 st->sections,
+		 st->visible_nodes,
+		 st->injected,
+		 mb(st->memory.bytes),
+		 mb(st->memory.peak));
+	ui_label_draw_colored(
+	    ctx, x, y, str_from_cstr(line), ctx->theme.fg_secondary);
+}
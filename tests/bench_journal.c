@@ -0,0 +1,94 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <editor/journal.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DOC "/tmp/wlplatform_bench_journal.md"
+
+#define BURST_KEYS 100000
+#define TYPED_KEYS 500
+#define TYPED_GAP_US 1000 /* A fast typist is ~10 ms per key */
+
+static double
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static void
+reset(void)
+{
+	char path[JOURNAL_PATH_MAX];
+	FILE *f = fopen(DOC, "w");
+
+	if (f) {
+		fputs("# bench\n", f);
+		fclose(f);
+	}
+	if (journal_path(DOC, path, sizeof(path)))
+		unlink(path);
+}
+
+/*
+ * Time spent on the typing thread per keystroke. With sync set every
+ * record is fsynced before the keystroke returns: the baseline.
+ */
+static void
+run(const char *label, int latency_ms, int keys, int gap_us, int sync)
+{
+	struct str line = str_from_cstr("the quick brown fox jumps over");
+	struct timespec gap = {0, (long)gap_us * 1000};
+	struct journal *j;
+	double spent = 0, t;
+	uint64_t fsyncs;
+	int i, err;
+
+	reset();
+	j = journal_open(DOC, latency_ms, &err);
+	if (!j) {
+		fprintf(stderr, "journal_open: %d\n", err);
+		return;
+	}
+
+	for (i = 0; i < keys; i++) {
+		t = now_ns();
+		journal_append(j, i % 64, line);
+		if (sync)
+			journal_sync(j);
+		spent += now_ns() - t;
+		if (gap_us)
+			nanosleep(&gap, NULL);
+	}
+	journal_sync(j);
+	fsyncs = journal_fsync_count(j);
+	journal_close(j);
+
+	printf("%-24s %10.0f ns/key %8llu fsyncs %7.1f keys/fsync\n",
+	       label,
+	       spent / keys,
+	       (unsigned long long)fsyncs,
+	       (double)keys / (double)(fsyncs ? fsyncs : 1));
+}
+
+int
+main(void)
+{
+	printf("burst: %d keys back to back\n", BURST_KEYS);
+	run("  group, 0 ms", 0, BURST_KEYS, 0, 0);
+	run("  group, 50 ms", 50, BURST_KEYS, 0, 0);
+
+	printf("typed: %d keys, %d us apart\n", TYPED_KEYS, TYPED_GAP_US);
+	run("  fsync per key", 0, TYPED_KEYS, TYPED_GAP_US, 1);
+	run("  group, 0 ms", 0, TYPED_KEYS, TYPED_GAP_US, 0);
+	run("  group, 10 ms", 10, TYPED_KEYS, TYPED_GAP_US, 0);
+	run("  group, 50 ms", 50, TYPED_KEYS, TYPED_GAP_US, 0);
+
+	reset();
+	unlink(DOC);
+	return 0;
+}
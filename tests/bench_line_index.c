@@ -0,0 +1,118 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <editor/line_index.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define LOOKUPS (1 << 22)
+
+/*
+ * Memory and lookup latency of the plain and the Elias-Fano line index
+ * over synthetic log-like line lengths (mean ~40 bytes, some empty).
+ * Usage: bench_line_index [millions of lines], default 20.
+ */
+
+static double
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static uint64_t
+next_rand(uint64_t *x)
+{
+	*x ^= *x << 13;
+	*x ^= *x >> 7;
+	*x ^= *x << 17;
+	return *x;
+}
+
+/* Line starts are regenerated from a seed rather than stored */
+static uint64_t
+line_len(uint64_t *x)
+{
+	uint64_t r = next_rand(x);
+
+	return r % 8 == 0 ? 1 : 1 + 20 + r % 40;
+}
+
+static struct line_index *
+build(enum line_index_kind kind, uint64_t n, uint64_t universe)
+{
+	struct line_index *idx;
+	uint64_t seed = 42, pos = 0, i;
+
+	idx = line_index_init(
+	    malloc(line_index_size(kind, n, universe)), kind, n, universe);
+	for (i = 0; i < n; i++) {
+		line_index_push(idx, pos);
+		pos += line_len(&seed);
+	}
+	return idx;
+}
+
+static void
+run(const char *label,
+    enum line_index_kind kind,
+    uint64_t n,
+    uint64_t universe,
+    const uint64_t *probe)
+{
+	struct line_index *idx;
+	uint64_t sum = 0, i;
+	double t0, build_ms, rnd, seq;
+
+	t0 = now_ns();
+	idx = build(kind, n, universe);
+	build_ms = (now_ns() - t0) / 1e6;
+
+	t0 = now_ns();
+	for (i = 0; i < LOOKUPS; i++)
+		sum += line_index_get(idx, probe[i]);
+	rnd = (now_ns() - t0) / LOOKUPS;
+
+	t0 = now_ns();
+	for (i = 0; i < LOOKUPS && i < n; i++)
+		sum += line_index_get(idx, i);
+	seq = (now_ns() - t0) / (double)(i ? i : 1);
+
+	printf("  %-6s %8.1f MB %6.2f B/line  build %7.1f ms  "
+	       "random %5.1f ns  sequential %5.1f ns  (%llu)\n",
+	       label,
+	       (double)line_index_bytes(idx) / (1 << 20),
+	       (double)line_index_bytes(idx) / (double)n,
+	       build_ms,
+	       rnd,
+	       seq,
+	       (unsigned long long)(sum % 10));
+	free(idx);
+}
+
+int
+main(int argc, char **argv)
+{
+	uint64_t n = (uint64_t)(argc > 1 ? atol(argv[1]) : 20) * 1000000;
+	uint64_t seed = 42, universe = 0, i, *probe;
+
+	for (i = 0; i < n; i++)
+		universe += line_len(&seed);
+	universe++;
+
+	probe = malloc(LOOKUPS * sizeof(*probe));
+	seed = 7;
+	for (i = 0; i < LOOKUPS; i++)
+		probe[i] = next_rand(&seed) % n;
+
+	printf("%llu lines, %.1f MB of text\n",
+	       (unsigned long long)n,
+	       (double)universe / (1 << 20));
+	run("array", LINE_INDEX_ARRAY, n, universe, probe);
+	run("ef", LINE_INDEX_EF, n, universe, probe);
+
+	free(probe);
+	return 0;
+}
@@ -0,0 +1,115 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <editor/session.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DOC "/tmp/wlplatform_bench_session.md"
+#define SCREEN_LINES 50
+
+/*
+ * Time from "open this file" to having the first screen of lines, cold
+ * (read and scan for newlines) against warm (map the session cache).
+ * Both runs hit the page cache, so this measures CPU, not the disk.
+ * Usage: bench_session [megabytes], default 1024.
+ */
+
+static double
+now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+static void
+make_doc(long mb)
+{
+	static const char *words[] = {"alpha", "beta", "gamma", "delta"};
+	char line[128];
+	long written = 0, i = 0;
+	FILE *f = fopen(DOC, "w");
+	int n;
+
+	if (!f) {
+		perror(DOC);
+		exit(1);
+	}
+	while (written < mb * 1024 * 1024) {
+		n = snprintf(line,
+			     sizeof(line),
+			     "%ld %s lorem ipsum dolor sit amet\n",
+			     i,
+			     words[i % 4]);
+		fwrite(line, 1, (size_t)n, f);
+		written += n;
+		i++;
+	}
+	fclose(f);
+}
+
+/* Touch what the first frame draws */
+static long
+first_screen(struct snapshot *snap)
+{
+	long sum = 0;
+	int i;
+
+	for (i = 0; i < SCREEN_LINES && i < snapshot_line_count(snap); i++)
+		sum += snapshot_get_line(snap, i).len;
+	return sum;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct session_state st = {0};
+	struct session_key key;
+	struct snapshot *snap;
+	struct decor_tree t;
+	struct session *s;
+	char path[SESSION_PATH_MAX];
+	long mb = argc > 1 ? atol(argv[1]) : 1024, sum;
+	double t0, cold, save, warm;
+	int err;
+
+	make_doc(mb);
+	session_key(DOC, &key);
+
+	t0 = now_ms();
+	snap = snapshot_load(DOC, &err);
+	sum = first_screen(snap);
+	cold = now_ms() - t0;
+
+	decor_init(&t);
+	t0 = now_ms();
+	session_save(DOC, &key, snap, &st, &t);
+	save = now_ms() - t0;
+	snapshot_release(snap);
+
+	t0 = now_ms();
+	s = session_open(DOC, &key);
+	snap = s ? session_load(s, DOC, &err) : NULL;
+	session_close(s);
+	if (!snap || first_screen(snap) != sum) {
+		fprintf(stderr, "session cache not usable\n");
+		return 1;
+	}
+	warm = now_ms() - t0;
+
+	printf("%ld MB, %d lines\n", mb, snapshot_line_count(snap));
+	printf("  cold load       %9.2f ms\n", cold);
+	printf("  session save    %9.2f ms (once, at exit)\n", save);
+	printf("  session load    %9.2f ms\n", warm);
+
+	snapshot_release(snap);
+	decor_destroy(&t);
+	session_path(DOC, path, sizeof(path));
+	unlink(path);
+	unlink(DOC);
+	return 0;
+}
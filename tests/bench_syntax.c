@@ -0,0 +1,135 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <editor/syntax.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DOC	  "/tmp/wlplatform_bench_syntax.md"
+#define VIEW_ROWS 40
+#define QUERIES	  20000
+
+#include "syntax_harness.h"
+
+/*
+ * Cost of collecting the visible AST for a 40-row viewport at random
+ * rows of outlined documents of growing length: chapters of sections
+ * of subsections, each holding paragraphs and lists.
+ * Usage: bench_syntax [max thousands of lines], default 1000.
+ */
+
+static double
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static uint64_t
+next_rand(uint64_t *x)
+{
+	*x ^= *x << 13;
+	*x ^= *x >> 7;
+	*x ^= *x << 17;
+	return *x;
+}
+
+/*
+ * Write about lines lines, outlined or one flat run of blocks; returns
+ * the exact count.
+ */
+static int
+write_doc(int lines, bool outline)
+{
+	FILE *f = doc_create();
+	int n = 0, i;
+
+	while (n < lines) {
+		if (!outline)
+			;
+		else if (n % 2000 == 0)
+			n += fprintf(f, "# Chapter %d\n\n", n) > 0 ? 2 : 0;
+		else if (n % 200 == 0)
+			n += fprintf(f, "## Section %d\n\n", n) > 0 ? 2 : 0;
+		else if (n % 20 == 0)
+			n += fprintf(f, "### Part %d\n\n", n) > 0 ? 2 : 0;
+		for (i = 0; i < 3; i++)
+			fputs("- a list item with some words in it\n", f);
+		fputs("\nA paragraph of plain text that runs on.\n\n", f);
+		n += 6;
+	}
+	fclose(f);
+	return n;
+}
+
+static void
+run(int lines, bool outline)
+{
+	struct syntax_visible vis;
+	struct syntax_range *ranges;
+	struct syntax_ctx *ctx;
+	struct snapshot *snap;
+	struct arena_mark m;
+	struct arena a;
+	uint64_t seed = 7;
+	double t0, parse_ms, per;
+	long nodes = 0;
+	int i, row;
+
+	lines = write_doc(lines, outline);
+	snap = doc_load();
+	arena_init(&a);
+	ctx = syntax_create(&a, on_ready, NULL);
+	t0 = now_ns();
+	syntax_parse(ctx, snap);
+	wait_ready();
+	parse_ms = (now_ns() - t0) / 1e6;
+	if (syntax_poll(ctx, snapshot_version(snap), &a, &ranges) < 0) {
+		fprintf(stderr, "no tree\n");
+		exit(1);
+	}
+
+	t0 = now_ns();
+	for (i = 0; i < QUERIES; i++) {
+		row = (int)(next_rand(&seed) % (uint64_t)(lines - VIEW_ROWS));
+		m = arena_mark(&a);
+		syntax_get_visible_nodes(ctx,
+					 snap,
+					 (uint32_t)row,
+					 (uint32_t)(row + VIEW_ROWS - 1),
+					 &a,
+					 &vis);
+		nodes += vis.count;
+		arena_pop(&a, m);
+	}
+	per = (now_ns() - t0) / QUERIES;
+
+	printf("%-7s %9d lines  parse %8.1f ms  visible %7.2f us/query  "
+	       "(%.1f nodes)\n",
+	       outline ? "outline" : "flat",
+	       lines,
+	       parse_ms,
+	       per / 1e3,
+	       (double)nodes / QUERIES);
+
+	syntax_destroy(ctx);
+	arena_destroy(&a);
+	snapshot_release(snap);
+}
+
+int
+main(int argc, char **argv)
+{
+	int max = argc > 1 ? atoi(argv[1]) * 1000 : 1000000;
+	int lines;
+
+	for (lines = 10000; lines <= max; lines *= 10)
+		run(lines, true);
+	for (lines = 10000; lines <= max; lines *= 10)
+		run(lines, false);
+	return 0;
+}
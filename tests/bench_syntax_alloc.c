@@ -0,0 +1,173 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <editor/syntax.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DOC   "/tmp/wlplatform_bench_syntax_alloc.md"
+#define EDITS 50
+
+#include "syntax_harness.h"
+
+/*
+ * Parse time and memory of each tree-sitter allocator on outlined
+ * documents of growing length: a full parse, then EDITS incremental
+ * reparses after one-line edits. Each mode runs in its own process,
+ * since the allocator is fixed once installed, so peak RSS is its own.
+ * Usage: bench_syntax_alloc [max thousands of lines], default 1000.
+ */
+
+static const char *const mode_names[] = {"malloc", "counted", "pooled"};
+
+static double
+now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+/* Resident set size now, from /proc */
+static long
+rss_kb(void)
+{
+	FILE *f = fopen("/proc/self/statm", "r");
+	long size = 0, resident = 0;
+
+	if (f) {
+		if (fscanf(f, "%ld %ld", &size, &resident) != 2)
+			resident = 0;
+		fclose(f);
+	}
+	return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static int
+write_doc(int lines)
+{
+	FILE *f = doc_create();
+	int n = 0, i;
+
+	while (n < lines) {
+		if (n % 200 == 0)
+			n += fprintf(f, "## Section %d\n\n", n) > 0 ? 2 : 0;
+		for (i = 0; i < 3; i++)
+			fputs("- a list item with some words in it\n", f);
+		fputs("\nA paragraph of plain text that runs on.\n\n", f);
+		n += 6;
+	}
+	fclose(f);
+	return n;
+}
+
+static void
+adopt(struct syntax_ctx *ctx, struct snapshot *snap, struct arena *a)
+{
+	struct syntax_range *ranges;
+
+	if (wait_poll(ctx, snap, a, &ranges) < 0) {
+		fprintf(stderr, "no tree\n");
+		exit(1);
+	}
+}
+
+static void
+run(enum syntax_alloc_mode mode, int lines)
+{
+	struct snapshot *snap, *next;
+	struct syntax_account mem;
+	struct syntax_change c;
+	struct syntax_ctx *ctx;
+	struct rusage ru;
+	struct str line;
+	struct arena a;
+	double t0, full_ms, edit_ms;
+	long base_kb, offset;
+	char text[128];
+	int i, row, len;
+
+	syntax_alloc_install(mode);
+	lines = write_doc(lines);
+	snap = doc_load();
+	arena_init(&a);
+	base_kb = rss_kb();
+
+	ctx = syntax_create(&a, on_ready, NULL);
+	t0 = now_ms();
+	syntax_parse(ctx, snap);
+	adopt(ctx, snap, &a);
+	full_ms = now_ms() - t0;
+
+	/* Append a word to a list item spread through the document */
+	t0 = now_ms();
+	for (i = 0; i < EDITS; i++) {
+		row = (int)((long)lines * i / EDITS) / 6 * 6 + 2;
+		line = snapshot_get_line(snap, row);
+		len = snprintf(
+		    text, sizeof(text), "%.*s x", line.len, line.data);
+		offset = snapshot_line_offset(snap, row);
+		memset(&c, 0, sizeof(c));
+		c.start_byte = (uint32_t)offset;
+		c.old_end_byte = (uint32_t)(offset + line.len);
+		c.new_end_byte = (uint32_t)(offset + len);
+		c.start.row = c.old_end.row = c.new_end.row = (uint32_t)row;
+		c.old_end.col = (uint32_t)line.len;
+		c.new_end.col = (uint32_t)len;
+		next = snapshot_replace_line(
+		    snap, row, str_from_parts(text, len));
+		snapshot_release(snap);
+		snap = next;
+		syntax_edit(ctx, &c, snap);
+		adopt(ctx, snap, &a);
+	}
+	edit_ms = (now_ms() - t0) / EDITS;
+
+	syntax_memory(ctx, &mem);
+	getrusage(RUSAGE_SELF, &ru);
+	printf("%-7s %8d lines  parse %8.1f ms  edit %6.2f ms  "
+	       "trees %7.1f MB (peak %7.1f)  peak RSS +%7.1f MB\n",
+	       mode_names[mode],
+	       lines,
+	       full_ms,
+	       edit_ms,
+	       (double)mem.bytes / (1 << 20),
+	       (double)mem.peak / (1 << 20),
+	       (double)(ru.ru_maxrss - base_kb) / 1024);
+
+	syntax_destroy(ctx);
+	arena_destroy(&a);
+	snapshot_release(snap);
+}
+
+int
+main(int argc, char **argv)
+{
+	int max = argc > 1 ? atoi(argv[1]) * 1000 : 1000000;
+	int lines, mode, status;
+	pid_t pid;
+
+	for (lines = 10000; lines <= max; lines *= 10) {
+		for (mode = SYNTAX_ALLOC_MALLOC; mode <= SYNTAX_ALLOC_POOLED;
+		     mode++) {
+			fflush(stdout);
+			pid = fork();
+			if (pid < 0) {
+				perror("fork");
+				return 1;
+			}
+			if (pid == 0) {
+				run((enum syntax_alloc_mode)mode, lines);
+				exit(0);
+			}
+			if (waitpid(pid, &status, 0) < 0 || status != 0)
+				return 1;
+		}
+	}
+	return 0;
+}
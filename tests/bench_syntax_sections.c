@@ -0,0 +1,114 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <editor/syntax.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DOC "/tmp/wlplatform_bench_syntax_sections.md"
+
+#include "syntax_harness.h"
+
+/*
+ * Scaling of a parse from scratch with the threads it may use: 1, then
+ * doubling up to the cores online (and that count itself), on an
+ * outlined document of chapters, sections and parts.
+ * Usage: bench_syntax_sections [thousands of lines [max threads]],
+ * default 1000 and the cores online.
+ */
+
+static double
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static void
+write_doc(int lines)
+{
+	FILE *f = doc_create();
+	int n = 0, i;
+
+	while (n < lines) {
+		if (n % 2000 == 0)
+			n += fprintf(f, "# Chapter %d\n\n", n) > 0 ? 2 : 0;
+		else if (n % 200 == 0)
+			n += fprintf(f, "## Section %d\n\n", n) > 0 ? 2 : 0;
+		else if (n % 20 == 0)
+			n += fprintf(f, "### Part %d\n\n", n) > 0 ? 2 : 0;
+		for (i = 0; i < 3; i++)
+			fputs("- a list item with some words in it\n", f);
+		fputs("\nA paragraph of plain text that runs on.\n\n", f);
+		n += 6;
+	}
+	fclose(f);
+}
+
+/* Milliseconds to parse snap with threads threads */
+static double
+run(struct snapshot *snap, int threads, int *sections)
+{
+	struct syntax_range *ranges;
+	struct syntax_stats st;
+	struct syntax_ctx *ctx;
+	struct arena a;
+	double t0, ms;
+
+	arena_init(&a);
+	ctx = syntax_create(&a, on_ready, NULL);
+	syntax_set_threads(ctx, threads);
+	t0 = now_ns();
+	syntax_parse(ctx, snap);
+	wait_ready();
+	ms = (now_ns() - t0) / 1e6;
+	if (syntax_poll(ctx, snapshot_version(snap), &a, &ranges) < 0) {
+		fprintf(stderr, "no tree\n");
+		exit(1);
+	}
+	syntax_stats(ctx, &st);
+	*sections = st.sections;
+
+	syntax_destroy(ctx);
+	arena_destroy(&a);
+	return ms;
+}
+
+int
+main(int argc, char **argv)
+{
+	int lines = argc > 1 ? atoi(argv[1]) * 1000 : 1000000;
+	int cores = argc > 2 ? atoi(argv[2])
+			     : (int)sysconf(_SC_NPROCESSORS_ONLN);
+	struct snapshot *snap;
+	double base = 0, ms;
+	int threads, sections;
+
+	if (cores < 1)
+		cores = 1;
+	if (cores > SYNTAX_THREADS_MAX)
+		cores = SYNTAX_THREADS_MAX;
+	write_doc(lines);
+	snap = doc_load();
+
+	printf("%d lines, %d cores\n", snapshot_line_count(snap), cores);
+	for (threads = 1; threads <= cores; threads *= 2) {
+		ms = run(snap, threads, &sections);
+		if (threads == 1)
+			base = ms;
+		printf("%3d threads  %4d sections  parse %8.1f ms  "
+		       "speedup %5.2fx\n",
+		       threads,
+		       sections,
+		       ms,
+		       base / ms);
+		if (threads < cores && threads * 2 > cores)
+			threads = cores / 2; /* Then cores itself */
+	}
+	snapshot_release(snap);
+	return 0;
+}
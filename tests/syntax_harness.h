@@ -0,0 +1,110 @@
+/* tests/syntax_harness.h
+ *
+ * Fixture shared by the syntax tests and benchmarks: a document goes
+ * through a temporary file into a snapshot, and parses are awaited
+ * through the worker's ready callback.
+ *
+ * Define DOC, the temporary file's path, before including. The helpers
+ * are static, so each test or benchmark includes this from its one .c.
+ */
+
+#ifndef SYNTAX_HARNESS_H
+#define SYNTAX_HARNESS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <editor/syntax.h>
+
+#ifndef DOC
+#error "define DOC before including syntax_harness.h"
+#endif
+
+static int ready; /* Parses finished, bumped by the worker */
+
+static inline void
+on_ready(void *arg)
+{
+	(void)arg;
+	__atomic_add_fetch(&ready, 1, __ATOMIC_RELEASE);
+}
+
+/* Open DOC for the document to be written into */
+static inline FILE *
+doc_create(void)
+{
+	FILE *f = fopen(DOC, "w");
+
+	if (!f) {
+		perror(DOC);
+		exit(1);
+	}
+	return f;
+}
+
+/* Load DOC, written through doc_create, and remove it */
+static inline struct snapshot *
+doc_load(void)
+{
+	struct snapshot *s;
+	int err;
+
+	s = snapshot_load(DOC, &err);
+	unlink(DOC);
+	if (!s) {
+		fprintf(stderr, "%s: %s\n", DOC, strerror(err));
+		exit(1);
+	}
+	return s;
+}
+
+static inline struct snapshot *
+load(const char *text)
+{
+	FILE *f = doc_create();
+
+	fputs(text, f);
+	fclose(f);
+	return doc_load();
+}
+
+/* Wait for the worker to finish a parse */
+static inline void
+wait_ready(void)
+{
+	struct timespec ts = {0, 100000};
+
+	while (!__atomic_exchange_n(&ready, 0, __ATOMIC_ACQUIRE))
+		nanosleep(&ts, NULL);
+}
+
+/* Wait for a parse, then adopt its tree */
+static inline int
+wait_poll(struct syntax_ctx *ctx,
+	  struct snapshot *s,
+	  struct arena *a,
+	  struct syntax_range **ranges)
+{
+	wait_ready();
+	return syntax_poll(ctx, snapshot_version(s), a, ranges);
+}
+
+/* Poll until a tree is adopted, leaving ready alone */
+static inline int
+poll_tree(struct syntax_ctx *ctx,
+	  struct snapshot *s,
+	  struct arena *a,
+	  struct syntax_range **ranges)
+{
+	struct timespec ts = {0, 100000};
+	int n;
+
+	while ((n = syntax_poll(ctx, snapshot_version(s), a, ranges)) < 0)
+		nanosleep(&ts, NULL);
+	return n;
+}
+
+#endif /* SYNTAX_HARNESS_H */
@@ -0,0 +1,148 @@
+#include <assert.h>
+#include <editor/decor.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static struct decor
+range(long start, long end, enum decor_kind kind)
+{
+	struct decor d = {start, end, kind, 0};
+	return d;
+}
+
+static void
+test_decor_query(void)
+{
+	struct decor_tree t;
+	struct arena a;
+	struct decor *out;
+	int n;
+
+	decor_init(&t);
+	arena_init(&a);
+
+	decor_add(&t, range(50, 60, DECOR_SEARCH_HIT));
+	decor_add(&t, range(10, 20, DECOR_SEARCH_HIT));
+	decor_add(&t, range(0, 100, DECOR_BOOKMARK));
+	decor_add(&t, range(30, 30, DECOR_BOOKMARK)); /* Anchor */
+
+	n = decor_query(&t, 15, 31, &a, &out);
+	assert(n == 3);
+	assert(out[0].start == 0 && out[1].start == 10 && out[2].start == 30);
+
+	/* Half-open: touching ranges do not overlap */
+	n = decor_query(&t, 60, 70, &a, &out);
+	assert(n == 1 && out[0].end == 100);
+
+	decor_clear(&t, DECOR_BOOKMARK);
+	n = decor_query(&t, 0, 1000, &a, &out);
+	assert(n == 2 && out[0].start == 10 && out[1].start == 50);
+
+	arena_destroy(&a);
+	decor_destroy(&t);
+}
+
+static void
+test_decor_edit(void)
+{
+	struct decor_tree t;
+	struct arena a;
+	struct decor *out;
+	int n;
+
+	decor_init(&t);
+	arena_init(&a);
+
+	decor_add(&t, range(0, 5, DECOR_SEARCH_HIT));
+	decor_add(&t, range(8, 12, DECOR_SEARCH_HIT));
+	decor_add(&t, range(20, 25, DECOR_SEARCH_HIT));
+
+	/* Grow [10, 12) to 6 bytes: later ranges move, overlap stretches */
+	decor_edit(&t, 10, 2, 6);
+	n = decor_query(&t, 0, 1000, &a, &out);
+	assert(n == 3);
+	assert(out[0].start == 0 && out[0].end == 5);
+	assert(out[1].start == 8 && out[1].end == 16);
+	assert(out[2].start == 24 && out[2].end == 29);
+
+	/* Delete [2, 22): ranges inside collapse onto the edit point */
+	decor_edit(&t, 2, 20, 0);
+	n = decor_query(&t, 0, 1000, &a, &out);
+	assert(n == 3);
+	assert(out[0].start == 0 && out[0].end == 2);
+	assert(out[1].start == 2 && out[1].end == 2);
+	assert(out[2].start == 4 && out[2].end == 9);
+
+	arena_destroy(&a);
+	decor_destroy(&t);
+}
+
+/* Compare against a plain array under random edits */
+static void
+test_decor_random(void)
+{
+	struct decor_tree t;
+	struct arena a;
+	struct decor *out;
+	long start[500], end[500];
+	int i, j, k, n, want;
+
+	decor_init(&t);
+	arena_init(&a);
+	srand(1);
+
+	for (i = 0; i < 500; i++) {
+		start[i] = rand() % 10000;
+		end[i] = start[i] + rand() % 50;
+		decor_add(&t, range(start[i], end[i], DECOR_SEARCH_HIT));
+	}
+
+	for (k = 0; k < 200; k++) {
+		long pos = rand() % 10000, old_len = rand() % 20;
+		long new_len = rand() % 20, cut = pos + old_len;
+		long lim = pos + new_len, lo, hi;
+
+		decor_edit(&t, pos, old_len, new_len);
+		for (i = 0; i < 500; i++) {
+			if (start[i] >= cut) {
+				start[i] += new_len - old_len;
+				end[i] += new_len - old_len;
+				continue;
+			}
+			if (start[i] > lim)
+				start[i] = lim;
+			if (end[i] >= cut)
+				end[i] += new_len - old_len;
+			else if (end[i] > lim)
+				end[i] = lim;
+		}
+
+		lo = rand() % 10000;
+		hi = lo + rand() % 500;
+		n = decor_query(&t, lo, hi, &a, &out);
+		want = 0;
+		for (i = 0; i < 500; i++)
+			if (start[i] < hi &&
+			    (end[i] > lo ||
+			     (end[i] == start[i] && start[i] >= lo)))
+				want++;
+		assert(n == want);
+		for (j = 1; j < n; j++)
+			assert(out[j - 1].start <= out[j].start);
+		arena_reset(&a);
+	}
+
+	arena_destroy(&a);
+	decor_destroy(&t);
+}
+
+int
+main(void)
+{
+	test_decor_query();
+	test_decor_edit();
+	test_decor_random();
+
+	printf("All decor tests passed!\n");
+	return 0;
+}
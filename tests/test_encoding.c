@@ -0,0 +1,235 @@
+#include <assert.h>
+#include <editor/encoding.h>
+#include <editor/snapshot.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define DOC "/tmp/wlplatform_test_encoding.txt"
+
+/* String literal and its length, embedded NULs included */
+#define LIT(s) s, sizeof(s) - 1
+
+/*
+ * Decode in chunks of step bytes, starting over when the decoder gives
+ * up on UTF-8; returns the output length
+ */
+static size_t
+decode(const char *in, size_t len, size_t step, char *out, int *eol)
+{
+	struct text_format f = text_sniff(in, len);
+	struct text_decoder d;
+	size_t i, n;
+	char *end;
+
+	do {
+		text_decoder_init(&d, f);
+		end = out;
+		for (i = 0; end && i < len; i += n) {
+			n = len - i < step ? len - i : step;
+			end = text_decode(&d, in + i, n, end);
+		}
+		if (end)
+			end = text_decode_finish(&d, end);
+		f = d.format;
+	} while (!end);
+	if (eol)
+		*eol = d.format.eol;
+	return (size_t)(end - out);
+}
+
+/* Every chunk size gives the same result */
+static void
+assert_decodes(const char *in, size_t len, const char *want, int want_eol)
+{
+	char out[256];
+	size_t step, n;
+	int eol;
+
+	for (step = 1; step <= len; step++) {
+		n = decode(in, len, step, out, &eol);
+		assert(n == strlen(want));
+		assert(memcmp(out, want, n) == 0);
+		assert(eol == want_eol);
+	}
+}
+
+static void
+test_encoding_sniff(void)
+{
+	struct text_format f;
+
+	f = text_sniff("\xEF\xBB\xBFhi", 5);
+	assert(f.encoding == TEXT_UTF8 && f.bom);
+	f = text_sniff("\xFF\xFEh\0", 4);
+	assert(f.encoding == TEXT_UTF16LE && f.bom);
+	f = text_sniff("\xFE\xFF\0h", 4);
+	assert(f.encoding == TEXT_UTF16BE && f.bom);
+	f = text_sniff("h\0e\0l\0l\0o\0", 10);
+	assert(f.encoding == TEXT_UTF16LE && !f.bom);
+	f = text_sniff("\0h\0e\0l\0l\0o", 10);
+	assert(f.encoding == TEXT_UTF16BE && !f.bom);
+	f = text_sniff("caf\xC3\xA9", 5);
+	assert(text_format_is_plain(f));
+	f = text_sniff("caf\xE9 au lait", 12);
+	assert(f.encoding == TEXT_LATIN1);
+
+	/* A sequence cut by the end of the sample is still UTF-8 */
+	f = text_sniff("caf\xC3", 4);
+	assert(f.encoding == TEXT_UTF8);
+}
+
+static void
+test_encoding_decode(void)
+{
+	/* "a\xE9\xD83D\xDE00" with CRLF, little and big endian */
+	static const char le[] = "\xFF\xFE"
+				 "a\0\xE9\0\x3D\xD8\x00\xDE\r\0\n\0"
+				 "b\0c\0d\0e\0f\0";
+	static const char be[] = "\0a\0\xE9\xD8\x3D\xDE\x00\0\r\0\n"
+				 "\0b\0c\0d\0e\0f";
+	static const char want[] = "a\xC3\xA9\xF0\x9F\x98\x80\nbcdef";
+
+	assert_decodes(LIT(le), want, TEXT_EOL_CRLF);
+	assert_decodes(LIT(be), want, TEXT_EOL_CRLF);
+
+	assert_decodes(
+	    LIT("caf\xE9\r\nx\rz\n"), "caf\xC3\xA9\nx\rz\n", TEXT_EOL_CRLF);
+	assert_decodes(
+	    LIT("\xEF\xBB\xBFone\ntwo\r\n"), "one\ntwo\n", TEXT_EOL_LF);
+	assert_decodes(LIT("a\r\r\n\r"), "a\r\n\r", TEXT_EOL_CRLF);
+
+	/* Torn unit and lone surrogate become U+FFFD */
+	assert_decodes(
+	    LIT("\xFF\xFE\x3D\xD8x"), "\xEF\xBF\xBD\xEF\xBF\xBD", TEXT_EOL_LF);
+}
+
+/* UTF-8 is checked across chunks, not just in the sniffed sample */
+static void
+test_encoding_utf8_checked(void)
+{
+	struct text_format utf8 = {TEXT_UTF8, false, TEXT_EOL_LF};
+	struct text_decoder d;
+	char out[16], *end;
+
+	/* A sequence split between chunks */
+	text_decoder_init(&d, utf8);
+	end = text_decode(&d, "caf\xC3", 4, out);
+	end = text_decode(&d, "\xA9!", 2, end);
+	assert(end == out + 6 && memcmp(out, "caf\xC3\xA9!", 6) == 0);
+
+	/* Torn by a chunk that does not continue it */
+	text_decoder_init(&d, utf8);
+	end = text_decode(&d, "caf\xC3", 4, out);
+	assert(end && !text_decode(&d, "x", 1, end));
+	assert(d.format.encoding == TEXT_LATIN1);
+
+	/* A BOM is believed */
+	text_decoder_init(&d, text_sniff("\xEF\xBB\xBF" "caf\xE9", 7));
+	assert(text_decode(&d, "\xEF\xBB\xBF" "caf\xE9", 7, out));
+	assert(d.format.encoding == TEXT_UTF8);
+
+	/* Cut off by the end of the file rather than the sample */
+	text_decoder_init(&d, text_sniff("caf\xC3", 4));
+	end = text_decode(&d, "caf\xC3", 4, out);
+	assert(end && !text_decode_finish(&d, end));
+
+	assert_decodes(LIT("caf\xC3\xA9 \xE9"),
+		       "caf\xC3\x83\xC2\xA9 \xC3\xA9", TEXT_EOL_LF);
+}
+
+/* Write n bytes of ASCII with b at offset at, then load it */
+static struct snapshot *
+load_with_byte(size_t n, size_t at, const char *b)
+{
+	struct snapshot *s;
+	FILE *fp;
+	size_t i;
+	int err;
+
+	fp = fopen(DOC, "wb");
+	assert(fp);
+	for (i = 0; i < n; i++) {
+		if (i == at) {
+			fputs(b, fp);
+			i += strlen(b) - 1;
+		} else {
+			fputc(i % 64 == 63 ? '\n' : 'a', fp);
+		}
+	}
+	fclose(fp);
+	s = snapshot_load(DOC, &err);
+	assert(s);
+	unlink(DOC);
+	return s;
+}
+
+static void
+test_encoding_load_late(void)
+{
+	struct snapshot *s;
+	struct str line;
+
+	/* Latin-1 whose first accent is past the sniffed sample */
+	s = load_with_byte(TEXT_SNIFF_LEN * 2, TEXT_SNIFF_LEN + 1, "\xE9");
+	assert(snapshot_format(s).encoding == TEXT_LATIN1);
+	line = snapshot_get_line(s, (TEXT_SNIFF_LEN + 1) / 64);
+	assert(str_find(line, STR_LIT("a\xC3\xA9" "a")).found);
+	assert(snapshot_line_count(s) == TEXT_SNIFF_LEN * 2 / 64 + 1);
+	snapshot_release(s);
+
+	/* Past the first read, where UTF-8 is read in place */
+	s = load_with_byte(300000, 200001, "\xE9");
+	assert(snapshot_format(s).encoding == TEXT_LATIN1);
+	snapshot_release(s);
+
+	/* UTF-8 split across two reads stays UTF-8 */
+	s = load_with_byte(300000, 65535, "\xC3\xA9");
+	assert(text_format_is_plain(snapshot_format(s)));
+	snapshot_release(s);
+}
+
+static void
+test_encoding_load(void)
+{
+	static const char le[] = "\xFF\xFE#\0 \0T\0\r\0\n\0x\0";
+	struct snapshot *s;
+	struct text_format f;
+	FILE *fp;
+	int err;
+
+	fp = fopen(DOC, "wb");
+	assert(fp);
+	fwrite(le, 1, sizeof(le) - 1, fp);
+	fclose(fp);
+
+	s = snapshot_load(DOC, &err);
+	assert(s);
+	f = snapshot_format(s);
+	assert(f.encoding == TEXT_UTF16LE && f.bom && f.eol == TEXT_EOL_CRLF);
+	assert(snapshot_line_count(s) == 2);
+	assert(str_eq(snapshot_get_line(s, 0), str_from_cstr("# T")));
+	assert(str_eq(snapshot_get_line(s, 1), str_from_cstr("x")));
+
+	/* The mapped path only takes files that need no decoding */
+	assert(!snapshot_map(DOC,
+			     snapshot_base_index(s),
+			     NULL,
+			     NULL,
+			     &err));
+	snapshot_release(s);
+	unlink(DOC);
+}
+
+int
+main(void)
+{
+	test_encoding_sniff();
+	test_encoding_decode();
+	test_encoding_utf8_checked();
+	test_encoding_load();
+	test_encoding_load_late();
+
+	printf("All encoding tests passed!\n");
+	return 0;
+}
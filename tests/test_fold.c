@@ -0,0 +1,124 @@
+#include <assert.h>
+#include <editor/fold.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static struct fold_range
+range(int start, int end)
+{
+	struct fold_range r = {start, end};
+	return r;
+}
+
+static void
+test_fold_nested(void)
+{
+	struct fold_map f;
+
+	fold_init(&f, 20);
+
+	/* Nothing folded: rows are lines */
+	assert(fold_rows(&f) == 20);
+	assert(fold_line_to_row(&f, 7) == 7);
+	assert(fold_row_to_line(&f, 7) == 7);
+	assert(!fold_hidden(&f, 7));
+
+	/* Inner fold hides 6..8, outer one 3..12 around it */
+	assert(fold_close(&f, range(5, 8)));
+	assert(fold_rows(&f) == 17);
+	assert(fold_row_to_line(&f, 5) == 5);
+	assert(fold_row_to_line(&f, 6) == 9);
+	assert(fold_line_to_row(&f, 7) == 5); /* Hidden: its fold's row */
+	assert(fold_line_to_row(&f, 9) == 6);
+
+	assert(fold_close(&f, range(2, 12)));
+	assert(!fold_close(&f, range(2, 4))); /* Already closed there */
+	assert(!fold_close(&f, range(15, 15)));
+	assert(f.count == 2);
+	assert(fold_rows(&f) == 10);
+	assert(fold_row_to_line(&f, 2) == 2);
+	assert(fold_row_to_line(&f, 3) == 13);
+	assert(fold_line_to_row(&f, 13) == 3);
+	assert(fold_line_to_row(&f, 9) == 2);
+
+	/* Opening the outer fold leaves the inner one closed */
+	assert(fold_open(&f, 2));
+	assert(!fold_open(&f, 2));
+	assert(fold_rows(&f) == 17);
+	assert(fold_hidden(&f, 6) && !fold_hidden(&f, 9));
+
+	/* Revealing a line opens every fold over it */
+	assert(fold_close(&f, range(2, 12)));
+	fold_reveal(&f, 7);
+	assert(f.count == 0);
+	assert(fold_rows(&f) == 20);
+
+	/* Rows past the end clamp to the last visible line */
+	assert(fold_close(&f, range(15, 30)));
+	assert(fold_rows(&f) == 16);
+	assert(fold_row_to_line(&f, 100) == 15);
+	assert(fold_row_to_line(&f, -3) == 0);
+
+	fold_destroy(&f);
+}
+
+/* Random folds against a per-line cover count */
+static void
+test_fold_random(void)
+{
+	enum { LINES = 1000, STEPS = 2000 };
+	static int cover[LINES];
+	struct fold_map f;
+	struct fold_range r;
+	int step, i, k, rows, row;
+
+	fold_init(&f, LINES);
+	srand(47);
+	for (step = 0; step < STEPS; step++) {
+		if (f.count > 0 && rand() % 3 == 0) {
+			r = f.folds[rand() % f.count];
+			assert(fold_open(&f, r.start));
+			for (i = r.start + 1; i <= r.end; i++)
+				cover[i]--;
+		} else {
+			r.start = rand() % LINES;
+			r.end = r.start + rand() % 50;
+			if (r.end >= LINES)
+				r.end = LINES - 1;
+			if (fold_close(&f, r))
+				for (i = r.start + 1; i <= r.end; i++)
+					cover[i]++;
+		}
+
+		rows = 0;
+		for (i = 0; i < LINES; i++) {
+			assert(fold_hidden(&f, i) == (cover[i] > 0));
+			if (cover[i] > 0) {
+				assert(fold_line_to_row(&f, i) == rows - 1);
+				continue;
+			}
+			assert(fold_line_to_row(&f, i) == rows);
+			assert(fold_row_to_line(&f, rows) == i);
+			rows++;
+		}
+		assert(fold_rows(&f) == rows);
+	}
+
+	/* The folds stay sorted by start */
+	for (k = 1; k < f.count; k++)
+		assert(f.folds[k - 1].start < f.folds[k].start);
+	row = fold_rows(&f);
+	assert(fold_row_to_line(&f, row) == fold_row_to_line(&f, row - 1));
+	fold_destroy(&f);
+}
+
+int
+main(void)
+{
+	test_fold_nested();
+	test_fold_random();
+
+	printf("All fold tests passed!\n");
+	return 0;
+}
@@ -0,0 +1,146 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <editor/highlight.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DOC  "/tmp/wlplatform_test_highlight.md"
+#define ROWS 8
+
+#include "syntax_harness.h"
+
+static const char text[] =
+    "# Title\n\npara one\n\npara two\n\n```\ncode\n```\n";
+
+/* Cached rows match a query run from scratch */
+static void
+assert_fresh(struct highlight_cache *hc,
+	     struct syntax_ctx *ctx,
+	     struct arena *a)
+{
+	struct syntax_line_spans got[ROWS], want[ROWS];
+	struct syntax_span *g, *w;
+	int i, j;
+
+	highlight_cache_get(hc, ctx, 0, ROWS - 1, got);
+	syntax_highlight(ctx, 0, ROWS - 1, a, want);
+	for (i = 0; i < ROWS; i++) {
+		assert(got[i].count == want[i].count);
+		for (j = 0; j < got[i].count; j++) {
+			g = &got[i].spans[j];
+			w = &want[i].spans[j];
+			assert(g->start == w->start && g->end == w->end);
+			assert(g->style == w->style);
+		}
+	}
+}
+
+static void
+test_highlight_scroll(void)
+{
+	struct highlight_cache *hc = highlight_cache_create();
+	struct syntax_line_spans out[ROWS];
+	struct snapshot *s = load(text);
+	struct syntax_range *ranges;
+	struct syntax_ctx *ctx;
+	struct arena a;
+
+	arena_init(&a);
+	ctx = syntax_create(&a, on_ready, NULL);
+
+	/* Nothing is kept from before the first tree */
+	highlight_cache_get(hc, ctx, 0, 3, out);
+	assert(out[0].count == 0 && highlight_cache_misses(hc) == 0);
+
+	syntax_parse(ctx, s);
+	assert(wait_poll(ctx, s, &a, &ranges) == 1);
+	highlight_cache_update(hc, ranges, 1);
+	highlight_cache_get(hc, ctx, 0, 3, out);
+	assert(highlight_cache_misses(hc) == 4);
+	assert(out[0].count == 2);
+
+	/* Scrolling back costs nothing, scrolling on only the new rows */
+	highlight_cache_get(hc, ctx, 0, 3, out);
+	assert(highlight_cache_misses(hc) == 4);
+	highlight_cache_get(hc, ctx, 2, 5, out);
+	assert(highlight_cache_misses(hc) == 6);
+	assert_fresh(hc, ctx, &a);
+	assert(highlight_cache_misses(hc) == ROWS);
+
+	highlight_cache_clear(hc);
+	highlight_cache_get(hc, ctx, 0, 0, out);
+	assert(highlight_cache_misses(hc) == ROWS + 1);
+
+	syntax_destroy(ctx);
+	highlight_cache_destroy(hc);
+	snapshot_release(s);
+	arena_destroy(&a);
+}
+
+/* An edit drops its row, the reparse the rows it restructured */
+static void
+test_highlight_edit(void)
+{
+	struct highlight_cache *hc = highlight_cache_create();
+	struct syntax_line_spans out[ROWS];
+	struct snapshot *before = load(text), *after;
+	struct syntax_range *ranges;
+	struct syntax_change c;
+	struct syntax_ctx *ctx;
+	struct arena a;
+	uint64_t misses;
+	int n;
+
+	arena_init(&a);
+	ctx = syntax_create(&a, on_ready, NULL);
+	syntax_parse(ctx, before);
+	assert(wait_poll(ctx, before, &a, &ranges) == 1);
+	highlight_cache_get(hc, ctx, 0, ROWS - 1, out);
+	assert(out[2].count == 0);
+
+	/* "para one" becomes "## Sub" */
+	after = snapshot_replace_line(before, 2, STR_LIT("## Sub"));
+	memset(&c, 0, sizeof(c));
+	c.start_byte = 9;
+	c.old_end_byte = 17;
+	c.new_end_byte = 15;
+	c.start.row = c.old_end.row = c.new_end.row = 2;
+	c.old_end.col = 8;
+	c.new_end.col = 6;
+	syntax_edit(ctx, &c, after);
+	highlight_cache_edit(hc, 2);
+	misses = highlight_cache_misses(hc);
+	highlight_cache_get(hc, ctx, 0, ROWS - 1, out);
+	assert(highlight_cache_misses(hc) == misses + 1);
+
+	n = wait_poll(ctx, after, &a, &ranges);
+	assert(n > 0);
+	highlight_cache_update(hc, ranges, n);
+	misses = highlight_cache_misses(hc);
+	assert_fresh(hc, ctx, &a);
+	assert(highlight_cache_misses(hc) > misses);
+	assert(highlight_cache_misses(hc) < misses + ROWS);
+
+	highlight_cache_get(hc, ctx, 2, 2, out);
+	assert(out[0].count == 2);
+	assert(out[0].spans[0].style == SYNTAX_STYLE_MARKER);
+
+	syntax_destroy(ctx);
+	highlight_cache_destroy(hc);
+	snapshot_release(after);
+	snapshot_release(before);
+	arena_destroy(&a);
+}
+
+int
+main(void)
+{
+	test_highlight_scroll();
+	test_highlight_edit();
+
+	printf("All highlight tests passed!\n");
+	return 0;
+}
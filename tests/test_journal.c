@@ -0,0 +1,178 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <editor/journal.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DOC "/tmp/wlplatform_test_journal.md"
+
+struct replayed {
+	int count;
+	int lines[16];
+	char text[16][32];
+};
+
+static void
+collect(int line, struct str text, void *arg)
+{
+	struct replayed *r = arg;
+
+	r->lines[r->count] = line;
+	memcpy(r->text[r->count], text.data, (size_t)text.len);
+	r->text[r->count][text.len] = '\0';
+	r->count++;
+}
+
+static void
+write_doc(const char *content)
+{
+	FILE *f = fopen(DOC, "w");
+
+	assert(f);
+	fputs(content, f);
+	fclose(f);
+}
+
+static void
+remove_journal(void)
+{
+	char path[JOURNAL_PATH_MAX];
+
+	assert(journal_path(DOC, path, sizeof(path)));
+	unlink(path);
+}
+
+static void
+test_journal_path(void)
+{
+	char path[JOURNAL_PATH_MAX];
+
+	assert(journal_path("/a/b/doc.md", path, sizeof(path)));
+	assert(strcmp(path, "/a/b/.doc.md.journal") == 0);
+	assert(journal_path("doc.md", path, sizeof(path)));
+	assert(strcmp(path, ".doc.md.journal") == 0);
+	assert(!journal_path("/a/b/doc.md", path, 8));
+}
+
+static void
+test_journal_roundtrip(void)
+{
+	struct replayed r = {0};
+	struct journal *j;
+	int err;
+
+	write_doc("one\ntwo\n");
+	remove_journal();
+	assert(journal_replay(DOC, collect, &r) == 0);
+
+	j = journal_open(DOC, 5, &err);
+	assert(j && err == 0);
+	journal_append(j, 0, str_from_cstr("ONE"));
+	journal_append(j, 1, str_from_cstr(""));
+	assert(journal_sync(j) == 0);
+	journal_append(j, 1, str_from_cstr("two!"));
+	journal_close(j);
+
+	assert(journal_replay(DOC, collect, &r) == 3);
+	assert(r.lines[0] == 0 && strcmp(r.text[0], "ONE") == 0);
+	assert(r.lines[1] == 1 && strcmp(r.text[1], "") == 0);
+	assert(r.lines[2] == 1 && strcmp(r.text[2], "two!") == 0);
+
+	/* Reopening keeps the records and appends after them */
+	j = journal_open(DOC, 0, &err);
+	assert(j);
+	journal_append(j, 0, str_from_cstr("uno"));
+	journal_close(j);
+	r.count = 0;
+	assert(journal_replay(DOC, collect, &r) == 4);
+	assert(strcmp(r.text[3], "uno") == 0);
+
+	remove_journal();
+}
+
+static void
+test_journal_torn(void)
+{
+	char path[JOURNAL_PATH_MAX];
+	struct replayed r = {0};
+	struct journal *j;
+	struct stat st;
+	int err;
+
+	write_doc("x\n");
+	remove_journal();
+	j = journal_open(DOC, 0, &err);
+	journal_append(j, 0, str_from_cstr("first"));
+	journal_append(j, 0, str_from_cstr("second"));
+	journal_close(j);
+
+	/* Lose the last two bytes of the second record */
+	assert(journal_path(DOC, path, sizeof(path)));
+	assert(stat(path, &st) == 0);
+	assert(truncate(path, st.st_size - 2) == 0);
+
+	assert(journal_replay(DOC, collect, &r) == 1);
+	assert(strcmp(r.text[0], "first") == 0);
+
+	/* Open drops the torn tail so new records stay reachable */
+	j = journal_open(DOC, 0, &err);
+	journal_append(j, 0, str_from_cstr("third"));
+	journal_close(j);
+	r.count = 0;
+	assert(journal_replay(DOC, collect, &r) == 2);
+	assert(strcmp(r.text[1], "third") == 0);
+
+	remove_journal();
+}
+
+static void
+test_journal_stale(void)
+{
+	struct replayed r = {0};
+	struct timespec later;
+	struct journal *j;
+	int err;
+
+	write_doc("x\n");
+	remove_journal();
+	j = journal_open(DOC, 0, &err);
+	journal_append(j, 0, str_from_cstr("edit"));
+	journal_close(j);
+	assert(journal_replay(DOC, collect, &r) == 1);
+
+	/* The document changed on disk: the journal no longer applies */
+	write_doc("y\n");
+	clock_gettime(CLOCK_REALTIME, &later);
+	later.tv_sec += 10;
+	{
+		struct timespec times[2] = {later, later};
+		assert(utimensat(AT_FDCWD, DOC, times, 0) == 0);
+	}
+	r.count = 0;
+	assert(journal_replay(DOC, collect, &r) == 0);
+
+	/* Opening starts afresh */
+	j = journal_open(DOC, 0, &err);
+	journal_close(j);
+	assert(journal_replay(DOC, collect, &r) == 0);
+
+	remove_journal();
+	unlink(DOC);
+}
+
+int
+main(void)
+{
+	test_journal_path();
+	test_journal_roundtrip();
+	test_journal_torn();
+	test_journal_stale();
+
+	printf("All journal tests passed!\n");
+	return 0;
+}
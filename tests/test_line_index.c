@@ -0,0 +1,164 @@
+#include <assert.h>
+#include <editor/line_index.h>
+#include <editor/snapshot.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define DOC "/tmp/wlplatform_test_line_index.md"
+
+static struct line_index *
+build(enum line_index_kind kind, const uint64_t *v, int n, uint64_t universe)
+{
+	size_t size = line_index_size(kind, (uint64_t)n, universe);
+	struct line_index *idx;
+	int i;
+
+	idx = line_index_init(malloc(size), kind, (uint64_t)n, universe);
+	for (i = 0; i < n; i++)
+		line_index_push(idx, v[i]);
+	return idx;
+}
+
+static void
+check_kind(enum line_index_kind kind, const uint64_t *v, int n, uint64_t u)
+{
+	struct line_index *idx = build(kind, v, n, u);
+	int i;
+
+	assert(line_index_count(idx) == (uint64_t)n);
+	for (i = 0; i < n; i++)
+		assert(line_index_get(idx, (uint64_t)i) == v[i]);
+	assert(line_index_check(idx, line_index_bytes(idx)) == idx);
+	assert(!line_index_check(idx, line_index_bytes(idx) - 8));
+	free(idx);
+}
+
+static void
+test_line_index_edges(void)
+{
+	static const uint64_t one[] = {0};
+	static const uint64_t dense[] = {0, 1, 2, 3, 4, 5, 6, 7, 8};
+	static const uint64_t gaps[] = {0, 1, 1000000, 1000001, 5000000000ull};
+
+	check_kind(LINE_INDEX_EF, one, 1, 1);
+	check_kind(LINE_INDEX_EF, dense, 9, 9);
+	check_kind(LINE_INDEX_EF, gaps, 5, 5000000001ull);
+	check_kind(LINE_INDEX_ARRAY, gaps, 5, 5000000001ull);
+}
+
+/* Word k past the header of idx, to corrupt it as a stale file might */
+static uint64_t *
+data_word(struct line_index *idx, int k)
+{
+	return (uint64_t *)idx + 8 + k;
+}
+
+/* Contents that would read out of bounds are refused, not trusted */
+static void
+test_line_index_corrupt(void)
+{
+	static const uint64_t dense[] = {0, 1, 2, 3, 4, 5, 6, 7, 8};
+	static const uint64_t gaps[] = {0, 1, 1000000, 1000001, 5000000000ull};
+	struct line_index *idx;
+	size_t len;
+
+	/* Array: out of order, then past the universe */
+	idx = build(LINE_INDEX_ARRAY, gaps, 5, 5000000001ull);
+	len = line_index_bytes(idx);
+	*data_word(idx, 2) = 0;
+	assert(!line_index_check(idx, len));
+	*data_word(idx, 2) = 1000000;
+	assert(line_index_check(idx, len) == idx);
+	*data_word(idx, 4) = 5000000001ull;
+	assert(!line_index_check(idx, len));
+	free(idx);
+
+	/* EF over 0..8 has no low bits: the i-th one at 2i, then a sample */
+	idx = build(LINE_INDEX_EF, dense, 9, 9);
+	len = line_index_bytes(idx);
+	assert(*data_word(idx, 0) == 0x15555 && *data_word(idx, 1) == 0);
+
+	*data_word(idx, 0) = 0x05555; /* A one missing */
+	assert(!line_index_check(idx, len));
+	*data_word(idx, 0) = 0x55555; /* One too many */
+	assert(!line_index_check(idx, len));
+	*data_word(idx, 0) = 0x2AAAA; /* Shifted: the sample is off */
+	assert(!line_index_check(idx, len));
+	*data_word(idx, 0) = 0x15555;
+	*data_word(idx, 1) = 1 << 20; /* Sample past the bitvector */
+	assert(!line_index_check(idx, len));
+	*data_word(idx, 1) = 0;
+	assert(line_index_check(idx, len) == idx);
+	free(idx);
+}
+
+/* Line-like gaps, including runs of empty lines, across many samples */
+static void
+test_line_index_random(void)
+{
+	int n = 100000, i;
+	uint64_t *v = malloc((size_t)n * sizeof(*v));
+	struct line_index *ef, *arr;
+
+	srand(7);
+	v[0] = 0;
+	for (i = 1; i < n; i++)
+		v[i] = v[i - 1] + 1 +
+		       (rand() % 4 ? (uint64_t)(rand() % 80) : 0);
+
+	check_kind(LINE_INDEX_EF, v, n, v[n - 1] + 1);
+	check_kind(LINE_INDEX_ARRAY, v, n, v[n - 1] + 1);
+
+	/* The point of it: far smaller than the array */
+	ef = build(LINE_INDEX_EF, v, n, v[n - 1] + 1);
+	arr = build(LINE_INDEX_ARRAY, v, n, v[n - 1] + 1);
+	assert(line_index_bytes(ef) * 6 < line_index_bytes(arr));
+	free(ef);
+	free(arr);
+	free(v);
+}
+
+/* A file past the threshold loads with the compressed index */
+static void
+test_line_index_snapshot(void)
+{
+	struct snapshot *s;
+	FILE *f;
+	int i, err;
+	char want[16];
+
+	f = fopen(DOC, "w");
+	assert(f);
+	for (i = 0; i < (1 << 20); i++)
+		fprintf(f, "%d\n", i);
+	fclose(f);
+
+	s = snapshot_load(DOC, &err);
+	assert(s);
+	assert(line_index_kind(snapshot_base_index(s)) == LINE_INDEX_EF);
+	assert(snapshot_line_count(s) == (1 << 20) + 1);
+	for (i = 0; i < (1 << 20); i += 4099) {
+		snprintf(want, sizeof(want), "%d", i);
+		assert(str_eq(snapshot_get_line(s, i), str_from_cstr(want)));
+	}
+	assert(snapshot_get_line(s, 1 << 20).len == 0);
+	assert(snapshot_offset_line(s, snapshot_line_offset(s, 777777)) ==
+	       777777);
+
+	snapshot_release(s);
+	unlink(DOC);
+}
+
+int
+main(void)
+{
+	test_line_index_edges();
+	test_line_index_random();
+	test_line_index_corrupt();
+	test_line_index_snapshot();
+
+	printf("All line_index tests passed!\n");
+	return 0;
+}
@@ -0,0 +1,140 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <editor/outline.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DOC "/tmp/wlplatform_test_outline.md"
+
+#include "syntax_harness.h"
+
+/* Wait for the parse of s and fold its changes into o */
+static void
+adopt(struct syntax_ctx *ctx,
+      struct snapshot *s,
+      struct outline *o,
+      struct arena *a)
+{
+	struct syntax_range *ranges;
+	int n;
+
+	n = wait_poll(ctx, s, a, &ranges);
+	assert(n >= 0);
+	outline_update(o, ctx, ranges, n, a);
+}
+
+/* Replace row of s, old_len bytes at offset, by text */
+static struct snapshot *
+edit(struct syntax_ctx *ctx,
+     struct outline *o,
+     struct snapshot *s,
+     uint32_t row,
+     uint32_t offset,
+     uint32_t old_len,
+     struct str text)
+{
+	struct snapshot *next = snapshot_replace_line(s, (int)row, text);
+	struct syntax_change c;
+
+	c.start_byte = offset;
+	c.old_end_byte = offset + old_len;
+	c.new_end_byte = offset + (uint32_t)text.len;
+	c.start.row = c.old_end.row = c.new_end.row = row;
+	c.start.col = 0;
+	c.old_end.col = old_len;
+	c.new_end.col = (uint32_t)text.len;
+	syntax_edit(ctx, &c, next);
+	outline_edit(o, row);
+	snapshot_release(s);
+	return next;
+}
+
+static void
+test_outline_build(void)
+{
+	struct snapshot *s =
+	    load("# One\n\ntext\n\nTwo\n---\n\n### Three\n\npara\n");
+	struct syntax_heading *h;
+	struct syntax_ctx *ctx;
+	struct outline o;
+	struct arena a;
+
+	arena_init(&a);
+	outline_init(&o);
+	ctx = syntax_create(&a, on_ready, NULL);
+	syntax_parse(ctx, s);
+	adopt(ctx, s, &o, &a);
+
+	assert(o.count == 3);
+	h = o.entries;
+	assert(h[0].row == 0 && h[0].level == 1);
+	assert(h[0].title_row == 0);
+	assert(h[0].title_start == 2 && h[0].title_end == 5);
+	assert(h[1].row == 4 && h[1].level == 2 && h[1].title_row == 4);
+	assert(h[2].row == 7 && h[2].level == 3);
+
+	assert(outline_enclosing(&o, 3) == 0);
+	assert(outline_enclosing(&o, 4) == 1);
+	assert(outline_enclosing(&o, 9) == 2);
+	assert(outline_next(&o, 0) == 1);
+	assert(outline_next(&o, 7) == -1);
+	assert(outline_prev(&o, 7) == 1);
+	assert(outline_prev(&o, 0) == -1);
+	assert(outline_offset(&o, 1, s) == 13);
+
+	syntax_destroy(ctx);
+	outline_destroy(&o);
+	snapshot_release(s);
+	arena_destroy(&a);
+}
+
+/* Reparses patch the outline where they changed it */
+static void
+test_outline_patch(void)
+{
+	struct snapshot *s = load("# One\n\ntext\n\n### Three\n\npara\n");
+	struct syntax_ctx *ctx;
+	struct outline o;
+	struct arena a;
+
+	arena_init(&a);
+	outline_init(&o);
+	ctx = syntax_create(&a, on_ready, NULL);
+	syntax_parse(ctx, s);
+	adopt(ctx, s, &o, &a);
+	assert(o.count == 2);
+
+	/* A paragraph becomes a heading */
+	s = edit(ctx, &o, s, 2, 7, 4, STR_LIT("## Mid"));
+	adopt(ctx, s, &o, &a);
+	assert(o.count == 3);
+	assert(o.entries[1].row == 2 && o.entries[1].level == 2);
+	assert(o.entries[2].row == 4);
+
+	/* Retitling changes no structure, the edit alone says so */
+	s = edit(ctx, &o, s, 0, 0, 5, STR_LIT("# Onee"));
+	adopt(ctx, s, &o, &a);
+	assert(o.count == 3 && o.entries[0].title_end == 6);
+
+	/* And a heading goes away */
+	s = edit(ctx, &o, s, 4, 16, 9, STR_LIT("Three"));
+	adopt(ctx, s, &o, &a);
+	assert(o.count == 2 && outline_next(&o, 2) == -1);
+
+	syntax_destroy(ctx);
+	outline_destroy(&o);
+	snapshot_release(s);
+	arena_destroy(&a);
+}
+
+int
+main(void)
+{
+	test_outline_build();
+	test_outline_patch();
+
+	printf("All outline tests passed!\n");
+	return 0;
+}
@@ -0,0 +1,173 @@
+#include <assert.h>
+#include <editor/regex.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Match pattern against text from 0; returns start, sets *end */
+static int
+find(const char *pattern, const char *text, int *end)
+{
+	const char *err;
+	struct regex *re;
+	struct regex_match m;
+	int start = -1;
+
+	re = regex_compile(str_from_cstr(pattern), &err);
+	assert(re && !err);
+	if (regex_find(re, str_from_cstr(text), 0, &m)) {
+		start = m.start;
+		*end = m.end;
+	}
+	regex_destroy(re);
+	return start;
+}
+
+static void
+test_regex_basic(void)
+{
+	int end;
+
+	assert(find("disk", "error: disk full", &end) == 7 && end == 11);
+	assert(find("d.sk", "error: dusk", &end) == 7 && end == 11);
+	assert(find("x", "abc", &end) == -1);
+
+	/* Leftmost, then longest */
+	assert(find("a+", "baaab", &end) == 1 && end == 4);
+	assert(find("ab|abcd", "xabcd", &end) == 1 && end == 5);
+	assert(find("bc|abcd", "xabcd", &end) == 1 && end == 5);
+	assert(find("b*c|ab", "xabbc", &end) == 1 && end == 3);
+	assert(find("(ab)*c", "ababc", &end) == 0 && end == 5);
+	assert(find("colou?r", "color", &end) == 0 && end == 5);
+
+	/* Classes */
+	assert(find("[0-9]+", "v12.5", &end) == 1 && end == 3);
+	assert(find("\\d+\\.\\d", "v12.5", &end) == 1 && end == 5);
+	assert(find("[^a-z ]", "abc Def", &end) == 4 && end == 5);
+	assert(find("\\w+", "  foo_1 ", &end) == 2 && end == 7);
+	assert(find("\\s", "a\tb", &end) == 1 && end == 2);
+
+	/* Anchors */
+	assert(find("^ab", "abab", &end) == 0 && end == 2);
+	assert(find("^b", "ab", &end) == -1);
+	assert(find("b$", "abab", &end) == 3 && end == 4);
+	assert(find("^$", "", &end) == 0 && end == 0);
+	assert(find("a*$", "baa", &end) == 1 && end == 3);
+}
+
+static void
+test_regex_from(void)
+{
+	const char *err;
+	struct regex *re;
+	struct regex_match m;
+	struct str text = STR_LIT("one two one");
+
+	re = regex_compile(STR_LIT("one"), &err);
+	assert(regex_find(re, text, 0, &m) && m.start == 0);
+	assert(regex_find(re, text, m.end, &m) && m.start == 8);
+	assert(!regex_find(re, text, m.end, &m));
+	regex_destroy(re);
+
+	/* ^ does not match at a later starting offset */
+	re = regex_compile(STR_LIT("^t"), &err);
+	assert(!regex_find(re, text, 4, &m));
+	regex_destroy(re);
+}
+
+static void
+test_regex_errors(void)
+{
+	const char *err;
+
+	assert(!regex_compile(STR_LIT("(ab"), &err) && err);
+	assert(!regex_compile(STR_LIT("ab)"), &err) && err);
+	assert(!regex_compile(STR_LIT("[ab"), &err) && err);
+	assert(!regex_compile(STR_LIT("*a"), &err) && err);
+	assert(!regex_compile(STR_LIT("a\\"), &err) && err);
+	assert(!regex_compile(STR_LIT("[z-a]"), &err) && err);
+}
+
+static void
+test_regex_literal(void)
+{
+	const char *err;
+	struct regex *re;
+	struct str lit;
+
+	re = regex_compile(STR_LIT("x*error: [a-z]+"), &err);
+	lit = regex_required_literal(re);
+	assert(str_eq(lit, STR_LIT("error: ")));
+	regex_destroy(re);
+
+	/* Alternatives share no required literal */
+	re = regex_compile(STR_LIT("foo|bar"), &err);
+	assert(str_empty(regex_required_literal(re)));
+	regex_destroy(re);
+}
+
+static void
+test_regex_cache_flush(void)
+{
+	const char *err;
+	struct regex *re;
+	struct regex_match m;
+	char text[4096];
+	int i;
+
+	/* Tracking the last 12 bytes needs more states than the cache holds */
+	re = regex_compile(
+	    STR_LIT("a[ab][ab][ab][ab][ab][ab][ab][ab][ab][ab][ab]c"), &err);
+	assert(re);
+
+	for (i = 0; i < (int)sizeof(text) - 1; i++)
+		text[i] = "ab"[(i * 7 + i / 3) % 2];
+	text[sizeof(text) - 2] = 'c';
+	text[sizeof(text) - 1] = '\0';
+	text[sizeof(text) - 14] = 'a';
+
+	assert(regex_find(re, str_from_cstr(text), 0, &m));
+	assert(m.start == (int)sizeof(text) - 14);
+	assert(m.end == (int)sizeof(text) - 1);
+	regex_destroy(re);
+}
+
+static void
+test_regex_long_line(void)
+{
+	const char *err;
+	struct regex *re;
+	struct regex_match m;
+	static char text[1 << 20];
+	int n = (int)sizeof(text) - 1;
+
+	/* Every start runs to the end of the line before failing */
+	memset(text, 'a', (size_t)n);
+	text[n - 1] = 'c';
+	text[n] = '\0';
+
+	re = regex_compile(STR_LIT("a*b|c"), &err);
+	assert(regex_find(re, str_from_cstr(text), 0, &m));
+	assert(m.start == n - 1 && m.end == n);
+	regex_destroy(re);
+
+	/* Longest from the leftmost start, then from a later offset */
+	re = regex_compile(STR_LIT("a+c|a"), &err);
+	assert(regex_find(re, str_from_cstr(text), 0, &m));
+	assert(m.start == 0 && m.end == n);
+	assert(regex_find(re, str_from_cstr(text), n - 2, &m));
+	assert(m.start == n - 2 && m.end == n);
+	regex_destroy(re);
+}
+
+int
+main(void)
+{
+	test_regex_basic();
+	test_regex_from();
+	test_regex_errors();
+	test_regex_literal();
+	test_regex_cache_flush();
+	test_regex_long_line();
+	printf("All regex tests passed!\n");
+	return 0;
+}
@@ -0,0 +1,93 @@
+#include <assert.h>
+#include <render/render_metrics.h>
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * A fake proportional font: the cache only calls font_measure_prefix, and
+ * the real font is monospaced, so a hit could not be told from a miss.
+ */
+static int measured;
+
+static int
+advance(unsigned char c)
+{
+	return c == 'W' ? 14 : c == 'i' ? 4 : 9;
+}
+
+void
+font_measure_prefix(struct font_ctx *font, struct str text, int *out)
+{
+	int i;
+
+	(void)font;
+	measured++;
+	out[0] = 0;
+	for (i = 0; i < text.len; i++)
+		out[i + 1] = out[i] + advance((unsigned char)text.data[i]);
+}
+
+static void
+test_metrics_cache(void)
+{
+	struct line_metrics *lm = line_metrics_create(NULL);
+	char buf[] = "iiii";
+	struct str line = {buf, 4};
+
+	measured = 0;
+	assert(line_metrics_index_to_x(lm, line, 1, 4) == 16);
+	assert(measured == 1);
+
+	/* Same line and version: an array read, the bytes are not looked at */
+	memcpy(buf, "WWWW", 4);
+	assert(line_metrics_index_to_x(lm, line, 1, 2) == 8);
+	assert(measured == 1);
+
+	/* A new version misses and measures the new bytes */
+	assert(line_metrics_index_to_x(lm, line, 2, 2) == 28);
+	assert(measured == 2);
+
+	/* Out of range indices clamp without measuring */
+	assert(line_metrics_index_to_x(lm, line, 2, -1) == 0);
+	assert(line_metrics_index_to_x(lm, line, 2, 99) == 56);
+	assert(measured == 2);
+
+	line_metrics_destroy(lm);
+}
+
+/* x of index i, summed glyph by glyph */
+static int
+walk(struct str text, int i)
+{
+	int k, x = 0;
+
+	for (k = 0; k < i && k < text.len; k++)
+		x += advance((unsigned char)text.data[k]);
+	return x;
+}
+
+static void
+test_metrics_lines(void)
+{
+	struct line_metrics *lm = line_metrics_create(NULL);
+	struct str a = STR_LIT("Wide Will with ink");
+	struct str b = STR_LIT("int main(void) { return 0; }");
+	int i;
+
+	/* Interleaved lookups on two lines match a walk over the glyphs */
+	for (i = 0; i <= b.len + 1; i++) {
+		assert(line_metrics_index_to_x(lm, a, 7, i) == walk(a, i));
+		assert(line_metrics_index_to_x(lm, b, 7, i) == walk(b, i));
+	}
+	line_metrics_destroy(lm);
+}
+
+int
+main(void)
+{
+	test_metrics_cache();
+	test_metrics_lines();
+
+	printf("All render metrics tests passed!\n");
+	return 0;
+}
@@ -0,0 +1,290 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <editor/search.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <core/memory.h>
+
+#define DOC "/tmp/wlplatform_test_search.txt"
+
+static int notified; /* Calls of notify, from the workers */
+static int hold;     /* While set, notify keeps the worker waiting */
+
+static void
+on_notify(void *arg)
+{
+	struct timespec ts = {0, 1000000};
+
+	(void)arg;
+	__atomic_add_fetch(&notified, 1, __ATOMIC_RELEASE);
+	while (__atomic_load_n(&hold, __ATOMIC_ACQUIRE))
+		nanosleep(&ts, NULL);
+}
+
+static void
+load(struct buffer *buf, const char *text)
+{
+	FILE *f = fopen(DOC, "w");
+
+	assert(f);
+	fputs(text, f);
+	fclose(f);
+	buffer_init(buf);
+	assert(buffer_load(buf, DOC));
+	unlink(DOC);
+}
+
+/* Lines "hit N" every tenth row, "odd N" on odd rows, filler between */
+static char *
+make_text(int lines)
+{
+	char *text = xmalloc((size_t)lines * 16 + 1), *p = text;
+	int i;
+
+	for (i = 0; i < lines; i++) {
+		if (i % 10 == 0)
+			p += sprintf(p, "hit %d\n", i);
+		else if (i % 2 == 1)
+			p += sprintf(p, "odd %d\n", i);
+		else
+			p += sprintf(p, "even %d\n", i);
+	}
+	return text;
+}
+
+static void
+wait_notified(int n)
+{
+	struct timespec ts = {0, 1000000};
+
+	while (__atomic_load_n(&notified, __ATOMIC_ACQUIRE) < n)
+		nanosleep(&ts, NULL);
+}
+
+/* Drain streamed hits until the scan reports it is done */
+static void
+wait_done(struct search *s, struct buffer *buf)
+{
+	struct timespec ts = {0, 1000000};
+
+	while (search_poll(s, buf), !s->scan_done)
+		nanosleep(&ts, NULL);
+}
+
+/* Every hit of every run lies on a line containing word */
+static void
+assert_hits_on(struct search *s, struct buffer *buf, const char *word)
+{
+	const struct search_run *run;
+	struct str line;
+	int r, i;
+
+	for (r = 0; r < SEARCH_RUN_COUNT; r++) {
+		run = &s->runs[r];
+		for (i = 0; i < run->count; i++) {
+			line = buffer_get_line(buf, run->hits[i].line);
+			assert(str_find(line, str_from_cstr(word)).found);
+			assert(i == 0 ||
+			       run->hits[i - 1].line <= run->hits[i].line);
+		}
+	}
+}
+
+static void
+test_search_viewport_first(void)
+{
+	struct search s;
+	struct buffer buf;
+	char *text = make_text(3000);
+
+	load(&buf, text);
+	xfree(text);
+	search_init(&s, on_notify, NULL);
+	search_set_viewport(&s, 1000, 1099);
+	search_set_regex(&s, &buf, true);
+
+	/* The first hand-over holds the viewport's hits alone */
+	__atomic_store_n(&notified, 0, __ATOMIC_RELEASE);
+	__atomic_store_n(&hold, 1, __ATOMIC_RELEASE);
+	search_set_query(&s, &buf, STR_LIT("^hit"));
+	wait_notified(1);
+	assert(search_poll(&s, &buf));
+	assert(s.runs[SEARCH_RUN_VIEW].count == 10);
+	assert(s.runs[SEARCH_RUN_ABOVE].count == 0);
+	assert(s.runs[SEARCH_RUN_BELOW].count == 0);
+	assert(s.scan_lines == 100 && !s.scan_done);
+	__atomic_store_n(&hold, 0, __ATOMIC_RELEASE);
+
+	/* Then below the viewport, then above it */
+	wait_done(&s, &buf);
+	assert(s.runs[SEARCH_RUN_ABOVE].count == 100);
+	assert(s.runs[SEARCH_RUN_VIEW].count == 10);
+	assert(s.runs[SEARCH_RUN_BELOW].count == 190);
+	assert(s.scan_lines == buf.line_count);
+	assert_hits_on(&s, &buf, "hit");
+
+	search_destroy(&s);
+	buffer_destroy(&buf);
+}
+
+/* search_next walks ABOVE, VIEW and BELOW as one sorted list */
+static void
+test_search_next(void)
+{
+	struct search s;
+	struct buffer buf;
+	char *text = make_text(3000);
+
+	load(&buf, text);
+	xfree(text);
+	search_init(&s, on_notify, NULL);
+	search_set_viewport(&s, 1000, 1099);
+	search_set_regex(&s, &buf, true);
+	search_set_query(&s, &buf, STR_LIT("^hit"));
+	wait_done(&s, &buf);
+
+	/* Forward from above into the view and on below it */
+	assert(search_next(&s, &buf, 0, 1) == 0);
+	assert(search_next(&s, &buf, 991, 1) == 1000);
+	assert(search_next(&s, &buf, 1091, 1) == 1100);
+	assert(search_next(&s, &buf, 2991, 1) == -1);
+
+	/* And back */
+	assert(search_next(&s, &buf, 1109, -1) == 1100);
+	assert(search_next(&s, &buf, 1099, -1) == 1090);
+	assert(search_next(&s, &buf, 999, -1) == 990);
+	assert(search_next(&s, &buf, 2999, -1) == 2990);
+	assert(search_next(&s, &buf, -1, -1) == -1);
+
+	search_destroy(&s);
+	buffer_destroy(&buf);
+}
+
+/* A new query cancels the scan in flight and none of its hits survive */
+static void
+test_search_supersede(void)
+{
+	struct search s;
+	struct buffer buf;
+	char *text = make_text(20000);
+	unsigned id;
+
+	load(&buf, text);
+	xfree(text);
+	search_init(&s, on_notify, NULL);
+	search_set_viewport(&s, 0, 99);
+	search_set_regex(&s, &buf, true);
+
+	__atomic_store_n(&notified, 0, __ATOMIC_RELEASE);
+	__atomic_store_n(&hold, 1, __ATOMIC_RELEASE);
+	search_set_query(&s, &buf, STR_LIT("^hit"));
+	wait_notified(1);
+
+	/* The old scan is parked inside its first hand-over */
+	id = s.scan_id;
+	search_set_query(&s, &buf, STR_LIT("^odd"));
+	assert(s.scan_id != id && search_hit_count(&s) == 0);
+	__atomic_store_n(&hold, 0, __ATOMIC_RELEASE);
+
+	wait_done(&s, &buf);
+	assert(search_hit_count(&s) == 10000);
+	assert_hits_on(&s, &buf, "odd");
+
+	/* Leaving regex mode stops the scan and drops its hits */
+	search_set_regex(&s, &buf, false);
+	assert(search_hit_count(&s) == 0);
+	assert(search_next(&s, &buf, 0, 1) == -1); /* "^odd" as a substring */
+
+	search_destroy(&s);
+	buffer_destroy(&buf);
+}
+
+static void
+test_search_hits_max(void)
+{
+	struct search s;
+	struct buffer buf;
+	int lines = SEARCH_HITS_MAX / 1000 + 50, i;
+	char *text = xmalloc((size_t)lines * 1001 + 1), *p = text;
+
+	for (i = 0; i < lines; i++) {
+		memset(p, 'a', 1000);
+		p[1000] = '\n';
+		p += 1001;
+	}
+	*p = '\0';
+	load(&buf, text);
+	xfree(text);
+
+	search_init(&s, on_notify, NULL);
+	search_set_regex(&s, &buf, true);
+	search_set_query(&s, &buf, STR_LIT("a"));
+	wait_done(&s, &buf);
+	assert(search_hit_count(&s) == SEARCH_HITS_MAX);
+	assert(s.scan_lines == buf.line_count);
+
+	search_destroy(&s);
+	buffer_destroy(&buf);
+}
+
+static void
+test_search_structural(void)
+{
+	struct timespec ts = {0, 1000000};
+	struct syntax_range *ranges;
+	struct syntax_ctx *syntax;
+	struct search s;
+	struct buffer buf;
+	struct arena a;
+
+	load(&buf, "# One\n\npara\n\n## Two\n\ntext\n\n## Three\n");
+	arena_init(&a);
+	syntax = syntax_create(&a, NULL, NULL);
+	search_init(&s, on_notify, NULL);
+	search_set_query(&s, &buf, STR_LIT("(atx_heading) @h"));
+
+	/* No tree yet: the query waits for one */
+	search_set_structural(&s, &buf, syntax, true);
+	assert(search_is_scan(&s) && s.regex_error);
+	assert(search_hit_count(&s) == 0);
+
+	syntax_parse(syntax, buf.snap);
+	while (syntax_poll(syntax, buffer_version(&buf), &a, &ranges) < 0)
+		nanosleep(&ts, NULL);
+	search_syntax_changed(&s, &buf);
+	assert(!s.regex_error);
+	wait_done(&s, &buf);
+	assert(search_hit_count(&s) == 3);
+	assert(search_next(&s, &buf, 1, 1) == 4);
+	assert(search_next(&s, &buf, 5, 1) == 8);
+
+	/* A bad query reports its error instead of scanning */
+	search_set_query(&s, &buf, STR_LIT("(atx_heading"));
+	assert(s.regex_error && search_hit_count(&s) == 0);
+
+	/* Off again: back to substrings */
+	search_set_structural(&s, &buf, syntax, false);
+	assert(!search_is_scan(&s));
+
+	search_destroy(&s);
+	syntax_destroy(syntax);
+	buffer_destroy(&buf);
+	arena_destroy(&a);
+}
+
+int
+main(void)
+{
+	test_search_viewport_first();
+	test_search_next();
+	test_search_supersede();
+	test_search_hits_max();
+	test_search_structural();
+
+	printf("All search tests passed!\n");
+	return 0;
+}
@@ -0,0 +1,182 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <editor/session.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define DOC "/tmp/wlplatform_test_session.md"
+
+static void
+write_doc(const char *content, size_t len)
+{
+	FILE *f = fopen(DOC, "w");
+
+	assert(f);
+	fwrite(content, 1, len, f);
+	fclose(f);
+}
+
+static void
+remove_cache(void)
+{
+	char path[SESSION_PATH_MAX];
+
+	assert(session_path(DOC, path, sizeof(path)));
+	unlink(path);
+}
+
+static void
+assert_same_lines(struct snapshot *a, struct snapshot *b)
+{
+	int i;
+
+	assert(snapshot_line_count(a) == snapshot_line_count(b));
+	assert(snapshot_text_len(a) == snapshot_text_len(b));
+	for (i = 0; i < snapshot_line_count(a); i++)
+		assert(str_eq(snapshot_get_line(a, i),
+			      snapshot_get_line(b, i)));
+}
+
+static void
+test_session_roundtrip(void)
+{
+	const char *text = "# Title\n\nsome text\nlast";
+	struct session_state st = {2}, got;
+	struct decor keep = {3, 7, DECOR_BOOKMARK, 42};
+	struct decor hit = {0, 2, DECOR_SEARCH_HIT, 0};
+	struct snapshot *cold, *warm;
+	struct decor_tree t;
+	struct session_key key;
+	struct session *s;
+	struct decor *out;
+	struct arena a;
+	int err;
+
+	write_doc(text, strlen(text));
+	remove_cache();
+	assert(session_key(DOC, &key));
+	assert(!session_open(DOC, &key));
+
+	cold = snapshot_load(DOC, &err);
+	assert(cold);
+	decor_init(&t);
+	decor_add(&t, keep);
+	decor_add(&t, hit);
+	assert(session_save(DOC, &key, cold, &st, &t) == 0);
+	decor_destroy(&t);
+
+	s = session_open(DOC, &key);
+	assert(s);
+	got = session_state(s);
+	assert(got.cursor_line == 2);
+
+	/* Search hits are derived, so only the bookmark comes back */
+	decor_init(&t);
+	arena_init(&a);
+	session_restore_decor(s, &t);
+	assert(decor_query(&t, 0, 100, &a, &out) == 1);
+	assert(out[0].start == 3 && out[0].end == 7 && out[0].data == 42);
+	arena_destroy(&a);
+	decor_destroy(&t);
+
+	/* The snapshot outlives the handle */
+	warm = session_load(s, DOC, &err);
+	assert(warm && err == 0);
+	session_close(s);
+	assert_same_lines(cold, warm);
+	assert(str_eq(snapshot_get_line(warm, 3), str_from_cstr("last")));
+
+	/* A second save only rewrites state and decorations */
+	st.cursor_line = 3;
+	decor_init(&t);
+	assert(session_save(DOC, &key, warm, &st, &t) == 0);
+	decor_destroy(&t);
+	snapshot_release(warm);
+	s = session_open(DOC, &key);
+	assert(s && session_state(s).cursor_line == 3);
+	warm = session_load(s, DOC, &err);
+	session_close(s);
+	assert_same_lines(cold, warm);
+
+	snapshot_release(warm);
+	snapshot_release(cold);
+	remove_cache();
+}
+
+static void
+test_session_stale(void)
+{
+	struct session_state st = {0};
+	struct session_key key, now;
+	struct snapshot *snap;
+	struct decor_tree t;
+	int err;
+
+	write_doc("a\nb\n", 4);
+	remove_cache();
+	assert(session_key(DOC, &key));
+	snap = snapshot_load(DOC, &err);
+	decor_init(&t);
+	assert(session_save(DOC, &key, snap, &st, &t) == 0);
+
+	/* Another version of the document does not match the cache */
+	now = key;
+	now.mtime_nsec++;
+	assert(!session_open(DOC, &now));
+
+	/* An index that does not end at the size is refused */
+	now.size++;
+	assert(session_save(DOC, &now, snap, &st, &t) == EINVAL);
+	write_doc("a\nbb\n", 5);
+	assert(!snapshot_map(DOC,
+			     snapshot_base_index(snap),
+			     NULL,
+			     NULL,
+			     &err));
+	assert(err == EINVAL);
+
+	decor_destroy(&t);
+	snapshot_release(snap);
+	remove_cache();
+}
+
+/* A page-sized file cannot be NUL-terminated by its mapping */
+static void
+test_session_page_sized(void)
+{
+	static char text[4096];
+	struct snapshot *cold, *warm;
+	int err;
+
+	memset(text, 'x', sizeof(text));
+	text[100] = '\n';
+	write_doc(text, sizeof(text));
+
+	cold = snapshot_load(DOC, &err);
+	warm = snapshot_map(DOC,
+			    snapshot_base_index(cold),
+			    NULL,
+			    NULL,
+			    &err);
+	assert(warm);
+	assert_same_lines(cold, warm);
+	assert(snapshot_base_text(warm).data[4096] == '\0');
+
+	snapshot_release(warm);
+	snapshot_release(cold);
+	unlink(DOC);
+}
+
+int
+main(void)
+{
+	test_session_roundtrip();
+	test_session_stale();
+	test_session_page_sized();
+
+	printf("All session tests passed!\n");
+	return 0;
+}
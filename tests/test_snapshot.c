@@ -0,0 +1,181 @@
+#include <assert.h>
+#include <editor/snapshot.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void
+write_file(const char *path, const char *text)
+{
+	FILE *f = fopen(path, "w");
+	fputs(text, f);
+	fclose(f);
+}
+
+static void
+test_snapshot_load(void)
+{
+	int err;
+
+	write_file("/tmp/test_snapshot.txt", "alpha\nbeta\n\ngamma");
+
+	struct snapshot *s = snapshot_load("/tmp/test_snapshot.txt", &err);
+	assert(s && err == 0);
+	assert(snapshot_line_count(s) == 4);
+	assert(str_eq(snapshot_get_line(s, 0), STR_LIT("alpha")));
+	assert(str_eq(snapshot_get_line(s, 1), STR_LIT("beta")));
+	assert(str_empty(snapshot_get_line(s, 2)));
+	assert(str_eq(snapshot_get_line(s, 3), STR_LIT("gamma")));
+	assert(str_empty(snapshot_get_line(s, 4)));
+	assert(!snapshot_is_edited(s));
+
+	snapshot_release(s);
+	remove("/tmp/test_snapshot.txt");
+
+	assert(!snapshot_load("/nonexistent/path", &err));
+	assert(err == ENOENT);
+}
+
+static void
+test_snapshot_cow(void)
+{
+	int err;
+	char buf[64];
+
+	write_file("/tmp/test_snapshot.txt", "one\ntwo\nthree");
+
+	struct snapshot *a = snapshot_load("/tmp/test_snapshot.txt", &err);
+	struct snapshot *b = snapshot_replace_line(a, 1, STR_LIT("TWO!"));
+	assert(b);
+	assert(snapshot_version(b) > snapshot_version(a));
+
+	/* Old snapshot is unaffected */
+	assert(str_eq(snapshot_get_line(a, 1), STR_LIT("two")));
+	assert(str_eq(snapshot_get_line(b, 1), STR_LIT("TWO!")));
+	assert(str_eq(snapshot_get_line(b, 2), STR_LIT("three")));
+
+	assert(snapshot_text_len(b) == 14);
+	snapshot_flatten(b, buf);
+	assert(strcmp(buf, "one\nTWO!\nthree") == 0);
+
+	/* Releasing the parent keeps shared state alive */
+	snapshot_release(a);
+	assert(str_eq(snapshot_get_line(b, 0), STR_LIT("one")));
+	assert(!snapshot_replace_line(b, 3, STR_LIT("x")));
+
+	snapshot_release(b);
+	remove("/tmp/test_snapshot.txt");
+}
+
+static void
+test_snapshot_deep(void)
+{
+	int err, i;
+	FILE *f;
+	struct snapshot *s, *next, *old;
+
+	/* Enough lines for a three-level tree */
+	f = fopen("/tmp/test_snapshot.txt", "w");
+	for (i = 0; i < 10000; i++)
+		fprintf(f, "%d\n", i);
+	fclose(f);
+
+	s = snapshot_load("/tmp/test_snapshot.txt", &err);
+	assert(snapshot_line_count(s) == 10001);
+	old = snapshot_retain(s);
+
+	for (i = 0; i < 10000; i += 7) {
+		next = snapshot_replace_line(s, i, STR_LIT("x"));
+		snapshot_release(s);
+		s = next;
+	}
+
+	for (i = 0; i < 10000; i++) {
+		char want[16];
+		snprintf(want, sizeof(want), "%d", i);
+		if (i % 7 == 0)
+			assert(str_eq(snapshot_get_line(s, i), STR_LIT("x")));
+		else
+			assert(str_eq(snapshot_get_line(s, i),
+				      str_from_cstr(want)));
+		assert(str_eq(snapshot_get_line(old, i), str_from_cstr(want)));
+	}
+
+	snapshot_release(old);
+	snapshot_release(s);
+	remove("/tmp/test_snapshot.txt");
+}
+
+static void
+test_snapshot_offsets(void)
+{
+	int err, i, line, n;
+	long len, *offsets;
+	int *lines;
+	char *text;
+	FILE *f;
+	struct snapshot *s, *next;
+
+	f = fopen("/tmp/test_snapshot.txt", "w");
+	for (i = 0; i < 5000; i++)
+		fprintf(f, "line %d\n", i);
+	fclose(f);
+
+	s = snapshot_load("/tmp/test_snapshot.txt", &err);
+
+	/* Grow some lines, shrink others */
+	for (i = 0; i < 5000; i += 13) {
+		next = snapshot_replace_line(
+		    s, i, i % 2 ? STR_LIT("a much longer line") : STR_EMPTY);
+		snapshot_release(s);
+		s = next;
+	}
+
+	len = snapshot_text_len(s);
+	text = malloc((size_t)len + 1);
+	snapshot_flatten(s, text);
+	n = snapshot_line_count(s);
+	assert(snapshot_line_offset(s, n) == len + 1);
+
+	/* Every offset agrees with the flattened text */
+	offsets = malloc((size_t)(len + 1) * sizeof(*offsets));
+	lines = malloc((size_t)(len + 1) * sizeof(*lines));
+	line = 0;
+	for (i = 0; i <= len; i++) {
+		if (i > 0 && text[i - 1] == '\n') {
+			line++;
+			assert(snapshot_line_offset(s, line) == i);
+		}
+		assert(snapshot_offset_line(s, i) == line);
+		offsets[i] = i;
+	}
+
+	/* Batched: every offset, then a sparse subset */
+	snapshot_offsets_lines(s, offsets, lines, (int)len + 1);
+	for (i = 0; i <= len; i++)
+		assert(lines[i] == snapshot_offset_line(s, i));
+	for (i = 0; i * 997 <= len; i++)
+		offsets[i] = (long)i * 997;
+	snapshot_offsets_lines(s, offsets, lines, i);
+	while (i-- > 0)
+		assert(lines[i] == snapshot_offset_line(s, offsets[i]));
+
+	free(lines);
+	free(offsets);
+	free(text);
+	snapshot_release(s);
+	remove("/tmp/test_snapshot.txt");
+}
+
+int
+main(void)
+{
+	test_snapshot_load();
+	test_snapshot_cow();
+	test_snapshot_deep();
+	test_snapshot_offsets();
+
+	printf("All snapshot tests passed!\n");
+	return 0;
+}
@@ -0,0 +1,909 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <editor/syntax.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <core/memory.h>
+
+#define DOC "/tmp/wlplatform_test_syntax.md"
+
+#include "syntax_harness.h"
+
+extern const struct TSLanguage *tree_sitter_markdown(void);
+
+/* Change replacing row's old_len bytes at offset by new_len bytes */
+static struct syntax_change
+line_change(uint32_t row, uint32_t offset, uint32_t old_len, uint32_t new_len)
+{
+	struct syntax_change c;
+
+	c.start_byte = offset;
+	c.old_end_byte = offset + old_len;
+	c.new_end_byte = offset + new_len;
+	c.start.row = row;
+	c.start.col = 0;
+	c.old_end.row = row;
+	c.old_end.col = old_len;
+	c.new_end.row = row;
+	c.new_end.col = new_len;
+	return c;
+}
+
+static void
+assert_same_nodes(const struct syntax_visible *a,
+		  const struct syntax_visible *b)
+{
+	int i;
+
+	assert(a->count == b->count);
+	for (i = 0; i < a->count; i++) {
+		assert(strcmp(a->nodes[i].type, b->nodes[i].type) == 0);
+		assert(a->nodes[i].start_byte == b->nodes[i].start_byte);
+		assert(a->nodes[i].end_byte == b->nodes[i].end_byte);
+	}
+}
+
+static void
+test_syntax_parse(void)
+{
+	struct snapshot *s = load("# Title\n\ntext\n");
+	struct syntax_range *ranges;
+	struct syntax_ctx *ctx;
+	struct arena a;
+
+	arena_init(&a);
+	ctx = syntax_create(&a, on_ready, NULL);
+	assert(!syntax_has_tree(ctx));
+
+	/* A parse from scratch changes the whole document */
+	syntax_parse(ctx, s);
+	assert(wait_poll(ctx, s, &a, &ranges) == 1);
+	assert(syntax_has_tree(ctx));
+	assert(ranges[0].start_byte == 0 && ranges[0].end_byte == 14);
+
+	/* Nothing more to adopt */
+	assert(syntax_poll(ctx, snapshot_version(s), &a, &ranges) == -1);
+
+	syntax_destroy(ctx);
+	snapshot_release(s);
+	arena_destroy(&a);
+}
+
+static void
+test_syntax_edit(void)
+{
+	struct snapshot *before = load("# Title\n\npara one\n\npara two\n");
+	struct snapshot *after =
+	    snapshot_replace_line(before, 2, STR_LIT("## Sub"));
+	struct syntax_change c = line_change(2, 9, 8, 6);
+	struct syntax_visible inc, full;
+	struct syntax_range *ranges;
+	struct syntax_ctx *ctx, *ref;
+	struct arena a;
+	int n, i;
+	bool covered = false;
+
+	arena_init(&a);
+	ctx = syntax_create(&a, on_ready, NULL);
+	ref = syntax_create(&a, on_ready, NULL);
+
+	syntax_parse(ctx, before);
+	assert(wait_poll(ctx, before, &a, &ranges) == 1);
+	syntax_edit(ctx, &c, after);
+	n = wait_poll(ctx, after, &a, &ranges);
+	assert(n > 0);
+
+	/* A paragraph turning into a heading restructures its row */
+	for (i = 0; i < n; i++)
+		if (ranges[i].start.row <= 2 && ranges[i].end.row >= 2)
+			covered = true;
+	assert(covered);
+
+	/* The incremental tree matches one parsed from scratch */
+	syntax_parse(ref, after);
+	assert(wait_poll(ref, after, &a, &ranges) == 1);
+	syntax_get_visible_nodes(ctx, after, 0, 10, &a, &inc);
+	syntax_get_visible_nodes(ref, after, 0, 10, &a, &full);
+	assert(inc.count > 0);
+	assert_same_nodes(&inc, &full);
+
+	/* Leaf text is read from the edited line, not the loaded file */
+	for (i = 0; i < inc.count; i++)
+		if (strcmp(inc.nodes[i].type, "atx_h2_marker") == 0)
+			break;
+	assert(i < inc.count);
+	assert(str_eq(inc.nodes[i].text, STR_LIT("##")));
+
+	syntax_destroy(ref);
+	syntax_destroy(ctx);
+	snapshot_release(after);
+	snapshot_release(before);
+	arena_destroy(&a);
+}
+
+/* Retyping a word inside a paragraph leaves the structure alone */
+static void
+test_syntax_edit_text_only(void)
+{
+	struct snapshot *before = load("# Title\n\nsome text\n");
+	struct snapshot *after =
+	    snapshot_replace_line(before, 2, STR_LIT("some words"));
+	struct syntax_change c = line_change(2, 9, 9, 10);
+	struct syntax_range *ranges;
+	struct syntax_ctx *ctx;
+	struct arena a;
+
+	arena_init(&a);
+	ctx = syntax_create(&a, on_ready, NULL);
+	syntax_parse(ctx, before);
+	assert(wait_poll(ctx, before, &a, &ranges) == 1);
+	syntax_edit(ctx, &c, after);
+	assert(wait_poll(ctx, after, &a, &ranges) == 0);
+
+	syntax_destroy(ctx);
+	snapshot_release(after);
+	snapshot_release(before);
+	arena_destroy(&a);
+}
+
+/* Edited lines are read in place as if the file held them */
+static void
+test_syntax_reader(void)
+{
+	struct snapshot *v0 = load("a\n\nb\n\nc\n");
+	struct snapshot *v1 = snapshot_replace_line(v0, 0, STR_LIT("# a"));
+	struct snapshot *v2 = snapshot_replace_line(v1, 4, STR_LIT("- c"));
+	struct snapshot *flat = load("# a\n\nb\n\n- c\n");
+	struct syntax_visible got, want;
+	struct syntax_range *ranges;
+	struct syntax_ctx *ctx, *ref;
+	struct arena a;
+
+	arena_init(&a);
+	ctx = syntax_create(&a, on_ready, NULL);
+	ref = syntax_create(&a, on_ready, NULL);
+	syntax_parse(ctx, v2);
+	assert(wait_poll(ctx, v2, &a, &ranges) == 1);
+	syntax_parse(ref, flat);
+	assert(wait_poll(ref, flat, &a, &ranges) == 1);
+
+	syntax_get_visible_nodes(ctx, v2, 0, 10, &a, &got);
+	syntax_get_visible_nodes(ref, flat, 0, 10, &a, &want);
+	assert(got.count > 0);
+	assert_same_nodes(&got, &want);
+
+	syntax_destroy(ref);
+	syntax_destroy(ctx);
+	snapshot_release(flat);
+	snapshot_release(v2);
+	snapshot_release(v1);
+	snapshot_release(v0);
+	arena_destroy(&a);
+}
+
+/* Each operation is counted when its tree is adopted */
+static void
+test_syntax_stats(void)
+{
+	struct syntax_range *ranges;
+	struct syntax_visible vis;
+	struct syntax_stats st;
+	struct snapshot *s, *t;
+	struct syntax_change c;
+	struct syntax_ctx *ctx;
+	struct arena a;
+	char *text, *p;
+	uint32_t nodes;
+	uint64_t full;
+	int i;
+
+	/* Without a context every counter reads zero */
+	memset(&st, 0xff, sizeof(st));
+	syntax_stats(NULL, &st);
+	assert(st.full_parse.count == 0 && st.memory.bytes == 0);
+
+	p = text = xmalloc(2000 * 16 + 1);
+	for (i = 0; i < 2000; i++)
+		p += sprintf(p, "## H%03d\n\npara\n\n", i % 1000);
+	s = load(text);
+	xfree(text);
+
+	arena_init(&a);
+	ctx = syntax_create(&a, on_ready, NULL);
+	syntax_stats(ctx, &st);
+	assert(st.full_parse.count == 0 && st.nodes == 0);
+
+	syntax_parse(ctx, s);
+	assert(wait_poll(ctx, s, &a, &ranges) == 1);
+	syntax_get_visible_nodes(ctx, s, 100, 120, &a, &vis);
+	syntax_stats(ctx, &st);
+	assert(st.full_parse.count == 1 && st.incremental_parse.count == 0);
+	assert(st.full_parse.max_ns >= st.full_parse.last_ns);
+	assert(st.bytes_read >= (uint64_t)snapshot_text_len(s));
+	full = st.bytes_read;
+	assert(st.changed_ranges == 1);
+	assert(st.nodes > 4 * 2000);
+	nodes = st.nodes;
+	assert(st.visible.count == 1);
+	assert(st.visible_nodes == (uint32_t)vis.count);
+
+	/* Row 2 "para" becomes "parb" */
+	t = snapshot_replace_line(s, 2, STR_LIT("parb"));
+	c = line_change(2, 9, 4, 4);
+	syntax_edit(ctx, &c, t);
+	assert(wait_poll(ctx, t, &a, &ranges) >= 0);
+	syntax_stats(ctx, &st);
+	assert(st.incremental_parse.count == 1);
+	assert(st.nodes == nodes); /* Counted again by the worker */
+	assert(st.bytes_read > 0);
+	assert(st.bytes_read_total == full + st.bytes_read);
+
+	/* Polled for a newer version, the tree is dropped */
+	syntax_parse(ctx, s);
+	assert(wait_poll(ctx, t, &a, &ranges) == -1);
+	syntax_stats(ctx, &st);
+	assert(st.dropped == 1 && st.full_parse.count == 1);
+
+	syntax_destroy(ctx);
+	snapshot_release(t);
+	snapshot_release(s);
+	arena_destroy(&a);
+}
+
+static void
+test_syntax_fold(void)
+{
+	struct snapshot *s = load("# A\n"
+				  "\n"
+				  "- one\n"
+				  "- two\n"
+				  "\n"
+				  "## B\n"
+				  "```c\n"
+				  "x\n"
+				  "```\n"
+				  "tail\n");
+	struct syntax_range *ranges;
+	/* Sections run to the end, a list over the blank line after it */
+	static const uint32_t want[10][2] = {{0, 9}, {0, 9}, {2, 4}, {2, 4},
+					     {2, 4}, {5, 9}, {6, 8}, {6, 8},
+					     {6, 8}, {5, 9}};
+	struct syntax_fold f;
+	struct syntax_ctx *ctx;
+	struct arena a;
+	uint32_t row;
+
+	arena_init(&a);
+	ctx = syntax_create(&a, on_ready, NULL);
+	assert(!syntax_fold_at(ctx, 0, &f));
+	syntax_parse(ctx, s);
+	assert(wait_poll(ctx, s, &a, &ranges) == 1);
+
+	/* Starting on a row wins, else the innermost block around it */
+	for (row = 0; row < 10; row++) {
+		assert(syntax_fold_at(ctx, row, &f));
+		assert(f.start_row == want[row][0]);
+		assert(f.end_row == want[row][1]);
+	}
+
+	syntax_destroy(ctx);
+	snapshot_release(s);
+	arena_destroy(&a);
+}
+
+static void
+test_syntax_viewport(void)
+{
+	struct timespec ts = {0, 1000000};
+	struct syntax_heading *h;
+	struct syntax_range *ranges;
+	struct syntax_stats st;
+	struct syntax_ctx *ctx;
+	struct snapshot *s;
+	struct arena a;
+	char *text, *p;
+	int i, n;
+
+	/* Rows 4i: "## Hi", then a blank, a paragraph and a blank */
+	p = text = xmalloc(20000 * 20 + 1);
+	for (i = 0; i < 20000; i++)
+		p += sprintf(p, "## H%05d\n\npara\n\n", i);
+	s = load(text);
+	xfree(text);
+
+	arena_init(&a);
+	ctx = syntax_create(&a, on_ready, NULL);
+	syntax_parse_viewport(ctx, s, 40001, 40010);
+
+	/* The window comes first, the headings around it only */
+	assert(poll_tree(ctx, s, &a, &ranges) == 1);
+	syntax_stats(ctx, &st);
+	assert(st.partial && st.viewport_parse.count == 1);
+	assert(st.full_parse.count == 0);
+	n = syntax_headings(ctx, 0, 80000, &a, &h);
+	assert(n > 20 && n < 1000);
+	assert(h[0].row % 4 == 0 && h[0].row <= 40001 - 128);
+	assert(h[n - 1].row >= 40010 + 128);
+
+	/* Then the whole tree; rows well inside the window kept as is */
+	n = poll_tree(ctx, s, &a, &ranges);
+	assert(n >= 1);
+	syntax_stats(ctx, &st);
+	assert(!st.partial && st.full_parse.count == 1);
+	for (i = 0; i < n; i++)
+		assert(ranges[i].end.row < 40000 - 128 ||
+		       ranges[i].start.row > 40010 + 128);
+	assert(syntax_headings(ctx, 0, 80000, &a, &h) == 20000);
+
+	/* Two trees, two notifications */
+	while (__atomic_load_n(&ready, __ATOMIC_ACQUIRE) < 2)
+		nanosleep(&ts, NULL);
+	__atomic_store_n(&ready, 0, __ATOMIC_RELEASE);
+
+	/* The window never polled: the whole tree replaces it as all new */
+	syntax_parse_viewport(ctx, s, 40001, 40010);
+	while (__atomic_load_n(&ready, __ATOMIC_ACQUIRE) < 2)
+		nanosleep(&ts, NULL);
+	__atomic_store_n(&ready, 0, __ATOMIC_RELEASE);
+	assert(poll_tree(ctx, s, &a, &ranges) == 1);
+	assert(ranges[0].start.row == 0 && ranges[0].end.row >= 79999);
+	syntax_stats(ctx, &st);
+	assert(!st.partial && st.full_parse.count == 2);
+	assert(syntax_headings(ctx, 0, 80000, &a, &h) == 20000);
+
+	syntax_destroy(ctx);
+	snapshot_release(s);
+	arena_destroy(&a);
+}
+
+/*
+ * A forest parsed by several threads reads like the one tree, fenced
+ * lines that look like headings not cut at, and an edit only reparses
+ * the section it falls in.
+ */
+static void
+test_syntax_sections(void)
+{
+	struct syntax_visible vis, ref_vis;
+	struct syntax_heading *h;
+	struct syntax_range *ranges;
+	struct syntax_change c;
+	struct syntax_stats st;
+	struct syntax_ctx *ctx, *ref;
+	struct snapshot *s, *e;
+	struct arena a;
+	char *text, *p;
+	uint32_t row, off;
+	int i;
+
+	/* 14 rows a block, "# Top" on rows 14i and "text" on 14i + 4 */
+	p = text = xmalloc(2000 * 96 + 1);
+	for (i = 0; i < 2000; i++)
+		p += sprintf(p,
+			     "# Top %d\n\n## sub\n\ntext\n\n```\n\n"
+			     "# not a heading\n```\n\n- item\n- item\n\n",
+			     i);
+	s = load(text);
+	xfree(text);
+
+	arena_init(&a);
+	ctx = syntax_create(&a, on_ready, NULL);
+	ref = syntax_create(&a, on_ready, NULL);
+	syntax_set_threads(ctx, 4);
+	syntax_parse(ctx, s);
+	syntax_parse(ref, s);
+	assert(poll_tree(ctx, s, &a, &ranges) == 1);
+	assert(poll_tree(ref, s, &a, &ranges) == 1);
+	syntax_stats(ctx, &st);
+	assert(st.sections > 1);
+
+	syntax_get_visible_nodes(ctx, s, 0, 28000, &a, &vis);
+	syntax_get_visible_nodes(ref, s, 0, 28000, &a, &ref_vis);
+	assert_same_nodes(&vis, &ref_vis);
+	assert(syntax_headings(ctx, 0, 28000, &a, &h) == 4000);
+	for (i = 0; i < 4000; i++)
+		assert(h[i].row == (uint32_t)(i / 2 * 14 + i % 2 * 2));
+
+	/* "text" becomes a list: one section read again */
+	row = 1000 * 14 + 4;
+	off = (uint32_t)snapshot_line_offset(s, (int)row);
+	e = snapshot_replace_line(s, (int)row, STR_LIT("- x"));
+	c = line_change(row, off, 4, 3);
+	syntax_edit(ctx, &c, e);
+	syntax_edit(ref, &c, e);
+	assert(poll_tree(ctx, e, &a, &ranges) >= 1);
+	assert(poll_tree(ref, e, &a, &ranges) >= 1);
+	syntax_stats(ctx, &st);
+	assert(st.incremental_parse.count == 1);
+	assert(st.bytes_read < (uint64_t)snapshot_text_len(e) / 2);
+
+	syntax_get_visible_nodes(ctx, e, 0, 28000, &a, &vis);
+	syntax_get_visible_nodes(ref, e, 0, 28000, &a, &ref_vis);
+	assert_same_nodes(&vis, &ref_vis);
+
+	__atomic_store_n(&ready, 0, __ATOMIC_RELEASE);
+	syntax_destroy(ctx);
+	syntax_destroy(ref);
+	snapshot_release(e);
+	snapshot_release(s);
+	arena_destroy(&a);
+}
+
+/* Matches emitted by syntax_query_run, in order */
+struct found {
+	struct syntax_match m[64];
+	int count;
+	int calls;
+	int limit; /* Stop after this many calls */
+};
+
+static bool
+on_match(void *arg, const struct syntax_match *m, int n)
+{
+	struct found *f = arg;
+	int i;
+
+	for (i = 0; i < n && f->count < 64; i++)
+		f->m[f->count++] = m[i];
+	return ++f->calls != f->limit;
+}
+
+static int
+run_query(struct syntax_ctx *ctx, const char *src, struct found *out)
+{
+	struct syntax_forest *forest = syntax_forest_copy(ctx);
+	struct syntax_query *q;
+	const char *err = NULL;
+	int cancel = 0;
+
+	q = syntax_query_new(str_from_cstr(src), &err);
+	assert(q && !err && forest);
+	memset(out, 0, sizeof(*out));
+	assert(syntax_query_run(q, forest, &cancel, on_match, out));
+	syntax_query_delete(q);
+	syntax_forest_delete(forest);
+	return out->count;
+}
+
+/*
+ * User queries with predicates, run on several threads over a forest,
+ * find the same matches in document order as on one thread over one
+ * tree, and stop when cancelled or told to.
+ */
+static void
+test_syntax_query(void)
+{
+	static const char *const bad[] = {
+	    "(atx_heading",
+	    "(no_such_node) @n",
+	    "((inline) @i (#any-of? @i \"a\"))",
+	    "((inline) @i (#match? @i \"(\"))",
+	};
+	struct syntax_ctx *ctx, *ref;
+	struct syntax_forest *forest;
+	struct syntax_range *ranges;
+	struct syntax_stats st;
+	struct syntax_query *q;
+	struct found got, want;
+	struct snapshot *s;
+	struct arena a;
+	const char *err;
+	char *text, *p;
+	uint32_t row;
+	int cancel, i;
+
+	/* 10 rows a block; blocks 700i + 350 link somewhere else */
+	p = text = xmalloc(6000 * 100 + 1);
+	for (i = 0; i < 6000; i++)
+		p += sprintf(p,
+			     "# Top %d\n\n## %s %d\n\n[l%d]: %s\n\n"
+			     "```\n## Yes in a fence\n```\n\n",
+			     i,
+			     i % 100 == 7 ? "Yes" : "No",
+			     i,
+			     i,
+			     i % 700 == 350 ? "https://else.org" : "/local");
+	s = load(text);
+	xfree(text);
+
+	arena_init(&a);
+	ctx = syntax_create(&a, on_ready, NULL);
+	ref = syntax_create(&a, on_ready, NULL);
+	assert(!syntax_forest_copy(ctx));
+	syntax_set_threads(ctx, 4);
+	syntax_parse(ctx, s);
+	syntax_parse(ref, s);
+	assert(poll_tree(ctx, s, &a, &ranges) == 1);
+	assert(poll_tree(ref, s, &a, &ranges) == 1);
+	syntax_stats(ctx, &st);
+	assert(st.sections > 1);
+
+	for (i = 0; i < (int)(sizeof(bad) / sizeof(bad[0])); i++) {
+		err = NULL;
+		assert(!syntax_query_new(str_from_cstr(bad[i]), &err) && err);
+	}
+
+	/* Level 2 headings with Yes in them: 60, none from the fences */
+	assert(run_query(ctx,
+			 "(atx_heading (atx_h2_marker)"
+			 " (inline) @t (#match? @t \"^Yes\"))",
+			 &got) == 60);
+	assert(run_query(ref,
+			 "(atx_heading (atx_h2_marker)"
+			 " (inline) @t (#match? @t \"^Yes\"))",
+			 &want) == 60);
+	for (i = 0; i < 60; i++) {
+		row = (uint32_t)((i * 100 + 7) * 10 + 2);
+		assert(got.m[i].start.row == row);
+		assert(got.m[i].start.col == 3);
+		assert(got.m[i].start_byte == want.m[i].start_byte);
+		assert(got.m[i].end_byte == want.m[i].end_byte);
+	}
+	assert(got.calls > 1); /* Streamed as chunks finished */
+
+	/* Links not to /local, with the whole definition captured */
+	assert(run_query(ctx,
+			 "(link_reference_definition (link_destination) @u"
+			 " (#not-eq? @u \"/local\")) @d",
+			 &got) == 9);
+	for (i = 0; i < 9; i++) {
+		row = (uint32_t)((i * 700 + 350) * 10 + 4);
+		assert(got.m[i].start.row == row);
+	}
+
+	/* Comparing two captures */
+	assert(run_query(ctx,
+			 "(link_reference_definition (link_label) @l"
+			 " (link_destination) @u (#eq? @l @u))",
+			 &got) == 0);
+
+	/* Stopped by emit, then by a raised flag */
+	q = syntax_query_new(STR_LIT("(atx_heading) @h"), &err);
+	forest = syntax_forest_copy(ctx);
+	memset(&got, 0, sizeof(got));
+	got.limit = 1;
+	cancel = 0;
+	assert(!syntax_query_run(q, forest, &cancel, on_match, &got));
+	assert(got.calls == 1);
+	memset(&got, 0, sizeof(got));
+	cancel = 1;
+	assert(!syntax_query_run(q, forest, &cancel, on_match, &got));
+	assert(got.calls == 0);
+	syntax_query_delete(q);
+
+	/* The copy outlives the trees it was taken from */
+	syntax_destroy(ctx);
+	syntax_destroy(ref);
+	q = syntax_query_new(STR_LIT("(atx_heading (atx_h1_marker)) @h"),
+			     &err);
+	memset(&got, 0, sizeof(got));
+	got.limit = -1;
+	cancel = 0;
+	assert(syntax_query_run(q, forest, &cancel, on_match, &got));
+	assert(got.count == 64);
+	syntax_query_delete(q);
+	syntax_forest_delete(forest);
+
+	__atomic_store_n(&ready, 0, __ATOMIC_RELEASE);
+	snapshot_release(s);
+	arena_destroy(&a);
+}
+
+/* A tree parsed from text edited since is never adopted */
+static void
+test_syntax_stale(void)
+{
+	struct snapshot *v0 = load("a\n\nb\n");
+	struct snapshot *v1 = snapshot_replace_line(v0, 0, STR_LIT("# a"));
+	struct snapshot *v2 = snapshot_replace_line(v1, 2, STR_LIT("# b"));
+	struct syntax_change c1 = line_change(0, 0, 1, 3);
+	struct syntax_change c2 = line_change(2, 5, 1, 3);
+	struct syntax_visible inc, full;
+	struct syntax_range *ranges;
+	struct syntax_ctx *ctx, *ref;
+	struct arena a;
+
+	arena_init(&a);
+	ctx = syntax_create(&a, on_ready, NULL);
+	ref = syntax_create(&a, on_ready, NULL);
+	syntax_parse(ctx, v0);
+	assert(wait_poll(ctx, v0, &a, &ranges) == 1);
+
+	/* v1 is parsed, but the buffer is at v2 by the time it is polled */
+	syntax_edit(ctx, &c1, v1);
+	assert(wait_poll(ctx, v2, &a, &ranges) == -1);
+	assert(syntax_has_tree(ctx));
+
+	/* Both edits are applied to the tree the next parse starts from */
+	syntax_edit(ctx, &c2, v2);
+	assert(wait_poll(ctx, v2, &a, &ranges) >= 0);
+	syntax_parse(ref, v2);
+	assert(wait_poll(ref, v2, &a, &ranges) == 1);
+	syntax_get_visible_nodes(ctx, v2, 0, 10, &a, &inc);
+	syntax_get_visible_nodes(ref, v2, 0, 10, &a, &full);
+	assert_same_nodes(&inc, &full);
+
+	syntax_destroy(ref);
+	syntax_destroy(ctx);
+	snapshot_release(v2);
+	snapshot_release(v1);
+	snapshot_release(v0);
+	arena_destroy(&a);
+}
+
+/* A parse submitted later cancels the one in flight */
+static void
+test_syntax_cancel(void)
+{
+	struct snapshot *big, *small = load("# small\n");
+	struct syntax_range *ranges;
+	struct syntax_ctx *ctx;
+	struct arena a;
+	char *text;
+	size_t i, n = 200000;
+
+	text = xmalloc(n * 8 + 1);
+	for (i = 0; i < n; i++)
+		memcpy(text + i * 8, i % 4 ? "- items\n" : "# head\n\n", 8);
+	text[n * 8] = '\0';
+	big = load(text);
+	xfree(text);
+
+	arena_init(&a);
+	ctx = syntax_create(&a, on_ready, NULL);
+	syntax_parse(ctx, big);
+	syntax_parse(ctx, small);
+	assert(wait_poll(ctx, small, &a, &ranges) == 1);
+	assert(ranges[0].end_byte == 8);
+
+	syntax_destroy(ctx);
+	snapshot_release(small);
+	snapshot_release(big);
+	arena_destroy(&a);
+}
+
+/* Only nodes overlapping the rows come back, in document order */
+static void
+test_syntax_visible(void)
+{
+	struct syntax_range *ranges;
+	struct syntax_visible vis;
+	struct syntax_ctx *ctx;
+	struct snapshot *s;
+	struct arena a;
+	char *text, *p;
+	bool para = false;
+	int i;
+
+	/* Row 4k is a heading, 4k + 2 a paragraph */
+	p = text = xmalloc(400 * 16 + 1);
+	for (i = 0; i < 400; i++)
+		p += sprintf(p, "## H%03d\n\npara\n\n", i);
+	s = load(text);
+	xfree(text);
+
+	arena_init(&a);
+	ctx = syntax_create(&a, on_ready, NULL);
+	syntax_parse(ctx, s);
+	assert(wait_poll(ctx, s, &a, &ranges) == 1);
+
+	syntax_get_visible_nodes(ctx, s, 802, 805, &a, &vis);
+	assert(vis.count > 0);
+	assert(strcmp(vis.nodes[0].type, "document") == 0);
+	for (i = 0; i < vis.count; i++) {
+		assert(vis.nodes[i].start_row <= 805);
+		assert(vis.nodes[i].end_row >= 802);
+		if (i > 0)
+			assert(vis.nodes[i].start_byte >=
+			       vis.nodes[i - 1].start_byte);
+		if (strcmp(vis.nodes[i].type, "paragraph") == 0 &&
+		    vis.nodes[i].start_row == 802)
+			para = true;
+	}
+	assert(para);
+
+	syntax_destroy(ctx);
+	snapshot_release(s);
+	arena_destroy(&a);
+}
+
+/* Every node of a dense screen comes back, page by page or at once */
+static void
+test_syntax_paging(void)
+{
+	struct syntax_node page[5], *node;
+	struct syntax_range *ranges;
+	struct syntax_cursor *c;
+	struct syntax_visible all;
+	struct syntax_ctx *ctx;
+	struct snapshot *s;
+	struct arena a;
+	char *text, *p;
+	int i, n, seen = 0;
+
+	/* 60 rows of one list: the list plus an item and marker a row */
+	p = text = xmalloc(60 * 8 + 1);
+	for (i = 0; i < 60; i++)
+		p += sprintf(p, "- i%03d\n", i);
+	s = load(text);
+	xfree(text);
+
+	arena_init(&a);
+	ctx = syntax_create(&a, on_ready, NULL);
+	assert(!syntax_cursor_new(ctx, s, 0, 59));
+	assert(syntax_cursor_next(NULL, page, 5) == 0);
+	syntax_parse(ctx, s);
+	assert(wait_poll(ctx, s, &a, &ranges) == 1);
+
+	syntax_get_visible_nodes(ctx, s, 0, 59, &a, &all);
+	assert(all.count > 3 * 60);
+
+	c = syntax_cursor_new(ctx, s, 0, 59);
+	while ((n = syntax_cursor_next(c, page, 5)) > 0) {
+		assert(n <= 5);
+		for (i = 0; i < n; i++, seen++) {
+			assert(seen < all.count);
+			node = &all.nodes[seen];
+			assert(page[i].start_byte == node->start_byte);
+			assert(page[i].depth == node->depth);
+		}
+	}
+	assert(seen == all.count);
+	assert(syntax_cursor_next(c, page, 5) == 0);
+	syntax_cursor_delete(c);
+
+	syntax_destroy(ctx);
+	snapshot_release(s);
+	arena_destroy(&a);
+}
+
+static void
+assert_span(const struct syntax_line_spans *l,
+	    int i,
+	    uint32_t start,
+	    uint32_t end,
+	    enum syntax_style style)
+{
+	assert(i < l->count);
+	assert(l->spans[i].start == start && l->spans[i].end == end);
+	assert(l->spans[i].style == style);
+}
+
+/* Inner captures cut into the ones around them */
+static void
+test_syntax_highlight(void)
+{
+	struct snapshot *s = load("# Title\n\n```c\nint x;\n```\n");
+	struct syntax_line_spans rows[5];
+	struct syntax_range *ranges;
+	struct syntax_ctx *ctx;
+	struct arena a;
+
+	arena_init(&a);
+	ctx = syntax_create(&a, on_ready, NULL);
+
+	/* Nothing to color before the first tree */
+	syntax_highlight(ctx, 0, 4, &a, rows);
+	assert(rows[0].count == 0);
+
+	syntax_parse(ctx, s);
+	assert(wait_poll(ctx, s, &a, &ranges) == 1);
+	syntax_highlight(ctx, 0, 4, &a, rows);
+
+	assert(rows[0].count == 2);
+	assert_span(&rows[0], 0, 0, 1, SYNTAX_STYLE_MARKER);
+	assert_span(&rows[0], 1, 1, SYNTAX_SPAN_EOL, SYNTAX_STYLE_HEADING);
+	assert(rows[1].count == 0);
+	assert(rows[2].count == 3);
+	assert_span(&rows[2], 0, 0, 3, SYNTAX_STYLE_MARKER);
+	assert_span(&rows[2], 1, 3, 4, SYNTAX_STYLE_CODE_INFO);
+	assert_span(&rows[2], 2, 4, SYNTAX_SPAN_EOL, SYNTAX_STYLE_CODE);
+	assert(rows[3].count == 1);
+	assert_span(&rows[3], 0, 0, SYNTAX_SPAN_EOL, SYNTAX_STYLE_CODE);
+	assert(rows[4].count == 2);
+	assert_span(&rows[4], 0, 0, 3, SYNTAX_STYLE_MARKER);
+
+	/* A window in the middle sees the block it starts inside of */
+	syntax_highlight(ctx, 3, 3, &a, rows);
+	assert(rows[0].count == 1);
+	assert_span(&rows[0], 0, 0, SYNTAX_SPAN_EOL, SYNTAX_STYLE_CODE);
+
+	syntax_destroy(ctx);
+	snapshot_release(s);
+	arena_destroy(&a);
+}
+
+/* Fences naming a registered language are parsed as it, lazily */
+static void
+test_syntax_inject(void)
+{
+	struct snapshot *s, *edited;
+	struct syntax_line_spans rows[10];
+	struct syntax_range *ranges;
+	struct syntax_change c;
+	struct syntax_ctx *ctx;
+	struct arena a;
+	char *text, *p;
+	int i, n;
+
+	assert(syntax_register_language(
+	    "notes", tree_sitter_markdown, "(paragraph) @quote"));
+
+	p = text = xmalloc(4096);
+	p += sprintf(p, "# Doc\n\n```markdown\n# Inner\n- item\n```\n\n");
+	p += sprintf(p, "```c\nint x;\n```\n");
+	for (i = 0; i < 50; i++)
+		p += sprintf(p, "para\n\n");
+	sprintf(p, "```notes\nhello\n```\n"); /* Rows 110-112 */
+	s = load(text);
+	xfree(text);
+
+	arena_init(&a);
+	ctx = syntax_create(&a, on_ready, NULL);
+	syntax_parse(ctx, s);
+	assert(wait_poll(ctx, s, &a, &ranges) == 1);
+
+	/* Only fences on the rows asked for are parsed */
+	syntax_highlight(ctx, 0, 9, &a, rows);
+	assert(syntax_injected(ctx) == 1);
+	assert(rows[3].count == 2);
+	assert_span(&rows[3], 0, 0, 1, SYNTAX_STYLE_MARKER);
+	assert_span(&rows[3], 1, 1, SYNTAX_SPAN_EOL, SYNTAX_STYLE_HEADING);
+	assert(rows[4].spans[0].style == SYNTAX_STYLE_MARKER);
+	assert(rows[8].count == 1);
+	assert_span(&rows[8], 0, 0, SYNTAX_SPAN_EOL, SYNTAX_STYLE_CODE);
+
+	syntax_highlight(ctx, 109, 112, &a, rows);
+	assert(syntax_injected(ctx) == 2);
+	assert(rows[2].count == 1);
+	assert_span(&rows[2], 0, 0, SYNTAX_SPAN_EOL, SYNTAX_STYLE_QUOTE);
+
+	/* "# Inner" becomes "## Inner": the fence follows before the host */
+	edited = snapshot_replace_line(s, 3, STR_LIT("## Inner"));
+	c = line_change(3, 19, 7, 8);
+	syntax_edit(ctx, &c, edited);
+	syntax_highlight(ctx, 3, 3, &a, rows);
+	assert_span(&rows[0], 0, 0, 2, SYNTAX_STYLE_MARKER);
+
+	/* Reparsed by the render above, the fence is still reported */
+	n = wait_poll(ctx, edited, &a, &ranges);
+	for (i = 0; i < n; i++)
+		if (ranges[i].start.row <= 3 && ranges[i].end.row >= 5)
+			break;
+	assert(i < n);
+	syntax_highlight(ctx, 0, 9, &a, rows);
+	assert_span(&rows[3], 0, 0, 2, SYNTAX_STYLE_MARKER);
+	assert_span(&rows[3], 1, 2, SYNTAX_SPAN_EOL, SYNTAX_STYLE_HEADING);
+
+	syntax_destroy(ctx);
+	snapshot_release(edited);
+	snapshot_release(s);
+	arena_destroy(&a);
+}
+
+int
+main(void)
+{
+	test_syntax_parse();
+	test_syntax_edit();
+	test_syntax_edit_text_only();
+	test_syntax_reader();
+	test_syntax_stale();
+	test_syntax_cancel();
+	test_syntax_visible();
+	test_syntax_paging();
+	test_syntax_stats();
+	test_syntax_fold();
+	test_syntax_viewport();
+	test_syntax_sections();
+	test_syntax_query();
+	test_syntax_highlight();
+	test_syntax_inject();
+
+	printf("All syntax tests passed!\n");
+	return 0;
+}
@@ -0,0 +1,127 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <editor/syntax.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <core/memory.h>
+
+#define DOC "/tmp/wlplatform_test_syntax_alloc.md"
+
+#include "syntax_harness.h"
+
+static struct snapshot *
+load_lists(int n)
+{
+	FILE *f = doc_create();
+	int i;
+
+	for (i = 0; i < n; i++)
+		fputs(i % 10 ? "- an item\n" : "# heading\n\n", f);
+	fclose(f);
+	return doc_load();
+}
+
+static void
+parse(struct syntax_ctx *ctx, struct snapshot *s, struct arena *a)
+{
+	struct syntax_range *ranges;
+
+	syntax_parse(ctx, s);
+	assert(wait_poll(ctx, s, a, &ranges) == 1);
+}
+
+/* Trees are charged to their ctx and credited back wherever freed */
+static void
+test_syntax_alloc_account(void)
+{
+	struct snapshot *small = load_lists(100), *big = load_lists(20000);
+	struct syntax_account before, after, ma, mb;
+	struct syntax_ctx *ca, *cb;
+	struct arena a;
+
+	arena_init(&a);
+	syntax_alloc_install(SYNTAX_ALLOC_DEFAULT);
+	syntax_alloc_total(&before, NULL);
+	ca = syntax_create(&a, on_ready, NULL);
+	cb = syntax_create(&a, on_ready, NULL);
+	assert(syntax_alloc_mode() == SYNTAX_ALLOC_DEFAULT);
+
+	/* A parser alone already holds memory */
+	syntax_memory(cb, &mb);
+	assert(mb.bytes > 0 && mb.blocks > 0);
+
+	parse(ca, big, &a);
+	parse(cb, small, &a);
+	syntax_memory(ca, &ma);
+	syntax_memory(cb, &mb);
+	assert(ma.bytes > 10 * mb.bytes);
+	assert(ma.peak >= ma.bytes && mb.peak >= mb.bytes);
+	syntax_alloc_total(&after, NULL);
+	assert(after.bytes == before.bytes + ma.bytes + mb.bytes);
+
+	/* Built by the worker, freed here: everything is credited back */
+	syntax_destroy(cb);
+	syntax_alloc_total(&after, NULL);
+	assert(after.bytes == before.bytes + ma.bytes);
+	syntax_destroy(ca);
+	syntax_alloc_total(&after, NULL);
+	assert(after.bytes == before.bytes);
+	assert(after.blocks == before.blocks);
+
+	snapshot_release(big);
+	snapshot_release(small);
+	arena_destroy(&a);
+}
+
+/* Results tree-sitter hands out are freed through the same allocator */
+static void
+test_syntax_alloc_edit(void)
+{
+	struct snapshot *v0 = load_lists(50), *v1;
+	struct syntax_account before, after;
+	struct syntax_range *ranges;
+	struct syntax_change c;
+	struct syntax_ctx *ctx;
+	struct arena a;
+	int i;
+
+	arena_init(&a);
+	syntax_alloc_total(&before, NULL);
+	ctx = syntax_create(&a, on_ready, NULL);
+	parse(ctx, v0, &a);
+
+	/* Row 2 "- an item" gets longer: changed ranges come back */
+	v1 = snapshot_replace_line(v0, 2, STR_LIT("- an itemX"));
+	memset(&c, 0, sizeof(c));
+	c.start_byte = 11;
+	c.old_end_byte = 20;
+	c.new_end_byte = 21;
+	c.start.row = c.old_end.row = c.new_end.row = 2;
+	c.old_end.col = 9;
+	c.new_end.col = 10;
+	syntax_edit(ctx, &c, v1);
+	i = wait_poll(ctx, v1, &a, &ranges);
+	assert(i >= 0);
+
+	syntax_destroy(ctx);
+	syntax_alloc_total(&after, NULL);
+	assert(after.bytes == before.bytes);
+
+	snapshot_release(v1);
+	snapshot_release(v0);
+	arena_destroy(&a);
+}
+
+int
+main(void)
+{
+	test_syntax_alloc_account();
+	test_syntax_alloc_edit();
+
+	printf("All syntax_alloc tests passed!\n");
+	return 0;
+}
@@ -0,0 +1,122 @@
+#include <assert.h>
+#include <editor/trigram.h>
+#include <stdint.h>
+#include <stdio.h>
+
+static struct snapshot *
+load(const char *text)
+{
+	int err;
+	FILE *f = fopen("/tmp/test_trigram.txt", "w");
+
+	fputs(text, f);
+	fclose(f);
+	return snapshot_load("/tmp/test_trigram.txt", &err);
+}
+
+static void
+test_trigram_candidates(void)
+{
+	struct arena a;
+	struct snapshot *s;
+	struct trigram_index *idx;
+	int *lines;
+	int n;
+
+	arena_init(&a);
+	s = load("error: disk full\nok\nwarning: disk slow\nerror: net\n");
+	idx = trigram_build(s, SIZE_MAX, NULL);
+	assert(idx);
+
+	n = trigram_candidates(idx, STR_LIT("error"), &a, &lines);
+	assert(n == 2 && lines[0] == 0 && lines[1] == 3);
+
+	n = trigram_candidates(idx, STR_LIT("disk"), &a, &lines);
+	assert(n == 2 && lines[0] == 0 && lines[1] == 2);
+
+	n = trigram_candidates(idx, STR_LIT("missing"), &a, &lines);
+	assert(n == 0);
+
+	/* Too short for a trigram */
+	n = trigram_candidates(idx, STR_LIT("ok"), &a, &lines);
+	assert(n == 0);
+
+	trigram_destroy(idx);
+	snapshot_release(s);
+	arena_destroy(&a);
+	remove("/tmp/test_trigram.txt");
+}
+
+static void
+test_trigram_update(void)
+{
+	struct arena a;
+	struct snapshot *s, *edited;
+	struct trigram_index *idx;
+	int *lines;
+	int n;
+
+	arena_init(&a);
+	s = load("alpha\nbeta\ngamma\n");
+	idx = trigram_build(s, SIZE_MAX, NULL);
+
+	edited = snapshot_replace_line(s, 1, STR_LIT("alphabet"));
+	assert(trigram_update(idx, edited));
+	assert(trigram_snapshot(idx) == edited);
+
+	n = trigram_candidates(idx, STR_LIT("alpha"), &a, &lines);
+	assert(n == 2 && lines[0] == 0 && lines[1] == 1);
+	n = trigram_candidates(idx, STR_LIT("beta"), &a, &lines);
+	assert(n == 0);
+
+	trigram_destroy(idx);
+	snapshot_release(edited);
+	snapshot_release(s);
+	arena_destroy(&a);
+	remove("/tmp/test_trigram.txt");
+}
+
+static void
+test_trigram_cancel(void)
+{
+	int cancel = 1;
+	struct snapshot *s = load("some text\n");
+
+	assert(trigram_build(s, SIZE_MAX, &cancel) == NULL);
+	snapshot_release(s);
+	remove("/tmp/test_trigram.txt");
+}
+
+static void
+test_trigram_budget(void)
+{
+	struct snapshot *s = load("error: disk full\nwarning: disk slow\n");
+	struct trigram_index *idx;
+	size_t bytes;
+
+	idx = trigram_build(s, SIZE_MAX, NULL);
+	bytes = trigram_bytes(idx);
+	assert(bytes > 0);
+	trigram_destroy(idx);
+
+	/* The same text fits its own size and nothing less */
+	idx = trigram_build(s, bytes, NULL);
+	assert(idx && trigram_bytes(idx) == bytes);
+	trigram_destroy(idx);
+	assert(trigram_build(s, bytes - 1, NULL) == NULL);
+
+	snapshot_release(s);
+	remove("/tmp/test_trigram.txt");
+}
+
+int
+main(void)
+{
+	test_trigram_candidates();
+	test_trigram_update();
+	test_trigram_cancel();
+	test_trigram_budget();
+
+	printf("All trigram tests passed!\n");
+	return 0;
+}